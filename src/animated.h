@@ -177,7 +177,37 @@ public:
 		}
 	}
 
-	void init(AnimationBlock &b, MPQFile &f, uint32 *gs)
+	// sequences whose keyframes live in an external .anim file; the headers are
+	// kept so the data can be read in when the sequence is first played
+	std::vector<AnimationBlockHeader> extTimes, extKeys;
+	T (*fixer)(const T);
+
+	Animated(): fixer(0) {}
+
+	void initAnim(size_t j, AnimationBlockHeader *pHeadTimes, AnimationBlockHeader *pHeadKeys, unsigned char *buf)
+	{
+		uint32 *ptimes = (uint32*)(buf + pHeadTimes->ofsEntrys);
+		for (size_t i=0; i < pHeadTimes->nEntrys; i++)
+			times[j].push_back(ptimes[i]);
+
+		D *keys = (D*)(buf + pHeadKeys->ofsEntrys);
+		switch (type) {
+			case INTERPOLATION_NONE:
+			case INTERPOLATION_LINEAR:
+				for (size_t i = 0; i < pHeadKeys->nEntrys; i++) 
+					data[j].push_back(Conv::conv(keys[i]));
+				break;
+			case INTERPOLATION_HERMITE:
+				for (size_t i = 0; i < pHeadKeys->nEntrys; i++) {
+					data[j].push_back(Conv::conv(keys[i*3]));
+					in[j].push_back(Conv::conv(keys[i*3+1]));
+					out[j].push_back(Conv::conv(keys[i*3+2]));
+				}
+				break;
+		}
+	}
+
+	void init(AnimationBlock &b, MPQFile &f, uint32 *gs, ModelAnimation *anims = 0)
 	{
 		globals = gs;
 		type = b.type;
@@ -199,113 +229,58 @@ public:
 
 		for(size_t j=0; j < b.nTimes; j++) {
 			AnimationBlockHeader* pHeadTimes = (AnimationBlockHeader*)(f.getBuffer() + b.ofsTimes + j*sizeof(AnimationBlockHeader));
-		
-			unsigned int *ptimes = (unsigned int*)(f.getBuffer() + pHeadTimes->ofsEntrys);
-			for (size_t i=0; i < pHeadTimes->nEntrys; i++)
-				times[j].push_back(ptimes[i]);
-		}
-
-		// keyframes
-		for(size_t j=0; j < b.nKeys; j++) {
 			AnimationBlockHeader* pHeadKeys = (AnimationBlockHeader*)(f.getBuffer() + b.ofsKeys + j*sizeof(AnimationBlockHeader));
 
-			D *keys = (D*)(f.getBuffer() + pHeadKeys->ofsEntrys);
-			switch (type) {
-				case INTERPOLATION_NONE:
-				case INTERPOLATION_LINEAR:
-					for (size_t i = 0; i < pHeadKeys->nEntrys; i++) 
-						data[j].push_back(Conv::conv(keys[i]));
-					break;
-				case INTERPOLATION_HERMITE:
-					for (size_t i = 0; i < pHeadKeys->nEntrys; i++) {
-						data[j].push_back(Conv::conv(keys[i*3]));
-						in[j].push_back(Conv::conv(keys[i*3+1]));
-						out[j].push_back(Conv::conv(keys[i*3+2]));
-					}
-					break;
+			// global sequences are always stored in the .m2
+			if (anims && seq==-1 && !(anims[j].flags & MODELANIM_INLINE)) {
+				if (extTimes.empty()) {
+					extTimes.resize(b.nTimes);
+					extKeys.resize(b.nKeys);
+				}
+				extTimes[j] = *pHeadTimes;
+				extKeys[j] = *pHeadKeys;
+			} else {
+				initAnim(j, pHeadTimes, pHeadKeys, f.getBuffer());
 			}
 		}
 	}
 
-	void init(AnimationBlock &b, MPQFile &f, uint32 *gs, MPQFile *animfiles)
+	// read a deferred sequence from its .anim file
+	void initExternal(size_t anim, MPQFile &af)
 	{
-		globals = gs;
-		type = b.type;
-		seq = b.seq;
-		if (seq!=-1) {
-			assert(gs);
-		}
-
-		// times
-		assert(b.nTimes == b.nKeys);
-		sizes = b.nTimes;
-		if( b.nTimes == 0 )
+		if (anim >= extTimes.size() || extKeys[anim].nEntrys == 0)
 			return;
-
-#ifdef LESS_MEMORY
-		sizes = b.nTimes = b.nKeys = MAX_ANIMATED;
-#endif
-
-		for(size_t j=0; j < b.nTimes; j++) {
-			AnimationBlockHeader* pHeadTimes = (AnimationBlockHeader*)(f.getBuffer() + b.ofsTimes + j*sizeof(AnimationBlockHeader));
-			uint32 *ptimes;
-			if (animfiles[j].getSize() > 0)
-				ptimes = (uint32*)(animfiles[j].getBuffer() + pHeadTimes->ofsEntrys);
-			else
-				ptimes = (uint32*)(f.getBuffer() + pHeadTimes->ofsEntrys);
-			for (size_t i=0; i < pHeadTimes->nEntrys; i++)
-				times[j].push_back(ptimes[i]);
-		}
-
-		// keyframes
-		for(size_t j=0; j < b.nKeys; j++) {
-			AnimationBlockHeader* pHeadKeys = (AnimationBlockHeader*)(f.getBuffer() + b.ofsKeys + j*sizeof(AnimationBlockHeader));
-			assert((D*)(f.getBuffer() + pHeadKeys->ofsEntrys));
-			D *keys;
-			if (animfiles[j].getSize() > 0)
-				keys = (D*)(animfiles[j].getBuffer() + pHeadKeys->ofsEntrys);
-			else 
-				keys = (D*)(f.getBuffer() + pHeadKeys->ofsEntrys);
-			switch (type) {
-				case INTERPOLATION_NONE:
-				case INTERPOLATION_LINEAR:
-					for (size_t i = 0; i < pHeadKeys->nEntrys; i++) 
-						data[j].push_back(Conv::conv(keys[i]));
-					break;
-				case INTERPOLATION_HERMITE:
-					for (size_t i = 0; i < pHeadKeys->nEntrys; i++) {
-						data[j].push_back(Conv::conv(keys[i*3]));
-						in[j].push_back(Conv::conv(keys[i*3+1]));
-						out[j].push_back(Conv::conv(keys[i*3+2]));
-					}
-					break;
-			}
-		}
+		initAnim(anim, &extTimes[anim], &extKeys[anim], af.getBuffer());
+		if (fixer)
+			fixAnim(anim, fixer);
 	}
 
-	void fix(T fixfunc(const T))
+	void fixAnim(size_t i, T fixfunc(const T))
 	{
 		switch (type) {
 			case INTERPOLATION_NONE:
 			case INTERPOLATION_LINEAR:
-				for (size_t i=0; i<sizes; i++) {
-					for (size_t j=0; j<data[i].size(); j++) {
-						data[i][j] = fixfunc(data[i][j]);
-					}
+				for (size_t j=0; j<data[i].size(); j++) {
+					data[i][j] = fixfunc(data[i][j]);
 				}
 				break;
 			case INTERPOLATION_HERMITE:
-				for (size_t i=0; i<sizes; i++) {
-					for (size_t j=0; j<data[i].size(); j++) {
-						data[i][j] = fixfunc(data[i][j]);
-						in[i][j] = fixfunc(in[i][j]);
-						out[i][j] = fixfunc(out[i][j]);
-					}
+				for (size_t j=0; j<data[i].size(); j++) {
+					data[i][j] = fixfunc(data[i][j]);
+					in[i][j] = fixfunc(in[i][j]);
+					out[i][j] = fixfunc(out[i][j]);
 				}
 				break;
 		}
 	}
 
+	void fix(T fixfunc(const T))
+	{
+		fixer = fixfunc;
+		for (size_t i=0; i<sizes; i++)
+			fixAnim(i, fixfunc);
+	}
+
 };
 
 typedef Animated<float,short,ShortToFloat> AnimatedShort;
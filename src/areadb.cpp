@@ -29,29 +29,18 @@ void OpenDBs()
 
 std::string AreaDB::getAreaName( unsigned int pAreaID )
 {
-	unsigned int regionID = 0;
-	std::string areaName = "";
-	try 
-	{
-		AreaDB::Record rec = gAreaDB.getByID( pAreaID );
-		areaName = rec.getLocalizedString( AreaDB::Name );
-		regionID = rec.getUInt( AreaDB::Region );
-	} 
-	catch(AreaDB::NotFound)
-	{
-		areaName = "Unknown location";
-	}
+	AreaDB::Row area;
+	if( !gAreaDB.findRow( pAreaID, area ) )
+		return "Unknown location";
+
+	std::string areaName = area.get<AreaDB::Name>();
+	unsigned int regionID = area.get<AreaDB::Region>();
 	if (regionID != 0) 
 	{
-		try 
-		{
-			AreaDB::Record rec = gAreaDB.getByID( regionID );
-			areaName = std::string(rec.getLocalizedString( AreaDB::Name )) + std::string(": ") + areaName;
-		} 
-		catch(AreaDB::NotFound)
-		{
-			areaName = "Unknown location";
-		}
+		AreaDB::Row region;
+		if( !gAreaDB.findRow( regionID, region ) )
+			return "Unknown location";
+		areaName = std::string(region.get<AreaDB::Name>()) + std::string(": ") + areaName;
 	}
 	return areaName;
 }
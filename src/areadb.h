@@ -3,152 +3,170 @@
 #include "dbcfile.h"
 #include <string>
 
-class AreaDB: public DBCFile
+class AreaDB: public DBCTable<AreaDB>
 {
 public:
 	AreaDB():
-		DBCFile("DBFilesClient\\AreaTable.dbc")
+		DBCTable<AreaDB>("DBFilesClient\\AreaTable.dbc")
 	{ }
 
 	/// Fields
-	static const size_t AreaID = 0;		// uint
-	static const size_t Continent = 1;	// uint
-	static const size_t Region = 2;		// uint [AreaID]
-	static const size_t Flags = 4;		// bit field
-	static const size_t Name = 11;		// localisation string
+	typedef Field<unsigned int, 0> AreaID;
+	typedef Field<unsigned int, 1> Continent;
+	typedef Field<unsigned int, 2> Region;		// [AreaID]
+	typedef Field<unsigned int, 4> Flags;		// bit field
+	typedef Field<DBCLocString, 11> Name;
+	static const size_t Columns = 12;
+	static const int LocaleColumn = Name::column;
 
 	static std::string getAreaName( unsigned int pAreaID );
 };
 
-class MapDB: public DBCFile
+class MapDB: public DBCTable<MapDB>
 {
 public:
 	MapDB():
-		DBCFile("DBFilesClient\\Map.dbc")
+		DBCTable<MapDB>("DBFilesClient\\Map.dbc")
 	{ }
 
 	/// Fields
-	static const size_t MapID = 0;				// uint
-	static const size_t InternalName = 1;		// string
-	static const size_t AreaType = 2;			// uint
-	static const size_t IsBattleground = 3;		// uint
-	static const size_t Name = 4;				// loc
-	static const size_t LoadingScreen = 56;		// uint [LoadingScreen]
-	static const size_t CoordinateX = 110;		// float
-	static const size_t CoordinateY = 111;		// float
+	typedef Field<unsigned int, 0> MapID;
+	typedef Field<DBCString, 1> InternalName;
+	typedef Field<unsigned int, 2> AreaType;
+	typedef Field<unsigned int, 3> IsBattleground;
+	typedef Field<DBCLocString, 4> Name;
+	// the menu only needs the fields up to Name, which every client's Map.dbc has
+	static const size_t Columns = 5;
+	static const int LocaleColumn = Name::column;
 };
 
-class LoadingScreensDB: public DBCFile
+class LoadingScreensDB: public DBCTable<LoadingScreensDB>
 {
 public:
 	LoadingScreensDB():
-		DBCFile("DBFilesClient\\LoadingScreens.dbc")
+		DBCTable<LoadingScreensDB>("DBFilesClient\\LoadingScreens.dbc")
 	{ }
 
 	/// Fields
-	static const size_t ID = 0;				// uint
-	static const size_t Name = 1;			// string
-	static const size_t Path = 2;			// string
+	typedef Field<unsigned int, 0> ID;
+	typedef Field<DBCString, 1> Name;
+	typedef Field<DBCString, 2> Path;
+	static const size_t Columns = 3;
+	static const int LocaleColumn = -1;
 };
 
-class LightDB: public DBCFile
+class LightDB: public DBCTable<LightDB>
 {
 public:
 	LightDB():
-		DBCFile("DBFilesClient\\Light.dbc")
+		DBCTable<LightDB>("DBFilesClient\\Light.dbc")
 	{ }
 
 	/// Fields
-	static const size_t ID = 0;				// uint
-	static const size_t Map = 1;			// uint
-	static const size_t PositionX = 2;		// float
-	static const size_t PositionY = 3;		// float
-	static const size_t PositionZ = 4;		// float
-	static const size_t RadiusInner = 5;	// float
-	static const size_t RadiusOuter = 6;	// float
-	static const size_t DataIDs = 7;		// uint[8]
+	typedef Field<unsigned int, 0> ID;
+	typedef Field<unsigned int, 1> Map;
+	typedef Field<float, 2> PositionX;
+	typedef Field<float, 3> PositionY;
+	typedef Field<float, 4> PositionZ;
+	typedef Field<float, 5> RadiusInner;
+	typedef Field<float, 6> RadiusOuter;
+	typedef Field<unsigned int, 7, 8> DataIDs;
+	static const size_t Columns = 15;
+	static const int LocaleColumn = -1;
 };
 
-class LightSkyboxDB: public DBCFile
+class LightSkyboxDB: public DBCTable<LightSkyboxDB>
 {
 public:
 	LightSkyboxDB():
-		DBCFile("DBFilesClient\\LightSkybox.dbc")
+		DBCTable<LightSkyboxDB>("DBFilesClient\\LightSkybox.dbc")
 	{ }
 
 	/// Fields
-	static const size_t ID = 0;				// uint
-	static const size_t filename = 1;		// string
-	static const size_t flags = 2;			// uint
+	typedef Field<unsigned int, 0> ID;
+	typedef Field<DBCString, 1> filename;
+	typedef Field<unsigned int, 2> flags;
+	static const size_t Columns = 3;
+	static const int LocaleColumn = -1;
 };
 
-class LightIntBandDB: public DBCFile
+class LightIntBandDB: public DBCTable<LightIntBandDB>
 {
 public:
 	LightIntBandDB():
-		DBCFile("DBFilesClient\\LightIntBand.dbc")
+		DBCTable<LightIntBandDB>("DBFilesClient\\LightIntBand.dbc")
 	{ }
 
 	/// Fields
-	static const size_t ID = 0;				// uint
-	static const size_t Entries = 1;		// uint
-	static const size_t Times = 2;			// uint
-	static const size_t Values = 18;		// uint
+	typedef Field<unsigned int, 0> ID;
+	typedef Field<unsigned int, 1> Entries;
+	typedef Field<unsigned int, 2, 16> Times;
+	typedef Field<unsigned int, 18, 16> Values;
+	static const size_t Columns = 34;
+	static const int LocaleColumn = -1;
 };
 
-class LightFloatBandDB: public DBCFile
+class LightFloatBandDB: public DBCTable<LightFloatBandDB>
 {
 public:
 	LightFloatBandDB():
-		DBCFile("DBFilesClient\\LightFloatBand.dbc")
+		DBCTable<LightFloatBandDB>("DBFilesClient\\LightFloatBand.dbc")
 	{ }
 
 	/// Fields
-	static const size_t ID = 0;				// uint
-	static const size_t Entries = 1;		// uint
-	static const size_t Times = 2;			// uint
-	static const size_t Values = 18;		// float
+	typedef Field<unsigned int, 0> ID;
+	typedef Field<unsigned int, 1> Entries;
+	typedef Field<unsigned int, 2, 16> Times;
+	typedef Field<float, 18, 16> Values;
+	static const size_t Columns = 34;
+	static const int LocaleColumn = -1;
 };
 
-class GroundEffectTextureDB: public DBCFile
+class GroundEffectTextureDB: public DBCTable<GroundEffectTextureDB>
 {
 public:
 	GroundEffectTextureDB():
-		DBCFile("DBFilesClient\\GroundEffectTexture.dbc")
+		DBCTable<GroundEffectTextureDB>("DBFilesClient\\GroundEffectTexture.dbc")
 	{ }
 
 	/// Fields
-	static const size_t ID = 0;				// uint
-	static const size_t Doodads = 1;		// uint[4]
-	static const size_t Weights = 5;		// uint[4]
-	static const size_t Amount = 9;			// uint
-	static const size_t TerrainType = 10;	// uint
+	typedef Field<unsigned int, 0> ID;
+	typedef Field<unsigned int, 1, 4> Doodads;
+	typedef Field<unsigned int, 5, 4> Weights;
+	typedef Field<unsigned int, 9> Amount;
+	typedef Field<unsigned int, 10> TerrainType;
+	static const size_t Columns = 11;
+	static const int LocaleColumn = -1;
 };
 
-class GroundEffectDoodadDB: public DBCFile
+class GroundEffectDoodadDB: public DBCTable<GroundEffectDoodadDB>
 {
 public:
 	GroundEffectDoodadDB():
-		DBCFile("DBFilesClient\\GroundEffectDoodad.dbc")
+		DBCTable<GroundEffectDoodadDB>("DBFilesClient\\GroundEffectDoodad.dbc")
 	{ }
 
 	/// Fields
-	static const size_t ID = 0;				// uint
-	static const size_t Filename = 1;		// string
+	typedef Field<unsigned int, 0> ID;
+	typedef Field<DBCString, 1> Filename;
+	static const size_t Columns = 2;
+	static const int LocaleColumn = -1;
 };
 
-class LiquidTypeDB: public DBCFile
+class LiquidTypeDB: public DBCTable<LiquidTypeDB>
 {
 public:
 	LiquidTypeDB():
-		DBCFile("DBFilesClient\\LiquidType.dbc")
+		DBCTable<LiquidTypeDB>("DBFilesClient\\LiquidType.dbc")
 	{ }
 
 	/// Fields
-	static const size_t ID = 0;				// uint
-	static const size_t Filename = 1;		// string
-	static const size_t flags = 2;			// Water: 1, 2, 4, 8; Magma: 8, 16, 32, 64; Slime: 2, 64, 256; WMO Ocean: 1, 2, 4, 8, 512
-	static const size_t type = 3;			// 0: Water, 1: Ocean, 2: Magma, 3: Slime
+	typedef Field<unsigned int, 0> ID;
+	typedef Field<DBCString, 1> Filename;
+	typedef Field<unsigned int, 2> flags;	// Water: 1, 2, 4, 8; Magma: 8, 16, 32, 64; Slime: 2, 64, 256; WMO Ocean: 1, 2, 4, 8, 512
+	typedef Field<unsigned int, 3> type;		// 0: Water, 1: Ocean, 2: Magma, 3: Slime
+	static const size_t Columns = 4;
+	static const int LocaleColumn = -1;
 };
 
 void OpenDBs();
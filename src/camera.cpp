@@ -0,0 +1,57 @@
+#include "camera.h"
+#include "video.h"
+
+Camera::Camera()
+{
+	projection.unit();
+	view.unit();
+}
+
+void Camera::perspective(float fovy, float aspect, float znear, float zfar)
+{
+	float f = 1.0f / tanf(fovy * 0.5f * PI / 180.0f);
+
+	projection.zero();
+	projection.m[0][0] = f / aspect;
+	projection.m[1][1] = f;
+	projection.m[2][2] = (zfar + znear) / (znear - zfar);
+	projection.m[2][3] = 2.0f * zfar * znear / (znear - zfar);
+	projection.m[3][2] = -1.0f;
+}
+
+void Camera::lookAt(const Vec3D &eye, const Vec3D &target, const Vec3D &up)
+{
+	Vec3D f = target - eye;
+	f.normalize();
+	Vec3D s = f % up;
+	s.normalize();
+	Vec3D u = s % f;
+
+	view.unit();
+	view.m[0][0] = s.x;  view.m[0][1] = s.y;  view.m[0][2] = s.z;
+	view.m[1][0] = u.x;  view.m[1][1] = u.y;  view.m[1][2] = u.z;
+	view.m[2][0] = -f.x; view.m[2][1] = -f.y; view.m[2][2] = -f.z;
+	view *= Matrix::newTranslation(eye * -1.0f);
+}
+
+void Camera::loadProjection()
+{
+	Matrix m = projection;
+	m.transpose();
+	glMatrixMode(GL_PROJECTION);
+	glLoadMatrixf(m);
+	glMatrixMode(GL_MODELVIEW);
+}
+
+void Camera::loadView()
+{
+	Matrix m = view;
+	m.transpose();
+	glMatrixMode(GL_MODELVIEW);
+	glLoadMatrixf(m);
+}
+
+void Camera::getFrustum(Frustum &frustum) const
+{
+	frustum.set(projection * view);
+}
@@ -0,0 +1,31 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include "vec3d.h"
+#include "matrix.h"
+#include "frustum.h"
+
+/*
+	The camera keeps the view and projection matrices on the CPU, so culling and
+	billboarding never have to read them back from GL. Both are in math (row major)
+	form like the rest of the Matrix code; loadProjection/loadView hand them to GL.
+*/
+class Camera {
+public:
+	Matrix projection, view;
+
+	Camera();
+
+	// same as gluPerspective, fovy in degrees
+	void perspective(float fovy, float aspect, float znear, float zfar);
+	// same as gluLookAt
+	void lookAt(const Vec3D &eye, const Vec3D &target, const Vec3D &up);
+
+	void loadProjection();
+	void loadView();
+
+	// clip planes for projection * view, in world space
+	void getFrustum(Frustum &frustum) const;
+};
+
+#endif
@@ -0,0 +1,70 @@
+#include "chunkfile.h"
+
+bool readChunkHeader(MPQFile &f, uint32 &id, uint32 &size)
+{
+	id = 0;
+	size = 0;
+	if (f.getPos() + 8 > f.getSize())
+		return false;
+	f.read(&id, 4);
+	f.read(&size, 4);
+	return true;
+}
+
+void chunkName(uint32 id, char *name)
+{
+	for (int i=0; i<4; i++)
+		name[i] = (char)(id >> (24 - i*8));
+	name[4] = 0;
+}
+
+void ChunkIndex::build(MPQFile &f, size_t start, size_t end)
+{
+	chunks.clear();
+	if (end == 0 || end > f.getSize())
+		end = f.getSize();
+
+	f.seek((ssize_t)start);
+	uint32 id, size;
+	while (f.getPos() + 8 <= end && readChunkHeader(f, id, size)) {
+		if (size == 0)
+			continue;
+
+		Chunk c;
+		c.id = id;
+		c.offset = f.getPos();
+		c.size = size;
+
+		// a chunk running past the end is cut short, it still gets read like before
+		if (c.offset + c.size > end) {
+			char name[5];
+			chunkName(id, name);
+			gLog("Error: chunk %s [%d] runs past the end of the file.\n", name, size);
+			c.size = end - c.offset;
+			chunks.push_back(c);
+			break;
+		}
+		chunks.push_back(c);
+		f.seek((ssize_t)(c.offset + c.size));
+	}
+	f.seek((ssize_t)start);
+}
+
+const Chunk *ChunkIndex::find(uint32 id, const Chunk *after) const
+{
+	size_t i = after ? (after - &chunks[0]) + 1 : 0;
+	for (; i<chunks.size(); i++) {
+		if (chunks[i].id == id)
+			return &chunks[i];
+	}
+	return 0;
+}
+
+int ChunkIndex::seek(MPQFile &f, uint32 id) const
+{
+	const Chunk *c = find(id);
+	if (!c)
+		return -1;
+	f.seek((ssize_t)c->offset);
+	return (int)c->size;
+}
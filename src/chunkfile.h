@@ -0,0 +1,52 @@
+#ifndef CHUNKFILE_H
+#define CHUNKFILE_H
+
+#include "mpq.h"
+#include <vector>
+
+typedef unsigned int       uint32;
+
+/*
+	Reader for the chunked (IFF style) files: WDT, WDL, ADT and WMO.
+
+	Every chunk is a 4 byte id, a 4 byte size and the data. The id is stored
+	backwards on disk, so read as a little endian int "MVER" comes out as
+	FOURCC('M','V','E','R'), which can be compared and switched on directly.
+
+	ChunkIndex walks the chunk headers once and keeps the id, offset and size
+	of each chunk, so parsers can go straight to the chunks they need instead
+	of reading through the file again.
+*/
+
+#define FOURCC(a,b,c,d)	((uint32)(d) | ((uint32)(c) << 8) | ((uint32)(b) << 16) | ((uint32)(a) << 24))
+
+struct Chunk {
+	uint32 id;
+	size_t offset;	// start of the data, after the header
+	size_t size;
+};
+
+// reads one chunk header, false at the end of the file
+bool readChunkHeader(MPQFile &f, uint32 &id, uint32 &size);
+
+// zero terminated id for logging
+void chunkName(uint32 id, char *name);
+
+class ChunkIndex {
+public:
+	std::vector<Chunk> chunks;	// in file order
+
+	ChunkIndex() {}
+	ChunkIndex(MPQFile &f, size_t start = 0, size_t end = 0) { build(f, start, end); }
+
+	// indexes the chunks from start to end, or to the end of the file when end is 0
+	void build(MPQFile &f, size_t start = 0, size_t end = 0);
+
+	// first chunk with this id after the given one, or 0
+	const Chunk *find(uint32 id, const Chunk *after = 0) const;
+
+	// seeks f to the data of the chunk with this id and returns its size, or -1 if there is none
+	int seek(MPQFile &f, uint32 id) const;
+};
+
+#endif
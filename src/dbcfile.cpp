@@ -6,6 +6,7 @@ DBCFile::DBCFile(const std::string &filename):
 	filename(filename)
 {
 	data = NULL;
+	locale = -1;
 }
 
 bool DBCFile::open()
@@ -75,8 +76,40 @@ bool DBCFile::open()
 }
 
 DBCFile::~DBCFile()
+{
+	close();
+}
+
+void DBCFile::close()
 {
 	delete [] data;
+	data = NULL;
+	for (size_t i=0; i<indices.size(); i++)
+		delete indices[i];
+	indices.clear();
+}
+
+bool DBCFile::checkFields(size_t columns)
+{
+	if (fieldCount >= columns)
+		return true;
+	gLog("%s has %d fields, expected at least %d\n", filename.c_str(), (int)fieldCount, (int)columns);
+	close();
+	return false;
+}
+
+void DBCFile::resolveLocale(size_t column)
+{
+	// the client only fills in the strings of its own locale
+	locale = 0;
+	for (size_t loc=0; loc<8 && column+loc < fieldCount; loc++) {
+		for (size_t i=0; i<recordCount; i++) {
+			if (*reinterpret_cast<unsigned int*>(data + i*recordSize + (column+loc)*4)) {
+				locale = (int)loc;
+				return;
+			}
+		}
+	}
 }
 
 DBCFile::Record DBCFile::getRecord(size_t id)
@@ -96,3 +129,106 @@ DBCFile::Iterator DBCFile::end()
 	return Iterator(*this, stringTable);
 }
 
+// keys up to this many times the record count apart get an array, sparser ones a hash
+#define DENSE_INDEX_SPREAD	4
+
+int DBCFile::findByID(unsigned int id, size_t field)
+{
+	size_t count;
+	const unsigned int *records = findAll(id, count, field);
+	return count ? (int)records[0] : -1;
+}
+
+const unsigned int *DBCFile::findAll(unsigned int id, size_t &count, size_t field)
+{
+	count = 0;
+	if (!data || field >= fieldCount)
+		return 0;
+
+	if (indices.size() < fieldCount)
+		indices.resize(fieldCount, 0);
+	if (!indices[field]) {
+		indices[field] = new Index();
+		indices[field]->build(*this, field);
+	}
+	return indices[field]->find(id, count);
+}
+
+size_t DBCFile::Index::slot(unsigned int key) const
+{
+	unsigned int h = key * 2654435761u;
+	size_t i = (h ^ (h >> 16)) & mask;
+	while (slots[i].count && slots[i].key != key)
+		i = (i + 1) & mask;
+	return i;
+}
+
+void DBCFile::Index::build(const DBCFile &file, size_t field)
+{
+	size_t n = file.recordCount;
+	std::vector<unsigned int> keys(n);
+	unsigned int lo = 0xffffffff, hi = 0;
+	for (size_t i=0; i<n; i++) {
+		keys[i] = *reinterpret_cast<unsigned int*>(file.data + i*file.recordSize + field*4);
+		if (keys[i] < lo) lo = keys[i];
+		if (keys[i] > hi) hi = keys[i];
+	}
+	order.resize(n);
+
+	dense = (n == 0) || (size_t)(hi - lo) < n * DENSE_INDEX_SPREAD;
+	if (dense) {
+		// counting sort on the key
+		minKey = n ? lo : 0;
+		size_t range = n ? (size_t)(hi - lo) + 1 : 0;
+		start.assign(range + 1, 0);
+		for (size_t i=0; i<n; i++)
+			start[keys[i] - lo + 1]++;
+		for (size_t k=0; k<range; k++)
+			start[k+1] += start[k];
+		std::vector<unsigned int> next(start.begin(), start.end() - 1);
+		for (size_t i=0; i<n; i++)
+			order[next[keys[i] - lo]++] = (unsigned int)i;
+		return;
+	}
+
+	size_t size = 16;
+	while (size < n*2)
+		size *= 2;
+	Slot empty = { 0, 0, 0 };
+	slots.assign(size, empty);
+	mask = (unsigned int)(size - 1);
+
+	// count the records per key, then give each key its run
+	for (size_t i=0; i<n; i++) {
+		Slot &s = slots[slot(keys[i])];
+		s.key = keys[i];
+		s.count++;
+	}
+	unsigned int pos = 0;
+	for (size_t j=0; j<size; j++) {
+		slots[j].first = pos;
+		pos += slots[j].count;
+	}
+	std::vector<unsigned int> next(size);
+	for (size_t j=0; j<size; j++)
+		next[j] = slots[j].first;
+	for (size_t i=0; i<n; i++)
+		order[next[slot(keys[i])]++] = (unsigned int)i;
+}
+
+const unsigned int *DBCFile::Index::find(unsigned int key, size_t &count) const
+{
+	if (dense) {
+		size_t k = key - minKey;
+		if (key < minKey || k + 1 >= start.size()) {
+			count = 0;
+			return 0;
+		}
+		count = start[k+1] - start[k];
+		return count ? &order[start[k]] : 0;
+	}
+	const Slot &s = slots[slot(key)];
+	count = s.count;
+	return count ? &order[s.first] : 0;
+}
+
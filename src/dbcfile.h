@@ -2,6 +2,7 @@
 #define DBCFILE_H
 #include <cassert>
 #include <string>
+#include <vector>
 #include "wowmapview.h"
 
 #ifdef __GNUC__
@@ -18,6 +19,7 @@ public:
 
 	// Open database. It must be openened before it can be used.
 	bool open() WARN_IF_UNUSED;
+	void close();
 
 	// Database exceptions
 	class Exception
@@ -80,7 +82,9 @@ public:
 		const char *getLocalizedString( size_t field, size_t locale = -1 ) const
 		{
 			size_t loc = locale;
-			if( locale == -1 )
+			if( locale == -1 && file.locale >= 0 )
+				loc = file.locale;
+			else if( locale == -1 )
 			{
 				assert(field < file.fieldCount -  8 );
 				for( loc = 0; loc < 8; loc++ )
@@ -143,19 +147,39 @@ public:
 	/// Trivial
 	size_t getRecordCount() const { return recordCount;}
 	size_t getFieldCount() const { return fieldCount; }
+	// Keyed lookups go through an index on the field, built the first time it's used.
+	// First record with id in field, throws NotFound
 	Record getByID( unsigned int id, size_t field = 0 ) 
 	{
-		for( Iterator i = begin( ); i!=end( ); ++i )
-		{
-			if( i->getUInt( field ) == id )
-				return ( *i );
-		}
-		throw NotFound( );
+		int i = findByID( id, field );
+		if( i < 0 )
+			throw NotFound( );
+		return getRecord( i );
 	}
+	// Record number of the first record with id in field, -1 if there is none
+	int findByID( unsigned int id, size_t field = 0 );
+	// Record numbers of all records with id in field, in file order; count is 0 if there are none
+	const unsigned int *findAll( unsigned int id, size_t &count, size_t field = 0 );
 	int getRecordSize() { return recordSize; }
 	int getRecordCount() { return recordCount; }
 	int getFieldCount() { return fieldCount; }
 	int getStringSize() { return stringSize; }
+
+	// Raw access for typed rows
+	const unsigned char *recordData( size_t n ) const { return data + n*recordSize; }
+	const char *string( unsigned int offset ) const
+	{
+		return reinterpret_cast<const char*>( stringTable + ( offset < stringSize ? offset : 0 ) );
+	}
+	// Locale column of localized strings, -1 until resolveLocale
+	int getLocale() const { return locale; }
+
+protected:
+	// Picks the first locale column of a localized string field that has text in any record
+	void resolveLocale( size_t column );
+	// Closes the file if it has fewer than columns fields
+	bool checkFields( size_t columns );
+
 private:
 	std::string filename;
 	size_t recordSize;
@@ -164,6 +188,167 @@ private:
 	size_t stringSize;
 	unsigned char *data;
 	unsigned char *stringTable;
+	int locale;
+
+	// the records of one key field grouped by key
+	struct Index
+	{
+		// record numbers ordered by key, records with the same key in file order
+		std::vector<unsigned int> order;
+		// compact keys: key k has order[start[k-minKey]] up to order[start[k-minKey+1]]
+		bool dense;
+		unsigned int minKey;
+		std::vector<unsigned int> start;
+		// otherwise an open addressed hash from key to its run in order
+		struct Slot
+		{
+			unsigned int key, first, count;
+		};
+		std::vector<Slot> slots;
+		unsigned int mask;
+
+		size_t slot(unsigned int key) const;
+		void build(const DBCFile &file, size_t field);
+		const unsigned int *find(unsigned int key, size_t &count) const;
+	};
+	std::vector<Index*> indices;
+};
+
+/*
+	Typed records. A DB class lists its fields as DBCTable::Field types and reads them with
+	Row::get, straight from the record bytes:
+
+		AreaDB::Row r = gAreaDB.row(n);
+		const char *name = r.get<AreaDB::Name>();
+
+	DBCTable::open checks once that the file has all the schema's columns and resolves
+	the locale of its localized strings, so reading a field is just a load. A field of
+	another table, or one beyond the schema's Columns, doesn't compile.
+*/
+
+// string columns: an offset into the string table, or the first of the locale columns
+struct DBCString {};
+struct DBCLocString {};
+
+// reads a column of type T
+template <class T>
+struct DBCColumn
+{
+	typedef T Result;
+	static T read( const DBCFile &, const unsigned char *rec, size_t column )
+	{
+		return *reinterpret_cast<const T*>( rec + column*4 );
+	}
+};
+
+template <>
+struct DBCColumn<DBCString>
+{
+	typedef const char *Result;
+	static const char *read( const DBCFile &file, const unsigned char *rec, size_t column )
+	{
+		return file.string( *reinterpret_cast<const unsigned int*>( rec + column*4 ) );
+	}
+};
+
+template <>
+struct DBCColumn<DBCLocString>
+{
+	typedef const char *Result;
+	static const char *read( const DBCFile &file, const unsigned char *rec, size_t column )
+	{
+		return file.string( *reinterpret_cast<const unsigned int*>( rec + ( column + file.getLocale() )*4 ) );
+	}
+};
+
+// compile time checks, only DBCCheck<true> has a size
+template <bool Ok>
+struct DBCCheck;
+template <>
+struct DBCCheck<true> {};
+
+template <class A, class B>
+struct DBCSameSchema { static const bool value = false; };
+template <class A>
+struct DBCSameSchema<A, A> { static const bool value = true; };
+
+template <class Schema>
+class DBCRow
+{
+public:
+	DBCRow(): file( 0 ), rec( 0 ) {}
+	DBCRow( const DBCFile &file, const unsigned char *rec ): file( &file ), rec( rec ) {}
+
+	template <class F>
+	typename F::Result get() const
+	{
+		check<F>();
+		return DBCColumn<typename F::Type>::read( *file, rec, F::column );
+	}
+	// i-th column of a field with a count
+	template <class F>
+	typename F::Result get( size_t i ) const
+	{
+		check<F>();
+		assert( i < F::count );
+		return DBCColumn<typename F::Type>::read( *file, rec, F::column + i );
+	}
+
+private:
+	template <class F>
+	static void check()
+	{
+		(void)sizeof( DBCCheck< DBCSameSchema<typename F::Owner, Schema>::value
+			&& F::column + F::count <= Schema::Columns > );
+	}
+
+	const DBCFile *file;
+	const unsigned char *rec;
+};
+
+// Schema is the DB class itself, with its fields, Columns (the fields a file needs at least)
+// and LocaleColumn (the first localized string, or -1)
+template <class Schema>
+class DBCTable: public DBCFile
+{
+public:
+	typedef DBCRow<Schema> Row;
+
+	// Field at column of type T; Count > 1 for a run of columns, read with an index
+	template <class T, size_t Column, size_t Count = 1>
+	struct Field
+	{
+		typedef Schema Owner;
+		typedef T Type;
+		typedef typename DBCColumn<T>::Result Result;
+		static const size_t column = Column;
+		static const size_t count = Count;
+	};
+
+	DBCTable( const std::string &filename ): DBCFile( filename ) {}
+
+	bool open() WARN_IF_UNUSED
+	{
+		if( !DBCFile::open( ) || !checkFields( Schema::Columns ) )
+			return false;
+		if( Schema::LocaleColumn >= 0 )
+			resolveLocale( Schema::LocaleColumn );
+		return true;
+	}
+
+	Row row( size_t n ) const
+	{
+		return Row( *this, recordData( n ) );
+	}
+	// First row with id in field
+	bool findRow( unsigned int id, Row &r, size_t field = 0 )
+	{
+		int n = findByID( id, field );
+		if( n < 0 )
+			return false;
+		r = row( n );
+		return true;
+	}
 };
 
 #endif
@@ -0,0 +1,651 @@
+#include "dxt.h"
+#include <SDL/SDL.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DXT_SSE2
+#include <emmintrin.h>
+#endif
+
+// threads a single level is split across at most
+#define DXT_MAX_THREADS	8
+
+int dxtBlockSize(DXTFormat format)
+{
+	return format == DXT_1 ? 8 : 16;
+}
+
+int dxtLevelSize(DXTFormat format, int w, int h)
+{
+	return ((w+3)/4) * ((h+3)/4) * dxtBlockSize(format);
+}
+
+// 565 color to RGBA bytes (little endian), 5 and 6 bit values widened by replicating the top bits
+static inline unsigned int expand565(unsigned int c, unsigned int alpha)
+{
+	unsigned int r = (c >> 11) & 0x1f;
+	unsigned int g = (c >> 5) & 0x3f;
+	unsigned int b = c & 0x1f;
+	r = (r << 3) | (r >> 2);
+	g = (g << 2) | (g >> 4);
+	b = (b << 3) | (b >> 2);
+	return r | (g << 8) | (b << 16) | (alpha << 24);
+}
+
+// the 16 alpha values of a DXT5 block, in pixel order
+static void alphaDXT5(const unsigned char *block, unsigned char *alpha)
+{
+	unsigned int a0 = block[0], a1 = block[1];
+	unsigned char pal[8];
+	pal[0] = a0;
+	pal[1] = a1;
+	if (a0 > a1) {
+		for (int i=1; i<7; i++)
+			pal[i+1] = (unsigned char)(((7-i)*a0 + i*a1) / 7);
+	} else {
+		for (int i=1; i<5; i++)
+			pal[i+1] = (unsigned char)(((5-i)*a0 + i*a1) / 5);
+		pal[6] = 0;
+		pal[7] = 255;
+	}
+
+	// two runs of 24 bits, 8 pixels each
+	for (int half=0; half<2; half++) {
+		const unsigned char *p = block + 2 + half*3;
+		unsigned int bits = p[0] | (p[1] << 8) | (p[2] << 16);
+		for (int i=0; i<8; i++) {
+			alpha[half*8 + i] = pal[bits & 7];
+			bits >>= 3;
+		}
+	}
+}
+
+#ifdef DXT_SSE2
+
+// decodes one block to 4 rows of 4 RGBA pixels, pitch bytes apart
+static void decodeBlock(DXTFormat format, const unsigned char *block, unsigned char *dest, int pitch)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const unsigned char *cb = (format == DXT_1) ? block : block + 8;
+
+	unsigned int c0 = cb[0] | (cb[1] << 8);
+	unsigned int c1 = cb[2] | (cb[3] << 8);
+	unsigned int opaque = (format == DXT_1) ? 255 : 0;
+	__m128i ends = _mm_unpacklo_epi32(_mm_cvtsi32_si128(expand565(c0, opaque)), _mm_cvtsi32_si128(expand565(c1, opaque)));
+
+	// both end colors as 16 bit channels, and the same swapped
+	__m128i a = _mm_unpacklo_epi8(ends, zero);
+	__m128i b = _mm_shuffle_epi32(a, _MM_SHUFFLE(1,0,3,2));
+	__m128i mid;
+	if (format == DXT_1 && c0 <= c1) {
+		// (c0+c1)/2 and transparent black
+		mid = _mm_move_epi64(_mm_srli_epi16(_mm_add_epi16(a, b), 1));
+	} else {
+		// (2*c0+c1)/3 and (c0+2*c1)/3; x*0x5556>>16 is exactly x/3 up to 765
+		mid = _mm_mulhi_epu16(_mm_add_epi16(_mm_add_epi16(a, a), b), _mm_set1_epi16(0x5556));
+	}
+	__m128i pal = _mm_unpacklo_epi64(ends, _mm_packus_epi16(mid, mid));
+
+	__m128i e0 = _mm_shuffle_epi32(pal, 0x00);
+	__m128i e1 = _mm_shuffle_epi32(pal, 0x55);
+	__m128i e2 = _mm_shuffle_epi32(pal, 0xaa);
+	__m128i e3 = _mm_shuffle_epi32(pal, 0xff);
+
+	// each lane looks at its own two bits of the row's index byte
+	const __m128i k1 = _mm_set_epi32(1<<6, 1<<4, 1<<2, 1);
+	const __m128i k2 = _mm_set_epi32(2<<6, 2<<4, 2<<2, 2);
+	const __m128i k3 = _mm_set_epi32(3<<6, 3<<4, 3<<2, 3);
+
+	// alpha bytes in pixel order
+	__m128i av = zero;
+	if (format == DXT_3) {
+		__m128i v = _mm_loadl_epi64((const __m128i*)block);
+		__m128i lo = _mm_and_si128(v, _mm_set1_epi8(0x0f));
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0f));
+		av = _mm_unpacklo_epi8(lo, hi);
+		av = _mm_or_si128(av, _mm_slli_epi16(av, 4));
+	} else if (format == DXT_5) {
+		unsigned char alpha[16];
+		alphaDXT5(block, alpha);
+		av = _mm_loadu_si128((const __m128i*)alpha);
+	}
+	// moved up to the top byte of each pixel
+	__m128i alo = _mm_unpacklo_epi8(zero, av);
+	__m128i ahi = _mm_unpackhi_epi8(zero, av);
+	__m128i arow[4];
+	arow[0] = _mm_unpacklo_epi16(zero, alo);
+	arow[1] = _mm_unpackhi_epi16(zero, alo);
+	arow[2] = _mm_unpacklo_epi16(zero, ahi);
+	arow[3] = _mm_unpackhi_epi16(zero, ahi);
+
+	for (int j=0; j<4; j++) {
+		__m128i t = _mm_and_si128(_mm_set1_epi32(cb[4+j]), k3);
+		__m128i px = _mm_or_si128(
+			_mm_or_si128(_mm_and_si128(_mm_cmpeq_epi32(t, zero), e0), _mm_and_si128(_mm_cmpeq_epi32(t, k1), e1)),
+			_mm_or_si128(_mm_and_si128(_mm_cmpeq_epi32(t, k2), e2), _mm_and_si128(_mm_cmpeq_epi32(t, k3), e3)));
+		px = _mm_or_si128(px, arow[j]);
+		_mm_storeu_si128((__m128i*)(dest + j*pitch), px);
+	}
+}
+
+#else
+
+static void decodeBlock(DXTFormat format, const unsigned char *block, unsigned char *dest, int pitch)
+{
+	const unsigned char *cb = (format == DXT_1) ? block : block + 8;
+
+	unsigned int c0 = cb[0] | (cb[1] << 8);
+	unsigned int c1 = cb[2] | (cb[3] << 8);
+	unsigned int opaque = (format == DXT_1) ? 255 : 0;
+	unsigned int pal[4];
+	pal[0] = expand565(c0, opaque);
+	pal[1] = expand565(c1, opaque);
+	if (format == DXT_1 && c0 <= c1) {
+		pal[2] = 0;
+		for (int s=0; s<32; s+=8)
+			pal[2] |= ((((pal[0] >> s) & 0xff) + ((pal[1] >> s) & 0xff)) / 2) << s;
+		pal[3] = 0;
+	} else {
+		pal[2] = pal[3] = 0;
+		for (int s=0; s<32; s+=8) {
+			unsigned int x0 = (pal[0] >> s) & 0xff, x1 = (pal[1] >> s) & 0xff;
+			pal[2] |= ((2*x0 + x1) / 3) << s;
+			pal[3] |= ((x0 + 2*x1) / 3) << s;
+		}
+	}
+
+	unsigned char alpha[16];
+	if (format == DXT_3) {
+		for (int i=0; i<16; i++)
+			alpha[i] = ((block[i/2] >> ((i&1)*4)) & 0x0f) * 0x11;
+	} else if (format == DXT_5) {
+		alphaDXT5(block, alpha);
+	} else {
+		memset(alpha, 0, 16);
+	}
+
+	for (int j=0; j<4; j++) {
+		unsigned int *row = (unsigned int*)(dest + j*pitch);
+		unsigned int index = cb[4+j];
+		for (int i=0; i<4; i++) {
+			row[i] = pal[index & 3] | (alpha[j*4+i] << 24);
+			index >>= 2;
+		}
+	}
+}
+
+#endif
+
+// RGBA bytes to 565, rounded
+static inline unsigned int pack565(unsigned int c)
+{
+	unsigned int r = c & 0xff, g = (c >> 8) & 0xff, b = (c >> 16) & 0xff;
+	return (((r*31 + 127) / 255) << 11) | (((g*63 + 127) / 255) << 5) | ((b*31 + 127) / 255);
+}
+
+// the end colors of a block being encoded
+struct ColorEnds {
+	unsigned int c0, c1;
+	// pixels are projected on axis starting at base, len2 is the axis length squared
+	int base[3], axis[3], len2;
+	// three color mode with transparent pixels
+	bool three;
+};
+
+// cmin and cmax are opposite corners of the block's color box
+static void colorEnds(unsigned int cmin, unsigned int cmax, bool three, ColorEnds &e)
+{
+	// pull the corners in by 1/16th of the box; a block rarely has much right at them
+	unsigned int lo = 0, hi = 0;
+	for (int s=0; s<24; s+=8) {
+		int a = (cmin >> s) & 0xff, b = (cmax >> s) & 0xff;
+		int inset = (b - a) >> 4;
+		lo |= (a + inset) << s;
+		hi |= (b - inset) << s;
+	}
+	lo = pack565(lo);
+	hi = pack565(hi);
+	if (hi < lo) {
+		unsigned int t = lo;
+		lo = hi;
+		hi = t;
+	}
+
+	// four colors need color0 > color1, three colors color0 <= color1
+	e.three = three;
+	e.c0 = three ? lo : hi;
+	e.c1 = three ? hi : lo;
+
+	// measured between the colors the decoder will really see
+	unsigned int from = expand565(lo, 0), to = expand565(hi, 0);
+	e.len2 = 0;
+	for (int k=0; k<3; k++) {
+		e.base[k] = (from >> (k*8)) & 0xff;
+		e.axis[k] = (int)((to >> (k*8)) & 0xff) - e.base[k];
+		e.len2 += e.axis[k] * e.axis[k];
+	}
+}
+
+// the box's main diagonal runs from cmin to cmax; when green or blue go down as red goes up
+// the pixels lie along another diagonal, so swap those channels' ends
+static void pickDiagonal(const unsigned int *px, bool alpha1, unsigned int &cmin, unsigned int &cmax)
+{
+	int mid[3], cov[3] = { 0, 0, 0 };
+	for (int k=0; k<3; k++)
+		mid[k] = (((cmin >> (k*8)) & 0xff) + ((cmax >> (k*8)) & 0xff)) / 2;
+	for (int i=0; i<16; i++) {
+		if (alpha1 && (px[i] >> 24) < 128)
+			continue;
+		int r = (int)(px[i] & 0xff) - mid[0];
+		cov[1] += r * ((int)((px[i] >> 8) & 0xff) - mid[1]);
+		cov[2] += r * ((int)((px[i] >> 16) & 0xff) - mid[2]);
+	}
+	for (int k=1; k<3; k++) {
+		if (cov[k] < 0) {
+			unsigned int m = 0xff << (k*8);
+			unsigned int lo = cmin & m;
+			cmin = (cmin & ~m) | (cmax & m);
+			cmax = (cmax & ~m) | lo;
+		}
+	}
+}
+
+static void writeEnds(const ColorEnds &e, unsigned char *cb)
+{
+	cb[0] = e.c0 & 0xff;
+	cb[1] = e.c0 >> 8;
+	cb[2] = e.c1 & 0xff;
+	cb[3] = e.c1 >> 8;
+}
+
+#ifdef DXT_SSE2
+
+// color half of a block from 4 rows of 4 RGBA pixels, pitch bytes apart
+static void encodeColors(const unsigned char *src, int pitch, bool alpha1, unsigned char *cb)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi8(-1);
+
+	// color box, leaving out pixels that will be transparent
+	__m128i row[4], opaque[4];
+	__m128i lo = ones, hi = zero;
+	int anyOpaque = 0, allOpaque = 0xffff;
+	for (int j=0; j<4; j++) {
+		row[j] = _mm_loadu_si128((const __m128i*)(src + j*pitch));
+		opaque[j] = alpha1 ? _mm_srai_epi32(row[j], 31) : ones;
+		int m = _mm_movemask_epi8(opaque[j]);
+		anyOpaque |= m;
+		allOpaque &= m;
+		lo = _mm_min_epu8(lo, _mm_or_si128(row[j], _mm_andnot_si128(opaque[j], ones)));
+		hi = _mm_max_epu8(hi, _mm_and_si128(row[j], opaque[j]));
+	}
+	lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(1,0,3,2)));
+	lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2,3,0,1)));
+	hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(1,0,3,2)));
+	hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(2,3,0,1)));
+
+	if (!anyOpaque) {
+		// all transparent
+		memset(cb, 0, 4);
+		memset(cb+4, 0xff, 4);
+		return;
+	}
+
+	unsigned int px[16];
+	for (int j=0; j<4; j++)
+		_mm_storeu_si128((__m128i*)(px + j*4), row[j]);
+	unsigned int cmin = _mm_cvtsi128_si32(lo), cmax = _mm_cvtsi128_si32(hi);
+	pickDiagonal(px, alpha1, cmin, cmax);
+
+	ColorEnds e;
+	colorEnds(cmin, cmax, allOpaque != 0xffff, e);
+	writeEnds(e, cb);
+
+	__m128i base = _mm_set_epi16(0, e.base[2], e.base[1], e.base[0], 0, e.base[2], e.base[1], e.base[0]);
+	__m128i axis = _mm_set_epi16(0, e.axis[2], e.axis[1], e.axis[0], 0, e.axis[2], e.axis[1], e.axis[0]);
+	__m128i len1 = _mm_set1_epi32(e.len2);
+	__m128i len3 = _mm_set1_epi32(3*e.len2);
+	__m128i len5 = _mm_set1_epi32(5*e.len2);
+	const __m128i one = _mm_set1_epi32(1);
+	const __m128i two = _mm_set1_epi32(2);
+	// moves each lane's index to its place in the row byte
+	const __m128i place = _mm_set_epi32(64, 16, 4, 1);
+
+	for (int j=0; j<4; j++) {
+		// dot products come out as two halves per pixel, add them up
+		__m128i dlo = _mm_madd_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(row[j], zero), base), axis);
+		__m128i dhi = _mm_madd_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(row[j], zero), base), axis);
+		dlo = _mm_shuffle_epi32(dlo, _MM_SHUFFLE(3,1,2,0));
+		dhi = _mm_shuffle_epi32(dhi, _MM_SHUFFLE(3,1,2,0));
+		__m128i d = _mm_add_epi32(_mm_unpacklo_epi64(dlo, dhi), _mm_unpackhi_epi64(dlo, dhi));
+
+		__m128i idx;
+		if (e.three) {
+			// 0 at base, 2 halfway, 1 at the end, 3 transparent
+			__m128i d4 = _mm_slli_epi32(d, 2);
+			__m128i m1 = _mm_cmpgt_epi32(d4, len1);
+			__m128i m3 = _mm_cmpgt_epi32(d4, len3);
+			__m128i t = _mm_andnot_si128(opaque[j], ones);
+			idx = _mm_or_si128(
+				_mm_and_si128(_mm_or_si128(_mm_andnot_si128(m3, m1), t), two),
+				_mm_and_si128(_mm_or_si128(m3, t), one));
+		} else {
+			// 1 at base, then 3, 2 and 0 at the end
+			__m128i d6 = _mm_add_epi32(_mm_slli_epi32(d, 2), _mm_slli_epi32(d, 1));
+			__m128i m1 = _mm_cmpgt_epi32(d6, len1);
+			__m128i m3 = _mm_cmpgt_epi32(d6, len3);
+			__m128i m5 = _mm_cmpgt_epi32(d6, len5);
+			idx = _mm_or_si128(_mm_and_si128(_mm_andnot_si128(m5, m1), two), _mm_andnot_si128(m3, one));
+		}
+		idx = _mm_mullo_epi16(idx, place);
+		idx = _mm_or_si128(idx, _mm_srli_si128(idx, 8));
+		idx = _mm_or_si128(idx, _mm_srli_si128(idx, 4));
+		cb[4+j] = (unsigned char)_mm_cvtsi128_si32(idx);
+	}
+}
+
+#else
+
+static void encodeColors(const unsigned char *src, int pitch, bool alpha1, unsigned char *cb)
+{
+	unsigned int px[16];
+	for (int j=0; j<4; j++)
+		memcpy(px + j*4, src + j*pitch, 16);
+
+	// color box, leaving out pixels that will be transparent
+	unsigned int lo[3] = {255,255,255}, hi[3] = {0,0,0};
+	bool anyOpaque = false, allOpaque = true;
+	for (int i=0; i<16; i++) {
+		if (alpha1 && (px[i] >> 24) < 128) {
+			allOpaque = false;
+			continue;
+		}
+		anyOpaque = true;
+		for (int k=0; k<3; k++) {
+			unsigned int c = (px[i] >> (k*8)) & 0xff;
+			if (c < lo[k]) lo[k] = c;
+			if (c > hi[k]) hi[k] = c;
+		}
+	}
+
+	if (!anyOpaque) {
+		// all transparent
+		memset(cb, 0, 4);
+		memset(cb+4, 0xff, 4);
+		return;
+	}
+
+	unsigned int cmin = lo[0] | (lo[1] << 8) | (lo[2] << 16), cmax = hi[0] | (hi[1] << 8) | (hi[2] << 16);
+	pickDiagonal(px, alpha1, cmin, cmax);
+
+	ColorEnds e;
+	colorEnds(cmin, cmax, !allOpaque, e);
+	writeEnds(e, cb);
+
+	// 0 at base, 2 halfway, 1 at the end, 3 transparent; or 1 at base, then 3, 2 and 0 at the end
+	static const unsigned int four[4] = { 1, 3, 2, 0 };
+	for (int j=0; j<4; j++) {
+		unsigned int bits = 0;
+		for (int i=0; i<4; i++) {
+			unsigned int p = px[j*4+i];
+			int d = 0;
+			for (int k=0; k<3; k++)
+				d += ((int)((p >> (k*8)) & 0xff) - e.base[k]) * e.axis[k];
+
+			unsigned int idx;
+			if (e.three) {
+				if ((p >> 24) < 128)
+					idx = 3;
+				else if (4*d > 3*e.len2)
+					idx = 1;
+				else
+					idx = (4*d > e.len2) ? 2 : 0;
+			} else {
+				idx = four[(6*d > e.len2) + (6*d > 3*e.len2) + (6*d > 5*e.len2)];
+			}
+			bits |= idx << (i*2);
+		}
+		cb[4+j] = bits;
+	}
+}
+
+#endif
+
+// explicit 4 bit alpha
+static void encodeAlphaDXT3(const unsigned char *src, int pitch, unsigned char *block)
+{
+	for (int i=0; i<16; i+=2) {
+		const unsigned char *p = src + (i/4)*pitch + (i&3)*4 + 3;
+		unsigned int a0 = (p[0]*15 + 127) / 255;
+		unsigned int a1 = (p[4]*15 + 127) / 255;
+		block[i/2] = a0 | (a1 << 4);
+	}
+}
+
+// eight alpha mode between the block's lowest and highest alpha
+static void encodeAlphaDXT5(const unsigned char *src, int pitch, unsigned char *block)
+{
+	int alpha[16];
+	int amin = 255, amax = 0;
+	for (int i=0; i<16; i++) {
+		alpha[i] = src[(i/4)*pitch + (i&3)*4 + 3];
+		if (alpha[i] < amin) amin = alpha[i];
+		if (alpha[i] > amax) amax = alpha[i];
+	}
+	block[0] = amax;
+	block[1] = amin;
+
+	// sevenths up from amin; code 1 is amin, 0 is amax, 7..2 in between
+	int range = amax - amin;
+	unsigned int bits[2] = { 0, 0 };
+	for (int i=0; i<16; i++) {
+		unsigned int code = 0;
+		if (range) {
+			int k = ((alpha[i] - amin) * 7 + range/2) / range;
+			code = (k == 7) ? 0 : (k == 0) ? 1 : 8 - k;
+		}
+		bits[i/8] |= code << ((i&7)*3);
+	}
+	for (int half=0; half<2; half++) {
+		for (int b=0; b<3; b++)
+			block[2 + half*3 + b] = (bits[half] >> (b*8)) & 0xff;
+	}
+}
+
+static void encodeBlock(DXTFormat format, const unsigned char *src, int pitch, unsigned char *block)
+{
+	if (format == DXT_3) {
+		encodeAlphaDXT3(src, pitch, block);
+		block += 8;
+	} else if (format == DXT_5) {
+		encodeAlphaDXT5(src, pitch, block);
+		block += 8;
+	}
+	encodeColors(src, pitch, format == DXT_1, block);
+}
+
+// block rows [by0, by1) of a level
+static void decodeRows(DXTFormat format, int w, int h, const unsigned char *src, unsigned char *dest, int by0, int by1)
+{
+	int bs = dxtBlockSize(format);
+	int bw = (w+3)/4;
+	unsigned char tmp[64];
+
+	for (int by=by0; by<by1; by++) {
+		const unsigned char *block = src + by*bw*bs;
+		int y = by*4;
+		for (int bx=0; bx<bw; bx++, block+=bs) {
+			int x = bx*4;
+			if (x+4 <= w && y+4 <= h) {
+				decodeBlock(format, block, dest + (y*w + x)*4, w*4);
+			} else {
+				// edge of a level that's not a multiple of 4, or a 2x2 / 1x1 mip
+				decodeBlock(format, block, tmp, 16);
+				int cw = (w-x < 4) ? w-x : 4;
+				int ch = (h-y < 4) ? h-y : 4;
+				for (int j=0; j<ch; j++)
+					memcpy(dest + ((y+j)*w + x)*4, tmp + j*16, cw*4);
+			}
+		}
+	}
+}
+
+// block rows [by0, by1) of a level
+static void encodeRows(DXTFormat format, int w, int h, const unsigned char *src, unsigned char *dest, int by0, int by1)
+{
+	int bs = dxtBlockSize(format);
+	int bw = (w+3)/4;
+	unsigned char tmp[64];
+
+	for (int by=by0; by<by1; by++) {
+		unsigned char *block = dest + by*bw*bs;
+		int y = by*4;
+		for (int bx=0; bx<bw; bx++, block+=bs) {
+			int x = bx*4;
+			if (x+4 <= w && y+4 <= h) {
+				encodeBlock(format, src + (y*w + x)*4, w*4, block);
+			} else {
+				// pad a block hanging over the edge with the last row and column
+				for (int j=0; j<4; j++) {
+					int sy = (y+j < h) ? y+j : h-1;
+					for (int i=0; i<4; i++) {
+						int sx = (x+i < w) ? x+i : w-1;
+						memcpy(tmp + j*16 + i*4, src + (sy*w + sx)*4, 4);
+					}
+				}
+				encodeBlock(format, tmp, 16, block);
+			}
+		}
+	}
+}
+
+struct DXTJob {
+	bool encode;
+	DXTFormat format;
+	int w, h;
+	const unsigned char *src;
+	unsigned char *dest;
+	int by0, by1;
+};
+
+static int dxtThread(void *data)
+{
+	DXTJob *job = (DXTJob*)data;
+	if (job->encode)
+		encodeRows(job->format, job->w, job->h, job->src, job->dest, job->by0, job->by1);
+	else
+		decodeRows(job->format, job->w, job->h, job->src, job->dest, job->by0, job->by1);
+	return 0;
+}
+
+// splits the level's block rows over nThreads
+static void runJobs(bool encode, DXTFormat format, int w, int h, const unsigned char *src, unsigned char *dest, int nThreads)
+{
+	int bh = (h+3)/4;
+	if (nThreads > DXT_MAX_THREADS)
+		nThreads = DXT_MAX_THREADS;
+	if (nThreads > bh)
+		nThreads = bh;
+	if (nThreads < 1)
+		nThreads = 1;
+
+	DXTJob jobs[DXT_MAX_THREADS];
+	SDL_Thread *threads[DXT_MAX_THREADS];
+	for (int i=0; i<nThreads; i++) {
+		jobs[i].encode = encode;
+		jobs[i].format = format;
+		jobs[i].w = w;
+		jobs[i].h = h;
+		jobs[i].src = src;
+		jobs[i].dest = dest;
+		jobs[i].by0 = bh * i / nThreads;
+		jobs[i].by1 = bh * (i+1) / nThreads;
+	}
+	// the first run is done on this thread, and if a thread can't be made its run is too
+	for (int i=1; i<nThreads; i++)
+		threads[i] = SDL_CreateThread(dxtThread, &jobs[i]);
+	dxtThread(&jobs[0]);
+	for (int i=1; i<nThreads; i++) {
+		if (threads[i])
+			SDL_WaitThread(threads[i], 0);
+		else
+			dxtThread(&jobs[i]);
+	}
+}
+
+void decodeDXT(DXTFormat format, int w, int h, const unsigned char *src, unsigned char *dest, int nThreads)
+{
+	runJobs(false, format, w, h, src, dest, nThreads);
+}
+
+void encodeDXT(DXTFormat format, int w, int h, const unsigned char *src, unsigned char *dest, int nThreads)
+{
+	runJobs(true, format, w, h, src, dest, nThreads);
+}
+
+void decodeDXTReference(DXTFormat format, int w, int h, const unsigned char *src, unsigned char *dest)
+{
+	int bs = dxtBlockSize(format);
+	int bw = (w+3)/4;
+
+	for (int y=0; y<h; y++) {
+		for (int x=0; x<w; x++) {
+			const unsigned char *block = src + ((y/4)*bw + x/4)*bs;
+			const unsigned char *cb = (format == DXT_1) ? block : block + 8;
+			int px = x&3, py = y&3;
+
+			unsigned int c0 = cb[0] | (cb[1] << 8);
+			unsigned int c1 = cb[2] | (cb[3] << 8);
+			int rgb0[3], rgb1[3];
+			int r = (c0 >> 11) & 0x1f, g = (c0 >> 5) & 0x3f, b = c0 & 0x1f;
+			rgb0[0] = r*8 + r/4;
+			rgb0[1] = g*4 + g/16;
+			rgb0[2] = b*8 + b/4;
+			r = (c1 >> 11) & 0x1f; g = (c1 >> 5) & 0x3f; b = c1 & 0x1f;
+			rgb1[0] = r*8 + r/4;
+			rgb1[1] = g*4 + g/16;
+			rgb1[2] = b*8 + b/4;
+
+			int code = (cb[4+py] >> (px*2)) & 3;
+			int rgb[3];
+			int a = 255;
+			for (int k=0; k<3; k++) {
+				if (code == 0) rgb[k] = rgb0[k];
+				else if (code == 1) rgb[k] = rgb1[k];
+				else if (format != DXT_1 || c0 > c1) {
+					if (code == 2) rgb[k] = (2*rgb0[k] + rgb1[k]) / 3;
+					else rgb[k] = (rgb0[k] + 2*rgb1[k]) / 3;
+				} else {
+					if (code == 2) rgb[k] = (rgb0[k] + rgb1[k]) / 2;
+					else {
+						rgb[k] = 0;
+						a = 0;
+					}
+				}
+			}
+
+			int i = py*4 + px;
+			if (format == DXT_3) {
+				a = ((block[i/2] >> ((i&1)*4)) & 0x0f) * 255 / 15;
+			} else if (format == DXT_5) {
+				int a0 = block[0], a1 = block[1];
+				int bit = 16 + i*3;
+				int acode = 0;
+				for (int k=0; k<3; k++, bit++)
+					acode |= ((block[bit/8] >> (bit%8)) & 1) << k;
+				if (acode == 0) a = a0;
+				else if (acode == 1) a = a1;
+				else if (a0 > a1) a = ((8-acode)*a0 + (acode-1)*a1) / 7;
+				else if (acode == 6) a = 0;
+				else if (acode == 7) a = 255;
+				else a = ((6-acode)*a0 + (acode-1)*a1) / 5;
+			}
+
+			unsigned char *d = dest + (y*w + x)*4;
+			d[0] = rgb[0];
+			d[1] = rgb[1];
+			d[2] = rgb[2];
+			d[3] = a;
+		}
+	}
+}
@@ -0,0 +1,46 @@
+#ifndef DXT_H
+#define DXT_H
+
+/*
+	Software S3TC decoding, for when the GL has no texture_compression_s3tc, and
+	a fast encoder for compressing palettized BLPs at load time.
+
+	decodeDXT turns a whole mip level into RGBA8. Color blocks are expanded four
+	pixels at a time with SSE2 where the compiler has it, and big levels can be
+	split into runs of block rows decoded on several threads. The threads are
+	made and joined on every call, so callers that are themselves one of many
+	workers should pass 1.
+
+	Decoding follows EXT_texture_compression_s3tc: 5 and 6 bit colors are widened
+	by bit replication, DXT1 uses the three color mode with transparent black when
+	color0 <= color1, DXT3 and DXT5 always use four colors.
+
+	encodeDXT goes the other way. The end colors are the corners of each block's
+	color bounding box, pulled in a little, and every pixel takes the palette entry
+	nearest to its projection on the line between them (J.M.P. van Waveren, "Real-Time
+	DXT Compression"). That's well below what an offline compressor gets, but quick
+	enough to run on every texture load. DXT1 blocks with pixels below half alpha use
+	the three color mode and make them transparent.
+*/
+
+enum DXTFormat {
+	DXT_1,
+	DXT_3,
+	DXT_5
+};
+
+// bytes per 4x4 block
+int dxtBlockSize(DXTFormat format);
+// bytes of compressed data for a w*h level
+int dxtLevelSize(DXTFormat format, int w, int h);
+
+// dest gets w*h*4 bytes of RGBA
+void decodeDXT(DXTFormat format, int w, int h, const unsigned char *src, unsigned char *dest, int nThreads = 1);
+
+// one texel at a time, straight from the spec; slow, for checking decodeDXT against
+void decodeDXTReference(DXTFormat format, int w, int h, const unsigned char *src, unsigned char *dest);
+
+// src is w*h*4 bytes of RGBA, dest gets dxtLevelSize(format, w, h) bytes
+void encodeDXT(DXTFormat format, int w, int h, const unsigned char *src, unsigned char *dest, int nThreads = 1);
+
+#endif
@@ -0,0 +1,219 @@
+#include "dxt.h"
+#include "util.h"
+#include <SDL/SDL.h>
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+// checks decodeDXT against the reference decoder and a few hand made blocks,
+// and encodeDXT by how close the decoded result comes back, then times them,
+// no game data or GL needed
+
+using namespace std;
+
+const char *formatNames[] = { "DXT1", "DXT3", "DXT5" };
+
+struct KnownBlock {
+	DXTFormat format;
+	unsigned char block[16];
+	// first pixel and last pixel, RGBA
+	unsigned char first[4], last[4];
+};
+
+KnownBlock known[] = {
+	// red, all index 0; blue, all index 1
+	{ DXT_1, {0x00,0xf8, 0x1f,0x00, 0x00,0x00,0x00,0x00}, {255,0,0,255}, {255,0,0,255} },
+	{ DXT_1, {0x00,0xf8, 0x1f,0x00, 0x55,0x55,0x55,0x55}, {0,0,255,255}, {0,0,255,255} },
+	// color0 <= color1: index 2 is the average, index 3 transparent black
+	{ DXT_1, {0x1f,0x00, 0x00,0xf8, 0xaa,0xaa,0xaa,0xff}, {127,0,127,255}, {0,0,0,0} },
+	// four color mode, thirds
+	{ DXT_1, {0xff,0xff, 0x00,0x00, 0xaa,0xaa,0xaa,0xff}, {170,170,170,255}, {85,85,85,255} },
+	// explicit alpha 0xf and 0x8, white
+	{ DXT_3, {0xff,0xff,0xff,0xff,0xff,0xff,0xff,0x8f, 0xff,0xff, 0xff,0xff, 0,0,0,0}, {255,255,255,255}, {255,255,255,136} },
+	// DXT3 never uses the three color mode
+	{ DXT_3, {0,0,0,0,0,0,0,0, 0x1f,0x00, 0x00,0xf8, 0xff,0xff,0xff,0xff}, {170,0,85,0}, {170,0,85,0} },
+	// alpha 255..0 in sevenths: code 2 is 218; the last pixel has code 7, 36
+	{ DXT_5, {255,0, 0x02,0,0,0,0,0xe0, 0xe0,0x07, 0xe0,0x07, 0,0,0,0}, {0,255,0,218}, {0,255,0,36} },
+	// alpha 0..255 in fifths with 0 and 255: code 2 is 51, code 7 is 255
+	{ DXT_5, {0,255, 0x02,0,0,0,0,0xe0, 0xe0,0x07, 0xe0,0x07, 0,0,0,0}, {0,255,0,51}, {0,255,0,255} },
+};
+
+bool checkKnown()
+{
+	bool ok = true;
+	for (size_t i=0; i<sizeof(known)/sizeof(known[0]); i++) {
+		KnownBlock &k = known[i];
+		unsigned char out[64], ref[64];
+		decodeDXT(k.format, 4, 4, k.block, out);
+		decodeDXTReference(k.format, 4, 4, k.block, ref);
+		bool same = !memcmp(out, k.first, 4) && !memcmp(out+60, k.last, 4) && !memcmp(ref, k.first, 4) && !memcmp(ref+60, k.last, 4);
+		if (!same) {
+			printf("block %d (%s): got %d,%d,%d,%d .. %d,%d,%d,%d reference %d,%d,%d,%d .. %d,%d,%d,%d\tMISMATCH\n", (int)i, formatNames[k.format],
+				out[0], out[1], out[2], out[3], out[60], out[61], out[62], out[63],
+				ref[0], ref[1], ref[2], ref[3], ref[60], ref[61], ref[62], ref[63]);
+			ok = false;
+		}
+	}
+	cout << "known blocks\t" << (ok ? "ok" : "MISMATCH") << endl;
+	return ok;
+}
+
+void randomBlocks(vector<unsigned char> &data, size_t n)
+{
+	data.resize(n);
+	for (size_t i=0; i<n; i++)
+		data[i] = rand() & 0xff;
+}
+
+bool checkRandom(DXTFormat format, int w, int h, int nThreads)
+{
+	vector<unsigned char> src, out(w*h*4), ref(w*h*4);
+	randomBlocks(src, dxtLevelSize(format, w, h));
+	decodeDXT(format, w, h, &src[0], &out[0], nThreads);
+	decodeDXTReference(format, w, h, &src[0], &ref[0]);
+	if (out != ref) {
+		size_t i = 0;
+		while (out[i] == ref[i])
+			i++;
+		i &= ~3;
+		printf("pixel %d: %d,%d,%d,%d reference %d,%d,%d,%d\n", (int)(i/4), out[i], out[i+1], out[i+2], out[i+3], ref[i], ref[i+1], ref[i+2], ref[i+3]);
+		cout << formatNames[format] << "\t" << w << "x" << h << "\t" << nThreads << " threads\tMISMATCH" << endl;
+		return false;
+	}
+	return true;
+}
+
+void bench(DXTFormat format, int size, int nThreads)
+{
+	vector<unsigned char> src, out(size*size*4);
+	randomBlocks(src, dxtLevelSize(format, size, size));
+	const int runs = 8;
+
+	Uint32 t0 = SDL_GetTicks();
+	for (int i=0; i<runs; i++)
+		decodeDXTReference(format, size, size, &src[0], &out[0]);
+	Uint32 t1 = SDL_GetTicks();
+	for (int i=0; i<runs; i++)
+		decodeDXT(format, size, size, &src[0], &out[0]);
+	Uint32 t2 = SDL_GetTicks();
+	for (int i=0; i<runs; i++)
+		decodeDXT(format, size, size, &src[0], &out[0], nThreads);
+	Uint32 t3 = SDL_GetTicks();
+
+	float mpix = (float)size * size * runs / 1000000.0f;
+	float ref = mpix / ((t1-t0 ? t1-t0 : 1) / 1000.0f);
+	float one = mpix / ((t2-t1 ? t2-t1 : 1) / 1000.0f);
+	float many = mpix / ((t3-t2 ? t3-t2 : 1) / 1000.0f);
+	printf("%s\t%dx%d\treference %.1f\tdecodeDXT %.1f\t%d threads %.1f Mpixels/s\n", formatNames[format], size, size, ref, one, nThreads, many);
+}
+
+// smooth colors and alpha with a bit of noise, like most textures; alpha cut to 0/255 for DXT1
+void makeImage(DXTFormat format, int w, int h, vector<unsigned char> &img)
+{
+	img.resize(w*h*4);
+	for (int y=0; y<h; y++) {
+		for (int x=0; x<w; x++) {
+			unsigned char *p = &img[(y*w + x)*4];
+			p[0] = (unsigned char)(120 + 100*sin(x/13.0f) + rand() % 8);
+			p[1] = (unsigned char)(120 + 100*sin(y/9.0f + x/17.0f) + rand() % 8);
+			p[2] = (unsigned char)(120 + 100*sin((x+y)/11.0f) + rand() % 8);
+			int a = (int)(124 + 120*sin(x/7.0f)*cos(y/5.0f) + rand() % 8);
+			if (format == DXT_1)
+				a = (a < 128) ? 0 : 255;
+			p[3] = a;
+		}
+	}
+}
+
+// worst alpha error the format can give on this kind of image
+const int maxAlphaError[] = { 0, 9, 20 };
+
+bool checkEncode(DXTFormat format, int w, int h, int nThreads)
+{
+	vector<unsigned char> img, enc(dxtLevelSize(format, w, h)), enc1(enc.size()), out(w*h*4);
+	makeImage(format, w, h, img);
+	encodeDXT(format, w, h, &img[0], &enc1[0]);
+	encodeDXT(format, w, h, &img[0], &enc[0], nThreads);
+	decodeDXT(format, w, h, &enc[0], &out[0]);
+
+	double err = 0;
+	int n = 0, alphaErr = 0;
+	for (int i=0; i<w*h; i++) {
+		const unsigned char *a = &img[i*4], *b = &out[i*4];
+		alphaErr = max(alphaErr, abs(a[3] - b[3]));
+		// transparent DXT1 pixels come back black
+		if (format == DXT_1 && a[3] == 0)
+			continue;
+		for (int k=0; k<3; k++)
+			err += (a[k] - b[k]) * (a[k] - b[k]);
+		n += 3;
+	}
+	double rmse = n ? sqrt(err / n) : 0;
+	bool ok = (enc == enc1) && rmse < 8.0 && alphaErr <= maxAlphaError[format];
+	if (!ok) {
+		printf("%s\t%dx%d\t%d threads\tcolor rmse %.2f, alpha error %d%s\tMISMATCH\n", formatNames[format], w, h, nThreads,
+			rmse, alphaErr, enc == enc1 ? "" : ", threads differ");
+	}
+	return ok;
+}
+
+void benchEncode(DXTFormat format, int size, int nThreads)
+{
+	vector<unsigned char> img, enc(dxtLevelSize(format, size, size));
+	makeImage(format, size, size, img);
+	const int runs = 8;
+
+	Uint32 t0 = SDL_GetTicks();
+	for (int i=0; i<runs; i++)
+		encodeDXT(format, size, size, &img[0], &enc[0]);
+	Uint32 t1 = SDL_GetTicks();
+	for (int i=0; i<runs; i++)
+		encodeDXT(format, size, size, &img[0], &enc[0], nThreads);
+	Uint32 t2 = SDL_GetTicks();
+
+	float mpix = (float)size * size * runs / 1000000.0f;
+	float one = mpix / ((t1-t0 ? t1-t0 : 1) / 1000.0f);
+	float many = mpix / ((t2-t1 ? t2-t1 : 1) / 1000.0f);
+	printf("%s\t%dx%d\tencodeDXT %.1f\t%d threads %.1f Mpixels/s\n", formatNames[format], size, size, one, nThreads, many);
+}
+
+int main(int argc, char *argv[]) {
+	srand(1);
+	bool ok = checkKnown();
+
+	// every size a mip chain runs into, and some that aren't multiples of 4
+	int sizes[][2] = { {1,1}, {2,2}, {4,4}, {3,5}, {8,2}, {13,7}, {64,64}, {256,128}, {250,130} };
+	for (int f=0; f<3; f++) {
+		bool fok = true;
+		for (int i=0; i<9; i++) {
+			for (int n=1; n<=4; n*=2) {
+				for (int r=0; r<8 && fok; r++)
+					fok &= checkRandom((DXTFormat)f, sizes[i][0], sizes[i][1], n);
+			}
+		}
+		cout << formatNames[f] << " random blocks\t" << (fok ? "ok" : "MISMATCH") << endl;
+		ok &= fok;
+	}
+
+	for (int f=0; f<3; f++) {
+		bool fok = true;
+		for (int i=0; i<9; i++) {
+			for (int n=1; n<=4; n*=2)
+				fok &= checkEncode((DXTFormat)f, sizes[i][0], sizes[i][1], n);
+		}
+		cout << formatNames[f] << " encode\t" << (fok ? "ok" : "MISMATCH") << endl;
+		ok &= fok;
+	}
+
+	int nThreads = cpuCount();
+	for (int f=0; f<3; f++)
+		bench((DXTFormat)f, 1024, nThreads);
+	for (int f=0; f<3; f++)
+		benchEncode((DXTFormat)f, 1024, nThreads);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,231 @@
+#include "farterrain.h"
+#include "maptile.h"
+#include "util.h"
+#include <algorithm>
+
+using namespace std;
+
+int FarTerrain::maxRadius = 8;
+
+FarTerrain::FarTerrain(): ibo(0)
+{
+	for (int j=0; j<64; j++) {
+		for (int i=0; i<64; i++)
+			tiles[j][i] = -1;
+	}
+	for (int j=0; j<FAR_BLOCKS; j++) {
+		for (int i=0; i<FAR_BLOCKS; i++) {
+			FarBlock &b = blocks[j][i];
+			b.x = i;
+			b.z = j;
+			b.state = FARBLOCK_EMPTY;
+			b.vbo = 0;
+		}
+	}
+}
+
+FarTerrain::~FarTerrain()
+{
+	stopWorkers();
+	for (int j=0; j<FAR_BLOCKS; j++) {
+		for (int i=0; i<FAR_BLOCKS; i++) {
+			if (blocks[j][i].vbo)
+				glDeleteBuffersARB(1, &blocks[j][i].vbo);
+		}
+	}
+	if (ibo)
+		glDeleteBuffersARB(1, &ibo);
+}
+
+/*
+http://www.madx.dk/wowdev/wiki/index.php?title=WDL
+
+MAOF has the absolute offsets of each tile's MARE chunk, 0 for no tile. A MARE holds 17*17 + 16*16 = 545
+signed 16-bit heights: the "outer" 17x17 points in row major order, followed by the 16x16 "inner" ones.
+*/
+void FarTerrain::init(MPQFile &f, const ChunkIndex &chunks)
+{
+	int ofsbuf[64][64];
+	if (chunks.seek(f, FOURCC('M','A','O','F')) < (int)sizeof(ofsbuf))
+		return;
+	f.read(ofsbuf, sizeof(ofsbuf));
+
+	int n = 0;
+	for (int j=0; j<64; j++) {
+		for (int i=0; i<64; i++) {
+			if (ofsbuf[j][i] && ofsbuf[j][i] + 8 + FAR_TILE_HEIGHTS*2 <= (int)f.getSize())
+				tiles[j][i] = FAR_TILE_HEIGHTS * n++;
+		}
+	}
+
+	heights.resize(FAR_TILE_HEIGHTS * n);
+	for (int j=0; j<64; j++) {
+		for (int i=0; i<64; i++) {
+			if (tiles[j][i] >= 0) {
+				f.seek(ofsbuf[j][i]+8);
+				f.read(&heights[tiles[j][i]], FAR_TILE_HEIGHTS*2);
+			}
+		}
+	}
+	gLog("Low res terrain: %d tiles\n", n);
+}
+
+void FarTerrain::stopWorkers()
+{
+	WorkerPool::stopWorkers();
+	queue.clear();
+	built.clear();
+}
+
+void *FarTerrain::takeJob()
+{
+	if (queue.empty())
+		return 0;
+	FarBlock *b = queue.back();
+	queue.pop_back();
+	return b;
+}
+
+bool FarTerrain::runJob(void *job)
+{
+	build((FarBlock*)job);
+	return true;
+}
+
+// building a block can't fail
+void FarTerrain::jobDone(void *job, bool)
+{
+	FarBlock *b = (FarBlock*)job;
+	b->state = FARBLOCK_BUILT;
+	built.push_back(b);
+}
+
+// fills in the vertices of the block's tiles, no GL calls (worker thread)
+void FarTerrain::build(FarBlock *b)
+{
+	int nTiles = 0;
+	for (int tz=0; tz<FAR_BLOCK; tz++) {
+		for (int tx=0; tx<FAR_BLOCK; tx++) {
+			int i = b->x*FAR_BLOCK + tx, j = b->z*FAR_BLOCK + tz;
+			b->slot[tz][tx] = (tiles[j][i] >= 0) ? nTiles++ : -1;
+		}
+	}
+
+	b->vertices.resize(nTiles * FAR_TILE_HEIGHTS);
+	for (int tz=0; tz<FAR_BLOCK; tz++) {
+		for (int tx=0; tx<FAR_BLOCK; tx++) {
+			if (b->slot[tz][tx] < 0)
+				continue;
+			int i = b->x*FAR_BLOCK + tx, j = b->z*FAR_BLOCK + tz;
+			const short *h = &heights[tiles[j][i]];
+			Vec3D *v = &b->vertices[b->slot[tz][tx] * FAR_TILE_HEIGHTS];
+
+			for (int y=0; y<17; y++) {
+				for (int x=0; x<17; x++)
+					*v++ = Vec3D(TILESIZE*(i+x/16.0f), *h++, TILESIZE*(j+y/16.0f));
+			}
+			for (int y=0; y<16; y++) {
+				for (int x=0; x<16; x++)
+					*v++ = Vec3D(TILESIZE*(i+(x+0.5f)/16.0f), *h++, TILESIZE*(j+(y+0.5f)/16.0f));
+			}
+		}
+	}
+}
+
+void FarTerrain::upload(FarBlock *b)
+{
+	if (!b->vertices.empty()) {
+		glGenBuffersARB(1, &b->vbo);
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, b->vbo);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, b->vertices.size()*sizeof(Vec3D), &b->vertices[0], GL_STATIC_DRAW_ARB);
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+	}
+	std::vector<Vec3D>().swap(b->vertices);
+	b->state = FARBLOCK_RESIDENT;
+}
+
+void FarTerrain::update(int x, int z, int radius)
+{
+	if (heights.empty())
+		return;
+
+	if (nWorkers < 0)
+		startWorkers(min(max(cpuCount() - 1, 1), MAX_FAR_THREADS));
+
+	int bx0 = max(x - radius, 0) / FAR_BLOCK, bx1 = min(x + radius, 63) / FAR_BLOCK;
+	int bz0 = max(z - radius, 0) / FAR_BLOCK, bz1 = min(z + radius, 63) / FAR_BLOCK;
+	for (int j=bz0; j<=bz1; j++) {
+		for (int i=bx0; i<=bx1; i++) {
+			FarBlock *b = &blocks[j][i];
+			if (b->state != FARBLOCK_EMPTY)
+				continue;
+			if (nWorkers == 0) {
+				// no threads, build it right here
+				build(b);
+				upload(b);
+				continue;
+			}
+			SDL_mutexP(lock);
+			b->state = FARBLOCK_QUEUED;
+			queue.push_back(b);
+			post();
+			SDL_mutexV(lock);
+		}
+	}
+
+	if (nWorkers > 0) {
+		std::vector<FarBlock*> done;
+		SDL_mutexP(lock);
+		done.swap(built);
+		SDL_mutexV(lock);
+		for (size_t i=0; i<done.size(); i++)
+			upload(done[i]);
+	}
+}
+
+void FarTerrain::draw(int x, int z, int radius)
+{
+	if (heights.empty())
+		return;
+
+	if (!ibo) {
+		// 4 triangles around every inner point, same for every tile
+		unsigned short indices[FAR_TILE_INDICES], *p = indices;
+		for (int v=0; v<16; v++) {
+			for (int u=0; u<16; u++) {
+				unsigned short r00 = v*17+u, r01 = r00+1, r10 = r00+17, r11 = r00+18;
+				unsigned short s = 17*17 + v*16+u;
+				*p++ = r00; *p++ = s; *p++ = r01;
+				*p++ = r01; *p++ = s; *p++ = r11;
+				*p++ = r11; *p++ = s; *p++ = r10;
+				*p++ = r10; *p++ = s; *p++ = r00;
+			}
+		}
+		glGenBuffersARB(1, &ibo);
+		glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, ibo);
+		glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER_ARB, sizeof(indices), indices, GL_STATIC_DRAW_ARB);
+	}
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, ibo);
+	GLuint bound = 0;
+	for (int j=max(z-radius, 0); j<=min(z+radius, 63); j++) {
+		for (int i=max(x-radius, 0); i<=min(x+radius, 63); i++) {
+			if ((i==x && j==z) || tiles[j][i] < 0)
+				continue;
+			FarBlock &b = blocks[j/FAR_BLOCK][i/FAR_BLOCK];
+			if (b.state != FARBLOCK_RESIDENT || !b.vbo)
+				continue;
+			if (b.vbo != bound) {
+				glBindBufferARB(GL_ARRAY_BUFFER_ARB, b.vbo);
+				bound = b.vbo;
+			}
+			size_t ofs = b.slot[j%FAR_BLOCK][i%FAR_BLOCK] * FAR_TILE_HEIGHTS * sizeof(Vec3D);
+			glVertexPointer(3, GL_FLOAT, 0, (const GLvoid*)ofs);
+			glDrawElements(GL_TRIANGLES, FAR_TILE_INDICES, GL_UNSIGNED_SHORT, 0);
+		}
+	}
+	glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+	glDisableClientState(GL_VERTEX_ARRAY);
+}
@@ -0,0 +1,84 @@
+#ifndef FARTERRAIN_H
+#define FARTERRAIN_H
+
+#include "video.h"
+#include "vec3d.h"
+#include "chunkfile.h"
+#include "util.h"
+#include <vector>
+
+/*
+	The low resolution terrain from the WDL, drawn in the fog color behind the
+	real map tiles so the horizon isn't empty.
+
+	The heights of every tile are copied out of the WDL once. The meshes are
+	only made for the tiles around the camera: the map is split into blocks
+	of FAR_BLOCK x FAR_BLOCK tiles, worker threads fill in the vertices of a
+	block and the main thread puts them into one vertex buffer per block.
+	All tiles have the same triangles, so they share one index buffer.
+*/
+
+// tiles per block side, 64 must be a multiple
+#define FAR_BLOCK			8
+#define FAR_BLOCKS			(64 / FAR_BLOCK)
+#define MAX_FAR_THREADS		4
+
+// 17*17 outer heights followed by 16*16 inner ones
+#define FAR_TILE_HEIGHTS	(17*17 + 16*16)
+#define FAR_TILE_INDICES	(16*16*4*3)
+
+enum FarBlockState {
+	FARBLOCK_EMPTY,
+	FARBLOCK_QUEUED,
+	FARBLOCK_BUILT,
+	FARBLOCK_RESIDENT
+};
+
+struct FarBlock {
+	int x, z;	// in blocks
+	FarBlockState state;
+	GLuint vbo;
+	// position of each tile in the block's buffer, -1 for no tile
+	int slot[FAR_BLOCK][FAR_BLOCK];
+	// filled in by the worker, dropped once it's in the buffer
+	std::vector<Vec3D> vertices;
+};
+
+class FarTerrain: public WorkerPool {
+	// index into heights for each tile, -1 where the WDL has none
+	int tiles[64][64];
+	std::vector<short> heights;
+
+	FarBlock blocks[FAR_BLOCKS][FAR_BLOCKS];
+	GLuint ibo;
+
+	std::vector<FarBlock*> queue, built;
+
+	void stopWorkers();
+	// the workers fill in the vertices
+	void *takeJob();
+	bool runJob(void *job);
+	void jobDone(void *job, bool ok);
+	void build(FarBlock *b);
+	void upload(FarBlock *b);
+
+public:
+	// tiles around the camera drawn at most, see World::draw for the one actually used
+	static int maxRadius;
+
+	FarTerrain();
+	~FarTerrain();
+
+	// copies the heights out of the WDL; no GL calls
+	void init(MPQFile &f, const ChunkIndex &chunks);
+	bool loaded() { return !heights.empty(); }
+	// the tile's 545 heights, or 0
+	const short *tileHeights(int x, int z) { return (x>=0 && z>=0 && x<64 && z<64 && tiles[z][x] >= 0) ? &heights[tiles[z][x]] : 0; }
+
+	// queues the blocks within radius tiles of x,z and uploads the ones that are done; once per frame
+	void update(int x, int z, int radius);
+	// draws the tiles within radius of x,z that are resident, except x,z itself
+	void draw(int x, int z, int radius);
+};
+
+#endif
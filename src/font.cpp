@@ -54,41 +54,42 @@ Font::~Font()
 {
 }
 
-void Font::drawchar(uint16_t x, uint16_t y, const char ch)
+static inline float *fontVertex(float *v, float x, float y, float u, float t)
+{
+	v[0] = x; v[1] = y; v[2] = u; v[3] = t;
+	return v + 4;
+}
+
+float *Font::drawchar(float *v, int x, int y, const char ch)
 {
-	if (ch==32) return;
-	
 	charinfo *c = &chars[ch];
-	
-	glBegin(GL_TRIANGLES);
 
 	// triangle 1
-	glTexCoord2f(c->tx1,c->ty1);
-	glVertex2s(x, y);
-	
-	glTexCoord2f(c->tx2,c->ty1);
-	glVertex2s(x+c->w, y);
-	
-	glTexCoord2f(c->tx2,c->ty2);
-	glVertex2s(x+c->w, y+c->h);
-	
+	v = fontVertex(v, x, y, c->tx1, c->ty1);
+	v = fontVertex(v, x+c->w, y, c->tx2, c->ty1);
+	v = fontVertex(v, x+c->w, y+c->h, c->tx2, c->ty2);
+
 	// triangle 2
-	glTexCoord2f(c->tx2,c->ty2);
-	glVertex2s(x+c->w, y+c->h);
-	
-	glTexCoord2f(c->tx1,c->ty2);
-	glVertex2s(x, y+c->h);
-
-	glTexCoord2f(c->tx1,c->ty1);
-	glVertex2s(x, y);
-	
-	glEnd();
+	v = fontVertex(v, x+c->w, y+c->h, c->tx2, c->ty2);
+	v = fontVertex(v, x, y+c->h, c->tx1, c->ty2);
+	v = fontVertex(v, x, y, c->tx1, c->ty1);
+
+	return v;
 }
 
 // ASSUME: ortho mode
 void Font::drawtext(int x, int y, const char *text)
 {
-	glBindTexture(GL_TEXTURE_2D, tex);
+	size_t n = 0;
+	for (const char *c = text; *c!=0; c++) {
+		if (*c != '\n' && *c != '\r' && *c != 32) n++;
+	}
+	if (n == 0)
+		return;
+
+	// the whole string goes into the stream buffer and is drawn at once
+	float *dest = (float*)streamBuffer.alloc(n * 6 * 4 * sizeof(float));
+	float *v = dest;
 
     int base = y + size;
 	int xpos = x;
@@ -96,7 +97,8 @@ void Font::drawtext(int x, int y, const char *text)
 	while (*c!=0) {
 
 		if (*c != '\n' && *c != '\r') {
-			drawchar(xpos, base - chars[*c].baseline, *c);
+			if (*c != 32)
+				v = drawchar(v, xpos, base - chars[*c].baseline, *c);
 			xpos += chars[*c].w + 2;
 		} else {
 			base += size;
@@ -104,6 +106,25 @@ void Font::drawtext(int x, int y, const char *text)
 		}
 		c++;
 	}
+	const char *vbase = streamBuffer.commit();
+
+	glBindTexture(GL_TEXTURE_2D, tex);
+
+	glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_COLOR_ARRAY);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glClientActiveTextureARB(GL_TEXTURE1_ARB);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glClientActiveTextureARB(GL_TEXTURE0_ARB);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glVertexPointer(2, GL_FLOAT, 4*sizeof(float), vbase);
+	glTexCoordPointer(2, GL_FLOAT, 4*sizeof(float), vbase + 2*sizeof(float));
+
+	glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(n * 6));
+
+	glPopClientAttrib();
+	streamBuffer.unbind();
 }
 
 void Font::shdrawtext(int x, int y, const char *text)
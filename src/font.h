@@ -33,7 +33,8 @@ public:
 	void shprint(int x, int y, const char *str, ...);
 
 protected:
-	void drawchar(uint16_t x, uint16_t y, const char ch);
+	// 6 vertices of x, y, u, v
+	float *drawchar(float *v, int x, int y, const char ch);
 
 };
 
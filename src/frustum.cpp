@@ -13,57 +13,45 @@ void Plane::normalize()
 }
 
 
-void Frustum::retrieve()
+// planes from the combined projection * view matrix, in math form: each plane
+// is the last row plus or minus one of the others
+void Frustum::set(const Matrix &clip)
 {
-	float mat[16];
-	
-	glGetFloatv(GL_MODELVIEW_MATRIX, mat);
-	glMatrixMode(GL_PROJECTION);
-	
-	glPushMatrix();
-	
-	glMultMatrixf(mat);
-	glGetFloatv(GL_PROJECTION_MATRIX, mat);
-	
-	glPopMatrix();
-	glMatrixMode(GL_MODELVIEW);
-	
-	planes[RIGHT].a = mat[ 3] - mat[ 0];
-	planes[RIGHT].b = mat[ 7] - mat[ 4];
-	planes[RIGHT].c = mat[11] - mat[ 8];
-	planes[RIGHT].d = mat[15] - mat[12];
+	planes[RIGHT].a = clip.m[3][0] - clip.m[0][0];
+	planes[RIGHT].b = clip.m[3][1] - clip.m[0][1];
+	planes[RIGHT].c = clip.m[3][2] - clip.m[0][2];
+	planes[RIGHT].d = clip.m[3][3] - clip.m[0][3];
 	planes[RIGHT].normalize();
 
-	planes[LEFT].a = mat[ 3] + mat[ 0];
-	planes[LEFT].b = mat[ 7] + mat[ 4];
-	planes[LEFT].c = mat[11] + mat[ 8];
-	planes[LEFT].d = mat[15] + mat[12];
+	planes[LEFT].a = clip.m[3][0] + clip.m[0][0];
+	planes[LEFT].b = clip.m[3][1] + clip.m[0][1];
+	planes[LEFT].c = clip.m[3][2] + clip.m[0][2];
+	planes[LEFT].d = clip.m[3][3] + clip.m[0][3];
 	planes[LEFT].normalize();
 
-	planes[BOTTOM].a = mat[ 3] + mat[ 1];
-	planes[BOTTOM].b = mat[ 7] + mat[ 5];
-	planes[BOTTOM].c = mat[11] + mat[ 9];
-	planes[BOTTOM].d = mat[15] + mat[13];
+	planes[BOTTOM].a = clip.m[3][0] + clip.m[1][0];
+	planes[BOTTOM].b = clip.m[3][1] + clip.m[1][1];
+	planes[BOTTOM].c = clip.m[3][2] + clip.m[1][2];
+	planes[BOTTOM].d = clip.m[3][3] + clip.m[1][3];
 	planes[BOTTOM].normalize();
 
-	planes[TOP].a = mat[ 3] - mat[ 1];
-	planes[TOP].b = mat[ 7] - mat[ 5];
-	planes[TOP].c = mat[11] - mat[ 9];
-	planes[TOP].d = mat[15] - mat[13];
+	planes[TOP].a = clip.m[3][0] - clip.m[1][0];
+	planes[TOP].b = clip.m[3][1] - clip.m[1][1];
+	planes[TOP].c = clip.m[3][2] - clip.m[1][2];
+	planes[TOP].d = clip.m[3][3] - clip.m[1][3];
 	planes[TOP].normalize();
 
-	planes[BACK].a = mat[ 3] - mat[ 2];
-	planes[BACK].b = mat[ 7] - mat[ 6];
-	planes[BACK].c = mat[11] - mat[10];
-	planes[BACK].d = mat[15] - mat[14];
+	planes[BACK].a = clip.m[3][0] - clip.m[2][0];
+	planes[BACK].b = clip.m[3][1] - clip.m[2][1];
+	planes[BACK].c = clip.m[3][2] - clip.m[2][2];
+	planes[BACK].d = clip.m[3][3] - clip.m[2][3];
 	planes[BACK].normalize();
 
-	planes[FRONT].a = mat[ 3] + mat[ 2];
-	planes[FRONT].b = mat[ 7] + mat[ 6];
-	planes[FRONT].c = mat[11] + mat[10];
-	planes[FRONT].d = mat[15] + mat[14];
+	planes[FRONT].a = clip.m[3][0] + clip.m[2][0];
+	planes[FRONT].b = clip.m[3][1] + clip.m[2][1];
+	planes[FRONT].c = clip.m[3][2] + clip.m[2][2];
+	planes[FRONT].d = clip.m[3][3] + clip.m[2][3];
 	planes[FRONT].normalize();
-
 }
 
 bool Frustum::contains(const Vec3D &v) const
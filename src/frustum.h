@@ -2,6 +2,7 @@
 #define FRUSTUM_H
 
 #include "vec3d.h"
+#include "matrix.h"
 
 struct Plane {
 	float a,b,c,d;
@@ -15,7 +16,7 @@ enum Directions {
 struct Frustum {
 	Plane planes[6];
 
-	void retrieve();
+	void set(const Matrix &clip);
 
 	bool contains(const Vec3D &v) const;
 	bool intersects(const Vec3D &v1, const Vec3D &v2) const;
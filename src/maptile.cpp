@@ -269,7 +269,7 @@ MapTile::MapTile(int x0, int z0, std::string basename, bool bigAlpha): x(x0), z(
 				sprintf(name,"World\\Maps\\%s\\%s_%d_%d_obj0.adt", basename.c_str(), basename.c_str(), x0, z0);
 				break;
 		}
-		gLog("%s\n",name);
+		gLogDebug("%s\n",name);
 		parse_adt(name,mcnk_has_header,phase);
 	}
 	
@@ -280,7 +280,7 @@ void MapTile::parse_adt(char *name,bool mcnk_has_header,load_phases phase) {
 	MPQFile f(name);
 	ok = !f.isEof();
 	if (!ok) {
-		gLog("Error: loading %s\n",name);
+		gLogAt(LOG_ERROR, "Error: loading %s\n",name);
 		return;
 	}
 
@@ -292,30 +292,24 @@ void MapTile::parse_adt(char *name,bool mcnk_has_header,load_phases phase) {
 	memset(mcnk_sizes, 0, sizeof(mcnk_sizes));
 	int mcnk_count = 0;
 
-	while (!f.isEof()) {
-		memset(fourcc, 0, 4);
-		f.read(fourcc,4);
-		f.read(&size, 4);
+	ChunkIndex index(f);
+	for (size_t n=0; n<index.chunks.size(); n++) {
+		const Chunk &chunk = index.chunks[n];
+		size = (uint32)chunk.size;
+		f.seek((ssize_t)chunk.offset);
+		chunkName(chunk.id, fourcc);
 
-		flipcc(fourcc);
-		fourcc[4] = 0;
+		gLogDebug("FINDME %s %s %d\n",name,fourcc,size);
 
-		gLog("FINDME %s %s %d\n",name,fourcc,size);
-		if (size == 0)
-			continue;
-
-		// remember the next absolute pos
-		size_t nextpos = f.getPos() + size;
-
-		if (strncmp(fourcc, "MVER", 4) == 0) {
+		if (chunk.id == FOURCC('M','V','E','R')) {
 			__int32 version;
 			f.read(&version,4);
-			printf("adt version %d\n",version);
+			gLogDebug("adt version %d\n",version);
 		}
-		else if (strncmp(fourcc, "MHDR", 4) == 0) {
+		else if (chunk.id == FOURCC('M','H','D','R')) {
 		}
-		else if (strncmp(fourcc,"MCIN",4)==0) {
-			printf("MCIN chunk!!!\n");
+		else if (chunk.id == FOURCC('M','C','I','N')) {
+			gLogDebug("MCIN chunk\n");
 			/*
 			Index for MCNK chunks. Contains 256 records of 16 bytes, which have the following format:
 			struct SMChunkInfo // 03-29-2005 By ObscuR
@@ -335,9 +329,9 @@ void MapTile::parse_adt(char *name,bool mcnk_has_header,load_phases phase) {
 					f.seekRelative(8);
 				}
 			} else
-				gLog("Error: wrong MCIN chunk %d.\n", size);
+				gLogAt(LOG_ERROR, "Error: wrong MCIN chunk %d.\n", size);
 		}
-		else if (strncmp(fourcc,"MTEX",4)==0) {
+		else if (chunk.id == FOURCC('M','T','E','X')) {
 			/*
 			List of textures used by the terrain in this map tile.
 			A contiguous block of zero-terminated strings, that are complete filenames with paths. The textures will later be identified by their position in this list.
@@ -360,14 +354,14 @@ void MapTile::parse_adt(char *name,bool mcnk_has_header,load_phases phase) {
 					if (MPQFile::exists(texshader.c_str()))
 						texpath = texshader;
 				}
-				gLog("MTEX %s\n",texpath.c_str());
+				gLogDebug("MTEX %s\n",texpath.c_str());
 
 				video.textures.add(texpath);
 				textures.push_back(texpath);
 			}
 			delete[] buf;
 		}
-		else if (strncmp(fourcc,"MMDX",4)==0) {
+		else if (chunk.id == FOURCC('M','M','D','X')) {
 			/*
 			List of filenames for M2 models that appear in this map tile. A contiguous block of zero-terminated strings.
 			*/
@@ -382,20 +376,20 @@ void MapTile::parse_adt(char *name,bool mcnk_has_header,load_phases phase) {
 				std::string path(p);
 				p+=strlen(p)+1;
 				fixname(path);
-				gLog("MMDX %s\n",path.c_str());
+				gLogDebug("MMDX %s\n",path.c_str());
 
 				gWorld->modelmanager.add(path);
 				models.push_back(path);
 			}
 			delete[] buf;
 		}
-		else if (strncmp(fourcc,"MMID",4)==0) {
+		else if (chunk.id == FOURCC('M','M','I','D')) {
 			/*
 			Lists the relative offsets of string beginnings in the above MMDX chunk. One 32-bit integer per offset.
 			This will be referenced in the offsets in MDDF --Cromon 16:38, 28 August 2009 (CEST)
 			*/
 		}
-		else if (strncmp(fourcc,"MWMO",4)==0) {
+		else if (chunk.id == FOURCC('M','W','M','O')) {
 			/*
 			List of filenames for WMOs (world map objects) that appear in this map tile. A contiguous block of zero-terminated strings.
 			*/
@@ -409,20 +403,20 @@ void MapTile::parse_adt(char *name,bool mcnk_has_header,load_phases phase) {
 				std::string path(p);
 				p+=strlen(p)+1;
 				fixname(path);
-				gLog("MWMO %s\n",path.c_str());
+				gLogDebug("MWMO %s\n",path.c_str());
 
 				gWorld->wmomanager.add(path);
 				wmos.push_back(path);
 			}
 			delete[] buf;
 		}
-		else if (strncmp(fourcc,"MWID",4)==0) {
+		else if (chunk.id == FOURCC('M','W','I','D')) {
 			/*
 			Lists the relative offsets of string beginnings in the above MWMO chunk. One 32-bit integer per offset.
 			Again referenced in MODF
 			*/
 		}
-		else if (strncmp(fourcc,"MDDF",4)==0) {
+		else if (chunk.id == FOURCC('M','D','D','F')) {
 			/*
 			Placement information for doodads (M2 models). 36 bytes per model instance.
 			Offset 	Type 		Description
@@ -470,7 +464,7 @@ void MapTile::parse_adt(char *name,bool mcnk_has_header,load_phases phase) {
 				modelis.push_back(inst);
 			}
 		}
-		else if (strncmp(fourcc,"MODF",4)==0) {
+		else if (chunk.id == FOURCC('M','O','D','F')) {
 			/*
 			Placement information for WMOs. 64 bytes per WMO instance.
 			Offset 	Type 		Description
@@ -520,7 +514,7 @@ void MapTile::parse_adt(char *name,bool mcnk_has_header,load_phases phase) {
 				wmois.push_back(inst);
 			}
 		}
-		else if (strncmp(fourcc,"MH2O",4)==0) {
+		else if (chunk.id == FOURCC('M','H','2','O')) {
 			unsigned char *abuf = f.getPointer();
 			struct WaterTile *mh2oh;
 			struct WaterLayer *mh2oi;
@@ -531,7 +525,7 @@ void MapTile::parse_adt(char *name,bool mcnk_has_header,load_phases phase) {
 				mh2oh = (struct WaterTile *)abuf;
 				//
 				// start at 3072, 3072+24, 3072+24*2, ....
-				printf( "%d MH2O: %X, %X %d %X", i,
+				gLogDebug( "%d MH2O: %X, %X %d %X", i,
 					abuf - f.getPointer(),
 					0x86fa + mh2oh->ofsLayer,
 					mh2oh->layerCount,
@@ -553,8 +547,6 @@ void MapTile::parse_adt(char *name,bool mcnk_has_header,load_phases phase) {
 
 
 					// [FLOW] this step is required otherwise the print function interprets the data wrong
-					unsigned int x = mh2oi->x;
-					unsigned int y = mh2oi->y;
 					unsigned int w = mh2oi->w;
 					unsigned int h = mh2oi->h;
 
@@ -563,13 +555,13 @@ void MapTile::parse_adt(char *name,bool mcnk_has_header,load_phases phase) {
 					while( false );
 					}*/
 
-					printf( " Layer %d: %d %d %f-%f %d-%d-%d-%d %X-%X", j,
+					gLogDebug( " Layer %d: %d %d %f-%f %d-%d-%d-%d %X-%X", j,
 						mh2oi->flags,
 						mh2oi->type, 
 						mh2oi->min,
 						mh2oi->max,
-						x,
-						y,
+						(unsigned int)mh2oi->x,
+						(unsigned int)mh2oi->y,
 						w, 
 						h,
 						0x86fa + mh2oi->ofsDisplayMask, 
@@ -628,19 +620,19 @@ void MapTile::parse_adt(char *name,bool mcnk_has_header,load_phases phase) {
 
 					chunks[i/CHUNKS_IN_TILE][i%CHUNKS_IN_TILE].waterLayer.push_back( waterLayer );
 				}
-				printf( "\n");
+				gLogDebug( "\n");
 				abuf += sizeof(struct WaterTile);
 
 				//Water.push_back( waterTile );
 			}
 		}
-		else if(strncmp(fourcc, "MCNK", 4) == 0) {
+		else if(chunk.id == FOURCC('M','C','N','K')) {
 			// MCNK data will be processed separately ^_^
-			mcnk_offsets[mcnk_count] = f.getPos() - 8;
+			mcnk_offsets[mcnk_count] = (__int32)chunk.offset - 8;
 			mcnk_sizes[mcnk_count] = size;
 			mcnk_count++;
 		}
-		else if(strncmp(fourcc, "MFBO", 4) == 0) {
+		else if(chunk.id == FOURCC('M','F','B','O')) {
 			/*
 			A bounding box for flying.
 			This chunk is a "box" defining, where you can fly and where you can't. It also defines the height at which one you will fall into nowhere while your camera remains at the same position. Its actually two planes with 3*3 coordinates per plane.
@@ -655,7 +647,7 @@ void MapTile::parse_adt(char *name,bool mcnk_has_header,load_phases phase) {
 			};
 			*/
 		}
-		else if(strncmp(fourcc, "MTFX", 4) == 0) {
+		else if(chunk.id == FOURCC('M','T','F','X')) {
 			/*
 			This chunk is an array of integers that are 1 or 0. 1 means that the texture at the same position in the MTEX array has to be handled differentely. The size of this chunk is always the same as there are entries in the MTEX chunk.
 			Simple as it is:
@@ -669,11 +661,9 @@ void MapTile::parse_adt(char *name,bool mcnk_has_header,load_phases phase) {
 		else {
 			gLog("No implement tile chunk %s [%d].\n", fourcc, size);
 		}
-//gLog("test %d %d\n",f.getPos(),f.getSize());
-		f.seek((int)nextpos);
 	}
 
-	gLog("%d MCNK's found in %s\n",mcnk_count-1,name);
+	gLogDebug("%d MCNK's found in %s\n",mcnk_count-1,name);
 	// read individual map chunks
 	for (size_t j=0; j<CHUNKS_IN_TILE; j++) {
 		for (size_t i=0; i<CHUNKS_IN_TILE; i++) {
@@ -681,7 +671,7 @@ void MapTile::parse_adt(char *name,bool mcnk_has_header,load_phases phase) {
 				continue;
 			}
 			f.seek((int)mcnk_offsets[j*16+i]);
-			gLog("MCNK debug %s %f %f %d %d %d %d %d %x\n",name,xbase,zbase,j,i,mcnk_offsets[j*CHUNKS_IN_TILE+i],mcnk_sizes[j*CHUNKS_IN_TILE+i],f.getPos(),f.getPointer());
+			gLogDebug("MCNK debug %s %f %f %d %d %d %d %d %x\n",name,xbase,zbase,j,i,mcnk_offsets[j*CHUNKS_IN_TILE+i],mcnk_sizes[j*CHUNKS_IN_TILE+i],f.getPos(),f.getPointer());
 			chunks[j][i].init(this, f, mBigAlpha,mcnk_has_header,j,i,phase);
 		}
 	}
@@ -865,18 +855,16 @@ void MapChunk::init(MapTile* mt, MPQFile &f, bool bigAlpha, bool mcnk_has_header
 	Vec3D tn[mapbufsize], tv[mapbufsize];
 
 	char fcc[5];
-	uint32 size;
+	uint32 id, size;
 
 	size_t mcnk_pos = f.getPos();
 
-	f.read(fcc,4); // MCNK
-	f.read(&size, 4);
-	flipcc(fcc);
-	fcc[4] = 0;
-	gLog("MapChunk::init %s %d\n",fcc,size);
+	readChunkHeader(f, id, size); // MCNK
+	chunkName(id, fcc);
+	gLogDebug("MapChunk::init %s %d\n",fcc,size);
 
-	if (strncmp(fcc, "MCNK", 4)!=0 || size == 0) {
-		gLog("Error: mcnk main chunk %s [%d].\n", fcc, size);
+	if (id != FOURCC('M','C','N','K') || size == 0) {
+		gLogAt(LOG_ERROR, "Error: mcnk main chunk %s [%d].\n", fcc, size);
 		return;
 	}
 
@@ -886,7 +874,7 @@ void MapChunk::init(MapTile* mt, MPQFile &f, bool bigAlpha, bool mcnk_has_header
 	size_t lastpos = f.getPos() + size;
 	if (mcnk_has_header) {
 		if (size < 80) {
-			printf("err\n");
+			gLogAt(LOG_ERROR, "Error: mcnk header too short [%d].\n", size);
 			return;
 		}
 
@@ -965,23 +953,18 @@ void MapChunk::init(MapTile* mt, MPQFile &f, bool bigAlpha, bool mcnk_has_header
 	}
 
 	while (f.getPos() < lastpos) {
-		memset(fcc, 0, 4);
-		size = 0;
-		f.read(fcc,4);
-		f.read(&size, 4);
-		flipcc(fcc);
-		fcc[4] = 0;
+		if (!readChunkHeader(f, id, size))
+			break;
+		chunkName(id, fcc);
 
-		gLog("%d fcc: %s, size: %d, pos: %d, size: %d.\n", phase,fcc, size, f.getPos(), f.getSize());
+		gLogDebug("%d fcc: %s, size: %d, pos: %d, size: %d.\n", phase,fcc, size, f.getPos(), f.getSize());
 
 		if (size == 0) {
 			// MCAL always has wrong size....
-			if (strncmp(fcc, "MCAL", 4) == 0 && (size+8) != header.sizeAlpha) {
-				f.read(fcc,4);
-				flipcc(fcc);
-				fcc[4] = 0;
+			if (id == FOURCC('M','C','A','L') && (size+8) != header.sizeAlpha) {
+				f.read(&id,4);
 				size_t nextpos;
-				if (strncmp(fcc, "MCLQ", 4) == 0) {
+				if (id == FOURCC('M','C','L','Q')) {
 					nextpos = f.getPos() + size;
 				} else {
 					nextpos = mcnk_pos+header.ofsAlpha+header.sizeAlpha;
@@ -990,22 +973,18 @@ void MapChunk::init(MapTile* mt, MPQFile &f, bool bigAlpha, bool mcnk_has_header
 				//gLog("mcnk %d, pos %d, size %d, ofsAlpha %d, sizeAlpha %d, nextpos %d\n", mcnk_pos, f.getPos(), size, header.ofsAlpha, header.sizeAlpha, nextpos);
 			}
 			// MCLQ sometimes has wrong size, like StratholmeCOT
-			if (strncmp(fcc, "MCLQ", 4) == 0) // nothing behind MCLQ, just break;
+			if (id == FOURCC('M','C','L','Q')) // nothing behind MCLQ, just break;
 				break;
-			if (strncmp(fcc, "MCLQ", 4) == 0 && (size+8) != header.sizeLiquid) {
-				f.read(fcc,4);
-				flipcc(fcc);
-				fcc[4] = 0;
+			if (id == FOURCC('M','C','L','Q') && (size+8) != header.sizeLiquid) {
+				f.read(&id,4);
 				size_t nextpos;
-				if (strncmp(fcc, "MCSE", 4) == 0) {
+				if (id == FOURCC('M','C','S','E')) {
 					nextpos = f.getPos() + size;
 				} else {
 					nextpos = mcnk_pos+header.ofsSndEmitters;
 					f.seek((int)nextpos);
-					f.read(fcc, 4);
-					flipcc(fcc);
-					fcc[4] = 0;
-					if (strncmp(fcc, "MCSE", 4) != 0)
+					f.read(&id, 4);
+					if (id != FOURCC('M','C','S','E'))
 						break; // nothing behind MCLQ, just break;
 				}
 				f.seek((int)nextpos);
@@ -1016,12 +995,12 @@ void MapChunk::init(MapTile* mt, MPQFile &f, bool bigAlpha, bool mcnk_has_header
 
 		size_t nextpos = f.getPos() + size;
 
-		if (fcc[0] != 'M' || f.getPos() > f.getSize()) {
-			gLog("Error: mcnk chunk initial error, fcc: %s, size: %d, pos: %d, size: %d.\n", fcc, size, f.getPos(), f.getSize());
+		if ((id >> 24) != 'M' || f.getPos() > f.getSize()) {
+			gLogAt(LOG_ERROR, "Error: mcnk chunk initial error, fcc: %s, size: %d, pos: %d, size: %d.\n", fcc, size, f.getPos(), f.getSize());
 			break;
 		}
 
-		if (strncmp(fcc, "MCVT", 4) == 0) {
+		if (id == FOURCC('M','C','V','T')) {
 			/*
 			These are the actual height values for the 9x9+8x8 vertices. 145 floats in the following order/arrangement:.
 			1    2	3	 4	  5    6	7	 8	  9
@@ -1070,7 +1049,7 @@ void MapChunk::init(MapTile* mt, MPQFile &f, bool bigAlpha, bool mcnk_has_header
 			r = (vmax - vmin).length() * 0.5f;
 
 		}
-		else if (strncmp(fcc, "MCNR", 4) == 0) {
+		else if (id == FOURCC('M','C','N','R')) {
 			/*
 			MCNR sub-chunk
 			Normal vectors for each vertex, encoded as 3 signed bytes per normal, in the same order as specified above.
@@ -1091,7 +1070,7 @@ void MapChunk::init(MapTile* mt, MPQFile &f, bool bigAlpha, bool mcnk_has_header
 				}
 			}
 		}
-		else if (strncmp(fcc, "MCLY", 4) == 0) {
+		else if (id == FOURCC('M','C','L','Y')) {
 			/*
 			MCLY sub-chunk
 			Complete and right as of 19-AUG-09 (3.0.9 or higher)
@@ -1127,7 +1106,7 @@ void MapChunk::init(MapTile* mt, MPQFile &f, bool bigAlpha, bool mcnk_has_header
 			//gLog("=\n");
 			for (int i=0; i<nTextures; i++) {
 				f.read(&mcly[i], sizeof(struct MCLY));
-				gLog("MCLY %d %x %d\n",i,mcly[i].flags,mcly[i].textureId);
+				gLogDebug("MCLY %d %x %d\n",i,mcly[i].flags,mcly[i].textureId);
 
 				if (mcly[i].flags & 0x80) {
 					animated[i] = mcly[i].flags;
@@ -1138,13 +1117,13 @@ void MapChunk::init(MapTile* mt, MPQFile &f, bool bigAlpha, bool mcnk_has_header
 				textures[i] = video.textures.get(mt->textures[mcly[i].textureId]);
 			}
 		}
-		else if (strncmp(fcc, "MCRF", 4) == 0) {
+		else if (id == FOURCC('M','C','R','F')) {
 			/*
 			A list of with MCNK.nDoodadRefs + MCNK.nMapObjRefs indices into the file's MDDF and MODF chunks, saying which MCNK subchunk those particular doodads and objects are drawn within. This MCRF list contains duplicates for map doodads that overlap areas.
 			As both, WMOs and M2s are referenced here, they get doodad indices first, then WMOs. If you have a doodad and a WMO in the ADT as well as the MCNK, you will have a {0,0} in MCRF with nDoodadRefs and MCNK.nMapObjRefs being 1.
 			*/
 		}
-		else if (strncmp(fcc, "MCAL", 4) == 0) {
+		else if (id == FOURCC('M','C','A','L')) {
 			/*
 			Alpha maps for additional texture layers. For every layer, a 32x64 array of alpha values. Can be used as a secondary texture with the modulation op to control the blending of the texture layers. For video cards with 2 texture units, this requires one pass per layer. (For 4 or more texture units, maybe this could be done faster using register combiners? Pixel shaders maybe?)
 			The size field of this chunk might be wrong for map chunks with zero texture layers. There are a couple of these in some of the development maps.
@@ -1205,7 +1184,7 @@ void MapChunk::init(MapTile* mt, MPQFile &f, bool bigAlpha, bool mcnk_has_header
 			if (nTextures>0 && data) {
 				glGenTextures(nTextures-1, alphamaps);
 				/*
-				gLog("MCAL %d,%d,%d,%d %d,%d,%d,%d %d,%d,%d,%d %d,%d,%d,%d - %d\n", 
+				gLogDebug("MCAL %d,%d,%d,%d %d,%d,%d,%d %d,%d,%d,%d %d,%d,%d,%d - %d\n", 
 				mcly[0].flags&MCLY_USE_ALPHAMAP, 
 				mcly[1].flags&MCLY_USE_ALPHAMAP,
 				mcly[2].flags&MCLY_USE_ALPHAMAP,
@@ -1305,7 +1284,7 @@ void MapChunk::init(MapTile* mt, MPQFile &f, bool bigAlpha, bool mcnk_has_header
 				//gLog("mcnk %d, pos %d, size %d, ofsAlpha %d, sizeAlpha %d, nextpos %d\n", mcnk_pos, f.getPos(), size, header.ofsAlpha, header.sizeAlpha, nextpos);
 			}
 		}
-		else if (strncmp(fcc,"MCSH", 4) == 0) {
+		else if (id == FOURCC('M','C','S','H')) {
 			// shadow map 64 x 64
 			unsigned char sbuf[64*64], *p, c[8];
 			p = sbuf;
@@ -1331,7 +1310,7 @@ void MapChunk::init(MapTile* mt, MPQFile &f, bool bigAlpha, bool mcnk_has_header
 				}
 			}
 		}
-		else if (strncmp(fcc,"MCLQ", 4) == 0) {
+		else if (id == FOURCC('M','C','L','Q')) {
 			/*
 			Water levels for this map chunk. This chunk is old and not really used anymore. Still, there is backwards compatibility in the client as old ADTs are not updated as it would be much data to patch it. I guess, it will be done in some expansion. You can fully use this chunk, even to have multiple water. You can have a lot of stacked water with this and the MH2O one. I advise you to implement the MH2O one as its better if you want to write a editor for ADT files.
 			The size of the chunk is in the mapchunk header. The type of liquid is given in the mapchunk flags, also in the header.
@@ -1364,11 +1343,11 @@ void MapChunk::init(MapTile* mt, MPQFile &f, bool bigAlpha, bool mcnk_has_header
 			if (flags & 8) lq.append(" ocean");
 			if (flags & 16) lq.append(" magma");
 			if (flags & 32) lq.append(" slime?");
-			gLog("LQ%s (base:%f)\n", lq.c_str(), waterlevel);
+			gLogDebug("LQ%s (base:%f)\n", lq.c_str(), waterlevel);
 			*/
 			break; // nothing behind MCLQ, just break;
 		}
-		else if (strncmp(fcc,"MCSE", 4) == 0) {
+		else if (id == FOURCC('M','C','S','E')) {
 			/*
 			Sound emitters.
 			This seems to be a bit different to that structure, ObscuR posted back then. From what I can see, WoW takes only 0x1C bytes per entry. Quite a big difference. This change might have happened, when they introduced the SoundEntriesAdvanced.dbc.
@@ -1384,7 +1363,7 @@ void MapChunk::init(MapTile* mt, MPQFile &f, bool bigAlpha, bool mcnk_has_header
 			};
 			*/
 		}
-		else if (!strncmp(fcc, "MCCV", 4)) {
+		else if (id == FOURCC('M','C','C','V')) {
 			/*
 			New Subchunk found in Northrend-adts(and only there as far as I see). Size seems to be always 0x244. Offset seems to be at 0x74 in the MCNK-header.
 			--Tigurius:Found in WotLK-Beta 3.0.1
@@ -1520,7 +1499,7 @@ void MapChunk::init(MapTile* mt, MPQFile &f, bool bigAlpha, bool mcnk_has_header
 	glBindBufferARB(GL_ARRAY_BUFFER_ARB, minishadows);
 	glBufferDataARB(GL_ARRAY_BUFFER_ARB, mapbufsize*4*sizeof(float), ts, GL_STATIC_DRAW_ARB);
 #endif
-	if (vmin.x != 9999999) gLog("CHUNK %d,%d maptile: %d,%d vmin: %f,%f,%f\tvmax: %f,%f,%f\tbase: %f,%f,%f\n",chunkx,chunky, mt->x,mt->z, vmin.x,vmin.y,vmin.z, vmax.x,vmax.y,vmax.z, xbase,ybase,zbase);
+	if (vmin.x != 9999999) gLogDebug("CHUNK %d,%d maptile: %d,%d vmin: %f,%f,%f\tvmax: %f,%f,%f\tbase: %f,%f,%f\n",chunkx,chunky, mt->x,mt->z, vmin.x,vmin.y,vmin.z, vmax.x,vmax.y,vmax.z, xbase,ybase,zbase);
 }
 
 
@@ -1611,6 +1590,11 @@ void MapChunk::draw()
 	}
 	visible = true;
 
+	// the layers repeat detail_size times across the chunk
+	float texPixels = video.projectedSize(CHUNKSIZE / detail_size, mydist);
+	for (int i=0; i<nTextures; i++)
+		video.textures.need(textures[i], texPixels);
+
 	if (nTextures==0) return;
 
 	if (!hasholes) {
@@ -13,6 +13,7 @@
 #include "wmo.h"
 #include "model.h"
 #include "liquid.h"
+#include "chunkfile.h"
 #include <vector>
 #include <string>
 
@@ -121,6 +121,36 @@ public:
 		return t;
 	}
 
+	void rotation(const Vec3D& axis, float angle)
+	{
+		/*
+			###0
+			###0
+			###0
+			0001
+			angle in radians around a unit axis, same as glRotatef
+		*/
+		float c = cosf(angle), s = sinf(angle), t = 1.0f - c;
+		float x = axis.x, y = axis.y, z = axis.z;
+		unit();
+		m[0][0] = x*x*t + c;
+		m[0][1] = x*y*t - z*s;
+		m[0][2] = x*z*t + y*s;
+		m[1][0] = y*x*t + z*s;
+		m[1][1] = y*y*t + c;
+		m[1][2] = y*z*t - x*s;
+		m[2][0] = x*z*t - y*s;
+		m[2][1] = y*z*t + x*s;
+		m[2][2] = z*z*t + c;
+	}
+
+	static const Matrix newRotation(const Vec3D& axis, float angle)
+	{
+		Matrix t;
+		t.rotation(axis, angle);
+		return t;
+	}
+
 	Vec3D operator* (const Vec3D& v) const
 	{
 		Vec3D o;
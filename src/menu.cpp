@@ -1,7 +1,7 @@
 #include "menu.h"
 #include "mpq.h"
 #include "test.h"
-#include "dbcfile.h"
+#include "areadb.h"
 
 #include <fstream>
 
@@ -16,7 +16,7 @@ enum MAPID {
 
 Menu::Menu()
 {	
-	DBCFile f("DBFilesClient\\Map.dbc");
+	MapDB f;
 	if (!f.open()) {
 		gLog("error opening Map.dbc\n");
 		sel = -1;
@@ -27,17 +27,18 @@ Menu::Menu()
 	int y=0;
 	int x=5;
 	
-	for(DBCFile::Iterator i=f.begin(); i!=f.end(); ++i) {
+	for(int n=0; n<f.getRecordCount(); n++) {
+		MapDB::Row i = f.row(n);
 		MapEntry e;
 		int size;
 
 		size = 16;
 		e.font = f16;
-		e.id = i->getInt(0);
-		e.name = i->getString(1);
+		e.id = i.get<MapDB::MapID>();
+		e.name = i.get<MapDB::InternalName>();
 		// slot 3 doesnt look like a string!!
 		// http://udw.altervista.org/wiki/index.php?title=Map.dbc
-		int test = i->getInt(3);
+		int test = i.get<MapDB::IsBattleground>();
 		//e.description = i->getString(3); // + locale
 		gLog("found map %d %s %d\n",e.id,e.name.c_str(),test);
 		if (e.description == "")
@@ -241,7 +242,10 @@ void Menu::display(float t, float dt)
 		glDepthFunc(GL_LEQUAL);
 		glEnable(GL_LIGHTING);
 		bg->cam.setup(globalTime);
-		bg->draw();
+		Matrix world;
+		world.unit();
+		bg->draw(0, world);
+		particleBatch.flush();
 	}
 
 	video.set2D();
@@ -0,0 +1,207 @@
+#include "meshopt.h"
+#include <cmath>
+#include <vector>
+
+// tuning values from Forsyth's paper, for a 32 entry LRU cache
+const int maxCacheSize = 32;
+const float cacheDecayPower = 1.5f;
+const float lastTriScore = 0.75f;
+const float valenceBoostScale = 2.0f;
+const float valenceBoostPower = 0.5f;
+
+static float vertexScore(int cachePos, int activeTris)
+{
+	// no triangles left that use this vertex
+	if (activeTris == 0)
+		return -1.0f;
+
+	float score = 0;
+	if (cachePos < 0) {
+		// not in the cache
+	} else if (cachePos < 3) {
+		// used by the last triangle; fixed score so it doesn't get picked for a strip-like order
+		score = lastTriScore;
+	} else {
+		const float scaler = 1.0f / (maxCacheSize - 3);
+		score = powf(1.0f - (cachePos - 3) * scaler, cacheDecayPower);
+	}
+
+	// boost vertices with few triangles left, so we don't leave lone triangles behind
+	score += valenceBoostScale * powf((float)activeTris, -valenceBoostPower);
+	return score;
+}
+
+float calcACMR(const unsigned short *indices, size_t nIndices, int cacheSize)
+{
+	size_t nTris = nIndices / 3;
+	if (nTris == 0)
+		return 0;
+
+	std::vector<int> cache(cacheSize, -1);
+	int head = 0;
+	size_t misses = 0;
+
+	for (size_t i=0; i<nTris*3; i++) {
+		int v = indices[i];
+		bool hit = false;
+		for (int j=0; j<cacheSize; j++) {
+			if (cache[j] == v) {
+				hit = true;
+				break;
+			}
+		}
+		if (!hit) {
+			misses++;
+			cache[head] = v;
+			head = (head + 1) % cacheSize;
+		}
+	}
+
+	return misses / (float)nTris;
+}
+
+void optimizeVertexCache(unsigned short *indices, size_t nIndices)
+{
+	size_t nTris = nIndices / 3;
+	if (nTris < 2)
+		return;
+	nIndices = nTris * 3;
+
+	int nVertices = 0;
+	for (size_t i=0; i<nIndices; i++) {
+		if (indices[i] >= nVertices)
+			nVertices = indices[i] + 1;
+	}
+
+	// triangles using each vertex
+	std::vector<int> activeTris(nVertices, 0);
+	for (size_t i=0; i<nIndices; i++)
+		activeTris[indices[i]]++;
+
+	std::vector<int> triStart(nVertices+1, 0);
+	for (int v=0; v<nVertices; v++)
+		triStart[v+1] = triStart[v] + activeTris[v];
+
+	std::vector<int> triList(nIndices);
+	std::vector<int> fill(triStart.begin(), triStart.end()-1);
+	for (size_t i=0; i<nIndices; i++)
+		triList[fill[indices[i]]++] = (int)(i/3);
+
+	std::vector<int> cachePos(nVertices, -1);
+	std::vector<float> score(nVertices);
+	for (int v=0; v<nVertices; v++)
+		score[v] = vertexScore(-1, activeTris[v]);
+
+	std::vector<bool> emitted(nTris, false);
+	std::vector<float> triScore(nTris);
+	int bestTri = -1;
+	float bestScore = -1.0f;
+	for (size_t t=0; t<nTris; t++) {
+		triScore[t] = score[indices[t*3]] + score[indices[t*3+1]] + score[indices[t*3+2]];
+		if (triScore[t] > bestScore) {
+			bestScore = triScore[t];
+			bestTri = (int)t;
+		}
+	}
+
+	std::vector<unsigned short> out;
+	out.reserve(nIndices);
+
+	int cache[maxCacheSize+3], newCache[maxCacheSize+3];
+	int cacheSize = 0;
+	size_t scan = 0;
+
+	while (out.size() < nIndices) {
+		if (bestTri < 0) {
+			// nothing in the cache leads anywhere, carry on with the next triangle in file order
+			while (emitted[scan])
+				scan++;
+			bestTri = (int)scan;
+		}
+
+		emitted[bestTri] = true;
+
+		// the triangle's vertices go to the front of the cache
+		int newSize = 0;
+		for (int k=0; k<3; k++) {
+			int v = indices[bestTri*3+k];
+			out.push_back(v);
+			activeTris[v]--;
+
+			bool dup = false;
+			for (int j=0; j<newSize; j++) {
+				if (newCache[j] == v)
+					dup = true;
+			}
+			if (!dup)
+				newCache[newSize++] = v;
+		}
+		int triVerts = newSize;
+		for (int i=0; i<cacheSize; i++) {
+			int v = cache[i];
+			bool inTri = false;
+			for (int j=0; j<triVerts; j++) {
+				if (newCache[j] == v)
+					inTri = true;
+			}
+			if (!inTri)
+				newCache[newSize++] = v;
+		}
+
+		// update vertex scores, including the ones that just fell out
+		for (int i=0; i<newSize; i++) {
+			int v = newCache[i];
+			cachePos[v] = (i < maxCacheSize) ? i : -1;
+			score[v] = vertexScore(cachePos[v], activeTris[v]);
+		}
+
+		// rescore the triangles those vertices touch, and pick the best one
+		bestTri = -1;
+		bestScore = -1.0f;
+		for (int i=0; i<newSize; i++) {
+			int v = newCache[i];
+			for (int j=triStart[v]; j<triStart[v+1]; j++) {
+				int t = triList[j];
+				if (emitted[t])
+					continue;
+				triScore[t] = score[indices[t*3]] + score[indices[t*3+1]] + score[indices[t*3+2]];
+				if (triScore[t] > bestScore) {
+					bestScore = triScore[t];
+					bestTri = t;
+				}
+			}
+		}
+
+		cacheSize = (newSize < maxCacheSize) ? newSize : maxCacheSize;
+		for (int i=0; i<cacheSize; i++)
+			cache[i] = newCache[i];
+	}
+
+	for (size_t i=0; i<nIndices; i++)
+		indices[i] = out[i];
+}
+
+void buildFetchRemap(const unsigned short *indices, size_t nIndices, unsigned short *remap, size_t nVertices)
+{
+	std::vector<int> order(nVertices, -1);
+	int next = 0;
+
+	for (size_t i=0; i<nIndices; i++) {
+		unsigned short v = indices[i];
+		if (v < nVertices && order[v] < 0)
+			order[v] = next++;
+	}
+	for (size_t v=0; v<nVertices; v++) {
+		if (order[v] < 0)
+			order[v] = next++;
+	}
+
+	for (size_t v=0; v<nVertices; v++)
+		remap[v] = (unsigned short)order[v];
+}
+
+void remapIndices(unsigned short *indices, size_t nIndices, const unsigned short *remap)
+{
+	for (size_t i=0; i<nIndices; i++)
+		indices[i] = remap[indices[i]];
+}
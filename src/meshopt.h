@@ -0,0 +1,42 @@
+#ifndef MESHOPT_H
+#define MESHOPT_H
+
+#include <cstddef>
+
+/*
+	Load-time triangle list optimization.
+
+	optimizeVertexCache reorders the triangles of an indexed triangle list so that
+	vertices get reused while they're still in the post-transform cache (Tom Forsyth's
+	"linear-speed vertex cache optimisation"). It only changes the order the triangles
+	are drawn in, the winding of each triangle is kept.
+
+	buildFetchRemap then gives the vertices a new order by first use, so that vertex
+	fetches walk through memory instead of jumping around. Apply it to every vertex
+	stream with remapVertexData and to the indices with remapIndices.
+*/
+
+// size of the FIFO cache used for the ACMR figures
+#define	VERTEX_CACHE_SIZE	16
+
+// average cache miss ratio: transformed vertices per triangle, 0.5 .. 3.0
+float calcACMR(const unsigned short *indices, size_t nIndices, int cacheSize = VERTEX_CACHE_SIZE);
+
+void optimizeVertexCache(unsigned short *indices, size_t nIndices);
+
+// remap[old] = new for nVertices vertices; unreferenced vertices keep their relative order at the end
+void buildFetchRemap(const unsigned short *indices, size_t nIndices, unsigned short *remap, size_t nVertices);
+void remapIndices(unsigned short *indices, size_t nIndices, const unsigned short *remap);
+
+template <class T>
+void remapVertexData(T *data, const unsigned short *remap, size_t nVertices)
+{
+	T *tmp = new T[nVertices];
+	for (size_t i=0; i<nVertices; i++)
+		tmp[remap[i]] = data[i];
+	for (size_t i=0; i<nVertices; i++)
+		data[i] = tmp[i];
+	delete[] tmp;
+}
+
+#endif
@@ -0,0 +1,102 @@
+#include "meshopt.h"
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <cstdlib>
+
+// runs the load-time mesh optimizer over a set of generated meshes and prints
+// the ACMR before and after, no game data or GL needed
+
+using namespace std;
+
+struct Tri {
+	unsigned short a,b,c;
+
+	// rotate so the smallest index comes first, winding is kept
+	Tri(unsigned short x, unsigned short y, unsigned short z)
+	{
+		if (x <= y && x <= z) { a = x; b = y; c = z; }
+		else if (y <= x && y <= z) { a = y; b = z; c = x; }
+		else { a = z; b = x; c = y; }
+	}
+	bool operator< (const Tri &t) const
+	{
+		if (a != t.a) return a < t.a;
+		if (b != t.b) return b < t.b;
+		return c < t.c;
+	}
+	bool operator== (const Tri &t) const { return a==t.a && b==t.b && c==t.c; }
+};
+
+// w*h quads, two triangles each
+void makeGrid(int w, int h, vector<unsigned short> &indices)
+{
+	for (int y=0; y<h; y++) {
+		for (int x=0; x<w; x++) {
+			unsigned short v = y*(w+1) + x;
+			unsigned short right = v+1, down = v+w+1, diag = v+w+2;
+			indices.push_back(v); indices.push_back(down); indices.push_back(right);
+			indices.push_back(right); indices.push_back(down); indices.push_back(diag);
+		}
+	}
+}
+
+void shuffleTris(vector<unsigned short> &indices)
+{
+	size_t n = indices.size() / 3;
+	for (size_t i=n-1; i>0; i--) {
+		size_t j = rand() % (i+1);
+		for (int k=0; k<3; k++)
+			swap(indices[i*3+k], indices[j*3+k]);
+	}
+}
+
+bool run(const char *name, vector<unsigned short> indices, size_t nVertices)
+{
+	vector<unsigned short> orig = indices;
+	float before = calcACMR(&indices[0], indices.size());
+
+	optimizeVertexCache(&indices[0], indices.size());
+	vector<unsigned short> remap(nVertices);
+	buildFetchRemap(&indices[0], indices.size(), &remap[0], nVertices);
+	remapIndices(&indices[0], indices.size(), &remap[0]);
+
+	float after = calcACMR(&indices[0], indices.size());
+
+	// same triangles as before, once the vertices are mapped back
+	vector<unsigned short> inverse(nVertices);
+	for (size_t i=0; i<nVertices; i++)
+		inverse[remap[i]] = (unsigned short)i;
+	vector<Tri> t1, t2;
+	for (size_t i=0; i<orig.size(); i+=3) {
+		t1.push_back(Tri(orig[i], orig[i+1], orig[i+2]));
+		t2.push_back(Tri(inverse[indices[i]], inverse[indices[i+1]], inverse[indices[i+2]]));
+	}
+	sort(t1.begin(), t1.end());
+	sort(t2.begin(), t2.end());
+	bool same = (t1 == t2);
+
+	cout << name << "\t" << indices.size()/3 << " tris\tACMR " << before << " -> " << after << (same ? "" : "\tMISMATCH") << endl;
+	return same;
+}
+
+int main(int argc, char *argv[]) {
+	srand(1);
+	bool ok = true;
+
+	int sizes[] = { 4, 16, 64, 150 };
+	for (int i=0; i<4; i++) {
+		int n = sizes[i];
+		char name[64];
+		vector<unsigned short> indices;
+		makeGrid(n, n, indices);
+		sprintf(name, "grid%dx%d", n, n);
+		ok &= run(name, indices, (n+1)*(n+1));
+
+		shuffleTris(indices);
+		sprintf(name, "shuffled%dx%d", n, n);
+		ok &= run(name, indices, (n+1)*(n+1));
+	}
+
+	return ok ? 0 : 1;
+}
@@ -3,6 +3,8 @@
 #include <cassert>
 #include <algorithm>
 #include "util.h"
+#include "meshopt.h"
+#include "shaders.h"
 
 int globalTime = 0;
 
@@ -29,15 +31,6 @@ Model::Model(std::string name, bool forceAnim) : ManagedItem(name), forceAnim(fo
 
 	memcpy(&header, f.getBuffer(), sizeof(ModelHeader));
 
-	// HACK: these particle systems are way too active and cause horrible horrible slowdowns
-	// I'm removing them until I can fix emission speed so it doesn't get this crazy
-	if (false
-	|| name=="World\\Kalimdor\\Orgrimmar\\Passivedoodads\\Orgrimmarbonfire\\Orgrimmarsmokeemitter.Mdx"	
-	//|| name=="World\\Kalimdor\\Orgrimmar\\Passivedoodads\\Orgrimmarbonfire\\Orgrimmarbonfire01.Mdx"	
-	) {
-        header.nParticleEmitters = 0;
-	}
-
 	animated = isAnimated(f) || forceAnim;  // isAnimated will set animGeometry and animTextures
 
 	gLog("Loading model %s%s\n", tempname, animated ? " (animated)" : "");
@@ -51,14 +44,28 @@ Model::Model(std::string name, bool forceAnim) : ManagedItem(name), forceAnim(fo
 		useReplaceTextures[i] = false;
 	}
 
-	showGeosets = 0;
+	nSkins = 0;
+	skin = 0;
+	emitDist = 0;
+	prevDist = 0;
+	drawFrame = -1;
+	emitLOD = 1.0f;
+	animFrame = -1000;
+	vertexRemap = 0;
+	vertices = normals = 0;
+	streamGen = -1;
+	streamBase = 0;
 	vbuf = nbuf = tbuf = 0;
+	gpuSkin = false;
+	sbuf = 0;
+	paletteVersion = 0;
 
 	globalSequences = 0;
 	animtime = 0;
 	anim = 0;
 	colors = 0;
 	lights = 0;
+	animLoaded = 0;
 	transparency = 0;
 	particleSystems = 0;
 	ribbons = 0;
@@ -91,21 +98,32 @@ Model::~Model()
 		}
 
 		delete[] globalSequences;
-		delete[] showGeosets;
+
+		for (int i=0; i<nSkins; i++) {
+			delete[] skins[i].indices;
+			delete[] skins[i].showGeosets;
+			if (skins[i].dlist)
+				glDeleteLists(skins[i].dlist, 1);
+		}
 
 		if (animated) {
 			// unload all sorts of crap
 			//delete[] vertices;
 			//delete[] normals;
-			delete[] indices;
+			delete[] vertexRemap;
 			delete[] anims;
+			delete[] animLoaded;
 			delete[] origVertices;
 			if (animBones) delete[] bones;
 			if (!animGeometry) {
 				glDeleteBuffersARB(1, &nbuf);
+			} else {
+				// normals are in the same block
+				delete[] vertices;
 			}
 			glDeleteBuffersARB(1, &vbuf);
 			glDeleteBuffersARB(1, &tbuf);
+			if (sbuf) glDeleteBuffersARB(1, &sbuf);
 
 			if (animTextures) delete[] texAnims;
 			if (colors) delete[] colors;
@@ -115,8 +133,6 @@ Model::~Model()
 			if (particleSystems) delete[] particleSystems;
 			if (ribbons) delete[] ribbons;
 
-		} else {
-			glDeleteLists(dlist, 1);
 		}
 	}
 }
@@ -211,9 +227,10 @@ Quaternion fixCoordSystemQuat(Quaternion v)
 }
 
 
-void Model::initCommon(MPQFile &f)
+void Model::initVertices()
 {
 	// assume: origVertices already set
+	rad = 0;
 	if (!animGeometry) {
 		vertices = new Vec3D[header.nVertices];
 		normals = new Vec3D[header.nVertices];
@@ -246,6 +263,11 @@ void Model::initCommon(MPQFile &f)
 	}
 	rad = sqrtf(rad);
 	//rad = std::max(vmin.length(),vmax.length());
+}
+
+void Model::initCommon(MPQFile &f)
+{
+	initVertices();
 
 	// textures
 	ModelTextureDef *texdef = (ModelTextureDef*)(f.getBuffer() + header.ofsTextures);
@@ -287,7 +309,6 @@ void Model::initCommon(MPQFile &f)
 			colors[i].init(f, colorDefs[i], globalSequences);
 	}
 	// init transparency
-	int16 *transLookup = (int16*)(f.getBuffer() + header.ofsTransparencyLookup);
 	if (header.nTransparency) {
 		transparency = new ModelTransparency[header.nTransparency];
 		ModelTransDef *trDefs = (ModelTransDef*)(f.getBuffer() + header.ofsTransparency);
@@ -295,130 +316,210 @@ void Model::initCommon(MPQFile &f)
 			transparency[i].init(f, trDefs[i], globalSequences);
 	}
 
-	// just use the first LOD/view
+	std::string lodname = fullname.substr(0, fullname.length()-3);
+	fullname = lodname;
 
-	if (header.nViews > 0) {
-	// indices - allocate space, too
-		std::string lodname = fullname.substr(0, fullname.length()-3);
-		fullname = lodname;
-		lodname.append("00.skin");
-		MPQFile g(lodname.c_str());
-		if (g.isEof()) {
-			gLog("Error: loading lod [%s]\n", lodname.c_str());
-			g.close();
-			return;
-		}
-		ModelView *view = (ModelView*)(g.getBuffer());
-
-		uint16 *indexLookup = (uint16*)(g.getBuffer() + view->ofsIndex);
-		uint16 *triangles = (uint16*)(g.getBuffer() + view->ofsTris);
-		nIndices = view->nTris;
-		indices = new uint16[nIndices];
-		for (size_t i = 0; i<nIndices; i++) {
-			indices[i] = indexLookup[triangles[i]];
-		}
+	// all skins are read now, switching between them while drawing mustn't go to the MPQs
+	nSkins = header.nViews < MAX_SKINS ? header.nViews : MAX_SKINS;
+	for (int i=0; i<nSkins; i++)
+		initSkin(f, i);
 
-		// render ops
-		ModelGeoset *ops = (ModelGeoset*)(g.getBuffer() + view->ofsSub);
-		ModelTexUnit *tex = (ModelTexUnit*)(g.getBuffer() + view->ofsTex);
-		ModelRenderFlags *renderFlags = (ModelRenderFlags*)(f.getBuffer() + header.ofsTexFlags);
-		uint16 *texlookup = (uint16*)(f.getBuffer() + header.ofsTexLookup);
-		uint16 *texanimlookup = (uint16*)(f.getBuffer() + header.ofsTexAnimLookup);
-		int16 *texunitlookup = (int16*)(f.getBuffer() + header.ofsTexUnitLookup);
-
-		showGeosets = new bool[view->nSub];
-		for (size_t i=0; i<view->nSub; i++) {
-			showGeosets[i] = true;
-		}
+	// zomg done
+}
+
+bool Model::initSkin(MPQFile &f, int lod)
+{
+	ModelSkin &s = skins[lod];
+
+	ModelTextureDef *texdef = (ModelTextureDef*)(f.getBuffer() + header.ofsTextures);
+	int16 *transLookup = (int16*)(f.getBuffer() + header.ofsTransparencyLookup);
+
+	// indices - allocate space, too
+	char lodname[256];
+	sprintf(lodname, "%s%02d.skin", fullname.c_str(), lod);
+	MPQFile g(lodname);
+	if (g.isEof()) {
+		gLog("Error: loading lod [%s]\n", lodname);
+		g.close();
+		return false;
+	}
+	ModelView *view = (ModelView*)(g.getBuffer());
+
+	uint16 *indexLookup = (uint16*)(g.getBuffer() + view->ofsIndex);
+	uint16 *triangles = (uint16*)(g.getBuffer() + view->ofsTris);
+	s.nIndices = view->nTris;
+	s.indices = new uint16[s.nIndices];
+	for (size_t i = 0; i<s.nIndices; i++) {
+		s.indices[i] = indexLookup[triangles[i]];
+	}
 
-		for (size_t j = 0; j<view->nTex; j++) {
-			ModelRenderPass pass;
+	// render ops
+	ModelGeoset *ops = (ModelGeoset*)(g.getBuffer() + view->ofsSub);
 
-			pass.usetex2 = false;
-			pass.useEnvMap = false;
-			pass.cull = false;
-			pass.trans = false;
-			pass.unlit = false;
-			pass.noZWrite = false;
-			pass.billboard = false;
+	// all skins share the vertices, so later skins have to follow the order picked for skin 0
+	optimizeIndices(s, ops, view->nSub, lod > 0);
 
-			size_t geoset = tex[j].op;
+	ModelTexUnit *tex = (ModelTexUnit*)(g.getBuffer() + view->ofsTex);
+	ModelRenderFlags *renderFlags = (ModelRenderFlags*)(f.getBuffer() + header.ofsTexFlags);
+	uint16 *texlookup = (uint16*)(f.getBuffer() + header.ofsTexLookup);
+	uint16 *texanimlookup = (uint16*)(f.getBuffer() + header.ofsTexAnimLookup);
+	int16 *texunitlookup = (int16*)(f.getBuffer() + header.ofsTexUnitLookup);
 
-			pass.geoset = (int)geoset;
+	s.showGeosets = new bool[view->nSub];
+	for (size_t i=0; i<view->nSub; i++) {
+		s.showGeosets[i] = true;
+	}
 
-			pass.indexStart = ops[geoset].istart;
-			pass.indexCount = ops[geoset].icount;
-			pass.vertexStart = ops[geoset].vstart;
-			pass.vertexEnd = pass.vertexStart + ops[geoset].vcount;
+	for (size_t j = 0; j<view->nTex; j++) {
+		ModelRenderPass pass;
+
+		pass.usetex2 = false;
+		pass.useEnvMap = false;
+		pass.cull = false;
+		pass.trans = false;
+		pass.unlit = false;
+		pass.noZWrite = false;
+		pass.billboard = false;
+
+		size_t geoset = tex[j].op;
+
+		pass.geoset = (int)geoset;
+
+		pass.indexStart = ops[geoset].istart;
+		pass.indexCount = ops[geoset].icount;
+		// the vertex range has changed if optimizeIndices reordered the vertices
+		pass.vertexStart = 0xFFFF;
+		pass.vertexEnd = 0;
+		for (size_t i = pass.indexStart; i < pass.indexStart + pass.indexCount && i < s.nIndices; i++) {
+			if (s.indices[i] < pass.vertexStart) pass.vertexStart = s.indices[i];
+			if (s.indices[i] > pass.vertexEnd) pass.vertexEnd = s.indices[i];
+		}
+		if (pass.vertexStart > pass.vertexEnd)
+			pass.vertexStart = pass.vertexEnd = 0;
 
-			pass.order = tex[j].shading;
+		pass.order = tex[j].shading;
 
-			//TextureID texid = textures[texlookup[tex[j].textureid]];
-			//pass.texture = texid;
-			pass.tex = texlookup[tex[j].textureid];
-			
-			// TODO: figure out these flags properly -_-
-			ModelRenderFlags &rf = renderFlags[tex[j].flagsIndex];
-			
+		//TextureID texid = textures[texlookup[tex[j].textureid]];
+		//pass.texture = texid;
+		pass.tex = texlookup[tex[j].textureid];
+		
+		// TODO: figure out these flags properly -_-
+		ModelRenderFlags &rf = renderFlags[tex[j].flagsIndex];
+		
 
-			pass.blendmode = rf.blend;
-			pass.color = tex[j].colorIndex;
-			pass.opacity = transLookup[tex[j].transid];
+		pass.blendmode = rf.blend;
+		pass.color = tex[j].colorIndex;
+		pass.opacity = transLookup[tex[j].transid];
 
-			pass.unlit = (rf.flags & RENDERFLAGS_UNLIT)!=0;
-			pass.cull = (rf.flags & RENDERFLAGS_TWOSIDED)==0 && rf.blend==0;
+		pass.unlit = (rf.flags & RENDERFLAGS_UNLIT)!=0;
+		pass.cull = (rf.flags & RENDERFLAGS_TWOSIDED)==0 && rf.blend==0;
 
-			pass.billboard = (rf.flags & RENDERFLAGS_BILLBOARD) != 0;
+		pass.billboard = (rf.flags & RENDERFLAGS_BILLBOARD) != 0;
 
-			pass.useEnvMap = (texunitlookup[tex[j].texunit] == -1) && pass.billboard && rf.blend>2;
-			pass.noZWrite = (rf.flags & RENDERFLAGS_ZBUFFERED) != 0;
+		pass.useEnvMap = (texunitlookup[tex[j].texunit] == -1) && pass.billboard && rf.blend>2;
+		pass.noZWrite = (rf.flags & RENDERFLAGS_ZBUFFERED) != 0;
 
-			// ToDo: Work out the correct way to get the true/false of transparency
-			pass.trans = (pass.blendmode>0) && (pass.opacity>0);	// Transparency - not the correct way to get transparency
+		// ToDo: Work out the correct way to get the true/false of transparency
+		pass.trans = (pass.blendmode>0) && (pass.opacity>0);	// Transparency - not the correct way to get transparency
 
-			pass.p = ops[geoset].BoundingBox[0].x;
+		pass.p = ops[geoset].BoundingBox[0].x;
 
-			// Texture flags
-			pass.swrap = (texdef[pass.tex].flags & TEXTURE_WRAPX) != 0; // Texture wrap X
-			pass.twrap = (texdef[pass.tex].flags & TEXTURE_WRAPY) != 0; // Texture wrap Y
+		// Texture flags
+		pass.swrap = (texdef[pass.tex].flags & TEXTURE_WRAPX) != 0; // Texture wrap X
+		pass.twrap = (texdef[pass.tex].flags & TEXTURE_WRAPY) != 0; // Texture wrap Y
 
-			if (animTextures) {
-				if (tex[j].flags & TEXTUREUNIT_STATIC) {
-					pass.texanim = -1; // no texture animation
-				} else {
-					pass.texanim = texanimlookup[tex[j].texanimid];
-				}
-			} else {
+		if (animTextures) {
+			if (tex[j].flags & TEXTUREUNIT_STATIC) {
 				pass.texanim = -1; // no texture animation
+			} else {
+				pass.texanim = texanimlookup[tex[j].texanimid];
 			}
-
-       		passes.push_back(pass);
+		} else {
+			pass.texanim = -1; // no texture animation
 		}
-		g.close();
-		// transparent parts come later
-		std::sort(passes.begin(), passes.end());
+
+       		s.passes.push_back(pass);
 	}
+	g.close();
+	// transparent parts come later
+	std::sort(s.passes.begin(), s.passes.end());
 
-	// zomg done
+	s.ok = true;
+	return true;
 }
 
-void Model::initStatic(MPQFile &f)
+void Model::optimizeIndices(ModelSkin &s, ModelGeoset *ops, size_t nOps, bool sharedVertices)
 {
-	origVertices = (ModelVertex*)(f.getBuffer() + header.ofsVertices);
+	for (size_t i=0; i<s.nIndices; i++) {
+		if (s.indices[i] >= header.nVertices) {
+			gLog("Error: vertex index out of range in [%s]\n", fullname.c_str());
+			return;
+		}
+	}
 
-	initCommon(f);
+	if (sharedVertices && vertexRemap)
+		remapIndices(s.indices, s.nIndices, vertexRemap);
+
+	float before = calcACMR(s.indices, s.nIndices);
+
+	// triangle order only changes within each geoset, so the passes stay valid
+	for (size_t i=0; i<nOps; i++) {
+		size_t start = ops[i].istart, end = start + ops[i].icount;
+		bool overlaps = end > s.nIndices;
+		for (size_t j=0; j<i; j++) {
+			if (start < ops[j].istart + ops[j].icount && ops[j].istart < end)
+				overlaps = true;
+		}
+		if (!overlaps)
+			optimizeVertexCache(s.indices + start, ops[i].icount);
+	}
+
+	// then put the vertices in the order they are first used
+	if (!sharedVertices && header.nVertices <= 0x10000) {
+		uint16 *remap = new uint16[header.nVertices];
+		buildFetchRemap(s.indices, s.nIndices, remap, header.nVertices);
+		remapIndices(s.indices, s.nIndices, remap);
+		remapVertexData(origVertices, remap, header.nVertices);
+		if (!animGeometry) {
+			remapVertexData(vertices, remap, header.nVertices);
+			remapVertexData(normals, remap, header.nVertices);
+		}
+		vertexRemap = remap;
+	}
 
-	dlist = glGenLists(1);
-	glNewList(dlist, GL_COMPILE);
+	gLog("Model %s: ACMR %.3f -> %.3f\n", fullname.c_str(), before, calcACMR(s.indices, s.nIndices));
+}
+
+void Model::compileSkin(int lod)
+{
+	skin = &skins[lod];
+	skin->dlist = glGenLists(1);
+	glNewList(skin->dlist, GL_COMPILE);
 
     drawModel();
 
 	glEndList();
 
+	delete[] skin->indices;
+	skin->indices = 0;
+}
+
+void Model::initStatic(MPQFile &f)
+{
+	origVertices = (ModelVertex*)(f.getBuffer() + header.ofsVertices);
+
+	initCommon(f);
+
+	for (int i=0; i<nSkins; i++) {
+		if (skins[i].ok)
+			compileSkin(i);
+	}
+
 	// clean up vertices, indices etc
 	delete[] vertices;
 	delete[] normals;
-	delete[] indices;
+	delete[] vertexRemap;
+	vertexRemap = 0;
 
 	if (colors) delete[] colors;
 	if (transparency) delete[] transparency;
@@ -429,7 +530,6 @@ void Model::initAnimated(MPQFile &f)
 	origVertices = new ModelVertex[header.nVertices];
 	memcpy(origVertices, f.getBuffer() + header.ofsVertices, header.nVertices * sizeof(ModelVertex));
 
-	glGenBuffersARB(1,&vbuf);
 	glGenBuffersARB(1,&tbuf);
 	const size_t size = header.nVertices * sizeof(float);
 	vbufsize = 3 * size;
@@ -440,14 +540,10 @@ void Model::initAnimated(MPQFile &f)
 		anims = new ModelAnimation[header.nAnimations];
 		memcpy(anims, f.getBuffer() + header.ofsAnimations, header.nAnimations * sizeof(ModelAnimation));
 
-		animfiles = new MPQFile[header.nAnimations];
-		char tempname[256];
-		for(size_t i=0; i<header.nAnimations; i++) {
-			sprintf(tempname, "%s%04d-%02d.anim", fullname.c_str(), anims[i].animID, anims[i].subAnimID);
-			if (MPQFile::getSize(tempname) > 0) {
-				animfiles[i].openFile(tempname);
-			}
-		}
+		// sequences kept in .anim files are read in by loadAnim() when first played
+		animLoaded = new bool[header.nAnimations];
+		for(size_t i=0; i<header.nAnimations; i++)
+			animLoaded[i] = (anims[i].flags & MODELANIM_INLINE) != 0;
 	}
 
 	if (animBones) {
@@ -455,11 +551,12 @@ void Model::initAnimated(MPQFile &f)
 		bones = new Bone[header.nBones];
 		ModelBoneDef *mb = (ModelBoneDef*)(f.getBuffer() + header.ofsBones);
 		for (size_t i=0; i<header.nBones; i++) {
-			bones[i].init(f, mb[i], globalSequences, animfiles);
+			bones[i].init(f, mb[i], globalSequences, anims);
 		}
 	}
 
 	if (!animGeometry) {
+		glGenBuffersARB(1,&vbuf);
 		glBindBufferARB(GL_ARRAY_BUFFER_ARB, vbuf);
 		glBufferDataARB(GL_ARRAY_BUFFER_ARB, vbufsize, vertices, GL_STATIC_DRAW_ARB);
 		glGenBuffersARB(1,&nbuf);
@@ -475,6 +572,9 @@ void Model::initAnimated(MPQFile &f)
 	glBufferDataARB(GL_ARRAY_BUFFER_ARB, 2*size, texcoords, GL_STATIC_DRAW_ARB);
 	delete[] texcoords;
 
+	if (animGeometry)
+		initGPUSkinning();
+
 	if (animTextures) {
 		texAnims = new TextureAnim[header.nTexAnims];
 		ModelTexAnimDef *ta = (ModelTexAnimDef*)(f.getBuffer() + header.ofsTexAnims);
@@ -521,17 +621,113 @@ void Model::initAnimated(MPQFile &f)
 }
 
 
+// what goes into sbuf, one vertex per ModelVertex
+struct SkinVertex {
+	Vec3D pos;
+	uint8 weights[4];
+	uint8 slots[4];
+	Vec3D normal;
+};
+
+bool Model::passesNeedCPU(const ModelSkin &s)
+{
+	// sphere mapping and the second texture unit aren't in the vertex program
+	for (size_t i=0; i<s.passes.size(); i++) {
+		if (s.passes[i].useEnvMap || s.passes[i].usetex2)
+			return true;
+	}
+	return false;
+}
+
+void Model::initGPUSkinning()
+{
+	// the vertex program does lights 0 to 2 only, the model's own lights go from GL_LIGHT4 up
+	// and there are no CPU vertices for the glBegin path drawModel falls back to without glDrawRangeElements
+	if (!supportShaders || !supportVBO || !supportDrawRangeElements || !skinShader || header.nLights > 0)
+		return;
+	for (int i=0; i<nSkins; i++) {
+		if (skins[i].ok && passesNeedCPU(skins[i]))
+			return;
+	}
+
+	// only bones that actually move vertices go into the palette
+	int slot[256];
+	for (int i=0; i<256; i++)
+		slot[i] = -1;
+	paletteBones.clear();
+	for (size_t i=0; i<header.nVertices; i++) {
+		for (size_t b=0; b<4; b++) {
+			uint8 bone = origVertices[i].bones[b];
+			if (origVertices[i].weights[b] > 0 && slot[bone] < 0) {
+				if (bone >= header.nBones || (int)paletteBones.size() >= skinMaxBones) {
+					paletteBones.clear();
+					return;
+				}
+				slot[bone] = (int)paletteBones.size();
+				paletteBones.push_back(bone);
+			}
+		}
+	}
+	if (paletteBones.empty())
+		return;
+
+	SkinVertex *sv = new SkinVertex[header.nVertices];
+	for (size_t i=0; i<header.nVertices; i++) {
+		ModelVertex &ov = origVertices[i];
+		sv[i].pos = ov.pos;
+		sv[i].normal = ov.normal;
+		for (size_t b=0; b<4; b++) {
+			sv[i].weights[b] = ov.weights[b];
+			sv[i].slots[b] = ov.weights[b] > 0 ? (uint8)slot[ov.bones[b]] : 0;
+		}
+	}
+	glGenBuffersARB(1, &sbuf);
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB, sbuf);
+	glBufferDataARB(GL_ARRAY_BUFFER_ARB, header.nVertices * sizeof(SkinVertex), sv, GL_STATIC_DRAW_ARB);
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+	delete[] sv;
+
+	palette.resize(paletteBones.size() * SKIN_PARAMS_PER_BONE * 4);
+	gpuSkin = true;
+}
+
+void Model::loadAnim(int anim)
+{
+	animLoaded[anim] = true;
+
+	char tempname[256];
+	sprintf(tempname, "%s%04d-%02d.anim", fullname.c_str(), anims[anim].animID, anims[anim].subAnimID);
+	MPQFile af(tempname);
+	if (af.isEof()) {
+		gLog("Error: loading animation [%s]\n", tempname);
+		return;
+	}
+
+	for (size_t i=0; i<header.nBones; i++) {
+		bones[i].initExternal(anim, af);
+	}
+
+	af.close();
+}
+
 void Model::calcBones(int anim, int time)
 {
+	if (anim < (int)header.nAnimations && !animLoaded[anim])
+		loadAnim(anim);
+
 	for (size_t i=0; i<header.nBones; i++) {
 		bones[i].calc = false;
 	}
 
 	for (size_t i=0; i<header.nBones; i++) {
-		bones[i].calcMatrix(bones, anim, time);
+		bones[i].calcMatrix(bones, anim, time, modelview);
 	}
 }
 
+// every palette animate packs gets a new stamp, so the upload cache in setupGPUSkinning can't mistake
+// a model for a deleted one at the same address
+static int paletteStamp = 0;
+
 void Model::animate(int anim)
 {
 	ModelAnimation &a = anims[anim];
@@ -545,11 +741,25 @@ void Model::animate(int anim)
 		calcBones(anim, t);
 	}
 
-	if (animGeometry) {
-
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, vbuf);
-        glBufferDataARB(GL_ARRAY_BUFFER_ARB, 2*vbufsize, NULL, GL_STREAM_DRAW_ARB);
-		vertices = (Vec3D*)glMapBufferARB(GL_ARRAY_BUFFER_ARB, GL_WRITE_ONLY);
+	if (animGeometry && gpuSkin) {
+		// the vertex program does the rest
+		float *p = &palette[0];
+		for (size_t i=0; i<paletteBones.size(); i++) {
+			Bone &b = bones[paletteBones[i]];
+			for (int r=0; r<3; r++, p+=4) {
+				p[0] = b.mat.m[r][0]; p[1] = b.mat.m[r][1]; p[2] = b.mat.m[r][2]; p[3] = b.mat.m[r][3];
+			}
+			for (int r=0; r<3; r++, p+=4) {
+				p[0] = b.mrot.m[r][0]; p[1] = b.mrot.m[r][1]; p[2] = b.mrot.m[r][2]; p[3] = 0;
+			}
+		}
+		paletteVersion = ++paletteStamp;
+	} else if (animGeometry) {
+		// kept here for the frames animation is skipped, drawModel copies it to the stream buffer
+		if (!vertices) {
+			vertices = new Vec3D[2 * header.nVertices];
+			normals = vertices + header.nVertices;
+		}
 
 		// transform vertices
 		ModelVertex *ov = origVertices;
@@ -565,16 +775,10 @@ void Model::animate(int anim)
 				}
 			}
 
-			/*
 			vertices[i] = v;
-			normals[i] = n;
-			*/
-			vertices[i] = v;
-			vertices[header.nVertices + i] = n.normalize(); // shouldn't these be normal by default?
+			normals[i] = n.normalize(); // shouldn't these be normal by default?
 		}
-
-        glUnmapBufferARB(GL_ARRAY_BUFFER_ARB);
-
+		streamGen = -1;
 	}
 
 	for (size_t i=0; i<header.nLights; i++) {
@@ -605,7 +809,7 @@ void Model::animate(int anim)
 bool ModelRenderPass::init(Model *m)
 {
 	// May aswell check that we're going to render the geoset before doing all this crap.
-	if (m->showGeosets[geoset]) {
+	if (m->skin->showGeosets[geoset]) {
 
 		// COLOUR
 		// Get the colour and transparency and check that we should even render
@@ -785,18 +989,65 @@ void ModelRenderPass::deinit()
 	//glColor4f(1,1,1,1); //???
 }
 
+// the palette in skinShader's local parameters, so instances of the same model don't upload it again
+static int paletteShaderVersion = -1;
+static int paletteUploaded = -1;
+
+void Model::setupGPUSkinning()
+{
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB, sbuf);
+	glVertexPointer(3, GL_FLOAT, sizeof(SkinVertex), GL_BUFFER_OFFSET(0));
+	glNormalPointer(GL_FLOAT, sizeof(SkinVertex), GL_BUFFER_OFFSET(20));
+	glVertexAttribPointerARB(SKIN_ATTRIB_WEIGHTS, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(SkinVertex), GL_BUFFER_OFFSET(12));
+	glVertexAttribPointerARB(SKIN_ATTRIB_BONES, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(SkinVertex), GL_BUFFER_OFFSET(16));
+	glEnableVertexAttribArrayARB(SKIN_ATTRIB_WEIGHTS);
+	glEnableVertexAttribArrayARB(SKIN_ATTRIB_BONES);
+
+	skinShader->bind();
+	if (paletteShaderVersion != skinShaderVersion || paletteUploaded != paletteVersion) {
+		setSkinningPalette(&palette[0], (int)paletteBones.size());
+		paletteShaderVersion = skinShaderVersion;
+		paletteUploaded = paletteVersion;
+	}
+}
+
+// lights 0 to 2, GL_LIGHTING and GL_COLOR_MATERIAL as bits, last uploaded to skinShader
+static int lightsShaderVersion = -1;
+static int lightsState = -1;
+
+static void setSkinningLights(int state)
+{
+	if (lightsShaderVersion == skinShaderVersion && lightsState == state)
+		return;
+	glProgramLocalParameter4fARB(GL_VERTEX_PROGRAM_ARB, SKIN_PARAM_LIGHTS,
+		(state & 1) ? 1.0f : 0.0f, (state & 2) ? 1.0f : 0.0f, (state & 4) ? 1.0f : 0.0f, (state & 8) ? 1.0f : 0.0f);
+	glProgramLocalParameter4fARB(GL_VERTEX_PROGRAM_ARB, SKIN_PARAM_COLORMAT, (state & 16) ? 1.0f : 0.0f, 0, 0, 0);
+	lightsShaderVersion = skinShaderVersion;
+	lightsState = state;
+}
+
 void Model::drawModel()
 {
 	// assume these client states are enabled: GL_VERTEX_ARRAY, GL_NORMAL_ARRAY, GL_TEXTURE_COORD_ARRAY
 
-	if (animated) {
+	bool skinOnGPU = animated && animGeometry && gpuSkin;
 
-		if (animGeometry) {
+	if (animated) {
 
-			glBindBufferARB(GL_ARRAY_BUFFER_ARB, vbuf);
+		if (skinOnGPU) {
+			setupGPUSkinning();
+		} else if (animGeometry) {
+			if (streamGen != streamBuffer.generation) {
+				void *dest = streamBuffer.alloc(2*vbufsize);
+				memcpy(dest, vertices, 2*vbufsize);
+				streamBase = streamBuffer.commit();
+				streamGen = streamBuffer.generation;
+			} else {
+				streamBuffer.bind();
+			}
 
-			glVertexPointer(3, GL_FLOAT, 0, 0);
-			glNormalPointer(GL_FLOAT, 0, GL_BUFFER_OFFSET(vbufsize));
+			glVertexPointer(3, GL_FLOAT, 0, streamBase);
+			glNormalPointer(GL_FLOAT, 0, streamBase + vbufsize);
 
 		} else {
 			glBindBufferARB(GL_ARRAY_BUFFER_ARB, vbuf);
@@ -814,11 +1065,22 @@ void Model::drawModel()
 	glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glAlphaFunc (GL_GREATER, 0.3f);
 
-	for (size_t i=0; i<passes.size(); i++) {
-		ModelRenderPass &p = passes[i];
+	// the lights are whatever the world left on for this model, the passes only turn lighting off for unlit ones
+	int lights = 0;
+	if (skinOnGPU) {
+		lights = (glIsEnabled(GL_LIGHT0) ? 1 : 0) | (glIsEnabled(GL_LIGHT1) ? 2 : 0) | (glIsEnabled(GL_LIGHT2) ? 4 : 0)
+			| (glIsEnabled(GL_LIGHTING) ? 8 : 0) | (glIsEnabled(GL_COLOR_MATERIAL) ? 16 : 0);
+	}
+
+	uint16 *indices = skin->indices;
+	for (size_t i=0; i<skin->passes.size(); i++) {
+		ModelRenderPass &p = skin->passes[i];
 
 		if (p.init(this)) {
 			// we don't want to render completely transparent parts
+
+			if (skinOnGPU)
+				setSkinningLights(p.unlit ? (lights & ~8) : lights);
 		
 			// render
 			if (animated) {
@@ -856,6 +1118,12 @@ void Model::drawModel()
 	}
 	// done with all render ops
 
+	if (skinOnGPU) {
+		skinShader->unbind();
+		glDisableVertexAttribArrayARB(SKIN_ATTRIB_WEIGHTS);
+		glDisableVertexAttribArrayARB(SKIN_ATTRIB_BONES);
+	}
+
 	glAlphaFunc (GL_GREATER, 0.0f);
 	glDisable (GL_ALPHA_TEST);
 
@@ -911,18 +1179,16 @@ void ModelCamera::setup(int time)
 {
 	if (!ok) return;
 
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	gluPerspective(fov * 34.5f, (GLfloat)video.xres/(GLfloat)video.yres, nearclip, farclip);
+	video.camera.perspective(fov * 34.5f, (GLfloat)video.xres/(GLfloat)video.yres, nearclip, farclip);
+	video.camera.loadProjection();
 
 	Vec3D p = pos + tPos.getValue(0, time);
 	Vec3D t = target + tTarget.getValue(0, time);
 
 	Vec3D u(0,1,0);
 
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
-	gluLookAt(p.x, p.y, p.z, t.x, t.y, t.z, u.x, u.y, u.z);
+	video.camera.lookAt(p, t, u);
+	video.camera.loadView();
 	//float roll = rot.getValue(0, time) / PI * 180.0f;
 	//glRotatef(roll, 0, 0, 1);
 }
@@ -979,21 +1245,28 @@ void TextureAnim::init(MPQFile &f, ModelTexAnimDef &mta, uint32 *global)
 	scale.init(mta.scale, f, global);
 }
 
-void Bone::init(MPQFile &f, ModelBoneDef &b, uint32 *global, MPQFile *animfiles)
+void Bone::init(MPQFile &f, ModelBoneDef &b, uint32 *global, ModelAnimation *anims)
 {
 	parent = b.parent;
 	pivot = fixCoordSystem(b.pivot);
 	billboard = (b.flags & MODELBONE_BILLBOARD) != 0;
 
-	trans.init(b.translation, f, global, animfiles);
-	rot.init(b.rotation, f, global, animfiles);
-	scale.init(b.scaling, f, global, animfiles);
+	trans.init(b.translation, f, global, anims);
+	rot.init(b.rotation, f, global, anims);
+	scale.init(b.scaling, f, global, anims);
 	trans.fix(fixCoordSystem);
 	rot.fix(fixCoordSystemQuat);
 	scale.fix(fixCoordSystem2);
 }
 
-void Bone::calcMatrix(Bone *allbones, int anim, int time)
+void Bone::initExternal(int anim, MPQFile &af)
+{
+	trans.initExternal(anim, af);
+	rot.initExternal(anim, af);
+	scale.initExternal(anim, af);
+}
+
+void Bone::calcMatrix(Bone *allbones, int anim, int time, const Matrix &modelview)
 {
 	if (calc) return;
 	Matrix m;
@@ -1016,11 +1289,8 @@ void Bone::calcMatrix(Bone *allbones, int anim, int time)
 			m *= Matrix::newScale(sc);
 		}
 		if (billboard) {
-			float modelview[16];
-			glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
-
-			Vec3D vRight = Vec3D(modelview[0], modelview[4], modelview[8]);
-			Vec3D vUp = Vec3D(modelview[1], modelview[5], modelview[9]); // Spherical billboarding
+			Vec3D vRight = Vec3D(modelview.m[0][0], modelview.m[0][1], modelview.m[0][2]);
+			Vec3D vUp = Vec3D(modelview.m[1][0], modelview.m[1][1], modelview.m[1][2]); // Spherical billboarding
 			//Vec3D vUp = Vec3D(0,1,0); // Cylindrical billboarding
 			vRight = vRight * -1;
 			m.m[0][2] = vRight.x;
@@ -1036,7 +1306,7 @@ void Bone::calcMatrix(Bone *allbones, int anim, int time)
 	} else m.unit();
 
 	if (parent>=0) {
-		allbones[parent].calcMatrix(allbones, anim, time);
+		allbones[parent].calcMatrix(allbones, anim, time, modelview);
 		mat = allbones[parent].mat * m;
 	} else mat = m;
 
@@ -1053,38 +1323,66 @@ void Bone::calcMatrix(Bone *allbones, int anim, int time)
 }
 
 
-void Model::draw()
+void Model::draw(int lod, const Matrix &world)
 {
 	if (!ok) return;
 
+	// billboards and particles want the full modelview, the camera has the view part
+	modelview = video.camera.view * world;
+
+	if (lod >= nSkins)
+		lod = nSkins-1;
+	if (lod > 0 && !skins[lod].ok)
+		lod = 0;
+	skin = (nSkins > 0 && skins[lod].ok) ? &skins[lod] : 0;
+
 	if (!animated) {
-		glCallList(dlist);
+		if (skin) glCallList(skin->dlist);
 	} else {
-		if (ind) animate(0);
-		else {
+		if (gWorld && drawFrame != gWorld->modelmanager.frame) {
+			// drawn without an instance (skyboxes), no distance to go by
+			seen(0);
+		}
+
+		if (ind) {
+			animate(0);
+			if (gWorld) gWorld->modelmanager.nAnimated++;
+		} else {
 			if (!animcalc) {
-				animate(0);
 				animcalc = true;
+				// once per frame at most, and only every few frames when far away
+				if (gWorld) {
+					ModelManager &mm = gWorld->modelmanager;
+					if (mm.frame - animFrame >= ModelManager::animInterval(min(emitDist, prevDist))) {
+						animate(0);
+						animFrame = mm.frame;
+						mm.nAnimated++;
+					} else {
+						mm.nAnimSkipped++;
+					}
+				} else {
+					animate(0);
+				}
 			}
 		}
-		lightsOn(GL_LIGHT4);
-        drawModel();
-		lightsOff(GL_LIGHT4);
-
-		// effects are unfogged..?
-		glDisable(GL_FOG);
-
-		// draw particle systems
-		for (size_t i=0; i<header.nParticleEmitters; i++) {
-			particleSystems[i].draw();
+		if (skin) {
+			lightsOn(GL_LIGHT4);
+			drawModel();
+			lightsOff(GL_LIGHT4);
 		}
 
-		// draw ribbons
-		for (size_t i=0; i<header.nRibbonEmitters; i++) {
-			ribbons[i].draw();
-		}
+		// particle systems and ribbons go into the frame's particle batch, in eye space
+		if (header.nParticleEmitters || header.nRibbonEmitters) {
+			Matrix mv = modelview;
+			mv.transpose();
 
-		if (gWorld && gWorld->drawfog) glEnable(GL_FOG);
+			for (size_t i=0; i<header.nParticleEmitters; i++) {
+				particleSystems[i].draw(particleBatch, mv);
+			}
+			for (size_t i=0; i<header.nRibbonEmitters; i++) {
+				ribbons[i].draw(particleBatch, mv);
+			}
+		}
 	}
 }
 
@@ -1099,11 +1397,34 @@ void Model::lightsOff(GLuint lbase)
 	for (unsigned int i=0, l=lbase; i<header.nLights; i++) glDisable(l++);
 }
 
-void Model::updateEmitters(float dt)
+void Model::updateEmitters(float dt, float lod)
 {
 	if (!ok) return;
 	for (size_t i=0; i<header.nParticleEmitters; i++) {
-		particleSystems[i].update(dt);
+		particleSystems[i].update(dt, lod);
+	}
+}
+
+void Model::seen(float dist)
+{
+	ModelManager &mm = gWorld->modelmanager;
+	if (drawFrame != mm.frame) {
+		// keep last frame's nearest distance, later instances of this frame may be closer than the first
+		prevDist = (drawFrame == mm.frame - 1) ? emitDist : dist;
+		drawFrame = mm.frame;
+		emitDist = dist;
+		animcalc = false;
+		mm.active.push_back(this);
+	} else if (dist < emitDist) {
+		emitDist = dist;
+	}
+}
+
+void Model::needTextures(float pixels)
+{
+	for (size_t i=0; i<header.nTextures; i++) {
+		if (textures[i])
+			video.textures.need(textures[i], pixels);
 	}
 }
 
@@ -1119,21 +1440,137 @@ int ModelManager::add(std::string name)
 	Model *model = new Model(name);
 	id = nextID();
     do_add(name, id, model);
+	if (model->ok && model->header.nParticleEmitters)
+		nEmitterModels++;
     return id;
 }
 
+void ModelManager::doDelete(int id)
+{
+	Model *m = (Model*)items[id];
+	if (m->ok && m->header.nParticleEmitters)
+		nEmitterModels--;
+	std::vector<Model*>::iterator it = std::find(active.begin(), active.end(), m);
+	if (it != active.end())
+		active.erase(it);
+}
+
+#define ANIM_LOD_NEAR		80.0f
+#define ANIM_LOD_STEP		60.0f
+#define ANIM_LOD_MAX_INTERVAL	6
+
+int ModelManager::animInterval(float dist)
+{
+	if (dist <= ANIM_LOD_NEAR)
+		return 1;
+	return min(2 + (int)((dist - ANIM_LOD_NEAR) / ANIM_LOD_STEP), ANIM_LOD_MAX_INTERVAL);
+}
+
 void ModelManager::resetAnim()
 {
-	for (std::map<int, ManagedItem*>::iterator it = items.begin(); it != items.end(); ++it) {
-		((Model*)it->second)->animcalc = false;
+	for (int i=0; i<MAX_SKINS; i++)
+		lodCount[i] = 0;
+	// animcalc is cleared when a model is first drawn in the new frame, see Model::seen
+	frame++;
+	active.clear();
+	nAnimated = nAnimSkipped = 0;
+}
+
+void *ModelManager::takeJob()
+{
+	// the main thread may have finished the work before this worker got to it
+	if (shares == 0)
+		return 0;
+	shares--;
+	return this;
+}
+
+bool ModelManager::runJob(void *)
+{
+	runEmitters();
+	return true;
+}
+
+void ModelManager::jobDone(void *, bool)
+{
+}
+
+// models are handed out one at a time; each model's emitters only touch that model
+void ModelManager::runEmitters()
+{
+	for (;;) {
+		SDL_mutexP(lock);
+		if (workNext >= work.size()) {
+			SDL_mutexV(lock);
+			break;
+		}
+		Model *m = work[workNext++];
+		SDL_mutexV(lock);
+
+		m->updateEmitters(workDt, m->emitLOD);
 	}
 }
 
 void ModelManager::updateEmitters(float dt)
 {
-	for (std::map<int, ManagedItem*>::iterator it = items.begin(); it != items.end(); ++it) {
-		((Model*)it->second)->updateEmitters(dt);
+	// only models drawn this frame get updated; the others are paused until they're seen again
+	work.clear();
+	int demand = 0;
+	for (size_t i=0; i<active.size(); i++) {
+		Model *m = active[i];
+		if (!m->ok || !m->header.nParticleEmitters)
+			continue;
+		m->emitLOD = ParticleBudget::distanceScale(m->emitDist);
+		for (size_t i=0; i<m->header.nParticleEmitters; i++)
+			demand += (int)(m->particleSystems[i].capacity() * m->emitLOD);
+		work.push_back(m);
 	}
+
+	particleBudget.update(dt, gFPS, demand);
+	particleBudget.paused = nEmitterModels - (int)work.size();
+	for (size_t i=0; i<work.size(); i++)
+		work[i]->emitLOD *= particleBudget.scale;
+
+	updateWork(dt);
+
+	int live = 0;
+	for (size_t i=0; i<work.size(); i++) {
+		for (size_t j=0; j<work[i]->header.nParticleEmitters; j++)
+			live += work[i]->particleSystems[j].liveCount();
+	}
+	particleBudget.live = live;
+}
+
+// runs Model::updateEmitters over work, on the worker threads if there are any
+void ModelManager::updateWork(float dt)
+{
+	if (nWorkers < 0) {
+		startWorkers(min(cpuCount() - 1, MAX_EMITTER_THREADS));
+		if (nWorkers > 0)
+			gLog("Updating particle emitters on %d threads\n", nWorkers+1);
+	}
+
+	if (nWorkers == 0 || work.size() < 2) {
+		for (size_t i=0; i<work.size(); i++)
+			work[i]->updateEmitters(dt, work[i]->emitLOD);
+		return;
+	}
+
+	SDL_mutexP(lock);
+	workNext = 0;
+	workDt = dt;
+	shares = nWorkers;
+	SDL_mutexV(lock);
+	for (int i=0; i<nWorkers; i++)
+		post();
+	runEmitters();
+
+	// the shares nobody took aren't needed any more, wait for the ones that were
+	SDL_mutexP(lock);
+	shares = 0;
+	while (running() > 0)
+		waitJobDone();
+	SDL_mutexV(lock);
 }
 
 ModelInstance::ModelInstance(Model *m, MPQFile &f) : model (m)
@@ -1148,6 +1585,16 @@ ModelInstance::ModelInstance(Model *m, MPQFile &f) : model (m)
 	f.read(&scale,4);
 	// scale factor - divide by 1024. blizzard devs must be on crack, why not just use a float?
 	sc = scale / 1024.0f;
+	lod = 0;
+
+	const float deg = PI / 180.0f;
+	mat = Matrix::newTranslation(pos);
+	mat *= Matrix::newRotation(Vec3D(0,1,0), (dir.y - 90.0f) * deg);
+	mat *= Matrix::newRotation(Vec3D(0,0,1), -dir.x * deg);
+	mat *= Matrix::newRotation(Vec3D(1,0,0), dir.z * deg);
+	mat *= Matrix::newScale(Vec3D(sc,sc,sc));
+	glmat = mat;
+	glmat.transpose();
 }
 
 void ModelInstance::init2(Model *m, MPQFile &f)
@@ -1167,51 +1614,57 @@ void ModelInstance::init2(Model *m, MPQFile &f)
 	unsigned int d1;
 	f.read(&d1,4); // (B,G,R,A) Lightning-color. 
 	lcol = fromARGB(d1);
+	lod = 0;
+
+	// newQuatRotate gives the transpose, the way glMultMatrixf wants it
+	Matrix rot = Matrix::newQuatRotate(Quaternion(Vec3D(-dir.z, dir.x, dir.y), w));
+	rot.transpose();
+	mat = Matrix::newTranslation(pos) * rot * Matrix::newScale(Vec3D(sc,-sc,-sc));
+	glmat = mat;
+	glmat.transpose();
 }
 
-void ModelInstance::draw()
-{
-	//if ((pos - gWorld->camera).lengthSquared() > (gWorld->modeldrawdistance2+(model->rad*model->rad*sc))) return;
-	float dist = (pos - gWorld->camera).length() - model->rad;
-	if (dist > gWorld->modeldrawdistance) return;
-	if (!gWorld->frustum.intersectsSphere(pos, model->rad*sc)) return;
+// projected radius in pixels below which each skin gives way to the next one
+const float lodSwitchSize[MAX_SKINS-1] = { 100.0f, 40.0f, 15.0f };
+// how far past a switch size we have to go before switching, so models don't flicker between skins
+const float lodHysteresis = 0.15f;
 
-	glPushMatrix();
-	glTranslatef(pos.x, pos.y, pos.z);
-
-	glRotatef(dir.y - 90.0f, 0, 1, 0);
-	glRotatef(-dir.x, 0, 0, 1);
-	glRotatef(dir.z, 1, 0, 0);
-
-	glScalef(sc,sc,sc);
-
-	model->draw();
-	glPopMatrix();
-}
-
-void glQuaternionRotate(const Vec3D& vdir, float w)
+void ModelInstance::selectLOD(float dist, float radius)
 {
-	Matrix m;
-	Quaternion q(vdir, w);
-	m.quaternionRotate(q);
-	glMultMatrixf(m);
+	int n = model->nSkins;
+	if (lod >= n) lod = n-1;
+	if (lod < 0) lod = 0;
+
+	if (n > 1) {
+		// radius on screen for the 45 degree vertical fov set up in Video
+		const float pixelScale = video.yres * 0.5f / tanf(22.5f * PI / 180.0f);
+		float size = (dist > radius) ? radius / dist * pixelScale : pixelScale;
+
+		while (lod < n-1 && size < lodSwitchSize[lod] * (1.0f - lodHysteresis))
+			lod++;
+		while (lod > 0 && size > lodSwitchSize[lod-1] * (1.0f + lodHysteresis))
+			lod--;
+	}
+
+	gWorld->modelmanager.lodCount[lod]++;
 }
 
-void ModelInstance::draw2(const Vec3D& ofs, const float rot)
+void ModelInstance::draw()
 {
-	Vec3D tpos(ofs + pos);
-	rotate(ofs.x,ofs.z,&tpos.x,&tpos.z,rot*PI/180.0f);
-	if ( (tpos - gWorld->camera).lengthSquared() > (gWorld->doodaddrawdistance2*model->rad*sc) ) return;
-	if (!gWorld->frustum.intersectsSphere(tpos, model->rad*sc)) return;
+	//if ((pos - gWorld->camera).lengthSquared() > (gWorld->modeldrawdistance2+(model->rad*model->rad*sc))) return;
+	// the model's bounding sphere is centered on its origin
+	float radius = model->rad*sc;
+	float dist = (pos - gWorld->camera).length() - radius;
+	if (dist > gWorld->modeldrawdistance) return;
+	if (!gWorld->frustum.intersectsSphere(pos, radius)) return;
 
 	glPushMatrix();
+	glMultMatrixf(glmat);
 
-	glTranslatef(pos.x, pos.y, pos.z);
-	Vec3D vdir(-dir.z,dir.x,dir.y);
-	glQuaternionRotate(vdir,w);
-	glScalef(sc,-sc,-sc);
-
-	model->draw();
+	selectLOD(dist + radius, radius);
+	model->seen(dist + radius);
+	model->needTextures(video.projectedSize(2*radius, dist + radius));
+	model->draw(lod, mat);
 	glPopMatrix();
 }
 
@@ -36,8 +36,9 @@ public:
 	Matrix mrot;
 
 	bool calc;
-	void calcMatrix(Bone* allbones, int anim, int time);
-	void init(MPQFile &f, ModelBoneDef &b, uint32 *global, MPQFile *animfiles);
+	void calcMatrix(Bone* allbones, int anim, int time, const Matrix &modelview);
+	void init(MPQFile &f, ModelBoneDef &b, uint32 *global, ModelAnimation *anims);
+	void initExternal(int anim, MPQFile &af);
 
 };
 
@@ -108,6 +109,20 @@ struct ModelRenderPass {
 	}
 };
 
+// view/skin profiles (.skin files), 00 is the most detailed one
+#define	MAX_SKINS	4
+
+struct ModelSkin {
+	bool ok;
+	uint16 *indices;
+	size_t nIndices;
+	std::vector<ModelRenderPass> passes;
+	bool *showGeosets;
+	GLuint dlist;
+
+	ModelSkin():ok(false), indices(0), nIndices(0), showGeosets(0), dlist(0) {}
+};
+
 struct ModelCamera {
 	bool ok;
 
@@ -134,14 +149,13 @@ struct ModelLight {
 
 class Model: public ManagedItem {
 
-	GLuint dlist;
 	GLuint vbuf, nbuf, tbuf;
 	size_t vbufsize;
 	bool animated;
 	bool animGeometry,animTextures,animBones;
 
 	bool forceAnim;
-	MPQFile *animfiles;
+	bool *animLoaded;
 
 	void init(MPQFile &f);
 
@@ -156,18 +170,42 @@ class Model: public ManagedItem {
 	RibbonEmitter *ribbons;
 
 	void drawModel();
+	void initVertices();
 	void initCommon(MPQFile &f);
 	bool isAnimated(MPQFile &f);
 	void initAnimated(MPQFile &f);
 	void initStatic(MPQFile &f);
+	bool initSkin(MPQFile &f, int lod);
+	void compileSkin(int lod);
+	void optimizeIndices(ModelSkin &s, ModelGeoset *ops, size_t nOps, bool sharedVertices);
 
 	ModelVertex *origVertices;
 	Vec3D *vertices, *normals;
-	uint16 *indices;
-	size_t nIndices;
-	std::vector<ModelRenderPass> passes;
+	uint16 *vertexRemap;
+
+	// CPU skinned vertices and normals in streamBuffer, valid while its generation is streamGen
+	int streamGen;
+	const char *streamBase;
+
+	// GPU skinning: the untransformed vertices with palette slots live in sbuf,
+	// animate() only fills in the bone palette for skinShader
+	bool gpuSkin;
+	GLuint sbuf;
+	std::vector<uint8> paletteBones;
+	std::vector<float> palette;
+	int paletteVersion;
+	void initGPUSkinning();
+	bool passesNeedCPU(const ModelSkin &s);
+	void setupGPUSkinning();
+
+	ModelSkin skins[MAX_SKINS];
+	ModelSkin *skin;
+
+	// camera view * world of the current draw, for billboarded bones and particles
+	Matrix modelview;
 
 	void animate(int anim);
+	void loadAnim(int anim);
 	void calcBones(int anim, int time);
 
 	void lightsOn(GLuint lbase);
@@ -177,10 +215,6 @@ public:
 	ModelCamera cam;
 	Bone *bones;
 
-	// ===============================
-	// Toggles
-	bool *showGeosets;
-
 	// ===============================
 	// Texture data
 	// ===============================
@@ -192,6 +226,7 @@ public:
 
 	bool ok;
 	bool ind;
+	int nSkins;
 
 	float rad;
 	float trans;
@@ -201,22 +236,70 @@ public:
 
 	Model(std::string name, bool forceAnim=false);
 	~Model();
-	void draw();
-	void updateEmitters(float dt);
+	// world places the model, the same transform the caller has multiplied onto the modelview
+	void draw(int lod, const Matrix &world);
+	void updateEmitters(float dt, float lod = 1.0f);
+
+	// distance to the nearest instance drawn in frame drawFrame, for particle emission and animation LOD
+	float emitDist;
+	// the nearest distance of the frame before, the animation LOD decision is made before all instances are in
+	float prevDist;
+	int drawFrame;
+	float emitLOD;
+	// frame the bones were last calculated in
+	int animFrame;
+	void seen(float dist);
+	// the model covers about pixels across the screen, stream in texture levels to match
+	void needTextures(float pixels);
 
 	friend struct ModelRenderPass;
+	friend class ModelManager;
 };
 
-class ModelManager: public SimpleManager {
+// worker threads for ModelManager::updateEmitters, the main thread takes a share as well
+#define MAX_EMITTER_THREADS 8
+
+class ModelManager: public SimpleManager, public WorkerPool {
+	std::vector<Model*> work;
+	size_t workNext;
+	float workDt;
+	// a job is a share of work, the workers and the main thread take models from it until it's empty
+	int shares;
+
+	void runEmitters();
+	void updateWork(float dt);
+	void *takeJob();
+	bool runJob(void *job);
+	void jobDone(void *job, bool ok);
+
+	// loaded models with particle emitters
+	int nEmitterModels;
+
 public:
 	int add(std::string name);
 
-	ModelManager() : v(0) {}
+	ModelManager() : shares(0), nEmitterModels(0), v(0), frame(0) { resetAnim(); }
+	~ModelManager() { stopWorkers(); }
 
 	int v;
 
+	// counts up in resetAnim, once per drawn frame
+	int frame;
+
+	// models with something drawn this frame, in the order they were first drawn
+	std::vector<Model*> active;
+	// animated models whose bones were updated / left as they were this frame
+	int nAnimated, nAnimSkipped;
+
+	void doDelete(int id);
+
+	// instances drawn with each skin this frame
+	int lodCount[MAX_SKINS];
+
 	void resetAnim();
 	void updateEmitters(float dt);
+	// frames between bone updates at this distance
+	static int animInterval(float dist);
 
 };
 
@@ -236,11 +319,16 @@ public:
 	Vec3D ldir;
 	Vec4D lcol;
 
-	ModelInstance() { model = 0; }
+	int lod;
+
+	// placement, in the map for map tile models and in the WMO for doodads; glmat is the transpose for glMultMatrixf
+	Matrix mat, glmat;
+
+	ModelInstance() { model = 0; lod = 0; }
 	ModelInstance(Model *m, MPQFile &f);
     void init2(Model *m, MPQFile &f);
 	void draw();
-	void draw2(const Vec3D& ofs, const float rot);
+	void selectLOD(float dist, float radius);
 
 };
 
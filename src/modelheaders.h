@@ -122,6 +122,8 @@ struct ModelAnimation {
 	int16 Index;
 };
 
+#define	MODELANIM_INLINE	0x20	// keyframes are in the .m2, otherwise in a %04d-%02d.anim file
+
 struct AnimationBlockHeader
 {
 	uint32 nEntrys;
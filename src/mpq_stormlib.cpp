@@ -3,15 +3,81 @@
 
 #include <vector>
 #include <string>
+#include <SDL/SDL.h>
 #include "util.h"
 
 using namespace std;
 
-typedef vector< pair< string, HANDLE* > > ArchiveSet;
+typedef vector< pair< string, HANDLE > > ArchiveSet;
 static ArchiveSet gOpenArchives;
 
+// StormLib archive handles can't be used from two threads at once (WMO groups and textures are read
+// on worker threads). The main thread uses gOpenArchives, every other thread opens its own handles
+// to the same files, so reads and decompression don't wait on each other.
+// gMPQLock only guards the per thread sets.
+static SDL_mutex *gMPQLock = 0;
+static Uint32 gMainThread;
+// bumped when an archive is opened or closed, the thread sets are reopened to match
+static int gArchiveVersion = 0;
+
+struct ThreadArchives {
+	Uint32 thread;
+	int version;
+	ArchiveSet archives;
+};
+static vector<ThreadArchives*> gThreadArchives;
+
+static void closeArchives(ArchiveSet &archives)
+{
+	for (ArchiveSet::iterator it=archives.begin(); it!=archives.end(); ++it)
+		SFileCloseArchive(it->second);
+	archives.clear();
+}
+
+// the calling thread's handles to the open archives, in search order
+static const ArchiveSet &threadArchives()
+{
+	Uint32 id = SDL_ThreadID();
+	if (!gMPQLock || id == gMainThread)
+		return gOpenArchives;
+
+	SDL_mutexP(gMPQLock);
+	ThreadArchives *t = 0;
+	for (size_t i=0; i<gThreadArchives.size(); i++) {
+		if (gThreadArchives[i]->thread == id) {
+			t = gThreadArchives[i];
+			break;
+		}
+	}
+	if (!t) {
+		t = new ThreadArchives;
+		t->thread = id;
+		t->version = -1;
+		gThreadArchives.push_back(t);
+	}
+	if (t->version != gArchiveVersion) {
+		closeArchives(t->archives);
+		for (ArchiveSet::iterator it=gOpenArchives.begin(); it!=gOpenArchives.end(); ++it) {
+			HANDLE mpq;
+			if (SFileOpenArchive(it->first.c_str(), 0, MPQ_OPEN_FORCE_MPQ_V1|MPQ_OPEN_READ_ONLY, &mpq))
+				t->archives.push_back(make_pair(it->first, mpq));
+			else
+				gLog("Error opening archive %s on a worker thread, error #: 0x%x\n", it->first.c_str(), GetLastError());
+		}
+		t->version = gArchiveVersion;
+	}
+	SDL_mutexV(gMPQLock);
+	return t->archives;
+}
+
 MPQArchive::MPQArchive(const char* filename) : ok(false)
 {
+	// archives are opened on the main thread before anything else is loaded
+	if (!gMPQLock) {
+		gMPQLock = SDL_CreateMutex();
+		gMainThread = SDL_ThreadID();
+	}
+
 	if (!SFileOpenArchive(filename, 0, MPQ_OPEN_FORCE_MPQ_V1|MPQ_OPEN_READ_ONLY, &mpq_a )) {
 		int nError = GetLastError();
 		gLog("Error opening archive %s, error #: 0x%x\n", filename, nError);
@@ -42,7 +108,10 @@ MPQArchive::MPQArchive(const char* filename) : ok(false)
 	*/
 
 	ok = true;
-	gOpenArchives.push_back( make_pair( filename, &mpq_a ) );
+	SDL_mutexP(gMPQLock);
+	gOpenArchives.push_back( make_pair( filename, mpq_a ) );
+	gArchiveVersion++;
+	SDL_mutexV(gMPQLock);
 }
 
 MPQArchive::~MPQArchive()
@@ -70,15 +139,21 @@ void MPQArchive::close()
 	if (ok == false)
 		return;
 	SFileCloseArchive(mpq_a);
+	SDL_mutexP(gMPQLock);
 	for(ArchiveSet::iterator it=gOpenArchives.begin(); it!=gOpenArchives.end();++it)
 	{
-		HANDLE &mpq_b = *it->second;
-		if (&mpq_b == &mpq_a) {
+		if (it->second == mpq_a) {
 			gOpenArchives.erase(it);
 			//delete (*it);
-			return;
+			break;
 		}
 	}
+
+	// the worker threads are stopped by now, their copies are closed here and reopened if still needed
+	for (size_t i=0; i<gThreadArchives.size(); i++)
+		closeArchives(gThreadArchives[i]->archives);
+	gArchiveVersion++;
+	SDL_mutexV(gMPQLock);
 	
 }
 
@@ -97,9 +172,10 @@ MPQFile::openFile(const char* filename)
 	pointer = 0;
 	size = 0;
 
-	for(ArchiveSet::iterator i=gOpenArchives.begin(); i!=gOpenArchives.end(); ++i)
+	const ArchiveSet &archives = threadArchives();
+	for(ArchiveSet::const_iterator i=archives.begin(); i!=archives.end(); ++i)
 	{
-		HANDLE &mpq_a = *i->second;
+		HANDLE mpq_a = i->second;
 
 		HANDLE fh;
 
@@ -145,9 +221,10 @@ MPQFile::~MPQFile()
 
 bool MPQFile::exists(const char* filename)
 {
-	for(ArchiveSet::iterator i=gOpenArchives.begin(); i!=gOpenArchives.end();++i)
+	const ArchiveSet &archives = threadArchives();
+	for(ArchiveSet::const_iterator i=archives.begin(); i!=archives.end();++i)
 	{
-		HANDLE &mpq_a = *i->second;
+		HANDLE mpq_a = i->second;
 
 		if( SFileHasFile( mpq_a, filename ) )
 			return true;
@@ -215,9 +292,10 @@ size_t MPQFile::getSize()
 
 int MPQFile::getSize(const char* filename)
 {
-	for(ArchiveSet::iterator i=gOpenArchives.begin(); i!=gOpenArchives.end();++i)
+	const ArchiveSet &archives = threadArchives();
+	for(ArchiveSet::const_iterator i=archives.begin(); i!=archives.end();++i)
 	{
-		HANDLE &mpq_a = *i->second;
+		HANDLE mpq_a = i->second;
 		HANDLE fh;
 		
 		if( !SFileOpenFileEx( mpq_a, filename, SFILE_OPEN_PATCHED_FILE, &fh ) )
@@ -233,9 +311,10 @@ int MPQFile::getSize(const char* filename)
 
 const char* MPQFile::getArchive(const char* filename)
 {
-	for(ArchiveSet::iterator i=gOpenArchives.begin(); i!=gOpenArchives.end();++i)
+	const ArchiveSet &archives = threadArchives();
+	for(ArchiveSet::const_iterator i=archives.begin(); i!=archives.end();++i)
 	{
-		HANDLE &mpq_a = *i->second;
+		HANDLE mpq_a = i->second;
 		HANDLE fh;
 		
 		if( !SFileOpenFileEx( mpq_a, filename, SFILE_OPEN_PATCHED_FILE, &fh ) )
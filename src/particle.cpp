@@ -1,5 +1,11 @@
 #include "particle.h"
 #include "wowmapview.h"
+#include <cstddef>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define PARTICLE_SSE
+#include <xmmintrin.h>
+#endif
 
 #define MAX_PARTICLES 10000
 
@@ -22,11 +28,67 @@ Vec4D fromBGRA(uint32 color)
     return Vec4D(r,g,b,a);
 }
 
-template<class T>
-T lifeRamp(float life, float mid, const T &a, const T &b, const T &c)
+void ParticlePool::alloc(int n, bool withCorners)
+{
+	capacity = n;
+	count = 0;
+	px.resize(n); py.resize(n); pz.resize(n);
+	vx.resize(n); vy.resize(n); vz.resize(n);
+	dx.resize(n); dy.resize(n); dz.resize(n);
+	down.resize(n);
+	life.resize(n); maxlife.resize(n); size.resize(n);
+	cr.resize(n); cg.resize(n); cb.resize(n); ca.resize(n);
+	scale.resize(n);
+	origin.resize(n);
+	tile.resize(n);
+	if (withCorners)
+		corners.resize(n*4);
+}
+
+void ParticlePool::add(const Particle &p)
+{
+	int i = count++;
+	px[i] = p.pos.x; py[i] = p.pos.y; pz[i] = p.pos.z;
+	vx[i] = p.speed.x; vy[i] = p.speed.y; vz[i] = p.speed.z;
+	dx[i] = p.dir.x; dy[i] = p.dir.y; dz[i] = p.dir.z;
+	down[i] = p.down.y;
+	life[i] = p.life;
+	maxlife[i] = p.maxlife;
+	size[i] = p.size;
+	cr[i] = p.color.x; cg[i] = p.color.y; cb[i] = p.color.z; ca[i] = p.color.w;
+	origin[i] = p.origin;
+	tile[i] = p.tile;
+	if (!corners.empty()) {
+		for (int k=0; k<4; k++)
+			corners[i*4+k] = p.corners[k];
+	}
+}
+
+void ParticlePool::remove(int i)
+{
+	int j = --count;
+	if (i == j)
+		return;
+	px[i] = px[j]; py[i] = py[j]; pz[i] = pz[j];
+	vx[i] = vx[j]; vy[i] = vy[j]; vz[i] = vz[j];
+	dx[i] = dx[j]; dy[i] = dy[j]; dz[i] = dz[j];
+	down[i] = down[j];
+	life[i] = life[j];
+	maxlife[i] = maxlife[j];
+	size[i] = size[j];
+	cr[i] = cr[j]; cg[i] = cg[j]; cb[i] = cb[j]; ca[i] = ca[j];
+	origin[i] = origin[j];
+	tile[i] = tile[j];
+	if (!corners.empty()) {
+		for (int k=0; k<4; k++)
+			corners[i*4+k] = corners[j*4+k];
+	}
+}
+
+// lifeRamp without the branch: a + (b-a)*min(life/mid,1) + (c-b)*max((life-mid)/(1-mid),0)
+inline float lifeRamp(float t0, float t1, float a, float b, float c)
 {
-	if (life<=mid) return interpolate<T>(life / mid,a,b);
-	else return interpolate<T>((life-mid) / (1.0f-mid),b,c);
+	return a + (b-a)*t0 + (c-b)*t1;
 }
 
 
@@ -94,6 +156,15 @@ void ParticleSystem::init(MPQFile &f, ModelParticleEmitterDef &mta, uint32 *glob
 	rem = 0;
 
 	tofs = frand();
+	rng.seed(rand() ^ (rand() << 15));
+
+	// about rate particles are alive at once (spawned at rate/lifespan per second, living lifespan seconds)
+	float maxRate = 0;
+	for (size_t i=0; i<MAX_ANIMATED; i++) {
+		for (size_t j=0; j<rate.data[i].size(); j++)
+			maxRate = max(maxRate, rate.data[i][j]);
+	}
+	maxParticles = min(MAX_PARTICLES, (int)(maxRate * 2.0f) + 64);
 
 	// init tiles
 	for (int i=0; i<rows*cols; i++) {
@@ -127,14 +198,14 @@ void ParticleSystem::initTile(Vec2D *tc, int num)
 }
 
 
-void ParticleSystem::update(float dt)
+void ParticleSystem::update(float dt, float lod)
 {
 	float grav = gravity.getValue(manim, mtime);
 	float deaccel = deacceleration.getValue(manim, mtime);
 
 	// spawn new particles
 	if (emitter) {
-		float frate = rate.getValue(manim, mtime);
+		float frate = rate.getValue(manim, mtime) * lod;
 		float flife = 1.0f;
 		flife = lifespan.getValue(manim, mtime);
 
@@ -146,10 +217,17 @@ void ParticleSystem::update(float dt)
 		} else {
 			int tospawn = (int)ftospawn;
 
-			if ((tospawn + particles.size()) > MAX_PARTICLES) // Error check to prevent the program from trying to load insane amounts of particles.
-				tospawn = (int)particles.size() - MAX_PARTICLES;
+			if (particles.capacity == 0)
+				particles.alloc(maxParticles, !billboard);
+			// Error check to prevent the program from trying to load insane amounts of particles.
+			// Far away or over budget the cap comes down too; what's above it just dies off.
+			int cap = max(8, (int)(particles.capacity * lod));
+			if (tospawn > cap - particles.count)
+				tospawn = max(cap - particles.count, 0);
 
 			rem = ftospawn - (float)tospawn;
+			if (rem > 1.0f) // the pool is full, don't save up for later
+				rem = 0;
 
 			
 			float w = areal.getValue(manim, mtime) * 0.5f;
@@ -164,38 +242,94 @@ void ParticleSystem::update(float dt)
 
 			//rem = 0;
 			if (en) {
-				for (int i=0; i<tospawn; i++) {
-					Particle p = emitter->newParticle(manim, mtime, w, l, spd, var, spr, spr2);
-					// sanity check:
-					//if (particles.size() < MAX_PARTICLES) // No need to check this every loop iteration. Already checked above.
-						particles.push_back(p);
-				}
+				for (int i=0; i<tospawn; i++)
+					particles.add(emitter->newParticle(manim, mtime, w, l, spd, var, spr, spr2));
 			}
 		}
 	}
 
-	float mspeed = 1.0f;
-
-	for (ParticleList::iterator it = particles.begin(); it != particles.end(); ) {
-		Particle &p = *it;
-		p.speed += p.down * grav * dt - p.dir * deaccel * dt;
+	ParticlePool &p = particles;
+	const int n = p.count;
+	if (n == 0)
+		return;
+
+	// the only per particle exp; everything after this is plain float arrays
+	for (int i=0; i<n; i++)
+		p.scale[i] = (slowdown>0) ? expf(-1.0f * slowdown * p.life[i]) * dt : dt;
+
+	const float gdt = grav * dt;
+	const float ddt = deaccel * dt;
+	const float rmid = 1.0f / mid;
+	const float rmid2 = 1.0f / (1.0f - mid);
+
+	int i = 0;
+#ifdef PARTICLE_SSE
+	const __m128 vgdt = _mm_set1_ps(gdt);
+	const __m128 vddt = _mm_set1_ps(ddt);
+	const __m128 vdt = _mm_set1_ps(dt);
+	const __m128 vmid = _mm_set1_ps(mid);
+	const __m128 vrmid = _mm_set1_ps(rmid);
+	const __m128 vrmid2 = _mm_set1_ps(rmid2);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	for (; i+4<=n; i+=4) {
+		__m128 vx = _mm_sub_ps(_mm_loadu_ps(&p.vx[i]), _mm_mul_ps(_mm_loadu_ps(&p.dx[i]), vddt));
+		__m128 vy = _mm_add_ps(_mm_loadu_ps(&p.vy[i]), _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(&p.down[i]), vgdt), _mm_mul_ps(_mm_loadu_ps(&p.dy[i]), vddt)));
+		__m128 vz = _mm_sub_ps(_mm_loadu_ps(&p.vz[i]), _mm_mul_ps(_mm_loadu_ps(&p.dz[i]), vddt));
+		_mm_storeu_ps(&p.vx[i], vx);
+		_mm_storeu_ps(&p.vy[i], vy);
+		_mm_storeu_ps(&p.vz[i], vz);
+
+		__m128 sc = _mm_loadu_ps(&p.scale[i]);
+		_mm_storeu_ps(&p.px[i], _mm_add_ps(_mm_loadu_ps(&p.px[i]), _mm_mul_ps(vx, sc)));
+		_mm_storeu_ps(&p.py[i], _mm_add_ps(_mm_loadu_ps(&p.py[i]), _mm_mul_ps(vy, sc)));
+		_mm_storeu_ps(&p.pz[i], _mm_add_ps(_mm_loadu_ps(&p.pz[i]), _mm_mul_ps(vz, sc)));
+
+		__m128 life = _mm_add_ps(_mm_loadu_ps(&p.life[i]), vdt);
+		_mm_storeu_ps(&p.life[i], life);
+
+		// size and color based on lifetime
+		__m128 rlife = _mm_div_ps(life, _mm_loadu_ps(&p.maxlife[i]));
+		__m128 t0 = _mm_min_ps(_mm_mul_ps(rlife, vrmid), one);
+		__m128 t1 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(rlife, vmid), vrmid2), zero);
+
+#define RAMP(dst, a, b, c) _mm_storeu_ps(&(dst)[i], _mm_add_ps(_mm_set1_ps(a), _mm_add_ps(_mm_mul_ps(_mm_set1_ps((b)-(a)), t0), _mm_mul_ps(_mm_set1_ps((c)-(b)), t1))))
+		RAMP(p.size, sizes[0], sizes[1], sizes[2]);
+		RAMP(p.cr, colors[0].x, colors[1].x, colors[2].x);
+		RAMP(p.cg, colors[0].y, colors[1].y, colors[2].y);
+		RAMP(p.cb, colors[0].z, colors[1].z, colors[2].z);
+		RAMP(p.ca, colors[0].w, colors[1].w, colors[2].w);
+#undef RAMP
+	}
+#endif
+	for (; i<n; i++) {
+		p.vx[i] -= p.dx[i] * ddt;
+		p.vy[i] += p.down[i] * gdt - p.dy[i] * ddt;
+		p.vz[i] -= p.dz[i] * ddt;
+
+		p.px[i] += p.vx[i] * p.scale[i];
+		p.py[i] += p.vy[i] * p.scale[i];
+		p.pz[i] += p.vz[i] * p.scale[i];
+
+		p.life[i] += dt;
+
+		// size and color based on lifetime
+		float rlife = p.life[i] / p.maxlife[i];
+		float t0 = min(rlife * rmid, 1.0f);
+		float t1 = max((rlife - mid) * rmid2, 0.0f);
+		p.size[i] = lifeRamp(t0, t1, sizes[0], sizes[1], sizes[2]);
+		p.cr[i] = lifeRamp(t0, t1, colors[0].x, colors[1].x, colors[2].x);
+		p.cg[i] = lifeRamp(t0, t1, colors[0].y, colors[1].y, colors[2].y);
+		p.cb[i] = lifeRamp(t0, t1, colors[0].z, colors[1].z, colors[2].z);
+		p.ca[i] = lifeRamp(t0, t1, colors[0].w, colors[1].w, colors[2].w);
+	}
 
-		if (slowdown>0) {
-			mspeed = expf(-1.0f * slowdown * p.life);
-		}
-		p.pos += p.speed * mspeed * dt;
-		
-		p.life += dt;
-		float rlife = p.life / p.maxlife;
-		// calculate size and color based on lifetime
-		p.size = lifeRamp<float>(rlife, mid, sizes[0], sizes[1], sizes[2]);
-		p.color = lifeRamp<Vec4D>(rlife, mid, colors[0], colors[1], colors[2]);
-
-		// kill off old particles
-		if (rlife >= 1.0f) 
-			particles.erase(it++);
-		else 
-			++it;
+	// kill off old particles
+	for (i=0; i<p.count; ) {
+		if (p.life[i] >= p.maxlife[i])
+			p.remove(i);
+		else
+			++i;
 	}
 }
 
@@ -208,246 +342,140 @@ void ParticleSystem::setup(int anim, int time)
 	if (transform) {
 		// transform every particle by the parent trans matrix   - apparently this isn't needed
 		Matrix m = parent->mat;
-		for (ParticleList::iterator it = particles.begin(); it != particles.end(); ++it) {
-			it->tpos = m * it->pos;
-		}
-	} else {
-		for (ParticleList::iterator it = particles.begin(); it != particles.end(); ++it) {
-			it->tpos = it->pos;
-		}
+		...
+	}
 	}
 	*/
 }
 
-void ParticleSystem::draw()
+// modelview * v
+static inline void toEye(const float *m, const Vec3D &v, ParticleVertex &out)
 {
-	/*
-	// just draw points:
-	glDisable(GL_TEXTURE_2D);
-	glDisable(GL_LIGHTING);
-	glColor4f(1,1,1,1);
-	glBegin(GL_POINTS);
-	for (ParticleList::iterator it = particles.begin(); it != particles.end(); ++it) {
-		glVertex3fv(it->tpos);
-	}
-	glEnd();
-	glEnable(GL_LIGHTING);
-	glEnable(GL_TEXTURE_2D);
-	*/
-	//blend = 1;
-	// setup blend mode
-	switch (blend) {
-	case 0:
-		glDisable(GL_BLEND);
-		glDisable(GL_ALPHA_TEST);
-		break;
-	case 1:
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_COLOR, GL_ONE);
-		glDisable(GL_ALPHA_TEST);
-		break;
-	case 2:
-		glEnable(GL_BLEND);
-		// originally
-		//glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); 
-		// Changed blending mode to this in 0.5.08, seems to fix a few of the render problems
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE); 
-		glDisable(GL_ALPHA_TEST);
-		break;
-	case 3:
-		glDisable(GL_BLEND);
-		glEnable(GL_ALPHA_TEST);
-		break;
-	case 4:
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-		glDisable(GL_ALPHA_TEST);
-		break;
-	default:
-		break;
-	}
-	
-	//glDisable(GL_LIGHTING);
-	//glDisable(GL_CULL_FACE);
-	//glDepthMask(GL_FALSE);
-
-	glBindTexture(GL_TEXTURE_2D, texture);
-
-	/*
-	if (supportPointSprites && rows==1 && cols==1) {
-		// This is how will our point sprite's size will be modified by 
-		// distance from the viewer
-		float quadratic[] = {0.1f, 0.0f, 0.5f};
-		//float quadratic[] = {0.88f, 0.001f, 0.000004f};
-		glPointParameterfvARB( GL_POINT_DISTANCE_ATTENUATION_ARB, quadratic);
-
-		// Query for the max point size supported by the hardware
-		float maxSize = 512.0f;
-		//glGetFloatv(GL_POINT_SIZE_MAX_ARB, &maxSize );
-
-		// Clamp size to 100.0f or the sprites could get a little too big on some  
-		// of the newer graphic cards. My ATI card at home supports a max point 
-		// size of 1024.0f!
-		//if( maxSize > 100.0f )
-		//	maxSize = 100.0f;
-
-		glPointSize(maxSize);
-
-		// The alpha of a point is calculated to allow the fading of points 
-		// instead of shrinking them past a defined threshold size. The threshold 
-		// is defined by GL_POINT_FADE_THRESHOLD_SIZE_ARB and is not clamped to 
-		// the minimum and maximum point sizes.
-		glPointParameterfARB(GL_POINT_FADE_THRESHOLD_SIZE_ARB, 60.0f);
-
-		glPointParameterfARB(GL_POINT_SIZE_MIN_ARB, 1.0f );
-		glPointParameterfARB(GL_POINT_SIZE_MAX_ARB, maxSize );
-
-		// Specify point sprite texture coordinate replacement mode for each texture unit
-		glTexEnvf(GL_POINT_SPRITE_ARB, GL_COORD_REPLACE_ARB, GL_TRUE);
-		// Render point sprites...
-		glEnable(GL_POINT_SPRITE_ARB);
-
-		glBegin(GL_POINTS);
-		{
-			for (ParticleList::iterator it = particles.begin(); it != particles.end(); ++it) {
-				glPointSize(it->size);
-				glTexCoord2fv(tiles[it->tile].tc[0]);
-				glColor4fv(it->color);
-				glVertex3fv(it->pos);
-			}
-		}
-		glEnd();
+	out.x = m[0]*v.x + m[4]*v.y + m[8]*v.z + m[12];
+	out.y = m[1]*v.x + m[5]*v.y + m[9]*v.z + m[13];
+	out.z = m[2]*v.x + m[6]*v.y + m[10]*v.z + m[14];
+}
 
-		glDisable(GL_POINT_SPRITE_ARB);
-		glTexEnvf(GL_POINT_SPRITE_ARB, GL_COORD_REPLACE_ARB, GL_FALSE);
+static inline void packColor(unsigned char *c, float r, float g, float b, float a)
+{
+	c[0] = (unsigned char)(min(max(r, 0.0f), 1.0f) * 255.0f);
+	c[1] = (unsigned char)(min(max(g, 0.0f), 1.0f) * 255.0f);
+	c[2] = (unsigned char)(min(max(b, 0.0f), 1.0f) * 255.0f);
+	c[3] = (unsigned char)(min(max(a, 0.0f), 1.0f) * 255.0f);
+}
 
-	} else { // Old slow method */
+static inline void setCorner(ParticleVertex &v, const Vec2D &tc, const unsigned char *color)
+{
+	v.u = tc.x;
+	v.v = tc.y;
+	*(uint32*)v.color = *(const uint32*)color;
+}
 
-		Vec3D vRight(1,0,0);
-		Vec3D vUp(0,1,0);
+// camera facing quad around a point that's already in eye space
+static inline void billboardQuad(ParticleVertex *v, float x, float y, float z, float size, const TexCoordSet &tc, const unsigned char *color)
+{
+	v[0].x = x - size; v[0].y = y - size; v[0].z = z;
+	v[1].x = x + size; v[1].y = y - size; v[1].z = z;
+	v[2].x = x + size; v[2].y = y + size; v[2].z = z;
+	v[3].x = x - size; v[3].y = y + size; v[3].z = z;
+	for (int k=0; k<4; k++)
+		setCorner(v[k], tc.tc[k], color);
+}
 
-		// position stuff
-		const float f = 1;//0.707106781f; // sqrt(2)/2
-		Vec3D bv0 = Vec3D(-f,+f,0);
-		Vec3D bv1 = Vec3D(+f,+f,0);
-		Vec3D bv2 = Vec3D(+f,-f,0);
-		Vec3D bv3 = Vec3D(-f,-f,0);
+void ParticleSystem::draw(ParticleBatch &batch, const float *modelview)
+{
+	ParticlePool &p = particles;
+	const int n = p.count;
+	if (n == 0 || tiles.empty())
+		return;
 
-		if (billboard) {
-			float modelview[16];
-			glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+	const float *m = modelview;
+	const unsigned int ntiles = (unsigned int)tiles.size();
+	ParticleVertex *v = batch.add(texture, blend, n);
+	unsigned char color[4];
 
-			vRight = Vec3D(modelview[0], modelview[4], modelview[8]);
-			vUp = Vec3D(modelview[1], modelview[5], modelview[9]); // Spherical billboarding
-			//vUp = Vec3D(0,1,0); // Cylindrical billboarding
-		}
-		/*
-		 * type:
-		 * 0	 "normal" particle
-		 * 1	large quad from the particle's origin to its position (used in Moonwell water effects)
-		 * 2	seems to be the same as 0 (found some in the Deeprun Tram blinky-lights-sign thing)
- 		 */
-		if (type==0 || type==2 ) {
-			// TODO: figure out type 2 (deeprun tram subway sign)
-			// - doesn't seem to be any different from 0 -_-
-			// regular particles
-
-			if (billboard) {
-				glBegin(GL_QUADS);
-				// TODO: per-particle rotation in a non-expensive way?? :|
-				for (ParticleList::iterator it = particles.begin(); it != particles.end(); ++it) {
-					if (tiles.size() - 1 < it->tile) // Alfred, 2009.08.07, error prevent
-						break;
-					const float size = it->size;// / 2;
-					glColor4fv(it->color);
-
-					glTexCoord2fv(tiles[it->tile].tc[0]);
-					glVertex3fv(it->pos - (vRight + vUp) * size);
-
-					glTexCoord2fv(tiles[it->tile].tc[1]);
-					glVertex3fv(it->pos + (vRight - vUp) * size);
-
-					glTexCoord2fv(tiles[it->tile].tc[2]);
-					glVertex3fv(it->pos + (vRight + vUp) * size);
-
-					glTexCoord2fv(tiles[it->tile].tc[3]);
-					glVertex3fv(it->pos - (vRight - vUp) * size);
-				}
-				glEnd();
-
-			} else {
-				glBegin(GL_QUADS);
-				for (ParticleList::iterator it = particles.begin(); it != particles.end(); ++it) {
-					if (tiles.size() - 1 < it->tile) // Alfred, 2009.08.07, error prevent
-						break;
-					glColor4fv(it->color);
-
-					glTexCoord2fv(tiles[it->tile].tc[0]);
-					glVertex3fv(it->pos + it->corners[0] * it->size);
-
-					glTexCoord2fv(tiles[it->tile].tc[1]);
-					glVertex3fv(it->pos + it->corners[1] * it->size);
-
-					glTexCoord2fv(tiles[it->tile].tc[2]);
-					glVertex3fv(it->pos + it->corners[2] * it->size);
-
-					glTexCoord2fv(tiles[it->tile].tc[3]);
-					glVertex3fv(it->pos + it->corners[3] * it->size);
-				}
-				glEnd();
+	/*
+	 * type:
+	 * 0	 "normal" particle
+	 * 1	large quad from the particle's origin to its position (used in Moonwell water effects)
+	 * 2	seems to be the same as 0 (found some in the Deeprun Tram blinky-lights-sign thing)
+	 */
+	if ((type==0 || type==2) && billboard) {
+		// TODO: figure out type 2 (deeprun tram subway sign)
+		// - doesn't seem to be any different from 0 -_-
+		// TODO: per-particle rotation in a non-expensive way?? :|
+
+		// in eye space the billboard is just +-size on x and y, only the center gets transformed;
+		// the model instance's scale still applies to the size
+		const float scale = sqrtf(m[0]*m[0] + m[1]*m[1] + m[2]*m[2]);
+		int i = 0;
+#ifdef PARTICLE_SSE
+		float ex[4], ey[4], ez[4];
+		for (; i+4<=n; i+=4) {
+			__m128 x = _mm_loadu_ps(&p.px[i]);
+			__m128 y = _mm_loadu_ps(&p.py[i]);
+			__m128 z = _mm_loadu_ps(&p.pz[i]);
+			_mm_storeu_ps(ex, _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(m[0])), _mm_mul_ps(y, _mm_set1_ps(m[4]))), _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(m[8])), _mm_set1_ps(m[12]))));
+			_mm_storeu_ps(ey, _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(m[1])), _mm_mul_ps(y, _mm_set1_ps(m[5]))), _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(m[9])), _mm_set1_ps(m[13]))));
+			_mm_storeu_ps(ez, _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(m[2])), _mm_mul_ps(y, _mm_set1_ps(m[6]))), _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(m[10])), _mm_set1_ps(m[14]))));
+			for (int k=0; k<4; k++) {
+				int j = i+k;
+				packColor(color, p.cr[j], p.cg[j], p.cb[j], p.ca[j]);
+				billboardQuad(v + j*4, ex[k], ey[k], ez[k], p.size[j] * scale, tiles[p.tile[j] < ntiles ? p.tile[j] : 0], color);
 			}
-		} else if (type==1) { // Sphere particles
-			// particles from origin to position
-			/*
-			bv0 = mbb * Vec3D(0,-1.0f,0);
-			bv1 = mbb * Vec3D(0,+1.0f,0);
-			
-
-			bv0 = mbb * Vec3D(-1.0f,0,0);
-			bv1 = mbb * Vec3D(1.0f,0,0);
-			*/
-
-			glBegin(GL_QUADS);
-			for (ParticleList::iterator it = particles.begin(); it != particles.end(); ++it) {
-				if (tiles.size() - 1 < it->tile) // Alfred, 2009.08.07, error prevent
-					break;
-				glColor4fv(it->color);
-
-				glTexCoord2fv(tiles[it->tile].tc[0]);
-				glVertex3fv(it->pos + bv0 * it->size);
-
-				glTexCoord2fv(tiles[it->tile].tc[1]);
-				glVertex3fv(it->pos + bv1 * it->size);
-
-				glTexCoord2fv(tiles[it->tile].tc[2]);
-				glVertex3fv(it->origin + bv1 * it->size);
-
-				glTexCoord2fv(tiles[it->tile].tc[3]);
-				glVertex3fv(it->origin + bv0 * it->size);
+		}
+#endif
+		for (; i<n; i++) {
+			float x = m[0]*p.px[i] + m[4]*p.py[i] + m[8]*p.pz[i] + m[12];
+			float y = m[1]*p.px[i] + m[5]*p.py[i] + m[9]*p.pz[i] + m[13];
+			float z = m[2]*p.px[i] + m[6]*p.py[i] + m[10]*p.pz[i] + m[14];
+			packColor(color, p.cr[i], p.cg[i], p.cb[i], p.ca[i]);
+			billboardQuad(v + i*4, x, y, z, p.size[i] * scale, tiles[p.tile[i] < ntiles ? p.tile[i] : 0], color);
+		}
+	} else if (type==0 || type==2) {
+		for (int i=0; i<n; i++) {
+			const TexCoordSet &tc = tiles[p.tile[i] < ntiles ? p.tile[i] : 0];
+			const Vec3D pos(p.px[i], p.py[i], p.pz[i]);
+			const Vec3D *corners = &p.corners[i*4];
+			packColor(color, p.cr[i], p.cg[i], p.cb[i], p.ca[i]);
+			for (int k=0; k<4; k++) {
+				toEye(m, pos + corners[k] * p.size[i], v[i*4+k]);
+				setCorner(v[i*4+k], tc.tc[k], color);
 			}
-			glEnd();
-			
 		}
-	//}
-
-	//glEnable(GL_LIGHTING);
-	//glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	//glDepthMask(GL_TRUE);
-	//glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+	} else if (type==1) { // Sphere particles
+		// particles from origin to position
+		const Vec3D bv0(-1,+1,0);
+		const Vec3D bv1(+1,+1,0);
+		for (int i=0; i<n; i++) {
+			const TexCoordSet &tc = tiles[p.tile[i] < ntiles ? p.tile[i] : 0];
+			const Vec3D pos(p.px[i], p.py[i], p.pz[i]);
+			const float size = p.size[i];
+			packColor(color, p.cr[i], p.cg[i], p.cb[i], p.ca[i]);
+			toEye(m, pos + bv0 * size, v[i*4]);
+			toEye(m, pos + bv1 * size, v[i*4+1]);
+			toEye(m, p.origin[i] + bv1 * size, v[i*4+2]);
+			toEye(m, p.origin[i] + bv0 * size, v[i*4+3]);
+			for (int k=0; k<4; k++)
+				setCorner(v[i*4+k], tc.tc[k], color);
+		}
+	} else {
+		// unknown type, nothing sensible to draw; collapse the quads
+		memset(v, 0, n*4*sizeof(ParticleVertex));
+	}
 }
 
 //Generates the rotation matrix based on spread
-Matrix	SpreadMat;
-void CalcSpreadMatrix(float Spread1,float Spread2, float w, float l)
+static Matrix CalcSpreadMatrix(ParticleRandom &rng, float Spread1,float Spread2, float w, float l)
 {
 	int i,j;
 	float a[2],c[2],s[2];
-	Matrix	Temp;
+	Matrix	SpreadMat, Temp;
 	
 	SpreadMat.unit();
 	
-	a[0]=randfloat(-Spread1,Spread1)/2.0f;
-	a[1]=randfloat(-Spread2,Spread2)/2.0f;
+	a[0]=rng.randfloat(-Spread1,Spread1)/2.0f;
+	a[1]=rng.randfloat(-Spread2,Spread2)/2.0f;
 	
 	/*SpreadMat.m[0][0]*=l;
 	SpreadMat.m[1][1]*=l;
@@ -478,6 +506,7 @@ void CalcSpreadMatrix(float Spread1,float Spread2, float w, float l)
 	for(i=0;i<3;i++)
 		for(j=0;j<3;j++)
 			SpreadMat.m[i][j]*=Size;
+	return SpreadMat;
 }
 
 Particle PlaneParticleEmitter::newParticle(int anim, int time, float w, float l, float spd, float var, float spr, float spr2)
@@ -526,13 +555,12 @@ Particle PlaneParticleEmitter::newParticle(int anim, int time, float w, float l,
 	//Spread Calculation
 	Matrix mrot;
 
-	CalcSpreadMatrix(spr,spr,1.0f,1.0f);
-	mrot=sys->parent->mrot*SpreadMat;
+	mrot=sys->parent->mrot*CalcSpreadMatrix(sys->rng,spr,spr,1.0f,1.0f);
 	
 	if (sys->flags == 1041) { // Trans Halo
-		p.pos = sys->parent->mat * (sys->pos + Vec3D(randfloat(-l,l), 0, randfloat(-w,w)));
+		p.pos = sys->parent->mat * (sys->pos + Vec3D(sys->rng.randfloat(-l,l), 0, sys->rng.randfloat(-w,w)));
 
-		const float t = randfloat(0.0f, float(2*PI));
+		const float t = sys->rng.randfloat(0.0f, float(2*PI));
 
 		p.pos = Vec3D(0.0f, sys->pos.y + 0.15f, sys->pos.z) + Vec3D(cos(t)/8, 0.0f, sin(t)/8); // Need to manually correct for the halo - why?
 		
@@ -542,26 +570,26 @@ Particle PlaneParticleEmitter::newParticle(int anim, int time, float w, float l,
 		Vec3D dir(0.0f, 1.0f, 0.0f);
 		p.dir = dir;
 
-		p.speed = dir.normalize() * spd * randfloat(0, var);
+		p.speed = dir.normalize() * spd * sys->rng.randfloat(0, var);
 	} else if (sys->flags == 25 && sys->parent->parent<1) { // Weapon Flame
-		p.pos = sys->parent->pivot * (sys->pos + Vec3D(randfloat(-l,l), randfloat(-l,l), randfloat(-w,w)));
+		p.pos = sys->parent->pivot * (sys->pos + Vec3D(sys->rng.randfloat(-l,l), sys->rng.randfloat(-l,l), sys->rng.randfloat(-w,w)));
 		Vec3D dir = mrot * Vec3D(0.0f, 1.0f, 0.0f);
 		p.dir = dir.normalize();
 		//Vec3D dir = sys->model->bones[sys->parent->parent].mrot * sys->parent->mrot * Vec3D(0.0f, 1.0f, 0.0f);
 		//p.speed = dir.normalize() * spd;
 
 	} else if (sys->flags == 25 && sys->parent->parent > 0) { // Weapon with built-in Flame (Avenger lightsaber!)
-		p.pos = sys->parent->mat * (sys->pos + Vec3D(randfloat(-l,l), randfloat(-l,l), randfloat(-w,w)));
+		p.pos = sys->parent->mat * (sys->pos + Vec3D(sys->rng.randfloat(-l,l), sys->rng.randfloat(-l,l), sys->rng.randfloat(-w,w)));
 		Vec3D dir = Vec3D(sys->parent->mat.m[1][0],sys->parent->mat.m[1][1], sys->parent->mat.m[1][2]) * Vec3D(0.0f, 1.0f, 0.0f);
-		p.speed = dir.normalize() * spd * randfloat(0, var*2);
+		p.speed = dir.normalize() * spd * sys->rng.randfloat(0, var*2);
 
 	} else if (sys->flags == 17 && sys->parent->parent<1) { // Weapon Glow
-		p.pos = sys->parent->pivot * (sys->pos + Vec3D(randfloat(-l,l), randfloat(-l,l), randfloat(-w,w)));
+		p.pos = sys->parent->pivot * (sys->pos + Vec3D(sys->rng.randfloat(-l,l), sys->rng.randfloat(-l,l), sys->rng.randfloat(-w,w)));
 		Vec3D dir = mrot * Vec3D(0,1,0);
 		p.dir = dir.normalize();
 		
 	} else {
-		p.pos = sys->pos + Vec3D(randfloat(-l,l), 0, randfloat(-w,w));
+		p.pos = sys->pos + Vec3D(sys->rng.randfloat(-l,l), 0, sys->rng.randfloat(-w,w));
 		p.pos = sys->parent->mat * p.pos;
 
 		//Vec3D dir = mrot * Vec3D(0,1,0);
@@ -569,7 +597,7 @@ Particle PlaneParticleEmitter::newParticle(int anim, int time, float w, float l,
 		
 		p.dir = dir;//.normalize();
 		p.down = Vec3D(0,-1.0f,0); // dir * -1.0f;
-		p.speed = dir.normalize() * spd * (1.0f+randfloat(-var,var));
+		p.speed = dir.normalize() * spd * (1.0f+sys->rng.randfloat(-var,var));
 	}
 
 	if(!sys->billboard)	{
@@ -584,7 +612,7 @@ Particle PlaneParticleEmitter::newParticle(int anim, int time, float w, float l,
 
 	p.origin = p.pos;
 
-	p.tile = randint(0, sys->rows*sys->cols-1);
+	p.tile = sys->rng.randint(0, sys->rows*sys->cols-1);
 	return p;
 }
 
@@ -594,24 +622,23 @@ Particle SphereParticleEmitter::newParticle(int anim, int time, float w, float l
 	Vec3D dir;
 	float radius;
 
-	radius = randfloat(0,1);
+	radius = sys->rng.randfloat(0,1);
 	
 	// Old method
-	//float t = randfloat(0,2*PI);
+	//float t = sys->rng.randfloat(0,2*PI);
 
 	// New
 	// Spread should never be zero for sphere particles ?
 	float t = 0;
 	if (spr == 0)
-		t = randfloat((float)-PI,(float)PI);
+		t = sys->rng.randfloat((float)-PI,(float)PI);
 	else
-		t = randfloat(-spr,spr);
+		t = sys->rng.randfloat(-spr,spr);
 
 	//Spread Calculation
 	Matrix mrot;
 
-	CalcSpreadMatrix(spr*2,spr2*2,w,l);
-	mrot=sys->parent->mrot*SpreadMat;
+	mrot=sys->parent->mrot*CalcSpreadMatrix(sys->rng,spr*2,spr2*2,w,l);
 
 	// New
 	// Length should never technically be zero ?
@@ -629,11 +656,11 @@ Particle SphereParticleEmitter::newParticle(int anim, int time, float w, float l
 
 	
 	float theta_range = sys->spread.getValue(anim, time);
-	float theta = -0.5f* theta_range + randfloat(0, theta_range);
+	float theta = -0.5f* theta_range + sys->rng.randfloat(0, theta_range);
 	Vec3D bdir(0, l*cosf(theta), w*sinf(theta));
 
 	float phi_range = sys->lat.getValue(anim, time);
-	float phi = randfloat(0, phi_range);
+	float phi = sys->rng.randfloat(0, phi_range);
 	rotate(0,0, &bdir.z, &bdir.x, phi);
 	*/
 
@@ -647,7 +674,7 @@ Particle SphereParticleEmitter::newParticle(int anim, int time, float w, float l
 			p.speed = Vec3D(0,0,0);
 		else {
 			dir = sys->parent->mrot * (bdir.normalize());//mrot * Vec3D(0, 1.0f,0);
-			p.speed = dir.normalize() * spd * (1.0f+randfloat(-var,var));   // ?
+			p.speed = dir.normalize() * spd * (1.0f+sys->rng.randfloat(-var,var));   // ?
 		}
 
 	} else {
@@ -677,7 +704,7 @@ Particle SphereParticleEmitter::newParticle(int anim, int time, float w, float l
 			else
 				dir = bdir.normalize();
 
-			p.speed = dir.normalize() * spd * (1.0f+randfloat(-var,var));   // ?
+			p.speed = dir.normalize() * spd * (1.0f+sys->rng.randfloat(-var,var));   // ?
 		}
 	}
 
@@ -689,7 +716,7 @@ Particle SphereParticleEmitter::newParticle(int anim, int time, float w, float l
 
 	p.origin = p.pos;
 
-	p.tile = randint(0, sys->rows*sys->cols-1);
+	p.tile = sys->rng.randint(0, sys->rows*sys->cols-1);
 	return p;
 }
 
@@ -717,11 +744,15 @@ void RibbonEmitter::init(MPQFile &f, ModelRibbonEmitterDef &mta, uint32 *globals
 	seglen = mta.length;
 	length = mta.res * seglen;
 
+	// the trail is cut at length, so there's never much more than numsegs segments
+	segs.resize(max(numsegs, 0) + 4);
+
 	// create first segment
-	RibbonSegment rs;
+	seghead = 0;
+	nsegs = 1;
+	RibbonSegment &rs = seg(0);
 	rs.pos = tpos;
 	rs.len = 0;
-	segs.push_back(rs);
 }
 
 void RibbonEmitter::setup(int anim, int time)
@@ -736,16 +767,18 @@ void RibbonEmitter::setup(int anim, int time)
 	mtime = time;
 
 	// move first segment
-	RibbonSegment &first = *segs.begin();
+	RibbonSegment &first = seg(0);
 	if (first.len > seglen) {
-		// add new segment
+		// add new segment, dropping the oldest one if the ring is full
 		first.back = (tpos-ntpos).normalize();
 		first.len0 = first.len;
-		RibbonSegment newseg;
+		seghead = (seghead + (int)segs.size() - 1) % (int)segs.size();
+		if (nsegs < (int)segs.size())
+			nsegs++;
+		RibbonSegment &newseg = seg(0);
 		newseg.pos = ntpos;
 		newseg.up = ntup;
 		newseg.len = dlen;
-		segs.push_front(newseg);
 	} else {
 		first.up = ntup;
 		first.pos = ntpos;
@@ -754,17 +787,13 @@ void RibbonEmitter::setup(int anim, int time)
 
 	// kill stuff from the end
 	float l = 0;
-	bool erasemode = false;
-	for (std::list<RibbonSegment>::iterator it = segs.begin(); it != segs.end(); ) {
-		if (!erasemode) {
-			l += it->len;
-			if (l > length) {
-				it->len = l - length;
-				erasemode = true;
-			}
-			++it;
-		} else {
-			segs.erase(it++);
+	for (int i=0; i<nsegs; i++) {
+		RibbonSegment &s = seg(i);
+		l += s.len;
+		if (l > length) {
+			s.len = l - length;
+			nsegs = i+1;
+			break;
 		}
 	}
 
@@ -775,62 +804,199 @@ void RibbonEmitter::setup(int anim, int time)
 	tbelow = below.getValue(anim, time);
 }
 
-void RibbonEmitter::draw()
+void RibbonEmitter::draw(ParticleBatch &batch, const float *modelview)
 {
-	/*
-	// placeholders
-	glDisable(GL_TEXTURE_2D);
-	glDisable(GL_LIGHTING);
-	glColor4f(1,1,1,1);
-	glBegin(GL_TRIANGLES);
-	glVertex3fv(tpos);
-	glVertex3fv(tpos + Vec3D(1,1,0));
-	glVertex3fv(tpos + Vec3D(-1,1,0));
-	glEnd();
-	glEnable(GL_TEXTURE_2D);
-	glEnable(GL_LIGHTING);
-	*/
+	// a quad strip through the segments, plus the stretch back from the last one
+	int npairs = nsegs + (nsegs > 1 ? 1 : 0);
+	if (npairs < 2)
+		return;
 
-	glBindTexture(GL_TEXTURE_2D, texture);
-	glEnable(GL_BLEND);
-	glDisable(GL_LIGHTING);
-	glDisable(GL_ALPHA_TEST);
-	glDisable(GL_CULL_FACE);
-	glDepthMask(GL_FALSE);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-	glColor4fv(tcolor);
+	unsigned char color[4];
+	packColor(color, tcolor.x, tcolor.y, tcolor.z, tcolor.w);
+
+	ParticleVertex *v = batch.add(texture, 4, npairs - 1);
 
-	glBegin(GL_QUAD_STRIP);
-	std::list<RibbonSegment>::iterator it = segs.begin();
+	ParticleVertex top, bottom, ptop, pbottom;
 	float l = 0;
-	for (; it != segs.end(); ++it) {
-        float u = l/length;
+	for (int i=0; i<npairs; i++) {
+		float u;
+		if (i < nsegs) {
+			RibbonSegment &s = seg(i);
+			u = l/length;
+			toEye(modelview, s.pos + tabove * s.up, top);
+			toEye(modelview, s.pos - tbelow * s.up, bottom);
+			l += s.len;
+		} else {
+			// last segment...?
+			RibbonSegment &s = seg(nsegs-1);
+			u = 1;
+			toEye(modelview, s.pos + tabove * s.up + (s.len/s.len0) * s.back, top);
+			toEye(modelview, s.pos - tbelow * s.up + (s.len/s.len0) * s.back, bottom);
+		}
+		setCorner(top, Vec2D(u,0), color);
+		setCorner(bottom, Vec2D(u,1), color);
+
+		if (i > 0) {
+			*v++ = ptop;
+			*v++ = pbottom;
+			*v++ = bottom;
+			*v++ = top;
+		}
+		ptop = top;
+		pbottom = bottom;
+	}
+}
 
-		glTexCoord2f(u,0);
-		glVertex3fv(it->pos + tabove * it->up);
-		glTexCoord2f(u,1);
-		glVertex3fv(it->pos - tbelow * it->up);
+ParticleBatch particleBatch;
+ParticleBudget particleBudget;
 
-		l += it->len;
-	}
-	
-	if (segs.size() > 1) {
-		// last segment...?
-		--it;
-		glTexCoord2f(1,0);
-		glVertex3fv(it->pos + tabove * it->up + (it->len/it->len0) * it->back);
-		glTexCoord2f(1,1);
-		glVertex3fv(it->pos - tbelow * it->up + (it->len/it->len0) * it->back);
+#define PARTICLE_LOD_NEAR	40.0f
+#define PARTICLE_LOD_MIN	0.1f
+#define PARTICLE_MIN_BUDGET	1000
+
+float ParticleBudget::distanceScale(float dist)
+{
+	if (dist <= PARTICLE_LOD_NEAR)
+		return 1.0f;
+	return max(PARTICLE_LOD_NEAR / dist, PARTICLE_LOD_MIN);
+}
+
+void ParticleBudget::update(float dt, float fps, int demand)
+{
+	// gFPS is only measured once a second, so move by rate rather than by step
+	if (fps > 0) {
+		if (fps < targetFPS * 0.9f)
+			budget -= (int)(budget * 0.5f * dt);
+		else if (fps > targetFPS * 1.1f)
+			budget += (int)((budget * 0.25f + 500.0f) * dt);
+		budget = min(max(budget, PARTICLE_MIN_BUDGET), maxParticles);
 	}
-	glEnd();
 
-	glColor4f(1,1,1,1);
-	glEnable(GL_LIGHTING);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glDepthMask(GL_TRUE);
+	this->demand = demand;
+	scale = (demand > budget) ? budget / (float)demand : 1.0f;
 }
 
+ParticleVertex *ParticleBatch::add(GLuint texture, int blend, size_t nQuads)
+{
+	std::vector<ParticleVertex> &g = groups[Key(blend, texture)];
+	size_t start = g.size();
+	g.resize(start + nQuads*4);
+	return &g[start];
+}
+
+void ParticleBatch::setBlend(int blend)
+{
+	switch (blend) {
+	case 0:
+		glDisable(GL_BLEND);
+		glDisable(GL_ALPHA_TEST);
+		break;
+	case 1:
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_COLOR, GL_ONE);
+		glDisable(GL_ALPHA_TEST);
+		break;
+	case 2:
+		glEnable(GL_BLEND);
+		// originally
+		//glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); 
+		// Changed blending mode to this in 0.5.08, seems to fix a few of the render problems
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE); 
+		glDisable(GL_ALPHA_TEST);
+		break;
+	case 3:
+		glDisable(GL_BLEND);
+		glEnable(GL_ALPHA_TEST);
+		break;
+	case 4:
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+		glDisable(GL_ALPHA_TEST);
+		break;
+	default:
+		break;
+	}
+}
 
+void ParticleBatch::flush()
+{
+	nQuads = nGroups = 0;
+
+	// remember where each group starts
+	std::vector<size_t> first;
+	size_t nVertices = 0;
+	for (GroupMap::iterator it = groups.begin(); it != groups.end(); ) {
+		if (it->second.empty()) {
+			// nothing used this texture this frame
+			groups.erase(it++);
+			continue;
+		}
+		first.push_back(nVertices);
+		nVertices += it->second.size();
+		++it;
+	}
+	if (nVertices == 0)
+		return;
+
+	// all groups go into one piece of the stream buffer
+	ParticleVertex *dest = (ParticleVertex*)streamBuffer.alloc(nVertices * sizeof(ParticleVertex));
+	size_t g = 0;
+	for (GroupMap::iterator it = groups.begin(); it != groups.end(); ++it, ++g)
+		memcpy(dest + first[g], &it->second[0], it->second.size() * sizeof(ParticleVertex));
+	const char *base = streamBuffer.commit();
+
+	glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+
+	// vertices are in eye space already
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	// effects are unfogged..?
+	glDisable(GL_FOG);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_CULL_FACE);
+	glEnable(GL_TEXTURE_2D);
+	glAlphaFunc(GL_GREATER, 0.3f);
+
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	// the terrain leaves its alpha map coordinates enabled on the second unit
+	glClientActiveTextureARB(GL_TEXTURE1_ARB);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glClientActiveTextureARB(GL_TEXTURE0_ARB);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glVertexPointer(3, GL_FLOAT, sizeof(ParticleVertex), base + offsetof(ParticleVertex, x));
+	glTexCoordPointer(2, GL_FLOAT, sizeof(ParticleVertex), base + offsetof(ParticleVertex, u));
+	glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(ParticleVertex), base + offsetof(ParticleVertex, color));
+
+	// opaque and alpha tested groups first, then the blended ones without depth writes
+	for (int pass=0; pass<2; pass++) {
+		glDepthMask(pass==0 ? GL_TRUE : GL_FALSE);
+		size_t g = 0;
+		for (GroupMap::iterator it = groups.begin(); it != groups.end(); ++it, ++g) {
+			int blend = it->first.first;
+			bool blended = !(blend==0 || blend==3);
+			if (blended != (pass==1))
+				continue;
+
+			setBlend(blend);
+			glBindTexture(GL_TEXTURE_2D, it->first.second);
+			glDrawArrays(GL_QUADS, (GLint)first[g], (GLsizei)it->second.size());
+
+			nQuads += (int)it->second.size() / 4;
+			nGroups++;
+		}
+	}
 
+	glPopMatrix();
+	glPopClientAttrib();
+	glPopAttrib();
 
+	streamBuffer.unbind();
 
+	for (GroupMap::iterator it = groups.begin(); it != groups.end(); ++it)
+		it->second.clear();
+}
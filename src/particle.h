@@ -7,7 +7,8 @@ class RibbonEmitter;
 #include "model.h"
 #include "animated.h"
 
-#include <list>
+#include <vector>
+#include <map>
 
 Vec4D fromARGB(uint32 color);
 Vec4D fromBGRA(uint32 color);
@@ -21,7 +22,48 @@ struct Particle {
 	Vec4D color;
 };
 
-typedef std::list<Particle> ParticleList;
+// live particles of one system, structure of arrays so update() can run four at a time.
+// the arrays are allocated once at the system's capacity; live particles are packed at the
+// front and a dead one is replaced by the last live one.
+struct ParticlePool {
+	int count, capacity;
+	std::vector<float> px, py, pz;		// position
+	std::vector<float> vx, vy, vz;		// speed
+	std::vector<float> dx, dy, dz;		// direction, for deacceleration
+	std::vector<float> down;			// gravity on y, -1 or 0
+	std::vector<float> life, maxlife, size;
+	std::vector<float> cr, cg, cb, ca;	// color
+	std::vector<float> scale;			// scratch, per particle speed scale
+	std::vector<Vec3D> origin;
+	std::vector<unsigned int> tile;
+	std::vector<Vec3D> corners;			// 4 per particle, only for systems that don't billboard
+
+	ParticlePool(): count(0), capacity(0) {}
+
+	void alloc(int n, bool withCorners);
+	void add(const Particle &p);
+	void remove(int i);
+};
+
+// xorshift32, one per system so emitters don't share rand() when they're updated from several threads
+class ParticleRandom {
+	uint32 state;
+public:
+	ParticleRandom(): state(2463534242u) {}
+
+	void seed(uint32 s) { state = s ? s : 2463534242u; }
+	uint32 next()
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+	// [0,1)
+	float frand() { return (next() >> 8) * (1.0f / 16777216.0f); }
+	float randfloat(float lower, float upper) { return lower + (upper-lower)*frand(); }
+	int randint(int lower, int upper) { return lower + (int)((upper+1-lower)*frand()); }
+};
 
 class ParticleEmitter {
 protected:
@@ -47,6 +89,59 @@ struct TexCoordSet {
     Vec2D tc[4];
 };
 
+// one corner of a particle or ribbon quad, in eye space
+struct ParticleVertex {
+	float x, y, z;
+	float u, v;
+	unsigned char color[4];
+};
+
+// all particle and ribbon quads of a frame, grouped by blend mode and texture.
+// Model::draw adds to it, World::draw flushes it once the models are done: one upload
+// into a streaming vertex buffer and one glDrawArrays per group.
+class ParticleBatch {
+	typedef std::pair<int, GLuint> Key;	// blend mode, texture
+	typedef std::map<Key, std::vector<ParticleVertex> > GroupMap;
+	GroupMap groups;
+
+	void setBlend(int blend);
+
+public:
+	// quads and groups drawn by the last flush
+	int nQuads, nGroups;
+
+	ParticleBatch(): nQuads(0), nGroups(0) {}
+
+	// room for nQuads quads, valid until the next add
+	ParticleVertex *add(GLuint texture, int blend, size_t nQuads);
+	void flush();
+};
+
+extern ParticleBatch particleBatch;
+
+// upper bound on live particles. The budget shrinks while the frame rate is below the target and
+// grows back above it; every system emits at its distance scale times the share the budget allows.
+class ParticleBudget {
+public:
+	int maxParticles;	// hard limit
+	int budget;			// current limit, follows the frame rate
+	float targetFPS;
+	float scale;		// share of the budget each system gets, 0..1
+
+	// last update
+	int demand;			// particles wanted by the visible systems at their distance scale
+	int live;
+	int paused;			// models with emitters that weren't drawn, not updated at all
+
+	ParticleBudget(): maxParticles(30000), budget(30000), targetFPS(30.0f), scale(1.0f), demand(0), live(0), paused(0) {}
+
+	void update(float dt, float fps, int demand);
+	// 1 up close, down to 0.1 far away
+	static float distanceScale(float dist);
+};
+
+extern ParticleBudget particleBudget;
+
 class ParticleSystem {
 	Animated<float> speed, variation, spread, lat, gravity, lifespan, rate, areal, areaw, deacceleration;
 	Animated<uint8> enabled;
@@ -56,7 +151,8 @@ class ParticleSystem {
 	Vec3D pos;
 	GLuint texture;
 	ParticleEmitter *emitter;
-	ParticleList particles;
+	ParticlePool particles;
+	ParticleRandom rng;
 	int blend, order, type;
 	int manim, mtime;
 	int rows, cols;
@@ -65,6 +161,7 @@ class ParticleSystem {
 	bool billboard;
 
 	float rem;
+	int maxParticles;
 	//bool transform;
 
 	// unknown parameters omitted for now ...
@@ -77,7 +174,7 @@ public:
 	Model *model;
 	float tofs;
 
-	ParticleSystem(): emitter(0), mid(0), rem(0)
+	ParticleSystem(): emitter(0), mid(0), rem(0), maxParticles(0)
 	{
 		blend = 0;
 		order = 0;
@@ -98,10 +195,14 @@ public:
 	~ParticleSystem() { delete emitter; }
 
 	void init(MPQFile &f, ModelParticleEmitterDef &mta, uint32 *globals);
-	void update(float dt);
+	// lod scales the emission rate and the live particle cap
+	void update(float dt, float lod = 1.0f);
+
+	int capacity() const { return maxParticles; }
+	int liveCount() const { return particles.count; }
 
 	void setup(int anim, int time);
-	void draw();
+	void draw(ParticleBatch &batch, const float *modelview);
 
 	friend class PlaneParticleEmitter;
 	friend class SphereParticleEmitter;
@@ -133,14 +234,19 @@ class RibbonEmitter {
 
 	GLuint texture;
 
-	std::list<RibbonSegment> segs;
+	// ring of segments, newest first, starting at seghead
+	std::vector<RibbonSegment> segs;
+	int seghead, nsegs;
+	RibbonSegment &seg(int i) { return segs[(seghead + i) % segs.size()]; }
 
 public:
 	Model *model;
 
+	RibbonEmitter(): seghead(0), nsegs(0), model(0) {}
+
 	void init(MPQFile &f, ModelRibbonEmitterDef &mta, uint32 *globals);
 	void setup(int anim, int time);
-	void draw();
+	void draw(ParticleBatch &batch, const float *modelview);
 };
 
 
@@ -9,9 +9,19 @@ PFNGLBINDPROGRAMARBPROC glBindProgramARB = NULL;
 PFNGLDELETEPROGRAMSARBPROC glDeleteProgramsARB = NULL;
 PFNGLGENPROGRAMSARBPROC glGenProgramsARB = NULL;
 PFNGLPROGRAMLOCALPARAMETER4FARBPROC glProgramLocalParameter4fARB;
+PFNGLPROGRAMLOCALPARAMETER4FVARBPROC glProgramLocalParameter4fvARB = NULL;
+PFNGLGETPROGRAMIVARBPROC glGetProgramivARB = NULL;
+PFNGLVERTEXATTRIBPOINTERARBPROC glVertexAttribPointerARB = NULL;
+PFNGLENABLEVERTEXATTRIBARRAYARBPROC glEnableVertexAttribArrayARB = NULL;
+PFNGLDISABLEVERTEXATTRIBARRAYARBPROC glDisableVertexAttribArrayARB = NULL;
+PFNGLPROGRAMLOCALPARAMETERS4FVEXTPROC glProgramLocalParameters4fvEXT = NULL;
 
 ShaderPair *terrainShaders[4]={0,0,0,0}, *wmoShader=0, *waterShaders[1]={0};
 
+Shader *skinShader = 0;
+int skinMaxBones = 0;
+int skinShaderVersion = 0;
+
 void initShaders()
 {
 	supportShaders = isExtensionSupported("ARB_vertex_program") && isExtensionSupported("ARB_fragment_program");
@@ -23,6 +33,13 @@ void initShaders()
 		glDeleteProgramsARB = (PFNGLDELETEPROGRAMSARBPROC) SDL_GL_GetProcAddress("glDeleteProgramsARB");
 		glGenProgramsARB = (PFNGLGENPROGRAMSARBPROC) SDL_GL_GetProcAddress("glGenProgramsARB");
 		glProgramLocalParameter4fARB = (PFNGLPROGRAMLOCALPARAMETER4FARBPROC) SDL_GL_GetProcAddress("glProgramLocalParameter4fARB");
+		glProgramLocalParameter4fvARB = (PFNGLPROGRAMLOCALPARAMETER4FVARBPROC) SDL_GL_GetProcAddress("glProgramLocalParameter4fvARB");
+		glGetProgramivARB = (PFNGLGETPROGRAMIVARBPROC) SDL_GL_GetProcAddress("glGetProgramivARB");
+		glVertexAttribPointerARB = (PFNGLVERTEXATTRIBPOINTERARBPROC) SDL_GL_GetProcAddress("glVertexAttribPointerARB");
+		glEnableVertexAttribArrayARB = (PFNGLENABLEVERTEXATTRIBARRAYARBPROC) SDL_GL_GetProcAddress("glEnableVertexAttribArrayARB");
+		glDisableVertexAttribArrayARB = (PFNGLDISABLEVERTEXATTRIBARRAYARBPROC) SDL_GL_GetProcAddress("glDisableVertexAttribArrayARB");
+		if (isExtensionSupported("GL_EXT_gpu_program_parameters"))
+			glProgramLocalParameters4fvEXT = (PFNGLPROGRAMLOCALPARAMETERS4FVEXTPROC) SDL_GL_GetProcAddress("glProgramLocalParameters4fvEXT");
 
 		// init various shaders here
 		reloadShaders();
@@ -42,6 +59,162 @@ void reloadShaders()
 	terrainShaders[3] = new ShaderPair(0, "shaders/terrain4.fs", true);
 	wmoShader = new ShaderPair(0, "shaders/wmospecular.fs", true);
 	waterShaders[0] = new ShaderPair(0, "shaders/wateroutdoor.fs", true);
+
+	// the palette is as big as the local parameters allow; the program's own state bindings take about 40 parameters
+	GLint maxLocal = 0, maxParams = 0;
+	glGetProgramivARB(GL_VERTEX_PROGRAM_ARB, GL_MAX_PROGRAM_LOCAL_PARAMETERS_ARB, &maxLocal);
+	glGetProgramivARB(GL_VERTEX_PROGRAM_ARB, GL_MAX_PROGRAM_PARAMETERS_ARB, &maxParams);
+	int maxBones = min((maxLocal - SKIN_PARAM_PALETTE) / SKIN_PARAMS_PER_BONE, (maxParams - 40) / SKIN_PARAMS_PER_BONE);
+	maxBones = min(maxBones, 256);
+	if (maxBones >= 8) {
+		std::string prog = skinningProgram(maxBones);
+		Shader *s = new Shader(GL_VERTEX_PROGRAM_ARB, prog.c_str());
+		// a program over the native limits would still load, but run in software
+		GLint native = 0;
+		glGetProgramivARB(GL_VERTEX_PROGRAM_ARB, GL_PROGRAM_UNDER_NATIVE_LIMITS_ARB, &native);
+		if (s->ok && native) {
+			delete skinShader;
+			skinShader = s;
+			skinMaxBones = maxBones;
+			skinShaderVersion++;
+		} else {
+			// models already skinning on the GPU have no CPU vertices, so a failed reload keeps the old program
+			delete s;
+		}
+	}
+	gLog("GPU skinning %s, %d bones\n", skinShader ? "enabled" : "disabled", skinMaxBones);
+}
+
+std::string skinningProgram(int maxBones)
+{
+	std::string s;
+	char buf[256];
+
+	s +=	"!!ARBvp1.0\n"
+			"ATTRIB iPos = vertex.position;\n"
+			"ATTRIB iNormal = vertex.normal;\n"
+			"ATTRIB iColor = vertex.color;\n"
+			"ATTRIB iTex = vertex.texcoord[0];\n";
+	sprintf(buf,"ATTRIB iWeights = vertex.attrib[%d];\n", SKIN_ATTRIB_WEIGHTS);
+	s += buf;
+	sprintf(buf,"ATTRIB iBones = vertex.attrib[%d];\n", SKIN_ATTRIB_BONES);
+	s += buf;
+	s +=	"PARAM mvp[4] = { state.matrix.mvp };\n"
+			"PARAM mv[4] = { state.matrix.modelview };\n"
+			"PARAM mvit[4] = { state.matrix.modelview.invtrans };\n"
+			"PARAM tex[4] = { state.matrix.texture[0] };\n"
+			"PARAM emission = state.material.emission;\n"
+			"PARAM matAmbient = state.material.ambient;\n"
+			"PARAM matDiffuse = state.material.diffuse;\n"
+			"PARAM sceneAmbient = state.lightmodel.ambient;\n";
+	sprintf(buf,"PARAM ctl = program.local[%d];\n", SKIN_PARAM_LIGHTS);
+	s += buf;
+	sprintf(buf,"PARAM colorMat = program.local[%d];\n", SKIN_PARAM_COLORMAT);
+	s += buf;
+	int n = maxBones * SKIN_PARAMS_PER_BONE;
+	sprintf(buf,"PARAM bones[%d] = { program.local[%d..%d] };\n", n, SKIN_PARAM_PALETTE, SKIN_PARAM_PALETTE + n - 1);
+	s += buf;
+	sprintf(buf,"PARAM k = { 0, 1, %d, 0 };\n", SKIN_PARAMS_PER_BONE);
+	s += buf;
+	s +=	"ADDRESS a;\n"
+			"TEMP idx, pos, nrm, t, eye, n, accA, accD, L, d, att, amb, dif;\n"
+			"MUL idx, iBones, k.z;\n";
+
+	// blend the bones like Model::animate does, weights of 0 add nothing
+	const char *c = "xyzw";
+	for (int i=0; i<4; i++) {
+		const char *op = i ? "MAD" : "MUL";
+		sprintf(buf,"ARL a.x, idx.%c;\n", c[i]);
+		s += buf;
+		for (int r=0; r<3; r++) {
+			sprintf(buf,"DP4 t.%c, bones[a.x + %d], iPos;\n", c[r], r);
+			s += buf;
+		}
+		sprintf(buf,"%s pos.xyz, t, iWeights.%c%s;\n", op, c[i], i ? ", pos" : "");
+		s += buf;
+		for (int r=0; r<3; r++) {
+			sprintf(buf,"DP3 t.%c, bones[a.x + %d], iNormal;\n", c[r], r+3);
+			s += buf;
+		}
+		sprintf(buf,"%s nrm.xyz, t, iWeights.%c%s;\n", op, c[i], i ? ", nrm" : "");
+		s += buf;
+	}
+
+	s +=	"MOV pos.w, k.y;\n"
+			"DP3 t.w, nrm, nrm;\n"
+			"RSQ t.w, t.w;\n"
+			"MUL nrm.xyz, nrm, t.w;\n"
+			"DP4 result.position.x, mvp[0], pos;\n"
+			"DP4 result.position.y, mvp[1], pos;\n"
+			"DP4 result.position.z, mvp[2], pos;\n"
+			"DP4 result.position.w, mvp[3], pos;\n"
+			"DP4 eye.x, mv[0], pos;\n"
+			"DP4 eye.y, mv[1], pos;\n"
+			"DP4 eye.z, mv[2], pos;\n"
+			"DP4 eye.w, mv[3], pos;\n"
+			"DP3 n.x, mvit[0], nrm;\n"
+			"DP3 n.y, mvit[1], nrm;\n"
+			"DP3 n.z, mvit[2], nrm;\n"
+			"ABS result.fogcoord.x, eye.z;\n"
+			"DP4 result.texcoord[0].x, tex[0], iTex;\n"
+			"DP4 result.texcoord[0].y, tex[1], iTex;\n"
+			"DP4 result.texcoord[0].z, tex[2], iTex;\n"
+			"DP4 result.texcoord[0].w, tex[3], iTex;\n"
+			"SUB t, iColor, matAmbient;\n"
+			"MAD amb, t, colorMat.x, matAmbient;\n"
+			"SUB t, iColor, matDiffuse;\n"
+			"MAD dif, t, colorMat.x, matDiffuse;\n"
+			"MOV accA, sceneAmbient;\n"
+			"MOV accD, k.x;\n";
+
+	for (int i=0; i<3; i++) {
+		sprintf(buf,"PARAM lp%d = state.light[%d].position;\n"
+					"PARAM la%d = state.light[%d].ambient;\n"
+					"PARAM ld%d = state.light[%d].diffuse;\n"
+					"PARAM lk%d = state.light[%d].attenuation;\n", i,i, i,i, i,i, i,i);
+		s += buf;
+		// direction to the light, and 1/(c + l*d + q*d*d) attenuation for positional lights
+		sprintf(buf,"MAD L, -eye, lp%d.w, lp%d;\n", i, i);
+		s += buf;
+		s +=	"DP3 d.w, L, L;\n"
+				"RSQ d.y, d.w;\n"
+				"MUL L.xyz, L, d.y;\n"
+				"MUL d.x, d.w, d.y;\n";
+		sprintf(buf,"MAD t.x, lk%d.z, d.w, lk%d.x;\n"
+					"MAD t.x, lk%d.y, d.x, t.x;\n", i, i, i);
+		s += buf;
+		s +=	"RCP t.x, t.x;\n"
+				"SUB t.x, t.x, k.y;\n";
+		sprintf(buf,"MAD att.x, t.x, lp%d.w, k.y;\n"
+					"MUL att.x, att.x, ctl.%c;\n", i, c[i]);
+		s += buf;
+		s +=	"DP3 t.y, n, L;\n"
+				"MAX t.y, t.y, k.x;\n"
+				"MUL t.y, t.y, att.x;\n";
+		sprintf(buf,"MAD accA, la%d, att.x, accA;\n"
+					"MAD accD, ld%d, t.y, accD;\n", i, i);
+		s += buf;
+	}
+
+	// emission + ambient * (scene ambient + lights) + diffuse * lights, or the plain color for unlit passes
+	s +=	"MAD t, accA, amb, emission;\n"
+			"MAD t, accD, dif, t;\n"
+			"MOV t.w, dif.w;\n"
+			"SUB t, t, iColor;\n"
+			"MAD result.color, t, ctl.w, iColor;\n"
+			"END\n";
+	return s;
+}
+
+void setSkinningPalette(const float *palette, int nBones)
+{
+	int n = nBones * SKIN_PARAMS_PER_BONE;
+	if (glProgramLocalParameters4fvEXT) {
+		glProgramLocalParameters4fvEXT(GL_VERTEX_PROGRAM_ARB, SKIN_PARAM_PALETTE, n, palette);
+	} else {
+		for (int i=0; i<n; i++)
+			glProgramLocalParameter4fvARB(GL_VERTEX_PROGRAM_ARB, SKIN_PARAM_PALETTE + i, palette + i*4);
+	}
 }
 
 Shader::Shader(GLenum target, const char *program, bool fromFile):id(0),target(target)
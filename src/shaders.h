@@ -2,6 +2,11 @@
 #define SHADERS_H
 
 #include "video.h"
+#include <string>
+
+#ifndef GL_EXT_gpu_program_parameters
+typedef void (APIENTRYP PFNGLPROGRAMLOCALPARAMETERS4FVEXTPROC) (GLenum target, GLuint index, GLsizei count, const GLfloat *params);
+#endif
 
 extern bool supportShaders;
 
@@ -10,6 +15,13 @@ extern PFNGLBINDPROGRAMARBPROC glBindProgramARB;
 extern PFNGLDELETEPROGRAMSARBPROC glDeleteProgramsARB;
 extern PFNGLGENPROGRAMSARBPROC glGenProgramsARB;
 extern PFNGLPROGRAMLOCALPARAMETER4FARBPROC glProgramLocalParameter4fARB;
+extern PFNGLPROGRAMLOCALPARAMETER4FVARBPROC glProgramLocalParameter4fvARB;
+extern PFNGLGETPROGRAMIVARBPROC glGetProgramivARB;
+extern PFNGLVERTEXATTRIBPOINTERARBPROC glVertexAttribPointerARB;
+extern PFNGLENABLEVERTEXATTRIBARRAYARBPROC glEnableVertexAttribArrayARB;
+extern PFNGLDISABLEVERTEXATTRIBARRAYARBPROC glDisableVertexAttribArrayARB;
+// GL_EXT_gpu_program_parameters, may be missing
+extern PFNGLPROGRAMLOCALPARAMETERS4FVEXTPROC glProgramLocalParameters4fvEXT;
 
 
 void initShaders();
@@ -43,5 +55,29 @@ public:
 
 extern ShaderPair *terrainShaders[4], *wmoShader, *waterShaders[1];
 
+/*
+	Vertex program for skinning animated models on the GPU (see Model::initGPUSkinning).
+	The original vertices stay in a static buffer; per vertex the program blends up to
+	four bones from a palette of local parameters and then lights the result the way the
+	fixed function pipeline does: lights 0 to 2, GL_COLOR_MATERIAL on ambient and diffuse
+	or off, no specular, no spot lights, fog from the eye space depth.
+*/
+#define SKIN_ATTRIB_WEIGHTS		6	// 4 x ubyte, normalized
+#define SKIN_ATTRIB_BONES		7	// 4 x ubyte palette slots
+#define SKIN_PARAM_LIGHTS		0	// light 0, 1, 2 enabled, GL_LIGHTING enabled
+#define SKIN_PARAM_COLORMAT		1	// GL_COLOR_MATERIAL enabled
+#define SKIN_PARAM_PALETTE		2	// first bone
+#define SKIN_PARAMS_PER_BONE	6	// rows 0-2 of Bone::mat, then of Bone::mrot
+
+extern Shader *skinShader;
+// palette size the program was built with, 0 if there's no GPU skinning
+extern int skinMaxBones;
+// goes up every time skinShader is replaced, the new program's local parameters start out empty
+extern int skinShaderVersion;
+
+std::string skinningProgram(int maxBones);
+// uploads nBones bones from palette (SKIN_PARAMS_PER_BONE vec4s each) into the bound skinning program
+void setSkinningPalette(const float *palette, int nBones);
+
 
 #endif
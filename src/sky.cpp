@@ -14,38 +14,39 @@ SkyColor::SkyColor( int t, int col )
 	color.x = ((col & 0xff0000) >> 16) / 255.0f;
 }
 
-Sky::Sky( DBCFile::Iterator data )
+Sky::Sky( const LightDB::Row &data )
 {
-	pos = Vec3D( data->getFloat( LightDB::PositionX ) / skymul, data->getFloat( LightDB::PositionY ) / skymul, data->getFloat( LightDB::PositionZ ) / skymul );
-	r1 = data->getFloat( LightDB::RadiusInner ) / skymul;
-	r2 = data->getFloat( LightDB::RadiusOuter ) / skymul;
-	//gLog( "New sky (%i) at (%f,%f,%f) with (%f > %f).\n", data->getInt( LightDB::ID ), pos.x, pos.y, pos.z, r1, r2 );
+	pos = Vec3D( data.get<LightDB::PositionX>() / skymul, data.get<LightDB::PositionY>() / skymul, data.get<LightDB::PositionZ>() / skymul );
+	r1 = data.get<LightDB::RadiusInner>() / skymul;
+	r2 = data.get<LightDB::RadiusOuter>() / skymul;
+	//gLog( "New sky (%i) at (%f,%f,%f) with (%f > %f).\n", data.get<LightDB::ID>(), pos.x, pos.y, pos.z, r1, r2 );
 
 	for (int i=0; i<36; i++) 
 		mmin[i] = -2;
+	weight = 0.0f;
+	built = false;
 
 	global = ( pos.x == 0.0f && pos.y == 0.0f && pos.z == 0.0f );
 
-	int FirstId = data->getInt( LightDB::DataIDs ) * 18;
+	int FirstId = data.get<LightDB::DataIDs>( 0 ) * 18;
 
 	/*for( int i = 0; i < 18; i++ ) 
 	{
-		try {
-			DBCFile::Record rec = gLightIntBandDB.getByID( FirstId + i );
-			int entries = rec.getInt( LightIntBandDB::Entries );
+		LightIntBandDB::Row rec;
+		if( gLightIntBandDB.findRow( FirstId + i, rec ) ) {
+			int entries = rec.get<LightIntBandDB::Entries>();
 
 			if ( entries == 0 ) 
 				mmin[i] = -1;
 			else 
 			{
-				mmin[i] = rec.getInt( LightIntBandDB::Times );
+				mmin[i] = rec.get<LightIntBandDB::Times>( 0 );
 				for( int l = 0; l < entries; l++ ) 
 				{
-					SkyColor sc( rec.getInt( LightIntBandDB::Times + l ), rec.getInt( LightIntBandDB::Values + l ) );
+					SkyColor sc( rec.get<LightIntBandDB::Times>( l ), rec.get<LightIntBandDB::Values>( l ) );
 					colorRows[i].push_back( sc );
 				}
 			}
-		} catch (LightIntBandDB::NotFound) {
 		}
 	}*/
 }
@@ -89,6 +90,41 @@ Vec3D Sky::colorFor(int r, int t) const
     return c1*(1.0f-tt) + c2*tt;
 }
 
+void Sky::buildTable()
+{
+	built = true;
+	for (int r=0; r<18; r++) {
+		if (mmin[r] < 0)
+			continue;
+		size_t base = table.size();
+		table.resize(base + SKY_TICKS);
+		bool bad = false;
+		for (int t=0; t<SKY_TICKS; t++) {
+			Vec3D c = colorFor(r, t);
+			if (c.x > 1.0f || c.y > 1.0f || c.z > 1.0f) {
+				// left out, like it always was
+				c = Vec3D(0,0,0);
+				bad = true;
+			}
+			table[base + t] = c;
+		}
+		if (bad)
+			gLog("Sky row %d is out of bounds!\n", r);
+		rows.push_back(r);
+	}
+}
+
+void Sky::addColors(Vec3D *set, int t, float weight)
+{
+	if (!built)
+		buildTable();
+	t %= SKY_TICKS;
+	if (t < 0)
+		t += SKY_TICKS;
+	for (size_t k=0; k<rows.size(); k++)
+		set[rows[k]] += table[k*SKY_TICKS + t] * weight;
+}
+
 const float rad = 400.0f;
 
 //.......................top....med....medh........horiz..........bottom
@@ -132,19 +168,19 @@ Skies::Skies( int mapid )
 	cs = -1;
 	stars = 0;
 
-	for( DBCFile::Iterator i = gLightDB.begin(); i != gLightDB.end(); ++i )
+	size_t count;
+	const unsigned int *lights = gLightDB.findAll( mapid, count, LightDB::Map::column );
+	for( size_t i = 0; i < count; i++ )
 	{
-		if( mapid == i->getUInt( LightDB::Map ) )
-		{
-			Sky s( i );
-			skies.push_back( s );
-			numSkies++;
-		}
+		Sky s( gLightDB.row( lights[i] ) );
+		skies.push_back( s );
+		numSkies++;
 	}
 
 	// sort skies from smallest to largest; global last.
 	// smaller skies will have precedence when calculating weights to achieve smooth transitions etc.
 	std::sort( skies.begin( ), skies.end( ) );
+	buildGrid();
 
 	stars = new Model( "Environments\\Stars\\Stars.mdx", true );
 
@@ -155,27 +191,74 @@ Skies::~Skies()
 	delete stars;
 }
 
+void Skies::buildGrid()
+{
+	gridX = gridZ = 0;
+	cellSize = 1.0f;
+	int maxsky = (int)skies.size()-1;
+	if (maxsky <= 0)
+		return;
+
+	float x0 = skies[0].pos.x - skies[0].r2, x1 = skies[0].pos.x + skies[0].r2;
+	float z0 = skies[0].pos.z - skies[0].r2, z1 = skies[0].pos.z + skies[0].r2;
+	for (int i=1; i<maxsky; i++) {
+		Sky &s = skies[i];
+		x0 = std::min(x0, s.pos.x - s.r2);
+		x1 = std::max(x1, s.pos.x + s.r2);
+		z0 = std::min(z0, s.pos.z - s.r2);
+		z1 = std::max(z1, s.pos.z + s.r2);
+	}
+	gridX = x0;
+	gridZ = z0;
+	cellSize = std::max(std::max(x1 - x0, z1 - z0) / SKY_GRID, 1.0f);
+
+	// the distance on x,z is never more than the real one, so a sky out of a cell on x,z is out of it
+	for (int i=0; i<maxsky; i++) {
+		Sky &s = skies[i];
+		int cx0 = std::max((int)((s.pos.x - s.r2 - gridX) / cellSize), 0);
+		int cx1 = std::min((int)((s.pos.x + s.r2 - gridX) / cellSize), SKY_GRID-1);
+		int cz0 = std::max((int)((s.pos.z - s.r2 - gridZ) / cellSize), 0);
+		int cz1 = std::min((int)((s.pos.z + s.r2 - gridZ) / cellSize), SKY_GRID-1);
+		for (int cz=cz0; cz<=cz1; cz++) {
+			for (int cx=cx0; cx<=cx1; cx++)
+				grid[cz*SKY_GRID + cx].push_back(i);
+		}
+	}
+}
+
 void Skies::findSkyWeights(Vec3D pos)
 {
+	for (size_t k=0; k<weighted.size(); k++)
+		skies[weighted[k]].weight = 0.0f;
+	weighted.clear();
+
+	// only the skies of the cell we're in can have a weight, and the last one
 	int maxsky = (int)skies.size()-1;
+	float fx = (pos.x - gridX) / cellSize, fz = (pos.z - gridZ) / cellSize;
+	if (fx >= 0 && fx < SKY_GRID && fz >= 0 && fz < SKY_GRID)
+		weighted = grid[(int)fz*SKY_GRID + (int)fx];
+	weighted.push_back(maxsky);
+
 	skies[maxsky].weight = 1.0f;
 	cs = maxsky;
-	for (int i=maxsky-1; i>=0; i--) {
+	int n = (int)weighted.size();
+	for (int k=n-2; k>=0; k--) {
+		int i = weighted[k];
 		Sky &s = skies[i];
         float dist = (pos - s.pos).length();
 		if (dist < s.r1) {
 			// we're in a sky, zero out the rest
 			s.weight = 1.0f;
 			cs = i;
-			for (size_t j=i+1; j<skies.size(); j++) 
-				skies[j].weight = 0.0f;
+			for (int j=k+1; j<n; j++) 
+				skies[weighted[j]].weight = 0.0f;
 		}
 		else if (dist < s.r2) {
 			// we're in an outer area, scale down the other weights
 			float r = (dist - s.r1)/(s.r2 - s.r1);
 			s.weight = 1.0f - r;
-			for (size_t j=i+1; j<skies.size(); j++) 
-				skies[j].weight *= r;
+			for (int j=k+1; j<n; j++) 
+				skies[weighted[j]].weight *= r;
 		}
 		else 
 			s.weight = 0.0f;
@@ -190,25 +273,13 @@ void Skies::initSky(Vec3D pos, int t)
 
 	findSkyWeights(pos);
 
-	for (int i=0; i<18; i++) colorSet[i] = Vec3D(1,1,1);
+	for (int i=0; i<18; i++) colorSet[i] = Vec3D(0,0,0);
 
 	// interpolation
-	for (size_t j=0; j<skies.size(); j++) {
-		if (skies[j].weight>0) {
-			// now calculate the color rows
-			for (int i=0; i<18; i++) {
-				if((skies[j].colorFor(i,t).x>1.0f)||(skies[j].colorFor(i,t).y>1.0f)||(skies[j].colorFor(i,t).z>1.0f))
-				{
-					gLog("Sky %d %d is out of bounds!\n",j,i);
-					continue;
-				}
-				colorSet[i] += skies[j].colorFor(i,t) * skies[j].weight;
-			}
-		}
-	}
-	for (int i=0; i<18; i++) 
-	{
-		colorSet[i] -= Vec3D( 1, 1, 1 );
+	for (size_t k=0; k<weighted.size(); k++) {
+		Sky &s = skies[weighted[k]];
+		if (s.weight>0)
+			s.addColors(colorSet, t, s.weight);
 	}
 }
 
@@ -259,7 +330,7 @@ bool Skies::drawSky(const Vec3D &pos)
 		glScalef(sc,sc,sc);
 		glEnable(GL_TEXTURE_2D);
 		stars->trans = ni;
-        stars->draw();
+		stars->draw(0, Matrix::newTranslation(pos) * Matrix::newScale(Vec3D(sc,sc,sc)));
 	}
 
 	glPopMatrix();
@@ -5,7 +5,7 @@
 #include "model.h"
 #include "mpq.h"
 #include <vector>
-#include "dbcfile.h"
+#include "areadb.h"
 
 struct SkyColor {
 	Vec3D color;
@@ -14,12 +14,15 @@ struct SkyColor {
 	SkyColor( int t, int col );
 };
 
+// half minute ticks in a day
+#define SKY_TICKS 2880
+
 class Sky {
 public:
 	Vec3D pos;
 	float r1, r2;
 
-	Sky( DBCFile::Iterator data );
+	Sky( const LightDB::Row &data );
 
 	std::vector<SkyColor> colorRows[36];
 	int mmin[36];
@@ -27,10 +30,21 @@ public:
 	char name[32];
 
 	Vec3D colorFor(int r, int t) const;
+	// adds the colors at tick t times weight to set
+	void addColors(Vec3D *set, int t, float weight);
 
 	float weight;
 	bool global;
 
+private:
+	// the rows that have colors, and their colors at every tick; built the first time the sky is used
+	std::vector<int> rows;
+	std::vector<Vec3D> table;
+	bool built;
+	void buildTable();
+
+public:
+
     bool operator<(const Sky& s) const
 	{
 		if (global) return false;
@@ -60,6 +74,9 @@ enum SkyColorNames {
 	SHADOW_COLOR
 };
 
+// skies whose outer sphere reaches into each cell of a grid over x,z, for findSkyWeights
+#define SKY_GRID 32
+
 class Skies {
 	std::vector<Sky> skies;
 	int numSkies;
@@ -67,6 +84,13 @@ class Skies {
 	Model *stars;
 	char skyname[128];
 
+	// cells are cellSize square starting at gridX, gridZ; each lists its skies in order, not the last one
+	float gridX, gridZ, cellSize;
+	std::vector<int> grid[SKY_GRID*SKY_GRID];
+	// skies weighted by the last findSkyWeights, the last sky included
+	std::vector<int> weighted;
+	void buildGrid();
+
 public:
 
 	Vec3D colorSet[18];
@@ -132,29 +132,35 @@ void Test::display(float t, float dt)
 			unsigned int areaID = world->getAreaID();
 			unsigned int regionID = 0;
 			/// Look up area
-			try {
-				AreaDB::Record rec = gAreaDB.getByID(areaID);
-				std::string areaName = rec.getString(AreaDB::Name);
-				regionID = rec.getUInt(AreaDB::Region);
-				f16->print(5,20,"%s", areaName.c_str());
-			} catch(AreaDB::NotFound)
-			{
+			AreaDB::Row area;
+			if (gAreaDB.findRow(areaID, area)) {
+				regionID = area.get<AreaDB::Region>();
+				f16->print(5,20,"%s", area.get<AreaDB::Name>());
+			} else {
 				/// Not found, unknown area
 				//f16->print(5,20,"Unknown [%i]", areaID);
 			}
 			if (regionID != 0) {
 				/// Look up region
-				try {
-					std::string regionName = gAreaDB.getAreaName(regionID);
-					f16->print(5,40,"%s", regionName.c_str());
-				} catch(AreaDB::NotFound)
-				{
-					//f16->print(5,40,"Unknown [%i]", regionID);
-				}
+				std::string regionName = gAreaDB.getAreaName(regionID);
+				f16->print(5,40,"%s", regionName.c_str());
 			}
 
 			//f16->print(5,60,"%d", world->modelmanager.v);
 
+			int *lc = world->modelmanager.lodCount;
+			f16->print(5,60,"Model LODs: %d / %d / %d / %d", lc[0], lc[1], lc[2], lc[3]);
+			f16->print(5,80,"Particles: %d / %d, %d quads in %d batches", particleBudget.live, particleBudget.budget, particleBatch.nQuads, particleBatch.nGroups);
+			f16->print(5,100,"Animated: %d models, %d skipped", world->modelmanager.nAnimated, world->modelmanager.nAnimSkipped);
+			f16->print(5,120,"Stream buffer: %d KB, %d maps, %d allocs", (int)(streamBuffer.lastBytes/1024), streamBuffer.lastMaps, streamBuffer.lastAllocs);
+			f16->print(5,140,"WMO groups: %d waiting, %d uploaded", world->wmomanager.waiting, world->wmomanager.uploaded);
+			f16->print(5,160,"WMO batches: %d draws, %d texture binds, %d shader switches", world->wmomanager.nDraws, world->wmomanager.nBinds, world->wmomanager.nShaderSwitches);
+			f16->print(5,180,"Textures: %d waiting, %d uploaded", video.textures.waiting, video.textures.uploaded);
+			TextureManager &tm = video.textures;
+			f16->print(5,200,"Texture memory: %d MB of %d, %d MB pooled (%d), %d MB evicted (%d)", (int)(tm.residentBytes>>20), (int)(tm.budget>>20),
+				(int)(tm.pooledBytes>>20), tm.nPooled, (int)(tm.evictedBytes>>20), tm.nEvicted);
+			f16->print(5,220,"Texture levels: %d streamed in, %d MB dropped", tm.nStreamed, (int)(tm.droppedBytes>>20));
+
 			int time = ((int)world->time)%2880;
 			int hh,mm;
 
@@ -319,22 +325,10 @@ void Test::keypressed(SDL_KeyboardEvent *e)
 			// copied from above: retreive area name for bookmarks, too
 			unsigned int areaID = world->getAreaID();
 			unsigned int regionID = 0;
-			std::string areaName = "";
-			try {
-				areaName = gAreaDB.getAreaName(areaID);
-				//regionID = rec.getUInt(AreaDB::Region);
-			} catch(AreaDB::NotFound)
-			{
-				if (world->gnWMO==0) areaName = "Unknown location";
-			}
+			std::string areaName = gAreaDB.getAreaName(areaID);
 			if (regionID != 0) {
 				/// Look up region
-				try {
-					areaName = gAreaDB.getAreaName(regionID);
-				} catch(AreaDB::NotFound)
-				{
-					// do nothing
-				}
+				areaName = gAreaDB.getAreaName(regionID);
 			}
 
 			fprintf(bf, "%s %d %f %f %f  %f %f  %s\n", world->basename.c_str(), world->mapid, world->camera.x, world->camera.y, world->camera.z, ah, av, areaName.c_str());
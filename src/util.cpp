@@ -6,6 +6,7 @@
 #include <stdarg.h>
 #include <assert.h>
 #include <unistd.h>
+#include <SDL/SDL.h>
 #include "defines.h"
 
 std::string gamePath;
@@ -19,28 +20,166 @@ void check_stuff() {
      assert(sizeof(__int16) == 2);
      assert(sizeof(__int32) == 4);
 }
-void gLog(const char *str, ...)
+/*
+	Log messages are formatted by the thread that logs them into a ring of
+	fixed size slots, and written out by one writer thread that keeps log.txt
+	open. Threads claim slots with a compare-and-swap on the head, so logging
+	from the loader threads never waits on a lock or on the file.
+
+	Every slot has a sequence number: it's the slot's position while the slot
+	is free, position+1 once the message in it is complete, and it moves on
+	by LOG_SLOTS when the writer is done with it.
+*/
+#define LOG_SLOTS	1024	// power of two
+#define LOG_LINE	256		// longer messages are cut off
+
+#ifdef _WINDOWS
+	static long atomicCAS(volatile long *p, long oldval, long newval) { return InterlockedCompareExchange(p, newval, oldval); }
+	#define memoryBarrier()	MemoryBarrier()
+	#define vsnprintf	_vsnprintf
+#else
+	static long atomicCAS(volatile long *p, long oldval, long newval) { return __sync_val_compare_and_swap(p, oldval, newval); }
+	#define memoryBarrier()	__sync_synchronize()
+#endif
+
+struct LogSlot {
+	volatile long seq;
+	int level;
+	char text[LOG_LINE];
+};
+
+static LogSlot logSlots[LOG_SLOTS];
+static volatile long logHead = 0;
+static long logTail = 0;
+static bool logStopping = false;
+static SDL_sem *logReady = 0;
+static SDL_Thread *logThread = 0;
+
+static void logWrite(int level, const char *text)
 {
-	if (glogfirst) {
-		flog = fopen("log.txt","w");
-		fclose(flog);
-		glogfirst = false;
+	if (flog) {
+		fputs(text, flog);
+		// errors are on disk straight away, in case they're followed by a crash
+		if (level >= LOG_ERROR)
+			fflush(flog);
 	}
+	fputs(text, stdout);
+}
 
-	flog = fopen("log.txt","a");
+static int logWriter(void *)
+{
+	while (true) {
+		SDL_SemWait(logReady);
+		if (logStopping && logTail == logHead)
+			break;
 
-	va_list ap;
+		LogSlot &s = logSlots[logTail & (LOG_SLOTS-1)];
+		// the slot is claimed, wait for its message to be finished
+		while (s.seq != logTail + 1)
+			SDL_Delay(0);
+		memoryBarrier();
+
+		logWrite(s.level, s.text);
+
+		memoryBarrier();
+		s.seq = logTail + LOG_SLOTS;
+		logTail++;
+
+		// nothing else waiting, good time to let the file catch up
+		if (flog && SDL_SemValue(logReady) == 0)
+			fflush(flog);
+	}
+	return 0;
+}
+
+static void logStart()
+{
+	glogfirst = false;
+	flog = fopen("log.txt","w");
+
+	for (long i=0; i<LOG_SLOTS; i++)
+		logSlots[i].seq = i;
+
+	logReady = SDL_CreateSemaphore(0);
+	if (logReady)
+		logThread = SDL_CreateThread(logWriter, 0);
+	atexit(gLogClose);
+}
+
+static void logMessage(int level, const char *str, va_list ap)
+{
+	// the first message comes from the main thread before any others are started
+	if (glogfirst)
+		logStart();
 
-	va_start (ap, str);
-	vfprintf (flog, str, ap);
-	va_end (ap);
+	if (!logThread) {
+		char text[LOG_LINE];
+		vsnprintf(text, LOG_LINE, str, ap);
+		text[LOG_LINE-1] = 0;
+		logWrite(level, text);
+		return;
+	}
+
+	// claim a slot
+	LogSlot *s;
+	long pos = logHead;
+	while (true) {
+		s = &logSlots[pos & (LOG_SLOTS-1)];
+		long seq = s->seq;
+		if (seq == pos) {
+			long old = atomicCAS(&logHead, pos, pos + 1);
+			if (old == pos)
+				break;
+			pos = old;
+		}
+		else if (seq < pos) {
+			// the ring is full, let the writer catch up
+			SDL_Delay(1);
+			pos = logHead;
+		}
+		else
+			pos = logHead;
+	}
 
-	va_start (ap,str);
-	vprintf(str,ap);
+	vsnprintf(s->text, LOG_LINE, str, ap);
+	s->text[LOG_LINE-1] = 0;
+	s->level = level;
+
+	memoryBarrier();
+	s->seq = pos + 1;
+	SDL_SemPost(logReady);
+}
+
+void gLogAt(int level, const char *str, ...)
+{
+	va_list ap;
+	va_start(ap, str);
+	logMessage(level, str, ap);
 	va_end(ap);
+}
 
-	fclose(flog);
-};
+void gLog(const char *str, ...)
+{
+	va_list ap;
+	va_start(ap, str);
+	logMessage(LOG_INFO, str, ap);
+	va_end(ap);
+}
+
+void gLogClose()
+{
+	if (logThread) {
+		// the writer empties the ring before it stops
+		logStopping = true;
+		SDL_SemPost(logReady);
+		SDL_WaitThread(logThread, 0);
+		logThread = 0;
+	}
+	if (flog) {
+		fclose(flog);
+		flog = 0;
+	}
+}
 
 int file_exists(char *path)
 {
@@ -56,6 +195,102 @@ int file_exists(char *path)
 	return false;
 };
 
+int cpuCount()
+{
+#ifdef _WINDOWS
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return (int)si.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int)n : 1;
+#endif
+}
+
+WorkerPool::WorkerPool(): queued(0), finished(0), quit(false), nRunning(0), nWorkers(-1), lock(0)
+{
+}
+
+void WorkerPool::startWorkers(int threads)
+{
+	nWorkers = min(max(threads, 0), MAX_WORKER_THREADS);
+
+	lock = SDL_CreateMutex();
+	queued = SDL_CreateSemaphore(0);
+	finished = SDL_CreateCond();
+	quit = false;
+	nRunning = 0;
+
+	for (int i=0; i<nWorkers; i++) {
+		workers[i] = SDL_CreateThread(workerThread, this);
+		if (!workers[i]) {
+			nWorkers = i;
+			break;
+		}
+	}
+}
+
+void WorkerPool::stopWorkers()
+{
+	if (nWorkers < 0)
+		return;
+
+	if (nWorkers > 0) {
+		SDL_mutexP(lock);
+		quit = true;
+		SDL_mutexV(lock);
+		for (int i=0; i<nWorkers; i++)
+			SDL_SemPost(queued);
+		for (int i=0; i<nWorkers; i++)
+			SDL_WaitThread(workers[i], 0);
+	}
+	SDL_DestroyCond(finished);
+	SDL_DestroySemaphore(queued);
+	SDL_DestroyMutex(lock);
+	finished = 0;
+	queued = 0;
+	lock = 0;
+	nWorkers = -1;
+}
+
+void WorkerPool::post()
+{
+	SDL_SemPost(queued);
+}
+
+void WorkerPool::waitJobDone()
+{
+	SDL_CondWait(finished, lock);
+}
+
+int WorkerPool::workerThread(void *data)
+{
+	WorkerPool *wp = (WorkerPool*)data;
+	for (;;) {
+		SDL_SemWait(wp->queued);
+		SDL_mutexP(wp->lock);
+		if (wp->quit) {
+			SDL_mutexV(wp->lock);
+			break;
+		}
+		void *job = wp->takeJob();
+		if (job)
+			wp->nRunning++;
+		SDL_mutexV(wp->lock);
+		if (!job)
+			continue;
+
+		bool ok = wp->runJob(job);
+
+		SDL_mutexP(wp->lock);
+		wp->jobDone(job, ok);
+		wp->nRunning--;
+		SDL_CondBroadcast(wp->finished);
+		SDL_mutexV(wp->lock);
+	}
+	return 0;
+}
+
 
 // String Effectors
 void Lower(std::string &text){
@@ -11,6 +11,8 @@
 #include <io.h>
 #endif
 
+#include <SDL/SDL_thread.h>
+#include <SDL/SDL_mutex.h>
 #include "defines.h"
 
 using namespace std;
@@ -48,7 +50,76 @@ std::string GetLast(const char* String);
 void Lower(std::string &text);
 void getGamePath();
 void check_stuff();
-void gLog(const char *str, ...);
+
+enum LogLevel {
+	LOG_DEBUG,
+	LOG_INFO,
+	LOG_WARNING,
+	LOG_ERROR
+};
+
+// messages go through a background writer, gLogClose flushes them and closes log.txt
+void gLog(const char *str, ...);	// LOG_INFO
+void gLogAt(int level, const char *str, ...);
+void gLogClose();
+
+// debug messages are only compiled in with LOG_DEBUG_MESSAGES defined
+#ifdef LOG_DEBUG_MESSAGES
+	#define gLogDebug(...)	gLogAt(LOG_DEBUG, __VA_ARGS__)
+#else
+	#define gLogDebug(...)	((void)0)
+#endif
 int file_exists(char *path);
+int cpuCount();
+
+#define MAX_WORKER_THREADS 8
+
+/*
+	Worker threads for a class that keeps its own queue of jobs. The owner puts
+	a job in its queue with the lock held and calls post once for it; a worker
+	wakes up, takes it with takeJob, runs it with runJob without the lock and
+	hands the result back with jobDone.
+
+	nWorkers is -1 until startWorkers and 0 when no thread could be made, then
+	the owner does its jobs itself.
+
+	The owner has to call stopWorkers in its own destructor, its hooks are gone
+	by the time ours runs.
+*/
+class WorkerPool {
+	SDL_Thread *workers[MAX_WORKER_THREADS];
+	// one post per queued job
+	SDL_sem *queued;
+	// broadcast after every jobDone
+	SDL_cond *finished;
+	bool quit;
+	// jobs between takeJob and jobDone
+	int nRunning;
+
+	static int workerThread(void *data);
+
+protected:
+	int nWorkers;
+	SDL_mutex *lock;
+
+	// with the lock held: the next job, or 0 when it went away since it was posted
+	virtual void *takeJob() = 0;
+	virtual bool runJob(void *job) = 0;
+	// with the lock held, ok is what runJob returned
+	virtual void jobDone(void *job, bool ok) = 0;
+
+	void startWorkers(int threads);
+	// the jobs still in the owner's queue are left there
+	void stopWorkers();
+	void post();
+	// with the lock held: jobs taken by a worker and not done yet
+	int running() { return nRunning; }
+	// with the lock held: sleeps until a worker is done with a job
+	void waitJobDone();
+
+public:
+	WorkerPool();
+	virtual ~WorkerPool() {}
+};
 
 #endif
@@ -2,6 +2,7 @@
 #include "shaders.h"
 #include "mpq.h"
 #include "wowmapview.h"
+#include "dxt.h"
 using namespace std;
 
 /////// EXTENSIONS
@@ -22,6 +23,8 @@ PFNGLDELETEBUFFERSARBPROC glDeleteBuffersARB = NULL;
 
 PFNGLMAPBUFFERARBPROC glMapBufferARB = NULL;
 PFNGLUNMAPBUFFERARBPROC glUnmapBufferARB = NULL;
+PFNGLBUFFERSUBDATAARBPROC glBufferSubDataARB = NULL;
+PFNGLMAPBUFFERRANGEPROC glMapBufferRange = NULL;
 
 #ifdef _WINDOWS
 PFNGLDRAWRANGEELEMENTSPROC glDrawRangeElements = NULL;
@@ -75,10 +78,9 @@ void Video::init(int xres, int yres, bool fullscreen)
 	this->yres = yres;
 
 	glViewport(0,0,xres,yres);
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	//gluPerspective(45.0f, (GLfloat)xres/(GLfloat)yres, 0.01f, 1024.0f);
-	gluPerspective(45.0f, (GLfloat)xres/(GLfloat)yres, 1.0f, 1024.0f);
+	//camera.perspective(45.0f, (GLfloat)xres/(GLfloat)yres, 0.01f, 1024.0f);
+	camera.perspective(45.0f, (GLfloat)xres/(GLfloat)yres, 1.0f, 1024.0f);
+	camera.loadProjection();
 
 
 	// hmmm...
@@ -89,6 +91,8 @@ void Video::init(int xres, int yres, bool fullscreen)
 
 void Video::close()
 {
+	textures.stopWorkers();
+	streamBuffer.release();
 	SDL_Quit();
 }
 
@@ -155,6 +159,10 @@ void Video::initExtensions()
 
 		glMapBufferARB = (PFNGLMAPBUFFERARBPROC) SDL_GL_GetProcAddress("glMapBufferARB");
 		glUnmapBufferARB = (PFNGLUNMAPBUFFERARBPROC) SDL_GL_GetProcAddress("glUnmapBufferARB");
+		glBufferSubDataARB = (PFNGLBUFFERSUBDATAARBPROC) SDL_GL_GetProcAddress("glBufferSubDataARB");
+
+		if (isExtensionSupported("GL_ARB_map_buffer_range"))
+			glMapBufferRange = (PFNGLMAPBUFFERRANGEPROC) SDL_GL_GetProcAddress("glMapBufferRange");
 	} else supportVBO = false;
 }
 
@@ -173,14 +181,20 @@ void Video::clearScreen()
 
 void Video::set3D()
 {
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	gluPerspective(45.0f, (GLfloat)xres/(GLfloat)yres, 1.0f, 1024.0f);
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
+	camera.perspective(45.0f, (GLfloat)xres/(GLfloat)yres, 1.0f, 1024.0f);
+	camera.loadProjection();
+	camera.view.unit();
+	camera.loadView();
 }
 
 
+float Video::projectedSize(float size, float dist)
+{
+	if (dist < 1.0f)
+		dist = 1.0f;
+	return size * camera.projection.m[1][1] * yres * 0.5f / dist;
+}
+
 void Video::set2D()
 {
 	glMatrixMode(GL_PROJECTION);
@@ -191,43 +205,321 @@ void Video::set2D()
 }
 
 
+//////// STREAMING VERTEX BUFFER
+
+// starting size, it grows if a single piece doesn't fit
+#define STREAM_BUFFER_SIZE	(4*1024*1024)
+
+StreamBuffer streamBuffer;
+
+StreamBuffer::StreamBuffer(): vbo(0), size(0), head(0), offset(0), length(0), mapped(false), generation(0),
+	nMaps(0), nAllocs(0), nBytes(0), lastMaps(0), lastAllocs(0), lastBytes(0)
+{
+}
+
+void StreamBuffer::orphan(size_t minSize)
+{
+	if (!vbo)
+		glGenBuffersARB(1, &vbo);
+	if (size < STREAM_BUFFER_SIZE)
+		size = STREAM_BUFFER_SIZE;
+	while (size < minSize)
+		size *= 2;
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB, vbo);
+	glBufferDataARB(GL_ARRAY_BUFFER_ARB, size, NULL, GL_STREAM_DRAW_ARB);
+	nAllocs++;
+	head = 0;
+	generation++;
+}
+
+void *StreamBuffer::alloc(size_t n)
+{
+	nBytes += n;
+
+	if (!supportVBO) {
+		// client arrays, only good until the next alloc
+		local.resize(n);
+		generation++;
+		return &local[0];
+	}
+
+	if (!vbo || head + n > size)
+		orphan(n);
+
+	offset = head;
+	length = n;
+	// keep the pieces aligned for the vertex fetch
+	head = (head + n + 63) & ~(size_t)63;
+
+	if (glMapBufferRange) {
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, vbo);
+		void *p = glMapBufferRange(GL_ARRAY_BUFFER_ARB, offset, n, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		nMaps++;
+		if (p) {
+			mapped = true;
+			return p;
+		}
+	}
+	mapped = false;
+	if (local.size() < n)
+		local.resize(n);
+	return &local[0];
+}
+
+const char *StreamBuffer::commit()
+{
+	if (!supportVBO)
+		return &local[0];
+
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB, vbo);
+	if (mapped) {
+		glUnmapBufferARB(GL_ARRAY_BUFFER_ARB);
+		mapped = false;
+	} else {
+		glBufferSubDataARB(GL_ARRAY_BUFFER_ARB, offset, length, &local[0]);
+		nMaps++;
+	}
+	return GL_BUFFER_OFFSET(offset);
+}
+
+void StreamBuffer::bind()
+{
+	if (supportVBO)
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, vbo);
+}
+
+void StreamBuffer::unbind()
+{
+	if (supportVBO)
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+}
+
+void StreamBuffer::newFrame()
+{
+	lastMaps = nMaps;
+	lastAllocs = nAllocs;
+	lastBytes = nBytes;
+	nMaps = nAllocs = 0;
+	nBytes = 0;
+}
+
+void StreamBuffer::release()
+{
+	if (vbo)
+		glDeleteBuffersARB(1, &vbo);
+	vbo = 0;
+	size = head = 0;
+	generation++;
+}
+
+
 //////// TEXTURE MANAGER
 
+// one mip level in TextureData::pixels
+struct TextureLevel {
+	int level;
+	int w, h;
+	int size;
+	size_t offset;
+};
+
+// a decoded BLP, ready for glTexImage2D / glCompressedTexImage2D
+struct TextureData {
+	GLint format;
+	bool compressed;
+	std::vector<TextureLevel> levels;
+	std::vector<unsigned char> pixels;
+
+	unsigned char* add(int level, int w, int h, int size)
+	{
+		TextureLevel l;
+		l.level = level;
+		l.w = w;
+		l.h = h;
+		l.size = size;
+		l.offset = pixels.size();
+		levels.push_back(l);
+		pixels.resize(pixels.size() + size);
+		return &pixels[l.offset];
+	}
+};
+
+// milliseconds per frame spent on texture uploads, one texture always goes through
+#define TEXTURE_UPLOAD_MS	4
+
+// default texture memory budget
+#define TEXTURE_BUDGET_MB	256
+
+bool TextureManager::transcode = true;
+
+// new textures come in with their top level at most this big
+#define TEXTURE_START_SIZE	64
+
+TextureManager::TextureManager() : frame(0), budget(TEXTURE_BUDGET_MB*1024*1024), residentBytes(0), pooledBytes(0), evictedBytes(0), droppedBytes(0),
+	nPooled(0), nEvicted(0), nStreamed(0), waiting(0), uploaded(0)
+{
+}
+
+TextureManager::~TextureManager()
+{
+	stopWorkers();
+}
 
 GLuint TextureManager::add(std::string name)
 {
 	GLuint id;
 	if (names.find(name) != names.end()) {
 		id = names[name];
-		items[id]->addref();
+		Texture *tex = (Texture*)items[id];
+		if (tex->pooled) {
+			// back from the pool as it was
+			pool.erase(tex->poolPos);
+			tex->pooled = false;
+			pooledBytes -= tex->bytes;
+			nPooled--;
+		}
+		tex->addref();
 		return id;
 	}
 	glGenTextures(1,&id);
 
 	Texture *tex = new Texture(name);
 	tex->id = id;
-	LoadBLP(id, tex);
-
 	do_add(name, id, tex);
 
+	if (nWorkers < 0)
+		startWorkers();
+
+	if (nWorkers == 0) {
+		// no threads, load it all right here like we used to
+		tex->loadFrom = 0;
+		if (decode(tex, cpuCount()))
+			upload(tex);
+		else
+			tex->state = TEXTURE_FAILED;
+		return id;
+	}
+
+	// grey until the real thing is decoded
+	static const unsigned char placeholder[4] = {0x80, 0x80, 0x80, 0xff};
+	glBindTexture(GL_TEXTURE_2D, id);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	setBytes(tex, 4);
+
+	SDL_mutexP(lock);
+	tex->state = TEXTURE_QUEUED;
+	queue.push_back(tex);
+	post();
+	SDL_mutexV(lock);
+
 	return id;
 }
 
-void TextureManager::LoadBLP(GLuint id, Texture *tex)
+void TextureManager::startWorkers()
 {
-	// load BLP texture
-	glBindTexture(GL_TEXTURE_2D, id);
+	WorkerPool::startWorkers(min(max(cpuCount() - 1, 1), MAX_TEXTURE_THREADS));
+	gLog("Decoding textures on %d threads\n", nWorkers);
+}
+
+void TextureManager::stopWorkers()
+{
+	if (nWorkers < 0)
+		return;
+
+	WorkerPool::stopWorkers();
+	for (size_t i=0; i<loaded.size(); i++) {
+		delete loaded[i]->data;
+		loaded[i]->data = 0;
+	}
+	queue.clear();
+	loaded.clear();
+}
+
+void *TextureManager::takeJob()
+{
+	// the texture may have been deleted since it was posted
+	if (queue.empty())
+		return 0;
+	Texture *tex = queue.front();
+	queue.pop_front();
+	tex->state = TEXTURE_LOADING;
+	return tex;
+}
+
+bool TextureManager::runJob(void *job)
+{
+	// the other workers are busy with textures of their own
+	return decode((Texture*)job, 1);
+}
+
+void TextureManager::jobDone(void *job, bool ok)
+{
+	Texture *tex = (Texture*)job;
+	if (ok) {
+		tex->state = TEXTURE_LOADED;
+		loaded.push_back(tex);
+	} else {
+		// a failed stream keeps the levels it already has
+		tex->state = (tex->baseLevel >= 0) ? TEXTURE_RESIDENT : TEXTURE_FAILED;
+	}
+}
+
+void TextureManager::uploadTextures()
+{
+	uploaded = 0;
+	if (nWorkers <= 0) {
+		waiting = 0;
+		return;
+	}
+
+	streamLevels();
+	frame++;
+
+	std::vector<Texture*> batch;
+	SDL_mutexP(lock);
+	batch.swap(loaded);
+	SDL_mutexV(lock);
+
+	Uint32 start = SDL_GetTicks();
+	size_t n = 0;
+	while (n < batch.size()) {
+		upload(batch[n++]);
+		if (SDL_GetTicks() - start >= TEXTURE_UPLOAD_MS)
+			break;
+	}
+	uploaded = (int)n;
+
+	// what didn't fit goes first next frame
+	SDL_mutexP(lock);
+	loaded.insert(loaded.begin(), batch.begin() + n, batch.end());
+	waiting = (int)(queue.size() + loaded.size()) + running();
+	SDL_mutexV(lock);
+
+	trim();
+}
 
+// the level a texture starts out with: the first one no bigger than TEXTURE_START_SIZE
+static int startLevel(int w, int h, int nLevels)
+{
+	int level = 0;
+	while (level < nLevels-1 && max(w >> level, h >> level) > TEXTURE_START_SIZE)
+		level++;
+	return level;
+}
+
+// reads and decodes levels loadFrom..loadTo of the BLP into tex->data, no GL calls (worker thread)
+bool TextureManager::decode(Texture *tex, int threads)
+{
 	int offsets[16],sizes[16],w,h, type=0;
-	GLint format;
 
 	char attr[4];
 
 	MPQFile f(tex->name.c_str());
 	if (f.isEof()) {
-		tex->id = 0;
 		gLog("Error: Could not load the texture '%s'\n", tex->name.c_str());
-		return;
+		return false;
 	}
 
 	f.seek(4);
@@ -245,142 +537,349 @@ void TextureManager::LoadBLP(GLuint id, Texture *tex)
 	int mipmax = hasmipmaps ? 16 : 1;
 
 	if (type != 1) {
-		gLog("Error: %s:%s#%d type=%d", tex->name.c_str());
-		tex->id = 0;
-		return;
+		gLog("Error: %s has BLP type %d\n", tex->name.c_str(), type);
+		return false;
 	}
 
+	int nLevels = 0;
+	while (nLevels < mipmax && offsets[nLevels] && sizes[nLevels])
+		nLevels++;
+	tex->nLevels = nLevels;
+
+	// a new texture starts small, streaming fills in the levels above
+	int from = tex->loadFrom, to = tex->loadTo;
+	if (from < 0) {
+		from = startLevel(w, h, nLevels);
+		to = nLevels-1;
+	}
+	if (to < 0 || to > nLevels-1)
+		to = nLevels-1;
+
+	TextureData *td = new TextureData();
+
 	if (attr[0] == 2) {
 		// compressed
 
-		unsigned char *ucbuf = NULL;
-		if (!supportCompression) 
-			ucbuf = new unsigned char[w*h*4];
-
-		format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+		td->compressed = supportCompression;
+		td->format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
 		int blocksize = 8;
 
 		// guesswork here :(
 		if (attr[1]==8 || attr[1]==4) {
-			format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+			td->format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
 			blocksize = 16;
 		}
 
 		if (attr[1]==8 && attr[2]==7) {
-			format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+			td->format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
 			blocksize = 16;
 		}
 
-		unsigned char *buf = new unsigned char[sizes[0]];
-
-		// do every mipmap level
-		for (int i=0; i<mipmax; i++) {
-			if (w==0) w = 1;
-			if (h==0) h = 1;
-			if (offsets[i] && sizes[i]) {
-				f.seek(offsets[i]);
-				f.read(buf,sizes[i]);
-
-				int size = ((w+3)/4) * ((h+3)/4) * blocksize;
+		// compressed levels are read straight into place
+		unsigned char *buf = (supportCompression || from > to) ? 0 : new unsigned char[sizes[from]];
 
-				if (supportCompression) {
-					glCompressedTexImage2DARB(GL_TEXTURE_2D, i, format, w, h, 0, size, buf);
-				} else {
-					decompressDXTC(format, w, h, size, buf, ucbuf);
-					glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, ucbuf);
-				}
+		for (int i=from; i<=to; i++) {
+			int lw = max(w >> i, 1);
+			int lh = max(h >> i, 1);
+			int size = ((lw+3)/4) * ((lh+3)/4) * blocksize;
 
-			} else break;
-			w >>= 1;
-			h >>= 1;
+			if (supportCompression) {
+				unsigned char *dest = td->add(i, lw, lh, size);
+				f.seek(offsets[i]);
+				f.read(dest, min(sizes[i], size));
+			} else {
+				f.seek(offsets[i]);
+				f.read(buf, min(sizes[i], sizes[from]));
+				decompressDXTC(td->format, lw, lh, sizes[i], buf, td->add(i, lw, lh, lw*lh*4), threads);
+			}
 		}
 
 		delete[] buf;
-		if (!supportCompression) 
-			delete[] ucbuf;
 	}
 	else if (attr[0]==1) {
 		// uncompressed
+		td->compressed = false;
+		td->format = GL_RGBA8;
+
 		unsigned int pal[256];
 		f.read(pal, 1024);
 
-		unsigned char *buf = new unsigned char[sizes[0]];
-		unsigned int *buf2 = new unsigned int[w*h];
+		unsigned char *buf = (from > to) ? 0 : new unsigned char[sizes[from]];
 		unsigned int *p = NULL;
 		unsigned char *c = NULL, *a = NULL;
 
 		int alphabits = attr[1];
 		bool hasalpha = (alphabits!=0);
 
-		for (int i=0; i<mipmax; i++) {
-			if (w==0) w = 1;
-			if (h==0) h = 1;
-			if (offsets[i] && sizes[i]) {
-				f.seek(offsets[i]);
-				f.read(buf,sizes[i]);
-
-				int cnt = 0;
-				int alpha = 0;
-
-				p = buf2;
-				c = buf;
-				a = buf + w*h;
-				for (int y=0; y<h; y++) {
-					for (int x=0; x<w; x++) {
-						unsigned int k = pal[*c++];
-						k = ((k&0x00FF0000)>>16) | ((k&0x0000FF00)) | ((k& 0x000000FF)<<16);
-
-						if (hasalpha) {
-							if (alphabits == 8) {
-								alpha = (*a++);
-							} else if (alphabits == 4) {
-								alpha = (*a & (0xf << cnt++)) * 0x11;
-								if (cnt == 2) {
-									cnt = 0;
-									a++;
-								}
-							} else if (alphabits == 1) {
-								alpha = (*a & (1 << cnt++)) ? 0xff : 0;
-								if (cnt == 8) {
-									cnt = 0;
-									a++;
-								}
+		// palettized, a quarter to an eighth the size as DXT; the format that keeps the alpha bits
+		DXTFormat dxt = DXT_1;
+		std::vector<unsigned char> rgba;
+		if (transcode && supportCompression) {
+			td->compressed = true;
+			td->format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+			if (alphabits == 4) {
+				dxt = DXT_3;
+				td->format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+			} else if (alphabits == 8) {
+				dxt = DXT_5;
+				td->format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+			}
+		}
+
+		for (int i=from; i<=to; i++) {
+			int lw = max(w >> i, 1);
+			int lh = max(h >> i, 1);
+			f.seek(offsets[i]);
+			f.read(buf, min(sizes[i], sizes[from]));
+
+			int cnt = 0;
+			int alpha = 0;
+
+			if (td->compressed) {
+				rgba.resize(lw*lh*4);
+				p = (unsigned int*)&rgba[0];
+			} else {
+				p = (unsigned int*)td->add(i, lw, lh, lw*lh*4);
+			}
+			c = buf;
+			a = buf + lw*lh;
+			for (int y=0; y<lh; y++) {
+				for (int x=0; x<lw; x++) {
+					unsigned int k = pal[*c++];
+					k = ((k&0x00FF0000)>>16) | ((k&0x0000FF00)) | ((k& 0x000000FF)<<16);
+
+					if (hasalpha) {
+						if (alphabits == 8) {
+							alpha = (*a++);
+						} else if (alphabits == 4) {
+							alpha = ((*a >> (cnt++ * 4)) & 0xf) * 0x11;
+							if (cnt == 2) {
+								cnt = 0;
+								a++;
+							}
+						} else if (alphabits == 1) {
+							alpha = (*a & (1 << cnt++)) ? 0xff : 0;
+							if (cnt == 8) {
+								cnt = 0;
+								a++;
 							}
-						} else alpha = 0xff;
+						}
+					} else alpha = 0xff;
 
-						k |= alpha << 24;
-						*p++ = k;
-					}
+					k |= alpha << 24;
+					*p++ = k;
 				}
+			}
 
-				glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, buf2);
-
-			} else break;
-			w >>= 1;
-			h >>= 1;
+			if (td->compressed)
+				encodeDXT(dxt, lw, lh, &rgba[0], td->add(i, lw, lh, dxtLevelSize(dxt, lw, lh)));
 		}
 
-		delete[] buf2;
 		delete[] buf;
 	}
 
 	f.close();
 
-	/*
-	// TODO: Add proper support for mipmaps
-	if (hasmipmaps) {
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	} else {
-	*/
+	tex->data = td;
+	return true;
+}
+
+// hands the decoded levels to GL and drops them (main thread)
+void TextureManager::upload(Texture *tex)
+{
+	TextureData *td = tex->data;
+	tex->data = 0;
+	tex->state = TEXTURE_RESIDENT;
+	if (!td)
+		return;
+	if (td->levels.empty()) {
+		delete td;
+		return;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, tex->id);
+
+	for (size_t i=0; i<td->levels.size(); i++) {
+		TextureLevel &l = td->levels[i];
+		if (td->compressed) {
+			glCompressedTexImage2DARB(GL_TEXTURE_2D, l.level, td->format, l.w, l.h, 0, l.size, &td->pixels[l.offset]);
+		} else {
+			glTexImage2D(GL_TEXTURE_2D, l.level, GL_RGBA8, l.w, l.h, 0, GL_RGBA, GL_UNSIGNED_BYTE, &td->pixels[l.offset]);
+		}
+		tex->levelBytes[l.level] = l.size;
+	}
+
+	if (tex->baseLevel < 0) {
+		// first real upload; levels above the base are streamed in later
+		tex->baseLevel = td->levels[0].level;
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, tex->nLevels-1);
 		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-	//}
+	} else {
+		tex->baseLevel = min(tex->baseLevel, td->levels[0].level);
+		nStreamed += (int)td->levels.size();
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, tex->baseLevel);
+
+	setBytes(tex, tex->levelsSize());
+	delete td;
+}
+
+// frees the levels above level, they get streamed in again when needed
+void TextureManager::dropLevels(Texture *tex, int level)
+{
+	glBindTexture(GL_TEXTURE_2D, tex->id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+	for (int i=tex->baseLevel; i<level; i++) {
+		glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		droppedBytes += tex->levelBytes[i];
+		tex->levelBytes[i] = 0;
+	}
+	tex->baseLevel = level;
+	setBytes(tex, tex->levelsSize());
 }
 
+// the finest level the last frame's draws asked for
+int TextureManager::wantedLevel(Texture *tex)
+{
+	if (tex->wantFrame < frame-1)
+		return startLevel(tex->w, tex->h, tex->nLevels);
+
+	float size = (float)max(tex->w, tex->h);
+	int level = 0;
+	while (level < tex->nLevels-1 && size > tex->wantPixels * 2.0f) {
+		size *= 0.5f;
+		level++;
+	}
+	return level;
+}
+
+void TextureManager::need(GLuint id, float pixels)
+{
+	if (nWorkers <= 0)
+		return;
+	std::map<GLuint, ManagedItem*>::iterator it = items.find(id);
+	if (it == items.end())
+		return;
+	Texture *tex = (Texture*)it->second;
+	if (tex->wantFrame != frame) {
+		tex->wantFrame = frame;
+		tex->wantPixels = pixels;
+		wanted.push_back(id);
+	} else if (pixels > tex->wantPixels) {
+		tex->wantPixels = pixels;
+	}
+}
+
+// queues the levels last frame's draws were missing
+void TextureManager::streamLevels()
+{
+	for (size_t i=0; i<wanted.size(); i++) {
+		std::map<GLuint, ManagedItem*>::iterator it = items.find(wanted[i]);
+		if (it == items.end())
+			continue;
+		Texture *tex = (Texture*)it->second;
+		if (tex->state != TEXTURE_RESIDENT || tex->baseLevel <= 0)
+			continue;
+		int level = wantedLevel(tex);
+		if (level >= tex->baseLevel)
+			continue;
+
+		SDL_mutexP(lock);
+		tex->loadFrom = level;
+		tex->loadTo = tex->baseLevel - 1;
+		tex->state = TEXTURE_QUEUED;
+		queue.push_back(tex);
+		post();
+		SDL_mutexV(lock);
+	}
+	wanted.clear();
+}
+
+// drops the texture from the queues, waiting for a worker that is decoding it
+void TextureManager::cancel(Texture *tex)
+{
+	if (nWorkers <= 0)
+		return;
+
+	SDL_mutexP(lock);
+	for (size_t i=0; i<queue.size(); i++) {
+		if (queue[i] == tex) {
+			queue.erase(queue.begin() + i);
+			break;
+		}
+	}
+	// a worker decoding it puts it in loaded when it's done
+	while (tex->state == TEXTURE_LOADING)
+		waitJobDone();
+	for (size_t i=0; i<loaded.size(); i++) {
+		if (loaded[i] == tex) {
+			loaded.erase(loaded.begin() + i);
+			break;
+		}
+	}
+	SDL_mutexV(lock);
+
+	delete tex->data;
+	tex->data = 0;
+}
+
+void TextureManager::setBytes(Texture *tex, size_t bytes)
+{
+	residentBytes += bytes - tex->bytes;
+	if (tex->pooled)
+		pooledBytes += bytes - tex->bytes;
+	tex->bytes = bytes;
+}
+
+void TextureManager::del(GLuint id)
+{
+	Texture *tex = (Texture*)items[id];
+	if (!tex->delref())
+		return;
+
+	tex->pooled = true;
+	tex->poolPos = pool.insert(pool.end(), id);
+	pooledBytes += tex->bytes;
+	nPooled++;
+	trim();
+}
+
+void TextureManager::trim()
+{
+	// unused textures go first
+	while (residentBytes > budget && !pool.empty()) {
+		GLuint id = pool.front();
+		pool.pop_front();
+		Texture *tex = (Texture*)items[id];
+		residentBytes -= tex->bytes;
+		pooledBytes -= tex->bytes;
+		evictedBytes += tex->bytes;
+		nPooled--;
+		nEvicted++;
+
+		doDelete(id);
+		names.erase(tex->name);
+		items.erase(id);
+		delete tex;
+	}
+
+	// then the levels above what the last frame drew with
+	if (residentBytes <= budget)
+		return;
+	for (std::map<GLuint, ManagedItem*>::iterator it = items.begin(); it != items.end() && residentBytes > budget; ++it) {
+		Texture *tex = (Texture*)it->second;
+		if (tex->state != TEXTURE_RESIDENT || tex->baseLevel < 0)
+			continue;
+		int level = wantedLevel(tex);
+		if (level > tex->baseLevel)
+			dropLevels(tex, level);
+	}
+}
 
 void TextureManager::doDelete(GLuint id)
 {
+	cancel((Texture*)items[id]);
 	glDeleteTextures(1, &id);
 }
 
@@ -451,70 +950,21 @@ GLuint loadTGA(const char *filename, bool mipmaps)
 }
 
 
-struct Color {
-	unsigned char r, g, b;
-};
+// levels at least this big are worth splitting over threads
+#define DXT_THREADED_PIXELS	(256*256)
 
-void decompressDXTC(GLint format, int w, int h, size_t size, unsigned char *src, unsigned char *dest)
+void decompressDXTC(GLint format, int w, int h, size_t size, unsigned char *src, unsigned char *dest, int nThreads)
 {
-	// sort of copied from linghuye
-	int bsx = (w<4) ? w : 4;
-	int bsy = (h<4) ? h : 4;
-
-	for(int y=0; y<h; y += bsy) {
-		for(int x=0; x<w; x += bsx) {
-			unsigned long long alpha = 0;
-			unsigned int a0 = 0, a1 = 0;
-
-			if (format == GL_COMPRESSED_RGBA_S3TC_DXT3_EXT)	{
-				alpha = *(unsigned long long*)src;
-				src += 8;
-			}
-
-			unsigned int c0 = *(unsigned short*)(src + 0);
-			unsigned int c1 = *(unsigned short*)(src + 2);
-			src += 4;
-
-			Color color[4];
-			color[0].b = (unsigned char) ((c0 >> 11) & 0x1f) << 3;
-			color[0].g = (unsigned char) ((c0 >>  5) & 0x3f) << 2;
-			color[0].r = (unsigned char) ((c0      ) & 0x1f) << 3;
-			color[1].b = (unsigned char) ((c1 >> 11) & 0x1f) << 3;
-			color[1].g = (unsigned char) ((c1 >>  5) & 0x3f) << 2;
-			color[1].r = (unsigned char) ((c1      ) & 0x1f) << 3;
-			if(c0 > c1) {
-				color[2].r = (color[0].r * 2 + color[1].r) / 3;
-				color[2].g = (color[0].g * 2 + color[1].g) / 3;
-				color[2].b = (color[0].b * 2 + color[1].b) / 3;
-				color[3].r = (color[0].r + color[1].r * 2) / 3;
-				color[3].g = (color[0].g + color[1].g * 2) / 3;
-				color[3].b = (color[0].b + color[1].b * 2) / 3;
-			} else {
-				color[2].r = (color[0].r + color[1].r) / 2;
-				color[2].g = (color[0].g + color[1].g) / 2;
-				color[2].b = (color[0].b + color[1].b) / 2;
-				color[3].r = 0;
-				color[3].g = 0;
-				color[3].b = 0;
-			}
-
-			for (int j=0; j<bsy; j++) {
-				unsigned int index = *src++;
-				unsigned char* dd = dest + (w*(y+j)+x)*4;
-				for (int i=0; i<bsx; i++) {
-					*dd++ = color[index & 0x03].b;
-					*dd++ = color[index & 0x03].g;
-					*dd++ = color[index & 0x03].r;
-					if (format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT)	{
-						*dd++ = ((index & 0x03) == 3 && c0 <= c1) ? 0 : 255;
-					}
-					else if (format == GL_COMPRESSED_RGBA_S3TC_DXT3_EXT)	{
-						*dd++ = (unsigned char)(alpha & 0x0f) << 4;
-						alpha >>= 4;
-					}
-					index >>= 2;
-				}
-			}
-		}
+	DXTFormat f = DXT_1;
+	if (format == GL_COMPRESSED_RGBA_S3TC_DXT3_EXT)
+		f = DXT_3;
+	else if (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+		f = DXT_5;
+
+	if (size < (size_t)dxtLevelSize(f, w, h)) {
+		memset(dest, 0, w*h*4);
+		return;
 	}
+
+	decodeDXT(f, w, h, src, dest, (w*h >= DXT_THREADED_PIXELS) ? nThreads : 1);
 }
@@ -4,6 +4,9 @@
 #include <SDL/SDL.h>
 #include <SDL/SDL_opengl.h>
 #include <map>
+#include <vector>
+#include <deque>
+#include <list>
 
 #ifndef _WINDOWS
 #include <stdarg.h>
@@ -12,8 +15,10 @@
 #include "vec3d.h"
 
 #include "manager.h"
+#include "util.h"
 #include "font.h"
 #include "ddslib.h"
+#include "camera.h"
 
 #define PI 3.14159265358f
 
@@ -40,6 +45,16 @@ extern PFNGLDELETEBUFFERSARBPROC glDeleteBuffersARB;
 
 extern PFNGLMAPBUFFERARBPROC glMapBufferARB;
 extern PFNGLUNMAPBUFFERARBPROC glUnmapBufferARB;
+extern PFNGLBUFFERSUBDATAARBPROC glBufferSubDataARB;
+
+// GL_ARB_map_buffer_range, may be missing
+#ifndef GL_ARB_map_buffer_range
+#define GL_MAP_WRITE_BIT				0x0002
+#define GL_MAP_INVALIDATE_RANGE_BIT		0x0004
+#define GL_MAP_UNSYNCHRONIZED_BIT		0x0020
+typedef GLvoid* (APIENTRYP PFNGLMAPBUFFERRANGEPROC) (GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+#endif
+extern PFNGLMAPBUFFERRANGEPROC glMapBufferRange;
 
 #ifdef _WINDOWS
 extern PFNGLDRAWRANGEELEMENTSPROC glDrawRangeElements;
@@ -47,6 +62,12 @@ extern PFNGLDRAWRANGEELEMENTSPROC glDrawRangeElements;
 
 #define GL_BUFFER_OFFSET(i) ((char *)(0) + (i))
 
+// GL 1.2 mipmap level clamping, the windows gl.h stops at 1.1
+#ifndef GL_TEXTURE_BASE_LEVEL
+#define GL_TEXTURE_BASE_LEVEL			0x813C
+#define GL_TEXTURE_MAX_LEVEL			0x813D
+#endif
+
 extern bool supportCompression;
 extern bool supportMultiTex;
 extern bool supportVBO;
@@ -55,25 +76,160 @@ extern bool supportDrawRangeElements;
 
 ////////// TEXTURE MANAGER
 
+struct TextureData;
+
+// BLPs are decoded on worker threads and uploaded by uploadTextures; until then the texture is a grey placeholder
+enum TextureState {
+	TEXTURE_QUEUED,
+	TEXTURE_LOADING,
+	TEXTURE_LOADED,
+	TEXTURE_RESIDENT,
+	TEXTURE_FAILED
+};
+
 class Texture : public ManagedItem {
 public:
 	int w,h;
 	GLuint id;
-
-	Texture(std::string name):ManagedItem(name), w(0), h(0) {}
+	TextureState state;
+	TextureData *data;
+	// GL memory of all levels
+	size_t bytes;
+	// no references left, waiting in TextureManager's pool for reuse or eviction
+	bool pooled;
+	std::list<GLuint>::iterator poolPos;
+
+	// mip levels in the file; levels below baseLevel aren't resident (-1 before the first upload)
+	int nLevels, baseLevel;
+	size_t levelBytes[16];
+	// levels the next decode reads, loadFrom -1 for the initial load, loadTo -1 up to the last one
+	int loadFrom, loadTo;
+	// biggest on-screen size in pixels asked for in wantFrame
+	float wantPixels;
+	int wantFrame;
+
+	Texture(std::string name):ManagedItem(name), w(0), h(0), state(TEXTURE_QUEUED), data(0), bytes(0), pooled(false),
+		nLevels(0), baseLevel(-1), loadFrom(-1), loadTo(-1), wantPixels(0), wantFrame(-1)
+	{
+		for (int i=0; i<16; i++)
+			levelBytes[i] = 0;
+	}
+
+	size_t levelsSize()
+	{
+		size_t n = 0;
+		for (int i=0; i<16; i++)
+			n += levelBytes[i];
+		return n;
+	}
 
 };
 
-class TextureManager : public Manager<GLuint> {
-	
-	void LoadBLP(GLuint id, Texture *tex);
+#define MAX_TEXTURE_THREADS 4
+
+class TextureManager : public Manager<GLuint>, public WorkerPool {
+	std::deque<Texture*> queue;
+	std::vector<Texture*> loaded;
+	// unreferenced textures, least recently released first
+	std::list<GLuint> pool;
+	// textures passed to need this frame
+	std::vector<GLuint> wanted;
+	int frame;
+
+	void startWorkers();
+	// the workers decode the BLPs
+	void *takeJob();
+	bool runJob(void *job);
+	void jobDone(void *job, bool ok);
+	// threads for the software DXT decode of big levels, 1 when we're already on a worker
+	static bool decode(Texture *tex, int threads);
+	void upload(Texture *tex);
+	void cancel(Texture *tex);
+	void setBytes(Texture *tex, size_t bytes);
+	// evicts pooled textures, then drops unneeded top levels, until we're within budget
+	void trim();
+	void dropLevels(Texture *tex, int level);
+	int wantedLevel(Texture *tex);
+	void streamLevels();
 
 public:
+	TextureManager();
+	~TextureManager();
+
 	virtual GLuint add(std::string name);
+	// textures that lose their last reference go to the pool instead of being deleted
+	virtual void del(GLuint id);
 	void doDelete(GLuint id);
 
+	// texture memory above which pooled textures are evicted; textures in use are never evicted
+	size_t budget;
+	// bytes in all textures, bytes in pooled ones, bytes evicted so far
+	size_t residentBytes, pooledBytes, evictedBytes, droppedBytes;
+	int nPooled, nEvicted;
+	// levels streamed in on demand so far
+	int nStreamed;
+
+	// textures queued or decoded but not uploaded yet / uploaded in the last uploadTextures
+	int waiting, uploaded;
+
+	// compress palettized BLPs to DXT as they're decoded, when the GL takes S3TC
+	static bool transcode;
+
+	// uploads decoded textures in the order they finished, within a time budget; once per frame
+	void uploadTextures();
+	void stopWorkers();
+
+	// a draw wants texture id at about pixels across on screen; missing levels get streamed in
+	void need(GLuint id, float pixels);
+
 };
 
+////////// STREAMING VERTEX BUFFER
+
+/*
+	One big vertex buffer for everything that's rebuilt every frame: CPU skinned models,
+	particles and ribbons, text. Each write takes the next piece of the buffer, and when
+	the end is reached the buffer is orphaned and writing starts over at the front, so
+	nothing ever waits for draws still reading the old contents. With map_buffer_range a
+	piece is mapped unsynchronized, otherwise it's uploaded with glBufferSubData.
+
+	Data stays usable until the next orphan, which bumps generation.
+*/
+class StreamBuffer {
+	GLuint vbo;
+	size_t size, head;
+	// the piece handed out by alloc
+	size_t offset, length;
+	bool mapped;
+	std::vector<char> local;
+
+	void orphan(size_t minSize);
+
+public:
+	int generation;
+
+	// GL buffer calls this frame and in the last complete one
+	int nMaps, nAllocs;
+	size_t nBytes;
+	int lastMaps, lastAllocs;
+	size_t lastBytes;
+
+	StreamBuffer();
+
+	// room for n bytes; fill it in and commit() before the next alloc
+	void *alloc(size_t n);
+	// binds the buffer and returns the base for gl*Pointer
+	const char *commit();
+	// for data committed earlier under the same generation
+	void bind();
+	void unbind();
+
+	void newFrame();
+	void release();
+};
+
+extern StreamBuffer streamBuffer;
+
 ////////// VIDEO CLASS
 
 class Video
@@ -97,7 +253,11 @@ public:
 	void set3D();
 	void set2D();
 
+	// roughly how many pixels across something size units big appears at distance dist
+	float projectedSize(float size, float dist);
+
 	TextureManager textures;
+	Camera camera;
     
 	int xres, yres;
 
@@ -106,7 +266,8 @@ public:
 extern Video video;
 
 GLuint loadTGA(const char *filename, bool mipmaps);
-void decompressDXTC(GLint format, int w, int h, size_t size, unsigned char *src, unsigned char *dest);
+// levels of at least DXT_THREADED_PIXELS are split over nThreads
+void decompressDXTC(GLint format, int w, int h, size_t size, unsigned char *src, unsigned char *dest, int nThreads = 1);
 bool isExtensionSupported(const char *search);
 
 
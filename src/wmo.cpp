@@ -2,9 +2,14 @@
 #include "world.h"
 #include "liquid.h"
 #include "shaders.h"
+#include "meshopt.h"
+#include <algorithm>
 
 using namespace std;
 
+// load order of groups that haven't been drawn yet, well behind anything in view
+#define WMO_BACKGROUND_PRIORITY	1000000.0f
+
 /*
 http://www.madx.dk/wowdev/wiki/index.php?title=WMO
 
@@ -27,9 +32,9 @@ groups
 visibility information
 more data
 */
-WMO::WMO(std::string name): ManagedItem(name), groups(0), nTextures(0), nGroups(0),
+WMO::WMO(std::string name, WMOManager *loader): ManagedItem(name), groups(0), nTextures(0), nGroups(0),
 	nP(0), nLights(0), nModels(0), nDoodads(0), nDoodadSets(0), nX(0), mat(0), LiquidType(0),
-	skybox(0)
+	skybox(0), loader(loader)
 {
 	MPQFile f(name.c_str());
 	ok = !f.isEof();
@@ -49,22 +54,16 @@ WMO::WMO(std::string name): ManagedItem(name), groups(0), nTextures(0), nGroups(
 
 	char *texbuf=0;
 
-	while (!f.isEof()) {
-		memset(fourcc, 0, 4);
-		size = 0;
-		f.read(fourcc,4);
-		f.read(&size, 4);
-		flipcc(fourcc);
-		fourcc[4] = 0;
-
-		if (size == 0)
-			continue;
+	ChunkIndex index(f);
+	for (size_t n=0; n<index.chunks.size(); n++) {
+		const Chunk &chunk = index.chunks[n];
+		size = (uint32)chunk.size;
+		f.seek((ssize_t)chunk.offset);
+		chunkName(chunk.id, fourcc);
 
-		size_t nextpos = f.getPos() + size;
-
-		if (strcmp(fourcc,"MVER")==0) {
+		if (chunk.id == FOURCC('M','V','E','R')) {
 		}
-		else if (strcmp(fourcc,"MOHD")==0) {
+		else if (chunk.id == FOURCC('M','O','H','D')) {
 			unsigned int col;
 			// Header for the map object. 64 bytes.
 			f.read(&nTextures, 4); // number of materials
@@ -86,7 +85,7 @@ WMO::WMO(std::string name): ManagedItem(name), groups(0), nTextures(0), nGroups(
 			mat = new WMOMaterial[nTextures];
 
 		}
-		else if (strcmp(fourcc,"MOTX")==0) {
+		else if (chunk.id == FOURCC('M','O','T','X')) {
 /*
 List of textures (BLP Files) used in this map object. 
 A block that are complete filenames with paths. There will be further material information for each texture in the next chunk. The gaps between the filenames are padded with extra zeroes, but the material chunk does have some positional information for these strings.
@@ -97,7 +96,7 @@ The beginning of a string is always aligned to a 4Byte Adress. (0, 4, 8, C). The
 			f.read(texbuf, size);
 			texbuf[size] = 0;
 		}
-		else if (strcmp(fourcc,"MOMT")==0) {
+		else if (chunk.id == FOURCC('M','O','M','T')) {
 			// Materials used in this map object, 64 bytes per texture (BLP file), nMaterials entries.
 			// WMOMaterialBlock bl;
 /*
@@ -131,7 +130,7 @@ flag2 		Meaning
 				
 			}
 		}
-		else if (strcmp(fourcc,"MOGN")==0) {
+		else if (chunk.id == FOURCC('M','O','G','N')) {
 /*
 List of group names for the groups in this map object. There are nGroups entries in this chunk.
 A contiguous block of zero-terminated strings. The names are purely informational, they aren't used elsewhere (to my knowledge)
@@ -139,7 +138,7 @@ i think think that his realy is zero terminated and just a name list .. but so f
 */
 			groupnames = (char*)f.getPointer();
 		}
-		else if (strcmp(fourcc,"MOGI")==0) {
+		else if (chunk.id == FOURCC('M','O','G','I')) {
 			// group info - important information! ^_^
 /*
 Group information for WMO groups, 32 bytes per group, nGroups entries.
@@ -173,7 +172,7 @@ Flag		Meaning
 
 			}
 		}
-		else if (strcmp(fourcc,"MOSB")==0) {
+		else if (chunk.id == FOURCC('M','O','S','B')) {
 /*
 Skybox. Always 00 00 00 00. Skyboxes are now defined in DBCs (Light.dbc etc.). Contained a M2 filename that was used as skybox.
 */
@@ -193,7 +192,7 @@ Skybox. Always 00 00 00 00. Skyboxes are now defined in DBCs (Light.dbc etc.). C
 				}
 			}
 		}
-		else if (strcmp(fourcc,"MOPV")==0) {
+		else if (chunk.id == FOURCC('M','O','P','V')) {
 /*
 Portal vertices, 4 * 3 * float per portal, nPortals entries.
 Portals are (always?) rectangles that specify where doors or entrances are in a WMO. They could be used for visibility, but I currently have no idea what relations they have to each other or how they work.
@@ -214,7 +213,7 @@ It's fun, you can actually map out the topology of the WMO using this and the MO
 				pvs.push_back(p);
 			}
 		}
-		else if (strcmp(fourcc,"MOPT")==0) {
+		else if (chunk.id == FOURCC('M','O','P','T')) {
 /*
 Portal information. 20 bytes per portal, nPortals entries.
 Offset	Type 		Description
@@ -224,7 +223,7 @@ Offset	Type 		Description
 0x10 	float 		unknown  - if this is NAN, the three floats will be (0,0,1)
 */
 		}
-		else if (strcmp(fourcc,"MOPR")==0) {
+		else if (chunk.id == FOURCC('M','O','P','R')) {
 /*
 Portal <> group relationship? 2*nPortals entries of 8 bytes.
 I think this might specify the two WMO groups that a portal connects.
@@ -248,20 +247,20 @@ struct SMOPortalRef // 04-29-2005 By ObscuR
 				prs.push_back(*pr++);
 			}
 		}
-		else if (strcmp(fourcc,"MOVV")==0) {
+		else if (chunk.id == FOURCC('M','O','V','V')) {
 /*
 Visible block vertices
 Just a list of vertices that corresponds to the visible block list.
 */
 		}
-		else if (strcmp(fourcc,"MOVB")==0) {
+		else if (chunk.id == FOURCC('M','O','V','B')) {
 /*
 Visible block list
 unsigned short firstVertex;
 unsigned short count;
 */
 		}
-		else if (strcmp(fourcc,"MOLT")==0) {
+		else if (chunk.id == FOURCC('M','O','L','T')) {
 /*
 Lighting information. 48 bytes per light, nLights entries
 Offset 	Type 		Description
@@ -303,7 +302,7 @@ The WoW client (at least on my system) uses only one light, which is always dire
 				lights.push_back(l);
 			}
 		}
-		else if (strcmp(fourcc,"MODS")==0) {
+		else if (chunk.id == FOURCC('M','O','D','S')) {
 /*
 This chunk defines doodad sets.
 Doodads in WoW are M2 model files. There are 32 bytes per doodad set, and nSets entries. Doodad sets specify several versions of "interior decoration" for a WMO. Like, a small house might have tables and a bed laid out neatly in one set called "Set_$DefaultGlobal", and have a horrible mess of abandoned broken things in another set called "Set_Abandoned01". The names are only informative.
@@ -327,7 +326,7 @@ struct SMODoodadSet // --Schlumpf 17:03, 31 July 2007 (CEST)
 				doodadsets.push_back(dds);
 			}
 		}
-		else if (strcmp(fourcc,"MODN")==0) {
+		else if (chunk.id == FOURCC('M','O','D','N')) {
 			// models ...
 			// MMID would be relative offsets for MMDX filenames
 /*
@@ -351,7 +350,7 @@ A block of zero-padded, zero-terminated strings. There are nModels file names in
 				f.seekRelative((int)size);
 			}
 		}
-		else if (strcmp(fourcc,"MODD")==0) {
+		else if (chunk.id == FOURCC('M','O','D','D')) {
 /*
 Information for doodad instances. 40 bytes per doodad instance, nDoodads entries.
 While WMOs and models (M2s) in a map tile are rotated along the axes, doodads within a WMO are oriented using quaternions! Hooray for consistency!
@@ -387,7 +386,7 @@ struct SMODoodadDef // 03-29-2005 By ObscuR
 			}
 
 		}
-		else if (strcmp(fourcc,"MFOG")==0) {
+		else if (chunk.id == FOURCC('M','F','O','G')) {
 /*
 Fog information. Made up of blocks of 48 bytes.
 Fog end: This is the distance at which all visibility ceases, and you see no objects or terrain except for the fog color.
@@ -400,7 +399,7 @@ Fog start: This is where the fog starts. Obtained by multiplying the fog end val
 				fogs.push_back(fog);
 			}
 		}
-		else if (strcmp(fourcc,"MCVP")==0) {
+		else if (chunk.id == FOURCC('M','C','V','P')) {
 /*
 MCVP chunk (optional)
 Convex Volume Planes. Contains blocks of floating-point numbers.
@@ -410,15 +409,14 @@ Convex Volume Planes. Contains blocks of floating-point numbers.
 		else {
 			gLog("No implement wmo chunk %s [%d].\n", fourcc, size);
 		}
-
-		f.seek((int)nextpos);
 	}
 
 	f.close();
 	delete[] texbuf;
 
+	// the groups come in on the loader threads; ones that get drawn are moved up the queue
 	for (int i=0; i<nGroups; i++) 
-		groups[i].initDisplayList();
+		loader->requestGroup(&groups[i], WMO_BACKGROUND_PRIORITY + i);
 
 }
 
@@ -428,8 +426,10 @@ WMO::~WMO()
 		return;
 
 	gLog("Unloading WMO %s\n", name.c_str());
-	if (groups)
+	if (groups) {
+		loader->cancel(this);
 		delete[] groups;
+	}
 
 	for (vector<string>::iterator it = textures.begin(); it != textures.end(); ++it)
             video.textures.delbyname(*it);
@@ -446,22 +446,13 @@ WMO::~WMO()
 	}
 }
 
-void WMO::draw(int doodadset, const Vec3D &ofs, const float rot)
+void WMO::draw(WMOInstance *inst)
 {
 	if (!ok) return;
 	
+	// doodads and liquid are drawn along with the queued groups, see WMOManager::drawQueued
 	for (int i=0; i<nGroups; i++) {
-		groups[i].draw(ofs, rot);
-	}
-
-	if (gWorld->drawdoodads) {
-		for (int i=0; i<nGroups; i++) {
-			groups[i].drawDoodads(doodadset, ofs, rot);
-		}
-	}
-
-	for (int i=0; i<nGroups; i++) {
-		groups[i].drawLiquid();
+		groups[i].draw(inst);
 	}
 
 	/*
@@ -572,7 +563,7 @@ void WMO::drawSkybox()
 		glTranslatef(o.x, o.y, o.z);
 		const float sc = 2.0f;
 		glScalef(sc,sc,sc);
-        skybox->draw();
+		skybox->draw(0, Matrix::newTranslation(o) * Matrix::newScale(Vec3D(sc,sc,sc)));
 		glPopMatrix();
 		gWorld->hadSky = true;
 		glEnable(GL_DEPTH_TEST);
@@ -678,8 +669,16 @@ void WMOGroup::init(WMO *wmo, MPQFile &f, int num, char *names)
 
 	ddr = 0;
 	nDoodads = 0;
+	indoor = false;
 
 	lq = 0;
+
+	// rough bounds until the group file is in, for culling and load order
+	Vec3D a(v1.x, v1.z, -v1.y), b(v2.x, v2.z, -v2.y);
+	center = (a + b) * 0.5f;
+	rad = (a - b).length() * 0.5f;
+	vmin = Vec3D(min(a.x,b.x), min(a.y,b.y), min(a.z,b.z));
+	vmax = Vec3D(max(a.x,b.x), max(a.y,b.y), max(a.z,b.z));
 }
 
 
@@ -690,16 +689,26 @@ struct WMOBatch {
 	unsigned char flags, texture;
 };
 
-void setGLColor(unsigned int col)
-{
-	//glColor4ubv((GLubyte*)(&col));
-	GLubyte r,g,b,a;
-	a = (col & 0xFF000000) >> 24;
-	r = (col & 0x00FF0000) >> 16;
-	g = (col & 0x0000FF00) >> 8;
-	b = (col & 0x000000FF);
-    glColor4ub(r,g,b,1);
-}
+// a group file as parsed by WMOGroup::load; the arrays point into the file buffer
+struct WMOGroupData {
+	MPQFile *gf;
+	Vec3D *vertices, *normals;
+	Vec2D *texcoords;
+	unsigned short *indices;
+	WMOBatch *batches;
+	unsigned int *cv;
+	short *useLights;
+	int nLR;
+	// swizzled copy of the vertex data
+	WMOVertex *verts;
+	// the liquid data starts at lqPos, 0 if there is none
+	WMOLiquidHeader hlq;
+	size_t lqPos;
+	Vec3D vmin, vmax;
+
+	WMOGroupData(): gf(0), vertices(0), normals(0), texcoords(0), indices(0), batches(0), cv(0), useLights(0), nLR(0), verts(0), lqPos(0) {}
+	~WMOGroupData() { delete gf; delete[] verts; }
+};
 
 Vec4D colorFromInt(unsigned int col) {
 	GLubyte r,g,b,a;
@@ -750,20 +759,71 @@ struct SMOPoly {
 	uint8 mtlId;
 };
 
-void WMOGroup::initDisplayList()
+/*
+	Reorder the triangles of each batch for the vertex cache, then the group's vertices
+	by first use. MOPY and MOBR refer to triangles by number and would be out of date
+	afterwards, but neither is used for drawing.
+*/
+static void optimizeBatches(const char *fname, WMOBatch *batches, unsigned int nBatches, unsigned short *indices, int nIndices,
+							Vec3D *vertices, Vec3D *normals, Vec2D *texcoords, unsigned int *cv, int nVertices)
+{
+	if (!indices || !vertices || !normals || !texcoords || nIndices == 0 || nVertices > 0x10000)
+		return;
+	for (int i=0; i<nIndices; i++) {
+		if (indices[i] >= nVertices) {
+			gLog("Error: vertex index out of range in [%s]\n", fname);
+			return;
+		}
+	}
+
+	float before = calcACMR(indices, nIndices);
+
+	for (unsigned int i=0; i<nBatches; i++) {
+		unsigned int start = batches[i].indexStart, end = start + batches[i].indexCount;
+		bool overlaps = end > (unsigned int)nIndices;
+		for (unsigned int j=0; j<i; j++) {
+			if (start < batches[j].indexStart + batches[j].indexCount && batches[j].indexStart < end)
+				overlaps = true;
+		}
+		if (!overlaps)
+			optimizeVertexCache(indices + start, batches[i].indexCount);
+	}
+
+	unsigned short *remap = new unsigned short[nVertices];
+	buildFetchRemap(indices, nIndices, remap, nVertices);
+	remapIndices(indices, nIndices, remap);
+	remapVertexData(vertices, remap, nVertices);
+	remapVertexData(normals, remap, nVertices);
+	remapVertexData(texcoords, remap, nVertices);
+	if (cv)
+		remapVertexData(cv, remap, nVertices);
+	delete[] remap;
+
+	// vertex ranges have moved along with the vertices
+	for (unsigned int i=0; i<nBatches; i++) {
+		unsigned int end = batches[i].indexStart + batches[i].indexCount;
+		if (end > (unsigned int)nIndices)
+			continue;
+		unsigned short vmin = 0xFFFF, vmax = 0;
+		for (unsigned int j=batches[i].indexStart; j<end; j++) {
+			if (indices[j] < vmin) vmin = indices[j];
+			if (indices[j] > vmax) vmax = indices[j];
+		}
+		if (vmin <= vmax) {
+			batches[i].vertexStart = vmin;
+			batches[i].vertexEnd = vmax;
+		}
+	}
+
+	gLog("WMO group %s: ACMR %.3f -> %.3f\n", fname, before, calcACMR(indices, nIndices));
+}
+
+bool WMOGroup::load()
 {
-	Vec3D *vertices, *normals;
-	Vec2D *texcoords;
-	unsigned short *indices;
 	struct SMOPoly *materials;
-	WMOBatch *batches;
-	//int nBatches;
 
 	WMOGroupHeader gh;
 
-	short *useLights = 0;
-	int nLR = 0;
-
 	// open group file
 	char temp[256];
 	strcpy(temp, wmo->name.c_str());
@@ -772,10 +832,14 @@ void WMOGroup::initDisplayList()
 	char fname[256];
 	sprintf(fname,"%s_%03d.wmo",temp, num);
 
-	MPQFile gf(fname);
-	if (gf.isEof()) {
-		return;
+	MPQFile *pf = new MPQFile(fname);
+	if (pf->isEof()) {
+		delete pf;
+		return false;
 	}
+	WMOGroupData *d = new WMOGroupData();
+	d->gf = pf;
+	MPQFile &gf = *pf;
 	gf.seek(0x14); // a header at 0x14
 
 	// read MOGP chunk header
@@ -787,30 +851,21 @@ void WMOGroup::initDisplayList()
 	b1 = Vec3D(gh.box1[0], gh.box1[2], -gh.box1[1]);
 	b2 = Vec3D(gh.box2[0], gh.box2[2], -gh.box2[1]);
 
-	gf.seek(0x58); // first chunk at 0x58
-
 	char fourcc[5];
 	uint32 size = 0;
 
-	unsigned int *cv;
 	hascv = false;
 
-	while (!gf.isEof()) {
-		memset(fourcc, 0, 4);
-		size = 0;
-		gf.read(fourcc,4);
-		gf.read(&size, 4);
-		flipcc(fourcc);
-		fourcc[4] = 0;
-
-		if (size == 0)
-			continue;
-
-		size_t nextpos = gf.getPos() + size;
+	ChunkIndex index(gf, 0x58); // first chunk at 0x58
+	for (size_t n=0; n<index.chunks.size(); n++) {
+		const Chunk &chunk = index.chunks[n];
+		size = (uint32)chunk.size;
+		gf.seek((ssize_t)chunk.offset);
+		chunkName(chunk.id, fourcc);
 
 		// why copy stuff when I can just map it from memory ^_^
 		
-		if (strcmp(fourcc,"MOPY")==0) {
+		if (chunk.id == FOURCC('M','O','P','Y')) {
 /*
 Material info for triangles, two bytes per triangle. So size of this chunk in bytes is twice the number of triangles in the WMO group.
 Offset	Type 	Description
@@ -849,23 +904,23 @@ Triangles stored here are more-or-less pre-sorted by texture, so it's ok to draw
 			nTriangles = (int)size / 2;
 			materials = (struct SMOPoly*)gf.getPointer();
 		}
-		else if (strcmp(fourcc,"MOVI")==0) {
+		else if (chunk.id == FOURCC('M','O','V','I')) {
 /*
 Vertex indices for triangles. Three 16-bit integers per triangle, that are indices into the vertex list. The numbers specify the 3 vertices for each triangle, their order makes it possible to do backface culling.
 */
 			// indices
-			indices =  (unsigned short*)gf.getPointer();
+			d->indices =  (unsigned short*)gf.getPointer();
 		}
-		else if (strcmp(fourcc,"MOVT")==0) {
+		else if (chunk.id == FOURCC('M','O','V','T')) {
 /*
 Vertices chunk. 3 floats per vertex, the coordinates are in (X,Z,-Y) order. It's likely that WMOs and models (M2s) were created in a coordinate system with the Z axis pointing up and the Y axis into the screen, whereas in OpenGL, the coordinate system used in WoWmapview the Z axis points toward the viewer and the Y axis points up. Hence the juggling around with coordinates.
 */
 			nVertices = (int)size / 12;
 			// let's hope it's padded to 12 bytes, not 16...
-			vertices =  (Vec3D*)gf.getPointer();
+			Vec3D *vertices = d->vertices = (Vec3D*)gf.getPointer();
+			Vec3D &vmin = d->vmin, &vmax = d->vmax;
 			vmin = Vec3D( 9999999.0f, 9999999.0f, 9999999.0f);
 			vmax = Vec3D(-9999999.0f,-9999999.0f,-9999999.0f);
-			rad = 0;
 			for (int i=0; i<nVertices; i++) {
 				Vec3D v(vertices[i].x, vertices[i].z, -vertices[i].y);
 				if (v.x < vmin.x) vmin.x = v.x;
@@ -875,18 +930,16 @@ Vertices chunk. 3 floats per vertex, the coordinates are in (X,Z,-Y) order. It's
 				if (v.y > vmax.y) vmax.y = v.y;
 				if (v.z > vmax.z) vmax.z = v.z;
 			}
-			center = (vmax + vmin) * 0.5f;
-			rad = (vmax-center).length();
 		}
-		else if (strcmp(fourcc,"MONR")==0) {
+		else if (chunk.id == FOURCC('M','O','N','R')) {
 			// Normals. 3 floats per vertex normal, in (X,Z,-Y) order.
-			normals =  (Vec3D*)gf.getPointer();
+			d->normals =  (Vec3D*)gf.getPointer();
 		}
-		else if (strcmp(fourcc,"MOTV")==0) {
+		else if (chunk.id == FOURCC('M','O','T','V')) {
 			// Texture coordinates, 2 floats per vertex in (X,Y) order. The values range from 0.0 to 1.0. Vertices, normals and texture coordinates are in corresponding order, of course.
-			texcoords =  (Vec2D*)gf.getPointer();
+			d->texcoords =  (Vec2D*)gf.getPointer();
 		}
-		else if (strcmp(fourcc,"MOBA")==0) {
+		else if (chunk.id == FOURCC('M','O','B','A')) {
 /*
 Render batches. Records of 24 bytes.
 struct SMOBatch // 03-29-2005 By ObscuR
@@ -922,7 +975,7 @@ Offset	Type 		Description
 0x17 	uint8 		Texture
 */
 			nBatches = (uint32)size / 24;
-			batches = (WMOBatch*)gf.getPointer();
+			d->batches = (WMOBatch*)gf.getPointer();
 			
 			/*
 			// batch logging
@@ -946,16 +999,16 @@ Offset	Type 		Description
 			*/
 			
 		}
-		else if (strcmp(fourcc,"MOLR")==0) {
+		else if (chunk.id == FOURCC('M','O','L','R')) {
 /*
 Light references, one 16-bit integer per light reference.
 This is basically a list of lights used in this WMO group, the numbers are indices into the WMO root file's MOLT table.
 For some WMO groups there is a large number of lights specified here, more than what a typical video card will handle at once. I wonder how they do lighting properly. Currently, I just turn on the first GL_MAX_LIGHTS and hope for the best. :(
 */
-			nLR = (int)size / 2;
-			useLights =  (short*)gf.getPointer();
+			d->nLR = (int)size / 2;
+			d->useLights =  (short*)gf.getPointer();
 		}
-		else if (strcmp(fourcc,"MODR")==0) {
+		else if (chunk.id == FOURCC('M','O','D','R')) {
 /*
 Doodad references, one 16-bit integer per doodad.
 The numbers are indices into the doodad instance table (MODD chunk) of the WMO root file. These have to be filtered to the doodad set being used in any given WMO instance.
@@ -964,7 +1017,7 @@ The numbers are indices into the doodad instance table (MODD chunk) of the WMO r
 			ddr = new short[nDoodads];
 			gf.read(ddr,size);
 		}
-		else if (strcmp(fourcc,"MOBN")==0) {
+		else if (chunk.id == FOURCC('M','O','B','N')) {
 /*
 Array of t_BSP_NODE.
 struct t_BSP_NODE
@@ -981,10 +1034,10 @@ struct t_BSP_NODE
 This+BoundingBox(in wmo_root.MOGI) is used for Collision --Tigurius
 */
 		}
-		else if (strcmp(fourcc,"MOBR")==0) {
+		else if (chunk.id == FOURCC('M','O','B','R')) {
 			// Triangle indices (in MOVI which define triangles) to describe polygon planes defined by MOBN BSP nodes.
 		}
-		else if (strcmp(fourcc,"MOCV")==0) {
+		else if (chunk.id == FOURCC('M','O','C','V')) {
 /*
 Vertex colors, 4 bytes per vertex (BGRA), for WMO groups using indoor lighting.
 I don't know if this is supposed to work together with, or replace, the lights referenced in MOLR. But it sure is the only way for the ground around the goblin smelting pot to turn red in the Deadmines. (but some corridors are, in turn, too dark - how the hell does lighting work anyway, are there lightmaps hidden somewhere?)
@@ -993,9 +1046,9 @@ After further inspection, this is it, actual pre-lit vertex colors for WMOs - ve
 */
 			//gLog("CV: %d\n", size);
 			hascv = true;
-			cv = (unsigned int*)gf.getPointer();
+			d->cv = (unsigned int*)gf.getPointer();
 		}
-		else if (strcmp(fourcc,"MLIQ")==0) {
+		else if (chunk.id == FOURCC('M','L','I','Q')) {
 /*
 Specifies liquids inside WMOs.
 This is where the water from Stormwind and BFD etc. is hidden. (slime in Undercity, pool water in the Darnassus temple, some lava in IF)
@@ -1023,136 +1076,133 @@ old:
 
 The material ID often refers to what seems to be a "special" material in the root WMO file (special because it often has a solid color/placeholder texture, or a texture from XTextures\*) - but sometimes the material referenced seems to be not special at all, so I'm not really sure how the liquid material is obtained - such as water/slime/lava.
 */
-			// liquids
-			WMOLiquidHeader hlq;
-			gf.read(&hlq, 0x1E);
+			// liquids, these load textures so they're made in upload
+			gf.read(&d->hlq, 0x1E);
+			d->lqPos = gf.getPos();
 
 			//gLog("WMO Liquid: %dx%d, %dx%d, (%f,%f,%f) %d\n", hlq.X, hlq.Y, hlq.A, hlq.B, hlq.pos.x, hlq.pos.y, hlq.pos.z, hlq.type);
-
-			lq = new Liquid(hlq.A, hlq.B, Vec3D(hlq.pos.x, hlq.pos.z, -hlq.pos.y));
-			lq->initFromWMO(gf, wmo->mat[hlq.type], (flags&0x2000)!=0);
 		} else {
 			gLog("No implement wmo group chunk %s [%d].\n", fourcc, size);
 		}
 
 		// TODO: figure out/use MFOG ?
-
- 		gf.seek((int)nextpos);
 	}
 
-	// ok, make a display list
-
-	indoor = (flags&8192)!=0;
-	//gLog("Lighting: %s %X\n\n", indoor?"Indoor":"Outdoor", flags);
-
-	initLighting(nLR,useLights);
-
-	//dl = glGenLists(1);
-	//glNewList(dl, GL_COMPILE);
-	//glDisable(GL_BLEND);
-	//glColor4f(1,1,1,1);
-
-	// generate lists for each batch individually instead
-	GLuint listbase = glGenLists(nBatches);
-
-	/*
-	float xr=0,xg=0,xb=0;
-	if (flags & 0x0040) xr = 1;
-	if (flags & 0x2000) xg = 1;
-	if (flags & 0x8000) xb = 1;
-	glColor4f(xr,xg,xb,1);
-	*/
+	optimizeBatches(fname, d->batches, nBatches, d->indices, nTriangles*3, d->vertices, d->normals, d->texcoords, hascv ? d->cv : 0, nVertices);
 
-	// assume that texturing is on, for unit 1
+	buildBatches(d);
+	buildDoodadSets();
 
-	for (uint32 b=0; b<nBatches; b++) {
-
-		GLuint list = listbase + b;
-
-		WMOBatch *batch = &batches[b];
-		WMOMaterial *mat = &wmo->mat[batch->texture];
-
-		bool overbright = ((mat->flags & 0x10) && !hascv);
-		bool spec_shader = (mat->specular && !hascv && !overbright);
-
-		pair<GLuint, int> currentList;
-		currentList.first = list;
-		currentList.second = spec_shader ? 1 : 0;
-
-		glNewList(list, GL_COMPILE);
-
-        // setup texture
-		glBindTexture(GL_TEXTURE_2D, mat->tex);
-
-		bool atest = (mat->transparent) != 0;
+	data = d;
+	return true;
+}
 
-		if (atest) {
-			glEnable(GL_ALPHA_TEST);
-			float aval = 0;
-            if (mat->flags & 0x80) aval = 0.3f;
-			if (mat->flags & 0x01) aval = 0.0f;
-			glAlphaFunc(GL_GREATER, aval);
-		}
+/*
+	Swizzles the vertices into a WMOVertex array and turns the MOBA batches into render
+	batches, merging neighbours with the same material. Batches reaching outside the
+	index or vertex data are dropped.
+*/
+void WMOGroup::buildBatches(WMOGroupData *d)
+{
+	vertexColors = (flags&0x2000) && hascv;
 
-		if (mat->flags & 0x04) glDisable(GL_CULL_FACE);
-		else glEnable(GL_CULL_FACE);
+	if (!d->vertices || !d->indices || !d->batches)
+		return;
 
-		if (spec_shader) {
-			glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, colorFromInt(mat->col2));
+	d->verts = new WMOVertex[nVertices];
+	for (int i=0; i<nVertices; i++) {
+		WMOVertex &v = d->verts[i];
+		Vec3D &p = d->vertices[i];
+		v.pos = Vec3D(p.x, p.z, -p.y);
+		if (d->normals) {
+			Vec3D &n = d->normals[i];
+			v.normal = Vec3D(n.x, n.z, -n.y);
+		} else v.normal = Vec3D(0,1,0);
+		v.tc = d->texcoords ? d->texcoords[i] : Vec2D(0,0);
+		if (vertexColors) {
+			// BGRA, with the alpha of 1 that setGLColor used to give it
+			unsigned int col = d->cv[i];
+			v.color[0] = (col & 0x00FF0000) >> 16;
+			v.color[1] = (col & 0x0000FF00) >> 8;
+			v.color[2] = (col & 0x000000FF);
+			v.color[3] = 1;
 		} else {
-			Vec4D nospec(0,0,0,1);
-			glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, nospec);
+			v.color[0] = v.color[1] = v.color[2] = v.color[3] = 255;
 		}
+	}
 
-		/*
-		float fr,fg,fb;
-		fr = rand()/(float)RAND_MAX;
-		fg = rand()/(float)RAND_MAX;
-		fb = rand()/(float)RAND_MAX;
-		glColor4f(fr,fg,fb,1);
-		*/
-
-		if (overbright) {
-			// TODO: use emissive color from the WMO Material instead of 1,1,1,1
-			GLfloat em[4] = {1,1,1,1};
-			glMaterialfv(GL_FRONT, GL_EMISSION, em);
-		}
-		
-		// render
-		glBegin(GL_TRIANGLES);
-		for (int t=0, i=batch->indexStart; t<batch->indexCount; t++,i++) {
-			int a = indices[i];
-			if (indoor && hascv) {
-	            setGLColor(cv[a]);
-			}
-			glNormal3f(normals[a].x, normals[a].z, -normals[a].y);
-			glTexCoord2fv(texcoords[a]);
-			glVertex3f(vertices[a].x, vertices[a].z, -vertices[a].y);
+	unsigned int nIndices = nTriangles*3;
+	for (unsigned int b=0; b<nBatches; b++) {
+		WMOBatch *batch = &d->batches[b];
+		unsigned int end = batch->indexStart + batch->indexCount;
+		if (batch->indexCount == 0 || end > nIndices || batch->texture >= wmo->nTextures)
+			continue;
+		unsigned short vmin = 0xFFFF, vmax = 0;
+		for (unsigned int i=batch->indexStart; i<end; i++) {
+			if (d->indices[i] < vmin) vmin = d->indices[i];
+			if (d->indices[i] > vmax) vmax = d->indices[i];
 		}
-		glEnd();
+		if (vmax >= nVertices)
+			continue;
 
-		if (overbright) {
-			GLfloat em[4] = {0,0,0,1};
-			glMaterialfv(GL_FRONT, GL_EMISSION, em);
+		WMORenderBatch rb;
+		rb.indexStart = batch->indexStart;
+		rb.indexCount = batch->indexCount;
+		rb.vertexStart = vmin;
+		rb.vertexEnd = vmax;
+		rb.mat = &wmo->mat[batch->texture];
+		rb.overbright = ((rb.mat->flags & 0x10) && !hascv);
+		rb.spec = (rb.mat->specular && !hascv && !rb.overbright);
+
+		if (rbatches.size()) {
+			WMORenderBatch &last = rbatches.back();
+			if (last.mat == rb.mat && last.indexStart + last.indexCount == rb.indexStart) {
+				last.indexCount += rb.indexCount;
+				last.vertexStart = min(last.vertexStart, rb.vertexStart);
+				last.vertexEnd = max(last.vertexEnd, rb.vertexEnd);
+				continue;
+			}
 		}
+		rbatches.push_back(rb);
+	}
+}
 
-		if (atest) {
-			glDisable(GL_ALPHA_TEST);
-		}
+void WMOGroup::upload()
+{
+	WMOGroupData *d = data;
 
-		glEndList();
-		lists.push_back(currentList);
+	if (d->lqPos) {
+		WMOLiquidHeader &hlq = d->hlq;
+		d->gf->seek(d->lqPos);
+		lq = new Liquid(hlq.A, hlq.B, Vec3D(hlq.pos.x, hlq.pos.z, -hlq.pos.y));
+		lq->initFromWMO(*d->gf, wmo->mat[hlq.type], (flags&0x2000)!=0);
 	}
 
-	//glColor4f(1,1,1,1);
-	//glEnable(GL_CULL_FACE);
+	initLighting(d->nLR, d->useLights);
+
+	if (d->verts && rbatches.size()) {
+		glGenBuffersARB(1, &vbo);
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, vbo);
+		glBufferDataARB(GL_ARRAY_BUFFER_ARB, nVertices*sizeof(WMOVertex), d->verts, GL_STATIC_DRAW_ARB);
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
 
-	//glEndList();
+		glGenBuffersARB(1, &ibo);
+		glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, ibo);
+		glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER_ARB, nTriangles*3*sizeof(unsigned short), d->indices, GL_STATIC_DRAW_ARB);
+		glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+	}
 
-	gf.close();
+	// exact bounds from the vertices
+	if (d->vertices) {
+		vmin = d->vmin;
+		vmax = d->vmax;
+		center = (vmax + vmin) * 0.5f;
+		rad = (vmax-center).length();
+	}
 
-	// hmm
-	indoor = false;
+	delete d;
+	data = 0;
+	state = WMOGROUP_RESIDENT;
 }
 
 
@@ -1190,22 +1240,37 @@ void WMOGroup::initLighting(int nLR, short *useLights)
 	}
 }
 
-void WMOGroup::draw(const Vec3D& ofs, const float rot)
+void WMOGroup::draw(WMOInstance *inst)
 {
 	visible = false;
 	// view frustum culling
-	Vec3D pos = center + ofs;
-	rotate(ofs.x,ofs.z,&pos.x,&pos.z,rot*PI/180.0f);
+	Vec3D pos = inst->mat * center;
 	if (!gWorld->frustum.intersectsSphere(pos,rad)) return;
 	float dist = (pos - gWorld->camera).length() - rad;
 	if (dist >= gWorld->culldistance) return;
+
+	// not in yet, its doodads and liquid wait along with it
+	if (state != WMOGROUP_RESIDENT) {
+		wmo->loader->requestGroup(this, dist);
+		return;
+	}
 	visible = true;
-	
+
+	float texPixels = video.projectedSize(2*rad, dist);
+	for (size_t i=0; i<rbatches.size(); i++)
+		video.textures.need(rbatches[i].mat->tex, texPixels);
+
+	wmo->loader->queueGroup(inst, this);
+}
+
+void WMOGroup::setupLighting()
+{
 	if (hascv) {
 		glDisable(GL_LIGHTING);
 		gWorld->outdoorLights(false);
 	} else {
 		if (gWorld->lighting) {
+			glEnable(GL_LIGHTING);
 			if (gWorld->skies->hasSkies()) {
 				gWorld->outdoorLights(true);
 			} else {
@@ -1218,36 +1283,12 @@ void WMOGroup::draw(const Vec3D& ofs, const float rot)
 			}
 		} else glDisable(GL_LIGHTING);
 	}
-	setupFog();
-
-	
-	//glCallList(dl);
-	glDisable(GL_BLEND);
-	glColor4f(1,1,1,1);
-	for (unsigned int i=0; i<nBatches; i++) {
-		bool useshader = (supportShaders && gWorld->useshaders && lists[i].second);
-		if (useshader) wmoShader->bind();
-		glCallList(lists[i].first);
-		if (useshader) wmoShader->unbind();
-	}
-
-	glColor4f(1,1,1,1);
-	glEnable(GL_CULL_FACE);
-
-	if (hascv) {
-		if (gWorld->lighting) {
-			glEnable(GL_LIGHTING);
-			//glCallList(dl_light);
-		}
-	}
-
-
 }
 
-void WMOGroup::drawDoodads(int doodadset, const Vec3D& ofs, const float rot)
+void WMOGroup::drawDoodads(WMOInstance *inst)
 {
-	if (!visible) return;
-	if (nDoodads==0) return;
+	std::vector<WMODoodad> &dl = inst->groupDoodads(num, doodadsInSet(inst->doodadset));
+	if (dl.empty()) return;
 
 	gWorld->outdoorLights(outdoorLights);
 	setupFog();
@@ -1262,23 +1303,25 @@ void WMOGroup::drawDoodads(int doodadset, const Vec3D& ofs, const float rot)
 
 	// draw doodads
 	glColor4f(1,1,1,1);
-	for (int i=0; i<nDoodads; i++) {
-		short dd = ddr[i];
-		bool inSet;
-		// apparently, doodadset #0 (defaultGlobal) should always be visible
-		inSet = ( ((dd >= wmo->doodadsets[doodadset].start) && (dd < (wmo->doodadsets[doodadset].start+wmo->doodadsets[doodadset].size))) 
-			|| ( (dd >= wmo->doodadsets[0].start) && ((dd < (wmo->doodadsets[0].start+wmo->doodadsets[0].size) )) ) );
-		if (inSet) {
- 		//if ((dd >= wmo->doodadsets[doodadset].start) && (dd < (wmo->doodadsets[doodadset].start+wmo->doodadsets[doodadset].size))) {
-
-			ModelInstance &mi = wmo->modelis[dd];
-
-			if (!outdoorLights) {
-				WMOLight::setupOnce(GL_LIGHT2, mi.ldir, mi.lcol);
-			}
-
-			wmo->modelis[dd].draw2(ofs,rot);
+	for (size_t i=0; i<dl.size(); i++) {
+		WMODoodad &d = dl[i];
+		float dist2 = (d.center - gWorld->camera).lengthSquared();
+		if (dist2 > gWorld->doodaddrawdistance2 * d.radius) continue;
+		if (!gWorld->frustum.intersectsSphere(d.center, d.radius)) continue;
+
+		ModelInstance *mi = d.mi;
+		if (!outdoorLights) {
+			WMOLight::setupOnce(GL_LIGHT2, d.ldir, mi->lcol);
 		}
+
+		glPushMatrix();
+		glMultMatrixf(d.glmat);
+		float dist = sqrtf(dist2);
+		mi->selectLOD(dist, d.radius);
+		mi->model->seen(dist);
+		mi->model->needTextures(video.projectedSize(2*d.radius, dist));
+		mi->model->draw(mi->lod, d.mat);
+		glPopMatrix();
 	}
 
 	glDisable(GL_LIGHT2);
@@ -1287,10 +1330,38 @@ void WMOGroup::drawDoodads(int doodadset, const Vec3D& ofs, const float rot)
 
 }
 
-void WMOGroup::drawLiquid()
+const std::vector<short>& WMOGroup::doodadsInSet(int doodadset)
+{
+	static const std::vector<short> none;
+	if (setDoodads.empty())
+		return none;
+	if (doodadset < 0 || doodadset >= (int)setDoodads.size())
+		doodadset = 0;
+	return setDoodads[doodadset];
+}
+
+// apparently, doodadset #0 (defaultGlobal) should always be visible
+void WMOGroup::buildDoodadSets()
 {
-	if (!visible) return;
+	std::vector<WMODoodadSet> &sets = wmo->doodadsets;
+	if (sets.empty())
+		return;
+	setDoodads.resize(sets.size());
+	for (size_t s=0; s<sets.size(); s++) {
+		for (int i=0; i<nDoodads; i++) {
+			short dd = ddr[i];
+			if (dd < 0 || dd >= (int)wmo->modelis.size())
+				continue;
+			bool inSet = (dd >= sets[s].start && dd < sets[s].start + sets[s].size)
+				|| (dd >= sets[0].start && dd < sets[0].start + sets[0].size);
+			if (inSet)
+				setDoodads[s].push_back(dd);
+		}
+	}
+}
 
+void WMOGroup::drawLiquid()
+{
 	// draw liquid
 	// TODO: culling for liquid boundingbox or something
 	if (lq) {
@@ -1314,29 +1385,30 @@ void WMOGroup::drawLiquid()
 	}
 }
 
+WMOFog* WMOGroup::fogSetup()
+{
+	if (outdoorLights || fog==-1)
+		return 0;
+	return &wmo->fogs[fog];
+}
+
 void WMOGroup::setupFog()
 {
-	if (outdoorLights || fog==-1) {
-		gWorld->setupFog();
-	} else {
-		wmo->fogs[fog].setup();
-	}
+	WMOFog *f = fogSetup();
+	if (f) f->setup();
+	else gWorld->setupFog();
 }
 
 
 
 WMOGroup::~WMOGroup()
 {
-	//if (dl) glDeleteLists(dl, 1);
-	//if (dl_light) glDeleteLists(dl_light, 1);
-
-	//for (size_t i=0; i<lists.size(); i++) {
-	//	glDeleteLists(lists[i].first);
-	//}
-	if (nBatches && lists.size()) glDeleteLists(lists[0].first, nBatches);
+	if (vbo) glDeleteBuffersARB(1, &vbo);
+	if (ibo) glDeleteBuffersARB(1, &ibo);
 
 	if (nDoodads) delete[] ddr;
 	if (lq) delete lq;
+	delete data;
 }
 
 
@@ -1376,12 +1448,355 @@ int WMOManager::add(std::string name)
 	}
 
 	// load new
-	WMO *wmo = new WMO(name);
+	WMO *wmo = new WMO(name, this);
 	id = nextID();
     do_add(name, id, wmo);
     return id;
 }
 
+// milliseconds per frame spent on making groups resident, one group always goes through
+#define WMO_UPLOAD_MS	4
+
+void WMOManager::startWorkers()
+{
+	WorkerPool::startWorkers(min(max(cpuCount() - 1, 1), MAX_WMO_THREADS));
+	gLog("Loading WMO groups on %d threads\n", nWorkers);
+}
+
+void WMOManager::stopWorkers()
+{
+	if (nWorkers < 0)
+		return;
+
+	WorkerPool::stopWorkers();
+	for (size_t i=0; i<loaded.size(); i++) {
+		delete loaded[i]->data;
+		loaded[i]->data = 0;
+	}
+	queue.clear();
+	loaded.clear();
+}
+
+// removes and returns the group with the lowest priority
+WMOGroup* WMOManager::takeFirst(std::vector<WMOGroup*> &groups)
+{
+	if (groups.empty())
+		return 0;
+	size_t best = 0;
+	for (size_t i=1; i<groups.size(); i++) {
+		if (groups[i]->priority < groups[best]->priority)
+			best = i;
+	}
+	WMOGroup *g = groups[best];
+	groups[best] = groups.back();
+	groups.pop_back();
+	return g;
+}
+
+void *WMOManager::takeJob()
+{
+	// the group may have been cancelled since it was posted
+	WMOGroup *g = takeFirst(queue);
+	if (g)
+		g->state = WMOGROUP_LOADING;
+	return g;
+}
+
+bool WMOManager::runJob(void *job)
+{
+	return ((WMOGroup*)job)->load();
+}
+
+void WMOManager::jobDone(void *job, bool ok)
+{
+	WMOGroup *g = (WMOGroup*)job;
+	if (ok) {
+		g->state = WMOGROUP_LOADED;
+		loaded.push_back(g);
+	} else {
+		g->state = WMOGROUP_FAILED;
+	}
+}
+
+void WMOManager::requestGroup(WMOGroup *g, float priority)
+{
+	if (nWorkers < 0)
+		startWorkers();
+
+	if (nWorkers == 0) {
+		// no threads, load it right here like we used to
+		if (g->state == WMOGROUP_EMPTY) {
+			if (g->load())
+				g->upload();
+			else
+				g->state = WMOGROUP_FAILED;
+		}
+		return;
+	}
+
+	SDL_mutexP(lock);
+	g->priority = priority;
+	if (g->state == WMOGROUP_EMPTY) {
+		g->state = WMOGROUP_QUEUED;
+		queue.push_back(g);
+		post();
+	}
+	SDL_mutexV(lock);
+}
+
+void WMOManager::cancel(WMO *wmo)
+{
+	if (nWorkers <= 0)
+		return;
+
+	SDL_mutexP(lock);
+	for (size_t i=0; i<queue.size(); ) {
+		if (queue[i]->wmo == wmo) {
+			queue[i]->state = WMOGROUP_EMPTY;
+			queue[i] = queue.back();
+			queue.pop_back();
+		} else i++;
+	}
+
+	// the workers reading our groups put them in loaded when they're done
+	for (;;) {
+		bool busy = false;
+		for (int i=0; i<wmo->nGroups; i++) {
+			if (wmo->groups[i].state == WMOGROUP_LOADING)
+				busy = true;
+		}
+		if (!busy)
+			break;
+		waitJobDone();
+	}
+
+	for (size_t i=0; i<loaded.size(); ) {
+		if (loaded[i]->wmo == wmo) {
+			delete loaded[i]->data;
+			loaded[i]->data = 0;
+			loaded[i]->state = WMOGROUP_EMPTY;
+			loaded[i] = loaded.back();
+			loaded.pop_back();
+		} else i++;
+	}
+	SDL_mutexV(lock);
+}
+
+void WMOManager::uploadGroups()
+{
+	nDraws = nBinds = nShaderSwitches = 0;
+	uploaded = 0;
+	if (nWorkers <= 0) {
+		waiting = 0;
+		return;
+	}
+
+	Uint32 start = SDL_GetTicks();
+	for (;;) {
+		SDL_mutexP(lock);
+		WMOGroup *g = takeFirst(loaded);
+		waiting = (int)(queue.size() + loaded.size()) + running();
+		SDL_mutexV(lock);
+		if (!g)
+			break;
+
+		g->upload();
+		uploaded++;
+		if (SDL_GetTicks() - start >= WMO_UPLOAD_MS)
+			break;
+	}
+}
+
+void WMOManager::queueGroup(WMOInstance *inst, WMOGroup *g)
+{
+	WMOFog *fog = g->fogSetup();
+	for (size_t i=0; i<g->rbatches.size(); i++) {
+		WMODrawItem it;
+		it.inst = inst;
+		it.group = g;
+		it.batch = &g->rbatches[i];
+		it.fog = fog;
+		it.tex = it.batch->mat->tex;
+		it.shader = supportShaders && gWorld->useshaders && it.batch->spec;
+		drawItems.push_back(it);
+	}
+	drawGroups.push_back(std::make_pair(inst, g));
+}
+
+// shader first, then lighting and fog, then texture and material; instances and groups last
+static bool drawOrder(const WMODrawItem &a, const WMODrawItem &b)
+{
+	if (a.shader != b.shader) return a.shader < b.shader;
+	if (a.group->hascv != b.group->hascv) return a.group->hascv < b.group->hascv;
+	if (a.fog != b.fog) return a.fog < b.fog;
+	if (a.tex != b.tex) return a.tex < b.tex;
+	if (a.batch->mat != b.batch->mat) return a.batch->mat < b.batch->mat;
+	if (a.inst != b.inst) return a.inst < b.inst;
+	if (a.group != b.group) return a.group < b.group;
+	return a.batch->indexStart < b.batch->indexStart;
+}
+
+void WMOManager::drawQueued()
+{
+	if (drawGroups.empty())
+		return;
+
+	std::sort(drawItems.begin(), drawItems.end(), drawOrder);
+
+	glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+	// the terrain leaves its second texture coordinates on
+	glClientActiveTextureARB(GL_TEXTURE1_ARB);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glClientActiveTextureARB(GL_TEXTURE0_ARB);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+	glDisable(GL_BLEND);
+	glColor4f(1,1,1,1);
+
+	WMOInstance *inst = 0;
+	WMOGroup *group = 0;
+	WMOMaterial *mat = 0;
+	WMOFog *fog = 0;
+	GLuint tex = 0;
+	bool shader = false, first = true, colors = false, overbright = false, spec = false;
+	int light = -1;
+
+	for (size_t i=0; i<drawItems.size(); i++) {
+		WMODrawItem &it = drawItems[i];
+		WMORenderBatch *b = it.batch;
+
+		if (it.shader != shader) {
+			if (it.shader) wmoShader->bind();
+			else wmoShader->unbind();
+			shader = it.shader;
+			nShaderSwitches++;
+		}
+
+		if (it.inst != inst) {
+			if (inst) glPopMatrix();
+			glPushMatrix();
+			it.inst->transform();
+			inst = it.inst;
+			// the default light's position goes through the modelview matrix
+			light = -1;
+		}
+
+		if ((it.group->hascv ? 1 : 0) != light) {
+			it.group->setupLighting();
+			light = it.group->hascv ? 1 : 0;
+		}
+
+		if (first || it.fog != fog) {
+			if (it.fog) it.fog->setup();
+			else gWorld->setupFog();
+			fog = it.fog;
+		}
+
+		if (it.group != group) {
+			group = it.group;
+			glBindBufferARB(GL_ARRAY_BUFFER_ARB, group->vbo);
+			glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, group->ibo);
+			glVertexPointer(3, GL_FLOAT, sizeof(WMOVertex), 0);
+			glNormalPointer(GL_FLOAT, sizeof(WMOVertex), (GLvoid*)(3*sizeof(float)));
+			glTexCoordPointer(2, GL_FLOAT, sizeof(WMOVertex), (GLvoid*)(6*sizeof(float)));
+			if (group->vertexColors) {
+				glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(WMOVertex), (GLvoid*)(8*sizeof(float)));
+				glEnableClientState(GL_COLOR_ARRAY);
+			} else if (colors) {
+				glDisableClientState(GL_COLOR_ARRAY);
+				glColor4f(1,1,1,1);
+			}
+			colors = group->vertexColors;
+		}
+
+		if (first || it.tex != tex) {
+			glBindTexture(GL_TEXTURE_2D, it.tex);
+			tex = it.tex;
+			nBinds++;
+		}
+
+		// specular depends on the group as well as the material
+		if (first || b->spec != spec || (b->spec && b->mat != mat)) {
+			if (b->spec) {
+				glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, colorFromInt(b->mat->col2));
+			} else {
+				Vec4D nospec(0,0,0,1);
+				glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, nospec);
+			}
+			spec = b->spec;
+		}
+
+		if (b->mat != mat || first) {
+			WMOMaterial *m = b->mat;
+			if (m->transparent) {
+				glEnable(GL_ALPHA_TEST);
+				float aval = 0;
+				if (m->flags & 0x80) aval = 0.3f;
+				if (m->flags & 0x01) aval = 0.0f;
+				glAlphaFunc(GL_GREATER, aval);
+			} else {
+				glDisable(GL_ALPHA_TEST);
+			}
+
+			if (m->flags & 0x04) glDisable(GL_CULL_FACE);
+			else glEnable(GL_CULL_FACE);
+			mat = m;
+		}
+
+		if (b->overbright != overbright || first) {
+			// TODO: use emissive color from the WMO Material instead of 1,1,1,1
+			GLfloat em[4] = {0,0,0,1};
+			if (b->overbright) em[0] = em[1] = em[2] = 1;
+			glMaterialfv(GL_FRONT, GL_EMISSION, em);
+			overbright = b->overbright;
+		}
+		first = false;
+
+		glDrawRangeElements(GL_TRIANGLES, b->vertexStart, b->vertexEnd, b->indexCount, GL_UNSIGNED_SHORT, (GLvoid*)(b->indexStart*sizeof(unsigned short)));
+		nDraws++;
+	}
+
+	if (inst) glPopMatrix();
+	if (shader) wmoShader->unbind();
+	if (overbright) {
+		GLfloat em[4] = {0,0,0,1};
+		glMaterialfv(GL_FRONT, GL_EMISSION, em);
+	}
+	glDisable(GL_ALPHA_TEST);
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+	glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+	glPopClientAttrib();
+
+	glColor4f(1,1,1,1);
+	glEnable(GL_CULL_FACE);
+	if (gWorld->lighting) glEnable(GL_LIGHTING);
+
+	// each instance's doodads, then its liquids
+	for (size_t i=0; i<drawGroups.size(); ) {
+		WMOInstance *wi = drawGroups[i].first;
+		size_t end = i;
+		while (end < drawGroups.size() && drawGroups[end].first == wi)
+			end++;
+
+		if (gWorld->drawdoodads) {
+			for (size_t j=i; j<end; j++)
+				drawGroups[j].second->drawDoodads(wi);
+		}
+		glPushMatrix();
+		wi->transform();
+		for (size_t j=i; j<end; j++)
+			drawGroups[j].second->drawLiquid();
+		glPopMatrix();
+
+		i = end;
+	}
+
+	drawItems.clear();
+	drawGroups.clear();
+}
+
 
 
 WMOInstance::WMOInstance(WMO *wmo, MPQFile &f) : wmo (wmo)
@@ -1403,6 +1818,61 @@ WMOInstance::WMOInstance(WMO *wmo, MPQFile &f) : wmo (wmo)
 	f.read(&unk, 2);
 	
 	//gLog("WMO instance: %s (%d, %d)\n", wmo->name.c_str(), d2, d3);
+
+	const float deg = PI / 180.0f;
+	mat = Matrix::newTranslation(pos);
+	mat *= Matrix::newRotation(Vec3D(0,1,0), (dir.y - 90.0f) * deg);
+	mat *= Matrix::newRotation(Vec3D(0,0,1), -dir.x * deg);
+	mat *= Matrix::newRotation(Vec3D(1,0,0), dir.z * deg);
+	glmat = mat;
+	glmat.transpose();
+
+	// the root bounding box in our coordinate system, grown to hold every group's box
+	if (wmo->ok) {
+		Vec3D a(wmo->v1.x, wmo->v1.z, -wmo->v1.y), b(wmo->v2.x, wmo->v2.z, -wmo->v2.y);
+		Vec3D vmin(min(a.x,b.x), min(a.y,b.y), min(a.z,b.z));
+		Vec3D vmax(max(a.x,b.x), max(a.y,b.y), max(a.z,b.z));
+		for (int i=0; i<wmo->nGroups; i++) {
+			WMOGroup &g = wmo->groups[i];
+			vmin = Vec3D(min(vmin.x,g.vmin.x), min(vmin.y,g.vmin.y), min(vmin.z,g.vmin.z));
+			vmax = Vec3D(max(vmax.x,g.vmax.x), max(vmax.y,g.vmax.y), max(vmax.z,g.vmax.z));
+		}
+		center = mat * ((vmin + vmax) * 0.5f);
+		radius = (vmax - vmin).length() * 0.5f;
+	} else {
+		center = pos;
+		radius = 0;
+	}
+}
+
+std::vector<WMODoodad>& WMOInstance::groupDoodads(int group, const std::vector<short> &refs)
+{
+	if (doodads.empty()) {
+		doodads.resize(wmo->nGroups);
+		doodadsBuilt.resize(wmo->nGroups, false);
+	}
+	std::vector<WMODoodad> &dl = doodads[group];
+	if (doodadsBuilt[group])
+		return dl;
+	doodadsBuilt[group] = true;
+
+	Vec3D origin = mat * Vec3D(0,0,0);
+	for (size_t i=0; i<refs.size(); i++) {
+		ModelInstance &mi = wmo->modelis[refs[i]];
+		WMODoodad d;
+		d.mi = &mi;
+
+		d.mat = mat * mi.mat;
+		d.glmat = d.mat;
+		d.glmat.transpose();
+
+		d.center = mat * mi.pos;
+		d.radius = mi.model->rad * mi.sc;
+		// directions only turn with the instance
+		d.ldir = mat * mi.ldir - origin;
+		dl.push_back(d);
+	}
+	return dl;
 }
 
 void WMOInstance::draw()
@@ -1410,20 +1880,15 @@ void WMOInstance::draw()
 	if (ids.find(id) != ids.end()) return;
 	ids.insert(id);
 
-	glPushMatrix();
-	glTranslatef(pos.x, pos.y, pos.z);
-
-	float rot = -90.0f + dir.y;
+	if (!gWorld->frustum.intersectsSphere(center, radius)) return;
+	if ((center - gWorld->camera).length() - radius >= gWorld->culldistance) return;
 
-	// TODO: replace this with a single transform matrix calculated at load time
-
-	glRotatef(dir.y - 90.0f, 0, 1, 0);
-	glRotatef(-dir.x, 0, 0, 1);
-	glRotatef(dir.z, 1, 0, 0);
-
-	wmo->draw(doodadset,pos,-rot);
+	wmo->draw(this);
+}
 
-	glPopMatrix();
+void WMOInstance::transform()
+{
+	glMultMatrixf(glmat);
 }
 
 /*
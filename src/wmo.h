@@ -4,6 +4,7 @@
 #include "manager.h"
 #include "vec3d.h"
 #include "mpq.h"
+#include "chunkfile.h"
 #include "model.h"
 #include <vector>
 #include <set>
@@ -14,7 +15,47 @@ class WMOGroup;
 class WMOInstance;
 class WMOManager;
 class Liquid;
+struct WMOGroupData;
+struct WMOMaterial;
+struct WMOFog;
 
+// group vertex, already in our coordinate system
+struct WMOVertex {
+	Vec3D pos;
+	Vec3D normal;
+	Vec2D tc;
+	uint8 color[4];
+};
+
+// a doodad of one WMO instance, placed in the world
+struct WMODoodad {
+	ModelInstance *mi;
+	// world transform; glmat is the transpose for glMultMatrixf
+	Matrix mat, glmat;
+	// bounding sphere in world space
+	Vec3D center;
+	float radius;
+	// towards the doodad's WMO light, in world space
+	Vec3D ldir;
+};
+
+// a run of triangles with one material, drawn from the group's buffers
+struct WMORenderBatch {
+	unsigned int indexStart, indexCount;
+	unsigned short vertexStart, vertexEnd;
+	WMOMaterial *mat;
+	bool spec, overbright;
+};
+
+// where a group is on its way from the MPQ to the screen; only RESIDENT groups are drawn
+enum WMOGroupState {
+	WMOGROUP_EMPTY,
+	WMOGROUP_QUEUED,
+	WMOGROUP_LOADING,
+	WMOGROUP_LOADED,
+	WMOGROUP_RESIDENT,
+	WMOGROUP_FAILED
+};
 
 class WMOGroup {
 	WMO *wmo;
@@ -30,7 +71,23 @@ class WMOGroup {
 	unsigned int nBatches;
 	short *ddr;
 	Liquid *lq;
-	std::vector< std::pair<GLuint, int> > lists;
+	GLuint vbo, ibo;
+	std::vector<WMORenderBatch> rbatches;
+	// MOCV colors replace lighting
+	bool vertexColors;
+	// indices into wmo->modelis of the doodads shown with each doodad set
+	std::vector< std::vector<short> > setDoodads;
+
+	// set by WMOManager under its lock
+	int state;
+	float priority;
+	// parsed group file, between load and upload
+	WMOGroupData *data;
+
+	void buildBatches(WMOGroupData *d);
+	void buildDoodadSets();
+
+	friend class WMOManager;
 public:
 	Vec3D b1,b2;
 	Vec3D vmin, vmax;
@@ -40,15 +97,23 @@ public:
 	bool outdoorLights;
 	std::string name;
 
-	WMOGroup():nBatches(0) {}
+	WMOGroup():wmo(0), nDoodads(0), nBatches(0), ddr(0), lq(0), vbo(0), ibo(0), vertexColors(false), state(WMOGROUP_EMPTY), priority(0), data(0), visible(false) {}
 	~WMOGroup();
 	void init(WMO *wmo, MPQFile &f, int num, char *names);
-	void initDisplayList();
+	// reads and prepares the group file, no GL calls (worker thread)
+	bool load();
+	// fills the buffers and makes the liquid from the loaded data (main thread)
+	void upload();
 	void initLighting(int nLR, short *useLights);
-	void draw(const Vec3D& ofs, const float rot);
+	// culls the group and queues it with WMOManager for drawing
+	void draw(WMOInstance *inst);
 	void drawLiquid();
-	void drawDoodads(int doodadset, const Vec3D& ofs, const float rot);
+	void drawDoodads(WMOInstance *inst);
+	const std::vector<short>& doodadsInSet(int doodadset);
+	void setupLighting();
 	void setupFog();
+	// the WMO fog used by setupFog, 0 for the world's
+	WMOFog* fogSetup();
 };
 
 struct WMOMaterial {
@@ -159,17 +224,66 @@ public:
 	Model *skybox;
 	int sbid;
 
-	WMO(std::string name);
+	// loads our groups
+	WMOManager *loader;
+
+	WMO(std::string name, WMOManager *loader);
 	~WMO();
-	void draw(int doodadset, const Vec3D& ofs, const float rot);
+	void draw(WMOInstance *inst);
 	//void drawPortals();
 	void drawSkybox();
 };
 
 
-class WMOManager: public SimpleManager {
+// group file loader threads
+#define MAX_WMO_THREADS 4
+
+// a batch of a visible group of one WMO instance, waiting in WMOManager::drawQueued
+struct WMODrawItem {
+	WMOInstance *inst;
+	WMOGroup *group;
+	WMORenderBatch *batch;
+	WMOFog *fog;
+	GLuint tex;
+	bool shader;
+};
+
+class WMOManager: public SimpleManager, public WorkerPool {
+	std::vector<WMOGroup*> queue, loaded;
+
+	void startWorkers();
+	void stopWorkers();
+	static WMOGroup* takeFirst(std::vector<WMOGroup*> &groups);
+	// the workers read the group files
+	void *takeJob();
+	bool runJob(void *job);
+	void jobDone(void *job, bool ok);
+
 public:
 	int add(std::string name);
+
+	WMOManager() : waiting(0), uploaded(0), nDraws(0), nBinds(0), nShaderSwitches(0) {}
+	~WMOManager() { stopWorkers(); }
+
+	// groups queued or loaded but not resident yet / made resident in the last uploadGroups
+	int waiting, uploaded;
+
+	// lower priority is loaded first; a group already on its way is just reprioritized
+	void requestGroup(WMOGroup *g, float priority);
+	// drops the wmo's pending groups and waits for the ones being loaded
+	void cancel(WMO *wmo);
+	// makes loaded groups resident, nearest first, within a time budget; once per frame
+	void uploadGroups();
+
+	// visible groups of the instances drawn since the last drawQueued
+	std::vector<WMODrawItem> drawItems;
+	std::vector< std::pair<WMOInstance*, WMOGroup*> > drawGroups;
+	// last frame's draw calls, texture binds and shader switches
+	int nDraws, nBinds, nShaderSwitches;
+
+	void queueGroup(WMOInstance *inst, WMOGroup *g);
+	// draws the queued batches sorted by state, then the doodads and liquids of their groups
+	void drawQueued();
 };
 
 struct SMMapObjDef {
@@ -186,6 +300,10 @@ struct SMMapObjDef {
 
 class WMOInstance {
 	static std::set<int> ids;
+
+	// per group, filled the first time the group's doodads are drawn
+	std::vector< std::vector<WMODoodad> > doodads;
+	std::vector<bool> doodadsBuilt;
 public:
 	WMO *wmo;
 
@@ -198,8 +316,18 @@ public:
 	uint16 nameset;
 	uint16 unk;
 
+	// placement in the world; glmat is the transpose for glMultMatrixf
+	Matrix mat, glmat;
+	// bounding sphere of the whole WMO, world space
+	Vec3D center;
+	float radius;
+
 	WMOInstance(WMO *wmo, MPQFile &f);
 	void draw();
+	// multiplies the instance's placement onto the modelview matrix
+	void transform();
+	// the group's doodads in our doodad set, with their world transforms
+	std::vector<WMODoodad>& groupDoodads(int group, const std::vector<short> &refs);
 	//void drawPortals();
 
 	static void reset();
@@ -16,12 +16,6 @@ World::World(const char* name, int id):basename(name),mapid(id)
 
 	gLog("\nLoading world %s\n", name);
 
-	for (int j=0; j<64; j++) {
-		for (int i=0; i<64; i++) {
-			lowrestiles[j][i] = 0;
-		}
-	}
-
 	for (int i=0; i<MAPTILECACHESIZE; i++) 
 		maptilecache[i] = 0;
 
@@ -56,13 +50,6 @@ World::World(const char* name, int id):basename(name),mapid(id)
 
 World::~World()
 {
-	for (int j=0; j<64; j++) {
-		for (int i=0; i<64; i++) {
-			if (lowrestiles[j][i]!=0)
-				glDeleteLists(lowrestiles[j][i],1);
-		}
-	}
-
 	for (int i=0; i<MAPTILECACHESIZE; i++) {
 		if (maptilecache[i] != 0)
 			delete maptilecache[i];
@@ -107,74 +94,60 @@ void World::init()
 {
 	char fn[256];
 	sprintf(fn,"World\\Maps\\%s\\%s.wdt", basename.c_str(), basename.c_str());
+	wdt.openFile(fn);
+	wdtChunks.build(wdt);
 
-	MPQFile f(fn);
-
-	char fourcc[5];
-	uint32 size;
+	// the WDL heights are used by both the minimap and the low res terrain, read them once
+	sprintf(fn,"World\\Maps\\%s\\%s.wdl", basename.c_str(), basename.c_str());
+	MPQFile wdl(fn);
+	ChunkIndex wdlChunks(wdl);
+	farterrain.init(wdl, wdlChunks);
+	wdl.close();
 
 	// WDT files specify exactly which map tiles are present in a world, 
 	// if any, and can also reference a "global" WMO. They have a chunked file structure.
-	while (!f.isEof()) {
-		memset(fourcc, 0, 4);
-		size = 0;
-		f.read(fourcc,4);
-		f.read(&size, 4);
-		flipcc(fourcc);
-		fourcc[4] = 0;
-
-		if (size == 0)
-			continue;
-
-		size_t nextpos = f.getPos() + size;
-
-		if (strcmp(fourcc,"MPHD") == 0) {
-			// unit32 flags
-			//   0b0001 		No Terrain/no terraincollision. The other flags are ONLY for ADT based maps! See a list here.
-			//   0b0010 		Use vertex shading (ADT.MCNK.MCCV)
-			//   0b0100 		Decides whether to use _env terrain shaders or not: funky and if MCAL has 4096 instead of 2048(?)
-			//   0b1000 		Disables something. No idea what. Another rendering thing. Someone may check all them in wild life..
-			// unit32 something
-			// unit32 unused[6]
-			uint32 flags;
-			f.read(&flags, 4);
-			if (flags & Map_TerrainShaders_BigAlpha)
-				mBigAlpha = true;
-		}
-		else if (strcmp(fourcc,"MAIN") == 0) {
-			// Map tile table. Contains 64x64 = 4096 records of 8 bytes each.
-			// int32 flags
-			//   0b0001			if a tile is holding an ADT
-			//   0b0010			set ingame when an ADT is loaded at that position. The pointer to some data is set if the tile is loaded asynchronous.
-			// AsyncObject *asyncobject
-			// if ( !(MAIN.flags & 2) )
-			//     LoadADTByPosition( x, y );
-			// if ( *(MAIN.asyncobject) )
-			//     AsyncFileReadWait( *(MAIN.asyncobject) );
-			for (int j=0; j<64; j++) {
-				for (int i=0; i<64; i++) {
-					int d;
-					f.read(&d, 4);
-					if (d & 0x1) {
-						maps[j][i] = true;
-						nMaps++;
-					} else
-						maps[j][i] = false;
-					f.read(&d, 4);
-				}
+	if (wdtChunks.seek(wdt, FOURCC('M','P','H','D')) >= 0) {
+		// unit32 flags
+		//   0b0001 		No Terrain/no terraincollision. The other flags are ONLY for ADT based maps! See a list here.
+		//   0b0010 		Use vertex shading (ADT.MCNK.MCCV)
+		//   0b0100 		Decides whether to use _env terrain shaders or not: funky and if MCAL has 4096 instead of 2048(?)
+		//   0b1000 		Disables something. No idea what. Another rendering thing. Someone may check all them in wild life..
+		// unit32 something
+		// unit32 unused[6]
+		uint32 flags;
+		wdt.read(&flags, 4);
+		if (flags & Map_TerrainShaders_BigAlpha)
+			mBigAlpha = true;
+	}
+	if (wdtChunks.seek(wdt, FOURCC('M','A','I','N')) >= 0) {
+		// Map tile table. Contains 64x64 = 4096 records of 8 bytes each.
+		// int32 flags
+		//   0b0001			if a tile is holding an ADT
+		//   0b0010			set ingame when an ADT is loaded at that position. The pointer to some data is set if the tile is loaded asynchronous.
+		// AsyncObject *asyncobject
+		// if ( !(MAIN.flags & 2) )
+		//     LoadADTByPosition( x, y );
+		// if ( *(MAIN.asyncobject) )
+		//     AsyncFileReadWait( *(MAIN.asyncobject) );
+		for (int j=0; j<64; j++) {
+			for (int i=0; i<64; i++) {
+				int d;
+				wdt.read(&d, 4);
+				if (d & 0x1) {
+					maps[j][i] = true;
+					nMaps++;
+				} else
+					maps[j][i] = false;
+				wdt.read(&d, 4);
 			}
 		}
-		else if (strcmp(fourcc,"MODF") == 0) {
-			// global wmo instance data
-			gnWMO = (int)size / 64;
-			// WMOS and WMO-instances are handled below in initWMOs()
-		}
-		else if (strcmp(fourcc,"MWMO") == 0) {
-			// Filename for WMO (world map objects) that appear in this map. A zero-terminated string.
-		}
-		f.seek((int)nextpos);
 	}
-	f.close();
+	const Chunk *modf = wdtChunks.find(FOURCC('M','O','D','F'));
+	if (modf) {
+		// global wmo instance data
+		gnWMO = (int)modf->size / 64;
+		// WMOS and WMO-instances are handled below in initWMOs()
+	}
 
 	if (nMaps) initMinimap();
 }
@@ -186,306 +159,136 @@ WDL files contain a low-resolution heightmap for a world. This is probably what
 */
 void World::initMinimap()
 {
-	char fn[256];
-	sprintf(fn,"World\\Maps\\%s\\%s.wdl", basename.c_str(), basename.c_str());
-	MPQFile f(fn);
-	if (f.isEof()) {
+	// the heights were read by farterrain.init()
+	if (!farterrain.loaded()) {
 		gLog("Error: loading minimap %s\n", basename.c_str());
 		return;
 	}
 
-	int ofsbuf[64][64];
-	memset(ofsbuf, 0, 64*64*4);
-
-	char fourcc[5];
-	uint32 size;
-
-	while (!f.isEof()) {
-		memset(fourcc, 0, 4);
-		size = 0;
-		f.read(fourcc,4);
-		f.read(&size, 4);
-
-		flipcc(fourcc);
-		fourcc[4] = 0;
-
-		if (size == 0)
-			continue;
-
-		size_t nextpos = f.getPos() + size;
-
-		if (strncmp(fourcc, "MVER", 4) == 0) {
-		} 
-		else if (strncmp(fourcc, "MWMO", 4) == 0) {
-			// Filenames for WMO that appear in the low resolution map. Zero terminated strings.
-		} 
-		else if (strncmp(fourcc, "MWID", 4) == 0) {
-			// List of indexes into the MWMO chunk.
-		} 
-		else if (strncmp(fourcc, "MODF", 4) == 0) {
-			// Placement information for the WMO. Appears to be the same 64 byte structure used in the WDT and ADT MODF chunks.
-		} 
-		else if (strncmp(fourcc, "MAOF", 4) == 0) {
-/*
-Contains 64*64 = 4096 unsigned 32-bit integers, these are absolute offsets in the file to each map tile's MapAreaLow-array-entry. For unused tiles the value is 0.
-*/
-
-
-			f.read(ofsbuf,64*64*4);
-		}
-		else if (strncmp(fourcc, "MARE", 4) == 0) {
 /*
 Map Area
 Heightmap for one map tile. Contains 17*17 + 16*16 = 545 signed 16-bit integers. So a 17 by 17 grid of height values is given, with additional height values in between grid points. Here, the "outer" 17x17 points are listed (in the usual row major order), followed by 16x16 "inner" points. The height values are on the same scale as those used in the regular height maps.
 */
-			glGenTextures(1, &minimap);
-
-			// zomg, data on the stack!!1
-			//int texbuf[512][512];
-			unsigned int *texbuf = new unsigned int[512*512];
-			memset(texbuf,0,512*512*4);
-
-			// as alpha is unused, maybe I should try 24bpp? :(
-			short tilebuf[17*17];
-
-			for (int j=0; j<64; j++) {
-				for (int i=0; i<64; i++) {
-					if (ofsbuf[j][i]) {
-						f.seek(ofsbuf[j][i]+8);
-						// read height values ^_^
-
-						/*
-						short *sp = tilebuf;
-						for (int z=0; z<33; z++) {
-							f.read(sp, 2 * ( (z%2) ? 16 : 17 ));
-							sp += 17;
-						}*/
-						/*
-						fucking win. in the .adt files, height maps are stored in 9-8-9-8-... interleaved order.
-						here, apparently, a 17x17 map is stored followed by a 16x16 map.
-						yay for consistency.
-						I'm only using the 17x17 map here.
-						*/
-						f.read(tilebuf,17*17*2);
-
-						// make minimap
-						// for a 512x512 minimap texture, and 64x64 tiles, one tile is 8x8 pixels
-						for (int z=0; z<8; z++) {
-							for (int x=0; x<8; x++) {
-								short hval = tilebuf[(z*2)*17+x*2]; // for now
-
-								// make rgb from height value
-								unsigned char r,g,b;
-								if (hval < 0) {
-									// water = blue
-									if (hval < -511) hval = -511;
-									hval /= -2;
-									r = g = 0;
-									b = 255 - hval;
-								} else {
-									// above water = should apply a palette :(
-									/*
-									float fh = hval / 1600.0f;
-									if (fh > 1.0f) fh = 1.0f;
-									unsigned char c = (unsigned char) (fh * 255.0f);
-									r = g = b = c;
-									*/
-
-									// green: 20,149,7		0-600
-									// brown: 137, 84, 21	600-1200
-									// gray: 96, 96, 96		1200-1600
-									// white: 255, 255, 255
-									unsigned char r1,r2,g1,g2,b1,b2;
-									float t;
-
-									if (hval < 600) {
-										r1 = 20;
-										r2 = 137;
-										g1 = 149;
-										g2 = 84;
-										b1 = 7;
-										b2 = 21;
-										t = hval / 600.0f;
-									}
-									else if (hval < 1200) {
-										r2 = 96;
-										r1 = 137;
-										g2 = 96;
-										g1 = 84;
-										b2 = 96;
-										b1 = 21;
-										t = (hval-600) / 600.0f;
-									}
-									else /*if (hval < 1600)*/ {
-										r1 = 96;
-										r2 = 255;
-										g1 = 96;
-										g2 = 255;
-										b1 = 96;
-										b2 = 255;
-										if (hval >= 1600) hval = 1599;
-										t = (hval-1200) / 600.0f;
-									}
-
-									// TODO: add a regular palette here
-
-									r = (unsigned char)(r2*t + r1*(1.0f-t));
-									g = (unsigned char)(g2*t + g1*(1.0f-t));
-									b = (unsigned char)(b2*t + b1*(1.0f-t));
-								}
-
-								texbuf[(j*8+z)*512 + i*8+x] = (r) | (g<<8) | (b<<16) | (255 << 24);
-							}
-						}
-					}
-				}
-			}
-			
-			/*
-			// TEMP - draw sky areas
-			skies = new Skies(basename.c_str());
-			skies->debugDraw(texbuf, 512);
-			delete skies;
-			*/
-
-			glBindTexture(GL_TEXTURE_2D, minimap);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 512, 512, 0, GL_RGBA, GL_UNSIGNED_BYTE, texbuf);
-			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
-
-			delete[] texbuf;
-			f.close();
-			return;
-		} 
-		else if (strncmp(fourcc, "MAHO", 4) == 0) {
-/*
-After each MARE chunk there follows a MAHO (MapAreaHOles) chunk. It may be left out if the data is supposed to be 0 all the time.
-Its an array of 16 shorts. Each short is a bitmask. If the bit is not set, there is a hole at this position.
-*/
-		} 
-		else  {
-			gLog("minimap %s [%d].\n", fourcc, size);
-		} 
-		f.seek((int)nextpos);
-	}
+	glGenTextures(1, &minimap);
 
-	f.close();
-}
+	// zomg, data on the stack!!1
+	//int texbuf[512][512];
+	unsigned int *texbuf = new unsigned int[512*512];
+	memset(texbuf,0,512*512*4);
 
+	// as alpha is unused, maybe I should try 24bpp? :(
 
-void World::initLowresTerrain()
-{
-	char fn[256];
-	sprintf(fn,"World\\Maps\\%s\\%s.wdl", basename.c_str(), basename.c_str());
-	MPQFile f(fn);
-	if (f.isEof()) {
-		gLog("Error: loading low res terrain %s\n", basename.c_str());
-		return;
-	}
-
-	int ofsbuf[64][64];
-	memset(ofsbuf, 0, 64*64*4);
-
-	char fourcc[5];
-	uint32 size;
-
-	while (!f.isEof()) {
-		memset(fourcc, 0, 4);
-		size = 0;
-		f.read(fourcc,4);
-		f.read(&size, 4);
-
-		flipcc(fourcc);
-		fourcc[4] = 0;
-
-		if (size == 0)
-			continue;
-
-		size_t nextpos = f.getPos() + size;
-
-		if (strncmp(fourcc, "MVER", 4) == 0) {
-		} 
-		else if (strncmp(fourcc, "MWMO", 4) == 0) {
-		} 
-		else if (strncmp(fourcc, "MWID", 4) == 0) {
-		} 
-		else if (strncmp(fourcc, "MODF", 4) == 0) {
-		} 
-		else if (strncmp(fourcc, "MAOF", 4) == 0) {
-			f.read(ofsbuf,64*64*4);
-		}
-		else if (strncmp(fourcc, "MARE", 4) == 0) {
-			short tilebuf[17*17];
-			short tilebuf2[16*16];
-			Vec3D lowres[17][17];
-			Vec3D lowsub[16][16];
-
-			for (int j=0; j<64; j++) {
-				for (int i=0; i<64; i++) {
-					if (ofsbuf[j][i]) {
-						f.seek(ofsbuf[j][i]+8);
-						f.read(tilebuf,17*17*2);
-						f.read(tilebuf2,16*16*2);
-					
-						for (int y=0; y<17; y++) {
-							for (int x=0; x<17; x++) {
-								lowres[y][x] = Vec3D(TILESIZE*(i+x/16.0f), tilebuf[y*17+x], TILESIZE*(j+y/16.0f));
-							}
-						}
-						for (int y=0; y<16; y++) {
-							for (int x=0; x<16; x++) {
-								lowsub[y][x] = Vec3D(TILESIZE*(i+(x+0.5f)/16.0f), tilebuf2[y*16+x], TILESIZE*(j+(y+0.5f)/16.0f));
+	for (int j=0; j<64; j++) {
+		for (int i=0; i<64; i++) {
+			const short *tilebuf = farterrain.tileHeights(i, j);
+			if (tilebuf) {
+
+				/*
+				short *sp = tilebuf;
+				for (int z=0; z<33; z++) {
+					f.read(sp, 2 * ( (z%2) ? 16 : 17 ));
+					sp += 17;
+				}*/
+				/*
+				fucking win. in the .adt files, height maps are stored in 9-8-9-8-... interleaved order.
+				here, apparently, a 17x17 map is stored followed by a 16x16 map.
+				yay for consistency.
+				I'm only using the 17x17 map here.
+				*/
+
+				// make minimap
+				// for a 512x512 minimap texture, and 64x64 tiles, one tile is 8x8 pixels
+				for (int z=0; z<8; z++) {
+					for (int x=0; x<8; x++) {
+						short hval = tilebuf[(z*2)*17+x*2]; // for now
+
+						// make rgb from height value
+						unsigned char r,g,b;
+						if (hval < 0) {
+							// water = blue
+							if (hval < -511) hval = -511;
+							hval /= -2;
+							r = g = 0;
+							b = 255 - hval;
+						} else {
+							// above water = should apply a palette :(
+							/*
+							float fh = hval / 1600.0f;
+							if (fh > 1.0f) fh = 1.0f;
+							unsigned char c = (unsigned char) (fh * 255.0f);
+							r = g = b = c;
+							*/
+
+							// green: 20,149,7		0-600
+							// brown: 137, 84, 21	600-1200
+							// gray: 96, 96, 96		1200-1600
+							// white: 255, 255, 255
+							unsigned char r1,r2,g1,g2,b1,b2;
+							float t;
+
+							if (hval < 600) {
+								r1 = 20;
+								r2 = 137;
+								g1 = 149;
+								g2 = 84;
+								b1 = 7;
+								b2 = 21;
+								t = hval / 600.0f;
 							}
-						}
-
-						GLuint dl;
-						dl = glGenLists(1);
-						glNewList(dl, GL_COMPILE);
-						/*
-						// draw tiles 16x16?
-						glBegin(GL_TRIANGLE_STRIP);
-						for (int y=0; y<16; y++) {
-							// end jump
-							if (y>0) glVertex3fv(lowres[y][0]);
-							for (int x=0; x<17; x++) {
-		                        glVertex3fv(lowres[y][x]);
-		                        glVertex3fv(lowres[y+1][x]);
+							else if (hval < 1200) {
+								r2 = 96;
+								r1 = 137;
+								g2 = 96;
+								g1 = 84;
+								b2 = 96;
+								b1 = 21;
+								t = (hval-600) / 600.0f;
 							}
-		                    // start jump
-							if (y<15) glVertex3fv(lowres[y+1][16]);
-						}
-						glEnd();
-						*/
-						// draw tiles 17*17+16*16
-						glBegin(GL_TRIANGLES);
-						for (int y=0; y<16; y++) {
-							for (int x=0; x<16; x++) {
-								glVertex3fv(lowres[y][x]);		glVertex3fv(lowsub[y][x]);	glVertex3fv(lowres[y][x+1]);
-								glVertex3fv(lowres[y][x+1]);	glVertex3fv(lowsub[y][x]);	glVertex3fv(lowres[y+1][x+1]);
-								glVertex3fv(lowres[y+1][x+1]);	glVertex3fv(lowsub[y][x]);	glVertex3fv(lowres[y+1][x]);
-								glVertex3fv(lowres[y+1][x]);	glVertex3fv(lowsub[y][x]);	glVertex3fv(lowres[y][x]);
+							else /*if (hval < 1600)*/ {
+								r1 = 96;
+								r2 = 255;
+								g1 = 96;
+								g2 = 255;
+								b1 = 96;
+								b2 = 255;
+								if (hval >= 1600) hval = 1599;
+								t = (hval-1200) / 600.0f;
 							}
+
+							// TODO: add a regular palette here
+
+							r = (unsigned char)(r2*t + r1*(1.0f-t));
+							g = (unsigned char)(g2*t + g1*(1.0f-t));
+							b = (unsigned char)(b2*t + b1*(1.0f-t));
 						}
-						glEnd();
-						glEndList();
-						lowrestiles[j][i] = dl;
+
+						texbuf[(j*8+z)*512 + i*8+x] = (r) | (g<<8) | (b<<16) | (255 << 24);
 					}
 				}
 			}
-			f.close();
-			return;
-		} 
-		else if (strncmp(fourcc, "MAHO", 4) == 0) {
-		} 
-		else  {
-			gLog("minimap %s [%d].\n", fourcc, size);
-		} 
-		f.seek((int)nextpos);
+		}
 	}
 
-	f.close();
+	/*
+	// TEMP - draw sky areas
+	skies = new Skies(basename.c_str());
+	skies->debugDraw(texbuf, 512);
+	delete skies;
+	*/
+
+	glBindTexture(GL_TEXTURE_2D, minimap);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 512, 512, 0, GL_RGBA, GL_UNSIGNED_BYTE, texbuf);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+
+	delete[] texbuf;
+/*
+After each MARE chunk there follows a MAHO (MapAreaHOles) chunk. It may be left out if the data is supposed to be 0 all the time.
+Its an array of 16 shorts. Each short is a bitmask. If the bit is not set, there is a hole at this position.
+*/
 }
 
+
 GLuint gdetailtexcoords=0, galphatexcoords=0;
 
 void initGlobalVBOs()
@@ -588,7 +391,8 @@ void World::initDisplay()
 
 	//ol = new OutdoorLighting("World\\dnc.db");
 
-	initLowresTerrain();
+	// everything that needs the WDT has been read
+	wdt.close();
 }
 
 /*
@@ -599,96 +403,27 @@ WDT files specify exactly which map tiles are present in a world, if any, and ca
 void World::initWMOs()
 {
 	gnWMO = 0;
-	char fn[256];
-	sprintf(fn,"World\\Maps\\%s\\%s.wdt", basename.c_str(), basename.c_str());
-
-	MPQFile f(fn);
-
-	char fourcc[5];
-	uint32 size;
-
-	while (!f.isEof()) {
-		memset(fourcc, 0, 4);
-		size = 0;
-		f.read(fourcc,4);
-		f.read(&size, 4);
-
-		flipcc(fourcc);
-		fourcc[4] = 0;
-
-		if (size == 0)
-			continue;
-
-		size_t nextpos = f.getPos() + size;
-
-		if (strcmp(fourcc,"MVER")==0) {
-		}
-		else if (strcmp(fourcc,"MPHD")==0) {
-/*
-Contains 8 32-bit integers.
-
-uint32 flags;
-uint32 something;
-uint32 unused[6];
-
-These are the only flags checked:
-
-Flag 		Description
-0b0001 		No Terrain/no terraincollision. The other flags are ONLY for ADT based maps! See a list here.
-0b0010 		Is checked pretty often and has some effect on rendering. Maybe search for an WDT having this value.
-0b0100 		Decides whether to use _env terrain shaders or not: funky
-0b1000 		Disables something. No idea what. Another rendering thing. Someone may check all them in wild life..
-
-if ( WDT_MPHD & 8 )
-   return result;
-
-The second integer is not ignored but stores something too:
-
-for( int i = 0; i < WDT_MPHD.something/8; i++ )
-{
-   WDT_MAIN[i].flags = 0;
-   WDT_MAIN[i].somedata = 0;
-}
-
-The other bytes seem to be unused from what I can tell.
-*/
+	MPQFile &f = wdt;
+
+	int size = wdtChunks.seek(f, FOURCC('M','W','M','O'));
+	if (size > 0) {
+		// Filename for WMO (world map objects) that appear in this map. A zero-terminated string.
+		// global map objects
+		char *buf = new char[size];
+		f.read(buf, size);
+		char *p=buf;
+		while (p<buf+size) {
+			string path(p);
+			p+=strlen(p)+1;
+			
+			wmomanager.add(path);
+			gwmos.push_back(path);
 		}
-		else if (strcmp(fourcc,"MAIN")==0) {
-/*
-Map tile table.
-Contains 64x64 = 4096 records of 8 bytes each.
-
-int32 flags;
-AsyncObject * asyncobject;
-
-Flags&1 tells us, if a tile is holding an ADT. Flags&2 gets set ingame when an ADT is loaded at that position. The pointer to some data is set if the tile is loaded asynchronous.
-
-if ( !(MAIN.flags & 2) )
-   LoadADTByPosition( x, y );
-if ( *(MAIN.asyncobject) )
-   AsyncFileReadWait( *(MAIN.asyncobject) );
+		delete[] buf;
+	}
 
-Blizzard was just too lazy to compress the files here. A simple bool array and adding the fields when parsing would the alternative. We just need to know the &1 flag.
-*/
-		}
-		else if (strcmp(fourcc,"MWMO")==0) {
-			// Filename for WMO (world map objects) that appear in this map. A zero-terminated string.
-			// global map objects
-			if (size) {
-				char *buf = new char[size];
-				f.read(buf, size);
-				char *p=buf;
-				while (p<buf+size) {
-					string path(p);
-					p+=strlen(p)+1;
-					
-					wmomanager.add(path);
-					gwmos.push_back(path);
-				}
-				delete[] buf;
-			}
-		}
-		else if (strcmp(fourcc,"MODF")==0) {
+	size = wdtChunks.seek(f, FOURCC('M','O','D','F'));
+	if (size > 0) {
 /*
 Placement information for the WMO. 64 bytes.
 Offset 	Type 		Description
@@ -702,22 +437,16 @@ Offset 	Type 		Description
 0x3C 	uint16 		Name set
 0x40
 */
-			// global wmo instance data
-			gnWMO = (int)size / 64;
-			for (int i=0; i<gnWMO; i++) {
-				int id;
-				f.read(&id, 4);
-				WMO *wmo = (WMO*)wmomanager.items[wmomanager.get(gwmos[id])];
-				WMOInstance inst(wmo, f);
-				gwmois.push_back(inst);
-			}
-		}
-		else {
-			gLog("No implement wdt chunk %s [%d].\n", fourcc, size);
+		// global wmo instance data
+		gnWMO = size / 64;
+		for (int i=0; i<gnWMO; i++) {
+			int id;
+			f.read(&id, 4);
+			WMO *wmo = (WMO*)wmomanager.items[wmomanager.get(gwmos[id])];
+			WMOInstance inst(wmo, f);
+			gwmois.push_back(inst);
 		}
-		f.seek((int)nextpos);
 	}
-	f.close();
 }
 
 bool oktile(int i, int j)
@@ -914,6 +643,7 @@ void World::draw()
 {
 	WMOInstance::reset();
 	modelmanager.resetAnim();
+	wmomanager.uploadGroups();
 
 	glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
 
@@ -923,13 +653,11 @@ void World::draw()
 	doodaddrawdistance2 = doodaddrawdistance * doodaddrawdistance;
 
 	// setup camera
-	// assume identity modelview matrix ^_^
-	//glMatrixMode(GL_MODELVIEW);
-	//glLoadIdentity();
-	gluLookAt(camera.x,camera.y,camera.z, lookat.x,lookat.y,lookat.z, 0, 1, 0);
+	video.camera.lookAt(camera, lookat, Vec3D(0,1,0));
+	video.camera.loadView();
 
 	// camera is set up
-	frustum.retrieve();
+	video.camera.getFrustum(frustum);
 
 	if (thirdperson) {
 		Vec3D l = (lookat-camera).normalize();
@@ -938,8 +666,8 @@ void World::draw()
 		Vec3D up = (l % rt).normalize();
 		float fl = 256.0f;
 		Vec3D fp = camera + l * fl;
-		glLoadIdentity();
-		gluLookAt(nc.x,nc.y,nc.z, camera.x,camera.y,camera.z, 1, 0, 0);
+		video.camera.lookAt(nc, camera, Vec3D(1,0,0));
+		video.camera.loadView();
 	}
 
 	glDisable(GL_LIGHTING);
@@ -999,17 +727,14 @@ void World::draw()
 		glColor3fv(this->skies->colorSet[FOG_COLOR]);
 		//glColor3f(0,1,0);
 		//glDisable(GL_FOG);
-		const int lrr = 2;
-		for (int i=cx-lrr; i<=cx+lrr; i++) {
-			for (int j=cz-lrr; j<=cz+lrr; j++) {
-				// TODO: some annoying visual artifacts when the verylowres terrain overlaps
-				// maptiles that are close (1-off) - figure out how to fix.
-				// still less annoying than hoels in the horizon when only 2-off verylowres tiles are drawn
-				if ( !(i==cx&&j==cz) && oktile(i,j) && lowrestiles[j][i]) {
-					glCallList(lowrestiles[j][i]);
-				}
-			}
-		}
+		// out to the fog, but never less than the 2 tiles it used to be
+		// TODO: some annoying visual artifacts when the verylowres terrain overlaps
+		// maptiles that are close (1-off) - figure out how to fix.
+		// still less annoying than hoels in the horizon when only 2-off verylowres tiles are drawn
+		int lrr = min((int)(fogdistance / TILESIZE) + 1, FarTerrain::maxRadius);
+		lrr = max(lrr, 2);
+		farterrain.update(cx, cz, lrr);
+		farterrain.draw(cx, cz, lrr);
 		//glEnable(GL_FOG);
 	}
 
@@ -1096,6 +821,7 @@ void World::draw()
 		for (int i=0; i<gnWMO; i++) {
 			 gwmois[i].draw();
 		}
+		wmomanager.drawQueued();
 	}
 
 	if (supportShaders && useshaders) {
@@ -1111,6 +837,7 @@ void World::draw()
 			if (oktile(i,j) && drawwmo && current[j][i] != 0) current[j][i]->drawObjects();
 		}
 	}
+	wmomanager.drawQueued();
 	if (supportShaders && useshaders) {
 		Vec4D spec_color(0,0,0,1);
 		glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, spec_color);
@@ -1128,6 +855,9 @@ void World::draw()
 		}
 	}
 
+	// particles and ribbons of everything drawn so far
+	particleBatch.flush();
+
 	glDisable( GL_CULL_FACE );
 	glEnable(GL_LIGHTING);
 	glEnable(GL_LIGHT0);
@@ -6,6 +6,8 @@
 #include "wmo.h"
 #include "frustum.h"
 #include "sky.h"
+#include "chunkfile.h"
+#include "farterrain.h"
 
 #include <string>
 
@@ -21,13 +23,17 @@ class World {
 	
 	bool mBigAlpha;
 
+	// read once in init(), kept until initDisplay() is done with it
+	MPQFile wdt;
+	ChunkIndex wdtChunks;
+
 public:
 
 	std::string basename;
 	int mapid;
 
 	bool maps[64][64];
-	GLuint lowrestiles[64][64];
+	FarTerrain farterrain;
 	bool autoheight;
 
 	std::vector<std::string> gwmos;
@@ -74,7 +80,6 @@ public:
 	void initMinimap();
 	void initDisplay();
 	void initWMOs();
-	void initLowresTerrain();
 
 	void enterTile(int x, int z);
 	MapTile *loadTile(int x, int z);
@@ -117,6 +117,15 @@ int main(int argc, char *argv[])
 		}
 		else if (!strcmp(argv[i],"-p")) usePatch = true;
 		else if (!strcmp(argv[i],"-np")) usePatch = false;
+		else if (!strcmp(argv[i],"-texmem") && i+1<argc) {
+			i++;
+			video.textures.budget = (size_t)atoi(argv[i]) * 1024 * 1024;
+		}
+		else if (!strcmp(argv[i],"-notranscode")) TextureManager::transcode = false;
+		else if (!strcmp(argv[i],"-farradius") && i+1<argc) {
+			i++;
+			FarTerrain::maxRadius = max(atoi(argv[i]), 2);
+		}
 	}
 
 	if (override_game_path) {
@@ -282,6 +291,8 @@ int main(int argc, char *argv[])
 
 		as->tick(ftime, dt/1000.0f);
 
+		streamBuffer.newFrame();
+		video.textures.uploadTextures();
 		as->display(ftime, dt/1000.0f);
 		glFlush();
 
@@ -328,6 +339,7 @@ int main(int argc, char *argv[])
 	archives.clear();
 
 	gLog("\nExiting.\n");
+	gLogClose();
 
 	return 0;
 }